@@ -27,58 +27,128 @@
  * @brief Application Control module implementation
  *
  * Manages scheduled song playback based on configured time schedules.
+ *
+ * The schedules of a day are compiled into a timeline once - the weekday masks and the exception
+ * calendar are applied and the remaining schedules are sorted by their timestamp. The timeline only
+ * holds positions in the time index of the ScheduleStore; a timestamp is the start of the day plus
+ * the time of day, corrected by the day's UTC offset change (DST). The evaluation then moves a
+ * cursor through the timeline. It is compiled again for the next day, or when the schedule
+ * revision of the ScheduleStore changed.
  */
 
 #include "ApplicationControl.h"
+#include "Logger.h"
 #include "MessageBroker.h"
 #include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "ScheduleStore.h"
+#include "TimeSync.h"
+#include "boot_timing.h"
 #include "custom_assert.h"
+#include "test_support.h"
 
 #include <Arduino.h>
-#include <Preferences.h>
 #include <time.h>
+#include "esp_timer.h"
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
 
 // ###########################################################################
 // # Defines
 // ###########################################################################
-#define MAX_SCHEDULES           20
-#define NVS_NAMESPACE           "appcontrol"
-#define NVS_KEY_SCHEDULE_COUNT  "sched_cnt"
-#define NVS_KEY_SCHEDULE_PREFIX "sched_"
+#define SCHEDULE_PERSIST_MS     2000 // Changes are written out once they stopped coming in for this long
+#define SCHEDULE_MAX_SLEEP_S    3600 // Re-evaluate at least once per hour, even if nothing is due
+#define SCHEDULE_LATE_GRACE_S   60   // A schedule that is overdue by more than this is skipped
+#define SCHEDULE_STEP_CATCHUP_S 300  // Schedules jumped over by a forward clock step are played up to this late
+#define SCHEDULE_PREARM_S       3    // The player is prepared this long before a schedule is due
+#define SCHEDULE_LOOKAHEAD_DAYS 7    // Days searched for the next schedule besides the exception days - a week
+#define SCHEDULE_MAX_SKIP_DAYS  366  // Exception days skipped at most while searching
+#define SECONDS_PER_MINUTE      60
+#define US_PER_SECOND           1000000LL
 
 // ###########################################################################
 // # Type Definitions
 // ###########################################################################
+// Schedules of one day, sorted by their due time
 typedef struct
 {
-    bool active;         // Whether this schedule entry is active
-    u8 hour;             // Hour (0-23)
-    u8 minute;           // Minute (0-59)
-    u16 song_index;      // Song index to play
-    u8 weekday_mask;     // Weekday mask: Bit 0=Monday, Bit 1=Tuesday, ..., Bit 6=Sunday
-    bool triggered;      // Flag to avoid re-triggering in the same minute
-    u8 last_checked_min; // Last checked minute to detect minute changes
-} schedule_entry_t;
+    u32 date;            // Compiled day as YYYYMMDD (0 = none)
+    u32 revision;        // ScheduleStore revision it was compiled from - the positions are valid for it
+    bool is_excepted;    // The day is in the exception calendar - nothing is played
+    u8 nof_entries;
+    u8 cursor;           // First entry that is not before the latest lookup
+    time_t day_start;    // Timestamp of 00:00 of the day
+    s32 offset_change_s; // Change of the UTC offset during the day (DST) - 0 on most days
+
+    // Positions in the time index of the ScheduleStore, and a bit per entry that is after the offset change
+    u8 positions[SCHEDULESTORE_MAX_SCHEDULES];
+    u8 is_shifted[(SCHEDULESTORE_MAX_SCHEDULES + 7) / 8];
+} day_timeline_t;
 
 // ###########################################################################
 // # Private function declarations
 // ###########################################################################
-static void prv_message_handler(const msg_t* const message);
-static void prv_check_schedules(const struct tm* timeinfo);
+static void prv_process_schedules(time_t now, u32 now_microseconds);
+STATIC time_t prv_find_next_due(time_t from);
+static u8 prv_trigger_schedules_at(time_t due);
+static void prv_prepare_schedules_at(time_t due);
+static void prv_record_trigger(time_t due, s64 error_us, u8 nof_schedules);
+static void prv_publish_trigger_timing(void);
+static u8 prv_get_weekday_bit(const struct tm* timeinfo);
+static u8 prv_seek_timeline(time_t at);
+static time_t prv_get_timeline_due(u8 entry, u8* out_schedule_id, u16* out_song_index);
+static void prv_set_timeline_entry(u8 entry, u8 position, bool is_shifted);
+static void prv_compile_timeline(const struct tm* day_tm, u32 date);
+static void prv_invalidate_timeline(void);
+static void prv_publish_exception_list(void);
+static void prv_request_reschedule(void);
+static void prv_schedule_timer_callback(void* arg);
+static void prv_publish_wake_deadline(time_t due);
 static void prv_play_song(u16 song_index);
-static void prv_save_schedules_to_flash(void);
-static void prv_load_schedules_from_flash(void);
+static void prv_prepare_song(u16 song_index);
+static void prv_announce_song(u16 song_index, time_t due);
+static void prv_mark_schedules_dirty(void);
+static void prv_persist_timer_callback(TimerHandle_t timer);
+static void prv_publish_schedule_page(u16 start_index, module_id_e requested_by);
+static void prv_import_schedules(const msg_schedule_add_t* schedules, u16 nof_schedules);
+static bool prv_is_valid_schedule(const msg_schedule_add_t* schedule);
 
 // ###########################################################################
 // # Private Variables
 // ###########################################################################
 static bool is_initialized = false;
 static bool scheduling_enabled = true;
-static bool g_logging_is_active = false; // Logging initially disabled
-static schedule_entry_t schedules[MAX_SCHEDULES];
-static struct tm current_time;
-static bool time_valid = false;
-static Preferences preferences;
+// Every occurrence before this point in time was already handled (0 = not evaluated yet)
+static time_t processed_until = 0;
+
+// Occurrence the player was already prepared for (0 = none)
+static time_t prepared_due = 0;
+
+// Compiled schedules of one day and the result of the latest search in it (protected by schedule_mutex)
+static day_timeline_t timeline;
+static time_t searched_from = 0; // Nothing is due from here up to found_due
+static time_t found_due = 0;     // 0 = no search result
+static u32 searched_revision = 0;
+
+// Extra grace for the next evaluation after the clock was stepped forward (protected by schedule_mutex)
+static time_t clock_step_grace_s = 0;
+
+// Measured trigger errors - the most recent ones in a ring (protected by schedule_mutex)
+static schedule_trigger_event_t trigger_log[SCHEDULE_TIMING_LOG_SIZE];
+static u8 trigger_log_next = 0;
+static u32 nof_triggers = 0;
+static s32 max_trigger_error_us = 0;
+
+static SemaphoreHandle_t schedule_mutex = NULL;  // Serializes all accesses to the ScheduleStore
+static SemaphoreHandle_t schedule_event = NULL;  // Wakes appcontrol_run()
+static esp_timer_handle_t schedule_timer = NULL; // Fires at the microsecond the next schedule is due
+static TimerHandle_t persist_timer = NULL;       // Debounces the write-back of changed schedules
+
+// The debounce timer of the write-back expired
+static volatile bool persist_is_due = false;
 
 // ###########################################################################
 // # Public function implementations
@@ -88,84 +158,161 @@ void appcontrol_init(void)
 {
     ASSERT(!is_initialized);
 
-    // Initialize schedule array
-    for (int i = 0; i < MAX_SCHEDULES; i++)
-    {
-        schedules[i].active = false;
-        schedules[i].hour = 0;
-        schedules[i].minute = 0;
-        schedules[i].song_index = 0;
-        schedules[i].weekday_mask = 0x7F; // Default: all days (Mon-Sun)
-        schedules[i].triggered = false;
-        schedules[i].last_checked_min = 255; // Invalid value to force initial check
-    }
+    schedule_mutex = xSemaphoreCreateMutex();
+    schedule_event = xSemaphoreCreateBinary();
+    esp_timer_create_args_t schedule_timer_args = {};
+    schedule_timer_args.callback = prv_schedule_timer_callback;
+    schedule_timer_args.dispatch_method = ESP_TIMER_TASK;
+    schedule_timer_args.name = "ScheduleTimer";
+    esp_timer_create(&schedule_timer_args, &schedule_timer);
+    persist_timer = xTimerCreate("PersistTimer", pdMS_TO_TICKS(SCHEDULE_PERSIST_MS), pdFALSE, NULL,
+                                 prv_persist_timer_callback);
+    ASSERT(schedule_mutex != NULL);
+    ASSERT(schedule_event != NULL);
+    ASSERT(schedule_timer != NULL);
+    ASSERT(persist_timer != NULL);
 
     // Load schedules from flash
-    prv_load_schedules_from_flash();
+    schedulestore_init();
 
     // Subscribe to messages
-    messagebroker_subscribe(MSG_0003, prv_message_handler); // Logging control
-    messagebroker_subscribe(MSG_0101, prv_message_handler); // Time response
-    messagebroker_subscribe(MSG_0400, prv_message_handler); // Add schedule
-    messagebroker_subscribe(MSG_0401, prv_message_handler); // Remove schedule
-    messagebroker_subscribe(MSG_0402, prv_message_handler); // List schedules
-    messagebroker_subscribe(MSG_0403, prv_message_handler); // Clear schedules
-    messagebroker_subscribe(MSG_0404, prv_message_handler); // Enable/disable scheduling
+    messagebroker_subscribe(MSG_0102, appcontrol_message_handler); // Time synchronized
+    messagebroker_subscribe(MSG_0400, appcontrol_message_handler); // Add schedule
+    messagebroker_subscribe(MSG_0401, appcontrol_message_handler); // Remove schedule
+    messagebroker_subscribe(MSG_0402, appcontrol_message_handler); // List schedules
+    messagebroker_subscribe(MSG_0403, appcontrol_message_handler); // Clear schedules
+    messagebroker_subscribe(MSG_0404, appcontrol_message_handler); // Enable/disable scheduling
+    messagebroker_subscribe(MSG_0407, appcontrol_message_handler); // Trigger timing
+    messagebroker_subscribe(MSG_0409, appcontrol_message_handler); // Replace all schedules
+    messagebroker_subscribe(MSG_0411, appcontrol_message_handler); // Add exception
+    messagebroker_subscribe(MSG_0412, appcontrol_message_handler); // Remove exception
+    messagebroker_subscribe(MSG_0413, appcontrol_message_handler); // List exceptions
+    messagebroker_subscribe(MSG_0504, appcontrol_message_handler); // Power state
 
     is_initialized = true;
+
+    // Evaluate the loaded schedules on the first run
+    prv_request_reschedule();
 }
 
 void appcontrol_run(void)
 {
     ASSERT(is_initialized);
 
+    // Sleep until a schedule is due, the schedules were changed or the time was synchronized
+    xSemaphoreTake(schedule_event, portMAX_DELAY);
+
+    if (persist_is_due)
+    {
+        persist_is_due = false;
+        appcontrol_flush_schedules();
+    }
+
     if (!scheduling_enabled)
     {
+        esp_timer_stop(schedule_timer);
+        prv_publish_wake_deadline(0);
         return;
     }
 
-    // Request current time every cycle (even if not valid yet)
-    msg_time_get_request_t request;
-    msg_t msg;
-    msg.msg_id = MSG_0100;
-    msg.data_size = sizeof(msg_time_get_request_t);
-    msg.data_bytes = (u8*)&request;
-    messagebroker_publish(&msg);
+    // Read the current time directly - no broker round trip
+    timesync_snapshot_t time_snapshot;
+    if (!timesync_get_snapshot(&time_snapshot))
+    {
+        // Nothing can be scheduled without a valid time - MSG_0102 wakes us up again
+        esp_timer_stop(schedule_timer);
+        prv_publish_wake_deadline(0);
+        return;
+    }
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    prv_process_schedules(time_snapshot.epoch, time_snapshot.microseconds);
+    xSemaphoreGive(schedule_mutex);
+
+    boot_timing_mark(BOOT_STAGE_SCHEDULES_ARMED);
+}
+
+void appcontrol_flush_schedules(void)
+{
+    ASSERT(is_initialized);
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    xTimerStop(persist_timer, 0);
+    schedulestore_save(); // Only writes if something was changed
+    xSemaphoreGive(schedule_mutex);
+}
+
+time_t appcontrol_get_processed_until(void) { return processed_until; }
+
+void appcontrol_resume_after(time_t resume_after)
+{
+    ASSERT(is_initialized);
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    processed_until = resume_after; // A clock that went backwards in the meantime is handled by the evaluation
+    xSemaphoreGive(schedule_mutex);
+}
+
+void appcontrol_get_trigger_timing(msg_schedule_timing_t* timing)
+{
+    { // Input Checks
+        ASSERT(is_initialized);
+        ASSERT(timing != NULL);
+    }
+
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    timing->nof_triggers = nof_triggers;
+    timing->max_error_us = max_trigger_error_us;
+    timing->count = (nof_triggers < SCHEDULE_TIMING_LOG_SIZE) ? (u8)nof_triggers : SCHEDULE_TIMING_LOG_SIZE;
+
+    // Oldest first - before the ring wrapped around the oldest entry is at 0
+    u8 oldest = (nof_triggers < SCHEDULE_TIMING_LOG_SIZE) ? 0 : trigger_log_next;
+    for (u8 i = 0; i < timing->count; i++)
+    {
+        timing->events[i] = trigger_log[(oldest + i) % SCHEDULE_TIMING_LOG_SIZE];
+    }
+    xSemaphoreGive(schedule_mutex);
 }
 
 // ###########################################################################
 // # Private function implementations
 // ###########################################################################
 
-static void prv_message_handler(const msg_t* const message)
+void appcontrol_message_handler(const msg_t* const message)
 {
     switch (message->msg_id)
     {
-        case MSG_0003: // Set logging
+        case MSG_0102: // Time synchronized
         {
-            msg_set_logging_t* cmd = (msg_set_logging_t*)message->data_bytes;
+            msg_time_sync_notification_t* notification = (msg_time_sync_notification_t*)message->data_bytes;
+
+            xSemaphoreTake(schedule_mutex, portMAX_DELAY);
 
-            // Check if this message is for us
-            if (cmd->module_id == MODULE_APPCONTROL || cmd->module_id == MODULE_ALL
-                || strncmp(cmd->module_name, "appcontrol", MODULE_NAME_MAX_LENGTH) == 0)
+            // A forward step must not skip the schedules it jumped over - play them late instead
+            if (notification->clock_step_s > 0)
             {
-                g_logging_is_active = cmd->enabled;
-                if (g_logging_is_active)
-                {
-                    Serial.println("[AppControl] Logging enabled");
-                }
+                clock_step_grace_s = (notification->clock_step_s < SCHEDULE_STEP_CATCHUP_S)
+                                         ? notification->clock_step_s
+                                         : SCHEDULE_STEP_CATCHUP_S;
             }
+
+            // The timestamps of the timeline depend on the time zone, which may have been set with the time
+            prv_invalidate_timeline();
+            xSemaphoreGive(schedule_mutex);
+
+            // The clock may have been set or stepped - compute the next due schedule again
+            prv_request_reschedule();
             break;
         }
 
-        case MSG_0101: // Time response
+        case MSG_0504: // Power state
         {
-            msg_time_get_response_t* response = (msg_time_get_response_t*)message->data_bytes;
-            time_valid = response->time_valid;
-            if (time_valid)
+            msg_power_state_t* state = (msg_power_state_t*)message->data_bytes;
+
+            // Re-arm the schedule timer from the wall clock after a light sleep window
+            if (state->woke_from_sleep)
             {
-                current_time = response->timeinfo;
-                prv_check_schedules(&current_time);
+                prv_request_reschedule();
             }
             break;
         }
@@ -174,40 +321,26 @@ static void prv_message_handler(const msg_t* const message)
         {
             msg_schedule_add_t* cmd = (msg_schedule_add_t*)message->data_bytes;
 
-            // Find free slot
-            int free_slot = -1;
-            for (int i = 0; i < MAX_SCHEDULES; i++)
+            xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+            u8 schedule_id = SCHEDULESTORE_INVALID_ID;
+            if (prv_is_valid_schedule(cmd))
             {
-                if (!schedules[i].active)
-                {
-                    free_slot = i;
-                    break;
-                }
+                u32 second_of_day = (u32)(cmd->hour * 3600 + cmd->minute * 60 + cmd->second);
+                schedule_id = schedulestore_add(second_of_day, cmd->weekday_mask, cmd->song_index);
             }
 
             msg_schedule_response_t response;
-            if (free_slot >= 0)
+            response.success = (schedule_id != SCHEDULESTORE_INVALID_ID);
+            response.schedule_id = response.success ? schedule_id : -1;
+            if (response.success)
             {
-                schedules[free_slot].active = true;
-                schedules[free_slot].hour = cmd->hour;
-                schedules[free_slot].minute = cmd->minute;
-                schedules[free_slot].song_index = cmd->song_index;
-                schedules[free_slot].weekday_mask = cmd->weekday_mask;
-                schedules[free_slot].triggered = false;
-                schedules[free_slot].last_checked_min = 255;
-
-                // Save to flash
-                prv_save_schedules_to_flash();
-
-                response.success = true;
-                response.schedule_id = free_slot;
-            }
-            else
-            {
-                response.success = false;
-                response.schedule_id = -1;
+                // Written to flash once the changes stopped coming in
+                prv_mark_schedules_dirty();
             }
 
+            xSemaphoreGive(schedule_mutex);
+            prv_request_reschedule();
+
             msg_t resp_msg;
             resp_msg.msg_id = MSG_0405;
             resp_msg.data_size = sizeof(msg_schedule_response_t);
@@ -221,12 +354,12 @@ static void prv_message_handler(const msg_t* const message)
             msg_schedule_remove_t* cmd = (msg_schedule_remove_t*)message->data_bytes;
 
             msg_schedule_response_t response;
-            if (cmd->schedule_id >= 0 && cmd->schedule_id < MAX_SCHEDULES)
+            xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+            if ((cmd->schedule_id >= 0) && (cmd->schedule_id < SCHEDULESTORE_MAX_SCHEDULES)
+                && schedulestore_remove((u8)cmd->schedule_id))
             {
-                schedules[cmd->schedule_id].active = false;
-
-                // Save to flash
-                prv_save_schedules_to_flash();
+                // Written to flash once the changes stopped coming in
+                prv_mark_schedules_dirty();
 
                 response.success = true;
                 response.schedule_id = cmd->schedule_id;
@@ -236,6 +369,8 @@ static void prv_message_handler(const msg_t* const message)
                 response.success = false;
                 response.schedule_id = -1;
             }
+            xSemaphoreGive(schedule_mutex);
+            prv_request_reschedule();
 
             msg_t resp_msg;
             resp_msg.msg_id = MSG_0405;
@@ -247,39 +382,28 @@ static void prv_message_handler(const msg_t* const message)
 
         case MSG_0402: // List schedules
         {
-            msg_schedule_list_t list;
-            list.count = 0;
-
-            for (int i = 0; i < MAX_SCHEDULES && list.count < 20; i++)
+            // One page per request - the requester asks for the next one after it handled this one
+            msg_schedule_list_request_t* request = (msg_schedule_list_request_t*)message->data_bytes;
+            if (message->data_size >= sizeof(msg_schedule_list_request_t))
             {
-                if (schedules[i].active)
-                {
-                    list.schedules[list.count].schedule_id = i;
-                    list.schedules[list.count].hour = schedules[i].hour;
-                    list.schedules[list.count].minute = schedules[i].minute;
-                    list.schedules[list.count].song_index = schedules[i].song_index;
-                    list.schedules[list.count].weekday_mask = schedules[i].weekday_mask;
-                    list.count++;
-                }
+                prv_publish_schedule_page(request->start_index, request->requested_by);
+            }
+            else
+            {
+                prv_publish_schedule_page(0, MODULE_CONSOLE);
             }
-
-            msg_t resp_msg;
-            resp_msg.msg_id = MSG_0406;
-            resp_msg.data_size = sizeof(msg_schedule_list_t);
-            resp_msg.data_bytes = (u8*)&list;
-            messagebroker_publish(&resp_msg);
             break;
         }
 
         case MSG_0403: // Clear all schedules
         {
-            for (int i = 0; i < MAX_SCHEDULES; i++)
-            {
-                schedules[i].active = false;
-            }
+            xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+            schedulestore_clear();
 
-            // Save to flash
-            prv_save_schedules_to_flash();
+            // Written to flash once the changes stopped coming in
+            prv_mark_schedules_dirty();
+            xSemaphoreGive(schedule_mutex);
+            prv_request_reschedule();
 
             msg_schedule_response_t response;
             response.success = true;
@@ -297,11 +421,91 @@ static void prv_message_handler(const msg_t* const message)
         {
             msg_schedule_enable_t* cmd = (msg_schedule_enable_t*)message->data_bytes;
             scheduling_enabled = cmd->enabled;
+            prv_request_reschedule();
+
+            msg_schedule_response_t response;
+            response.success = true;
+            response.schedule_id = -1;
+
+            msg_t resp_msg;
+            resp_msg.msg_id = MSG_0405;
+            resp_msg.data_size = sizeof(msg_schedule_response_t);
+            resp_msg.data_bytes = (u8*)&response;
+            messagebroker_publish(&resp_msg);
+            break;
+        }
+
+        case MSG_0407: // Trigger timing
+        {
+            prv_publish_trigger_timing();
+            break;
+        }
+
+        case MSG_0409: // Replace all schedules
+        {
+            prv_import_schedules((const msg_schedule_add_t*)message->data_bytes,
+                                 (u16)(message->data_size / sizeof(msg_schedule_add_t)));
+            break;
+        }
+
+        case MSG_0411: // Add exception
+        {
+            msg_schedule_add_exception_t* cmd = (msg_schedule_add_exception_t*)message->data_bytes;
+
+            xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+            u8 exception_id = schedulestore_add_exception(cmd->first_date, cmd->last_date);
+
+            msg_schedule_response_t response;
+            response.success = (exception_id != SCHEDULESTORE_INVALID_ID);
+            response.schedule_id = response.success ? exception_id : -1;
+            if (response.success)
+            {
+                // Written to flash once the changes stopped coming in
+                prv_mark_schedules_dirty();
+            }
+
+            xSemaphoreGive(schedule_mutex);
+            prv_request_reschedule();
+
+            msg_t resp_msg;
+            resp_msg.msg_id = MSG_0405;
+            resp_msg.data_size = sizeof(msg_schedule_response_t);
+            resp_msg.data_bytes = (u8*)&response;
+            messagebroker_publish(&resp_msg);
+            break;
+        }
+
+        case MSG_0412: // Remove exception
+        {
+            msg_schedule_remove_exception_t* cmd = (msg_schedule_remove_exception_t*)message->data_bytes;
 
             msg_schedule_response_t response;
             response.success = true;
             response.schedule_id = -1;
 
+            xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+            if (cmd->exception_id < 0)
+            {
+                schedulestore_clear_exceptions();
+            }
+            else if ((cmd->exception_id < SCHEDULESTORE_MAX_EXCEPTIONS)
+                     && schedulestore_remove_exception((u8)cmd->exception_id))
+            {
+                response.schedule_id = cmd->exception_id;
+            }
+            else
+            {
+                response.success = false;
+            }
+
+            if (response.success)
+            {
+                // Written to flash once the changes stopped coming in
+                prv_mark_schedules_dirty();
+            }
+            xSemaphoreGive(schedule_mutex);
+            prv_request_reschedule();
+
             msg_t resp_msg;
             resp_msg.msg_id = MSG_0405;
             resp_msg.data_size = sizeof(msg_schedule_response_t);
@@ -310,176 +514,582 @@ static void prv_message_handler(const msg_t* const message)
             break;
         }
 
+        case MSG_0413: // List exceptions
+        {
+            prv_publish_exception_list();
+            break;
+        }
+
         default: break;
     }
 }
 
-static void prv_check_schedules(const struct tm* timeinfo)
+static void prv_process_schedules(time_t now, u32 now_microseconds)
 {
-    u8 current_hour = timeinfo->tm_hour;
-    u8 current_min = timeinfo->tm_min;
-    u8 current_weekday = (timeinfo->tm_wday == 0)
-                             ? 6
-                             : (timeinfo->tm_wday - 1); // Convert Sunday=0 to Sunday=6, Monday=1 to Monday=0, etc.
+    if (processed_until == 0)
+    {
+        // First evaluation - a schedule earlier in the current minute is still played
+        processed_until = now - (now % SECONDS_PER_MINUTE);
+    }
+    else if (processed_until > (now + 1))
+    {
+        // The clock went backwards - continue after the current second to avoid playing it twice
+        processed_until = now + 1;
+    }
+
+    time_t due = prv_find_next_due(processed_until);
 
-    for (int i = 0; i < MAX_SCHEDULES; i++)
+    while ((due != 0) && (due <= now))
     {
-        if (!schedules[i].active)
+        if ((now - due) < (SCHEDULE_LATE_GRACE_S + clock_step_grace_s))
         {
-            continue;
+            if (prepared_due != due)
+            {
+                // Not seen before it was due (e.g. just added) - the cluster still gets it, if late
+                prv_prepare_schedules_at(due);
+                prepared_due = due;
+            }
+
+            u8 nof_triggered = prv_trigger_schedules_at(due);
+
+            // The evaluation started at now + now_microseconds - that is when the schedules were triggered
+            s64 error_us = (s64)(now - due) * US_PER_SECOND + (s64)now_microseconds;
+            prv_record_trigger(due, error_us, nof_triggered);
+
+            LOG_DEBUG(MODULE_APPCONTROL, "Triggered %ld us after the schedule was due", (long)error_us);
+        }
+        else
+        {
+            LOG_DEBUG(MODULE_APPCONTROL, "Skipping schedules due %ld s ago", (long)(now - due));
         }
 
-        // Check if minute changed since last check
-        if (schedules[i].last_checked_min != current_min)
+        processed_until = due + 1;
+        due = prv_find_next_due(processed_until);
+    }
+
+    // The schedules jumped over by a clock step are handled now
+    clock_step_grace_s = 0;
+
+    if (due == 0)
+    {
+        // No active schedules - a change of the schedules wakes us up again
+        esp_timer_stop(schedule_timer);
+        prv_publish_wake_deadline(0);
+        return;
+    }
+
+    // Shortly before a schedule is due the player is prepared, so the trigger itself is a single short command
+    time_t prearm_at = due - SCHEDULE_PREARM_S;
+    if ((now >= prearm_at) && (prepared_due != due))
+    {
+        prv_prepare_schedules_at(due);
+        prepared_due = due;
+    }
+    time_t wake_at = (prepared_due == due) ? due : prearm_at;
+
+    // Let the PowerManager wake the chip up in time for the next schedule
+    prv_publish_wake_deadline(wake_at);
+
+    time_t sleep_s = wake_at - now;
+    if (sleep_s > SCHEDULE_MAX_SLEEP_S)
+    {
+        sleep_s = SCHEDULE_MAX_SLEEP_S;
+    }
+
+    LOG_DEBUG(MODULE_APPCONTROL, "Next schedule due in %ld s", (long)(due - now));
+
+    // Absolute deadline against the synchronized clock - the timer expires at the start of the due second
+    s64 sleep_us = (s64)sleep_s * US_PER_SECOND - (s64)now_microseconds;
+    esp_timer_stop(schedule_timer); // Not running is fine
+    esp_timer_start_once(schedule_timer, (sleep_us > 0) ? (u64)sleep_us : 1U);
+}
+
+STATIC time_t prv_find_next_due(time_t from)
+{
+    if (schedulestore_get_count() == 0)
+    {
+        return 0;
+    }
+
+    u32 revision = schedulestore_get_revision();
+
+    // Usually the evaluation asks again before the found schedule is due - nothing changed in between
+    if ((found_due != 0) && (revision == searched_revision) && (from >= searched_from) && (from <= found_due))
+    {
+        return found_due;
+    }
+
+    struct tm from_tm;
+    localtime_r(&from, &from_tm);
+
+    time_t due = 0;
+    u16 nof_skipped_days = 0;
+    for (int day_offset = 0; day_offset <= (SCHEDULE_LOOKAHEAD_DAYS + nof_skipped_days); day_offset++)
+    {
+        time_t at = from;
+        if (day_offset > 0)
+        {
+            // Start of the day - the date is normalized around noon, which is unaffected by DST changes
+            struct tm day_tm = from_tm;
+            day_tm.tm_mday += day_offset;
+            day_tm.tm_hour = 12;
+            day_tm.tm_min = 0;
+            day_tm.tm_sec = 0;
+            day_tm.tm_isdst = -1;
+            mktime(&day_tm);
+            day_tm.tm_hour = 0;
+            day_tm.tm_isdst = -1;
+            at = mktime(&day_tm);
+        }
+
+        u8 position = prv_seek_timeline(at);
+        if (timeline.is_excepted && (nof_skipped_days < SCHEDULE_MAX_SKIP_DAYS))
         {
-            schedules[i].last_checked_min = current_min;
-            schedules[i].triggered = false; // Reset trigger flag on minute change
+            nof_skipped_days++; // A holiday does not count towards the lookahead
+        }
+        if (position < timeline.nof_entries)
+        {
+            due = prv_get_timeline_due(position, NULL, NULL);
+            break;
         }
+    }
+
+    searched_revision = revision;
+    searched_from = from;
+    found_due = due;
+
+    return due;
+}
+
+static u8 prv_trigger_schedules_at(time_t due)
+{
+    struct tm due_tm;
+    localtime_r(&due, &due_tm);
+
+    u8 nof_triggered = 0;
 
-        // Check if weekday matches (bit 0 = Monday, bit 6 = Sunday)
-        bool weekday_matches = (schedules[i].weekday_mask & (1 << current_weekday)) != 0;
+    // All schedules of this second are next to each other in the timeline
+    u8 schedule_id;
+    u16 song_index;
+    for (u8 position = prv_seek_timeline(due);
+         (position < timeline.nof_entries) && (prv_get_timeline_due(position, &schedule_id, &song_index) == due);
+         position++)
+    {
+        LOG_DEBUG(MODULE_APPCONTROL, "Triggering schedule %d: Playing song %d at %02d:%02d:%02d (weekday %d)",
+                  schedule_id, song_index, due_tm.tm_hour, due_tm.tm_min, due_tm.tm_sec, due_tm.tm_wday);
+
+        // Trigger song playback
+        prv_play_song(song_index);
+        nof_triggered++;
+    }
 
-        // Check if time matches, weekday matches, and hasn't been triggered yet this minute
-        if (schedules[i].hour == current_hour && schedules[i].minute == current_min && weekday_matches
-            && !schedules[i].triggered)
+    return nof_triggered;
+}
+
+static void prv_prepare_schedules_at(time_t due)
+{
+    // The player holds one cued song - the first schedule of this second gets it, the others play cold
+    bool is_prepared = false;
+    u16 song_index;
+    for (u8 position = prv_seek_timeline(due);
+         (position < timeline.nof_entries) && (prv_get_timeline_due(position, NULL, &song_index) == due); position++)
+    {
+        if (!is_prepared)
         {
-            if (g_logging_is_active)
-            {
-                Serial.printf("[AppControl] Triggering schedule %d: Playing song %d at %02d:%02d (weekday %d)\n", i,
-                              schedules[i].song_index, current_hour, current_min, current_weekday);
-            }
+            prv_prepare_song(song_index);
+            is_prepared = true;
+        }
+
+        // A cluster leader passes the play on to its followers ahead of time
+        prv_announce_song(song_index, due);
+    }
+}
 
-            // Trigger song playback
-            prv_play_song(schedules[i].song_index);
-            schedules[i].triggered = true;
+static void prv_record_trigger(time_t due, s64 error_us, u8 nof_schedules)
+{
+    // Saturate - a late catch-up after a clock step can be minutes behind
+    s32 error = (error_us > INT32_MAX) ? INT32_MAX : ((error_us < INT32_MIN) ? INT32_MIN : (s32)error_us);
+
+    schedule_trigger_event_t* event = &trigger_log[trigger_log_next];
+    event->due = due;
+    event->error_us = error;
+    event->nof_schedules = nof_schedules;
+    trigger_log_next = (u8)((trigger_log_next + 1) % SCHEDULE_TIMING_LOG_SIZE);
+
+    if ((nof_triggers == 0) || (error > max_trigger_error_us))
+    {
+        max_trigger_error_us = error;
+    }
+    nof_triggers++;
+}
+
+static void prv_publish_trigger_timing(void)
+{
+    msg_schedule_timing_t timing;
+    appcontrol_get_trigger_timing(&timing);
+
+    msg_t resp_msg;
+    resp_msg.msg_id = MSG_0408;
+    resp_msg.data_size = sizeof(msg_schedule_timing_t);
+    resp_msg.data_bytes = (u8*)&timing;
+    messagebroker_publish(&resp_msg);
+}
+
+static u8 prv_get_weekday_bit(const struct tm* timeinfo)
+{
+    // Convert Sunday=0 to Sunday=6, Monday=1 to Monday=0, etc. (bit 0 = Monday, bit 6 = Sunday)
+    u8 weekday = (timeinfo->tm_wday == 0) ? 6 : (timeinfo->tm_wday - 1);
+    return (u8)(1U << weekday);
+}
+
+static u8 prv_seek_timeline(time_t at)
+{
+    struct tm at_tm;
+    localtime_r(&at, &at_tm);
+
+    u32 date = schedulestore_pack_date((u16)(at_tm.tm_year + 1900), (u8)(at_tm.tm_mon + 1), (u8)at_tm.tm_mday);
+    if ((timeline.date != date) || (timeline.revision != schedulestore_get_revision()))
+    {
+        prv_compile_timeline(&at_tm, date);
+    }
+
+    // The lookups move forward in time - only a step back starts at the beginning again
+    if ((timeline.cursor > 0) && (prv_get_timeline_due(timeline.cursor - 1, NULL, NULL) >= at))
+    {
+        timeline.cursor = 0;
+    }
+    while ((timeline.cursor < timeline.nof_entries) && (prv_get_timeline_due(timeline.cursor, NULL, NULL) < at))
+    {
+        timeline.cursor++;
+    }
+
+    return timeline.cursor;
+}
+
+static time_t prv_get_timeline_due(u8 entry, u8* out_schedule_id, u16* out_song_index)
+{
+    ASSERT(entry < timeline.nof_entries);
+
+    u8 schedule_id;
+    schedule_record_t record;
+    bool is_found = schedulestore_get_at(timeline.positions[entry], &schedule_id, &record);
+    ASSERT(is_found); // The revision check keeps the positions valid
+    (void)is_found;
+
+    if (out_schedule_id != NULL)
+    {
+        *out_schedule_id = schedule_id;
+    }
+    if (out_song_index != NULL)
+    {
+        *out_song_index = schedulestore_get_song_index(record);
+    }
+
+    time_t due = timeline.day_start + (time_t)schedulestore_get_second_of_day(record);
+    if ((timeline.is_shifted[entry / 8] & (1U << (entry % 8))) != 0)
+    {
+        due += timeline.offset_change_s;
+    }
+    return due;
+}
+
+static void prv_compile_timeline(const struct tm* day_tm, u32 date)
+{
+    timeline.date = date;
+    timeline.revision = schedulestore_get_revision();
+    timeline.is_excepted = schedulestore_is_exception_date(date);
+    timeline.nof_entries = 0;
+    timeline.cursor = 0;
+    timeline.offset_change_s = 0;
+    memset(timeline.is_shifted, 0, sizeof(timeline.is_shifted));
+
+    if (timeline.is_excepted)
+    {
+        return;
+    }
+
+    struct tm start_tm = *day_tm;
+    start_tm.tm_hour = 0;
+    start_tm.tm_min = 0;
+    start_tm.tm_sec = 0;
+    start_tm.tm_isdst = -1;
+    timeline.day_start = mktime(&start_tm);
+
+    u8 weekday_bit = prv_get_weekday_bit(day_tm);
+
+    u8 schedule_id;
+    schedule_record_t record;
+    for (u8 idx = 0; schedulestore_get_at(idx, &schedule_id, &record); idx++)
+    {
+        if ((schedulestore_get_weekday_mask(record) & weekday_bit) == 0)
+        {
+            continue;
         }
+
+        u32 second_of_day = schedulestore_get_second_of_day(record);
+        struct tm due_tm = *day_tm;
+        due_tm.tm_hour = (int)(second_of_day / 3600);
+        due_tm.tm_min = (int)((second_of_day / 60) % 60);
+        due_tm.tm_sec = (int)(second_of_day % 60);
+        due_tm.tm_isdst = -1;
+        time_t due = mktime(&due_tm);
+
+        // A day has at most one offset change - every entry after it is shifted by the same amount
+        time_t offset_change_s = due - (timeline.day_start + (time_t)second_of_day);
+        bool is_shifted = (offset_change_s != 0);
+        if (is_shifted)
+        {
+            timeline.offset_change_s = (s32)offset_change_s;
+        }
+
+        // The index is sorted by the time of day - the timestamps only differ from that order around a DST change
+        u8 position = timeline.nof_entries;
+        timeline.nof_entries++;
+        while ((position > 0) && (prv_get_timeline_due(position - 1, NULL, NULL) > due))
+        {
+            prv_set_timeline_entry(position, timeline.positions[position - 1],
+                                   (timeline.is_shifted[(position - 1) / 8] & (1U << ((position - 1) % 8))) != 0);
+            position--;
+        }
+        prv_set_timeline_entry(position, idx, is_shifted);
     }
 }
 
+static void prv_set_timeline_entry(u8 entry, u8 position, bool is_shifted)
+{
+    timeline.positions[entry] = position;
+    if (is_shifted)
+    {
+        timeline.is_shifted[entry / 8] |= (u8)(1U << (entry % 8));
+    }
+    else
+    {
+        timeline.is_shifted[entry / 8] &= (u8)~(1U << (entry % 8));
+    }
+}
+
+static void prv_invalidate_timeline(void)
+{
+    timeline.date = 0;
+    found_due = 0;
+}
+
+static void prv_request_reschedule(void) { xSemaphoreGive(schedule_event); }
+
+static void prv_schedule_timer_callback(void* arg)
+{
+    (void)arg;
+
+    // Runs in the esp_timer task - the evaluation itself happens in appcontrol_run()
+    prv_request_reschedule();
+}
+
+static void prv_publish_wake_deadline(time_t due)
+{
+    msg_power_wake_deadline_t deadline;
+    deadline.module_id = MODULE_APPCONTROL;
+    deadline.wake_at = due;
+
+    msg_t msg;
+    msg.msg_id = MSG_0501;
+    msg.data_size = sizeof(msg_power_wake_deadline_t);
+    msg.data_bytes = (u8*)&deadline;
+
+    messagebroker_publish(&msg);
+}
+
 static void prv_play_song(u16 song_index)
 {
-    Serial.println("ApplicationControl: Playing scheduled song index " + String(song_index));
+    LOG_INFO(MODULE_APPCONTROL, "Playing scheduled song index %d", song_index);
 
     msg_mp3_play_song_t play_cmd;
     play_cmd.song_index = song_index;
+    play_cmd.requested_at_us = esp_timer_get_time();
 
     msg_t msg;
     msg.msg_id = MSG_0302;
     msg.data_size = sizeof(msg_mp3_play_song_t);
     msg.data_bytes = (u8*)&play_cmd;
 
+    // Deferred, so that the scheduler is not blocked by the UART exchange with the player
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        LOG_WARNING(MODULE_APPCONTROL, "Message queue is full, scheduled song was dropped");
+    }
+}
+
+static void prv_prepare_song(u16 song_index)
+{
+    LOG_DEBUG(MODULE_APPCONTROL, "Preparing song %d for the next schedule", song_index);
+
+    msg_mp3_prepare_song_t prepare_cmd;
+    prepare_cmd.song_index = song_index;
+
+    msg_t msg;
+    msg.msg_id = MSG_0309;
+    msg.data_size = sizeof(msg_mp3_prepare_song_t);
+    msg.data_bytes = (u8*)&prepare_cmd;
+
+    // Losing the preparation only costs latency - the schedule is still played cold
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        LOG_DEBUG(MODULE_APPCONTROL, "Message queue is full, song was not prepared");
+    }
+}
+
+static void prv_announce_song(u16 song_index, time_t due)
+{
+    msg_cluster_announce_t announce;
+    announce.song_index = song_index;
+    announce.play_at_us = (s64)due * US_PER_SECOND;
+
+    msg_t msg;
+    msg.msg_id = MSG_0603;
+    msg.data_size = sizeof(msg_cluster_announce_t);
+    msg.data_bytes = (u8*)&announce;
+
+    // Only queued by the ClusterSync - and ignored unless this node is a cluster leader
     messagebroker_publish(&msg);
 }
 
-static void prv_save_schedules_to_flash(void)
+static void prv_mark_schedules_dirty(void)
+{
+    // Every change restarts the debounce timer - the ScheduleStore tracks what has to be written
+    xTimerReset(persist_timer, 0);
+}
+
+static void prv_persist_timer_callback(TimerHandle_t timer)
 {
-    preferences.begin(NVS_NAMESPACE, false); // Open in read-write mode
+    (void)timer;
 
-    // Count active schedules
-    int active_count = 0;
-    for (int i = 0; i < MAX_SCHEDULES; i++)
+    // Runs in the timer service task - the flash write happens in appcontrol_run()
+    persist_is_due = true;
+    xSemaphoreGive(schedule_event);
+}
+
+static void prv_import_schedules(const msg_schedule_add_t* schedules, u16 nof_schedules)
+{
+    msg_schedule_import_response_t response;
+    response.success = false;
+
+    // Everything is checked before the table is touched - a rejected import leaves it as it was
+    bool is_valid = (nof_schedules <= SCHEDULESTORE_MAX_SCHEDULES);
+    response.error_index = is_valid ? 0 : SCHEDULESTORE_MAX_SCHEDULES;
+    for (u16 i = 0; is_valid && (i < nof_schedules); i++)
     {
-        if (schedules[i].active)
+        if (!prv_is_valid_schedule(&schedules[i]))
         {
-            active_count++;
+            is_valid = false;
+            response.error_index = i;
         }
     }
 
-    // Save count
-    preferences.putInt(NVS_KEY_SCHEDULE_COUNT, active_count);
-
-    // Save each active schedule
-    int save_index = 0;
-    for (int i = 0; i < MAX_SCHEDULES; i++)
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    if (is_valid)
     {
-        if (schedules[i].active)
+        schedulestore_clear();
+        for (u16 i = 0; i < nof_schedules; i++)
         {
-            char key[16];
-            // Save schedule data as a struct
-            snprintf(key, sizeof(key), "%s%d", NVS_KEY_SCHEDULE_PREFIX, save_index);
-
-            // Create a packed structure for storage
-            struct
-            {
-                u8 hour;
-                u8 minute;
-                u16 song_index;
-                u8 weekday_mask; // Weekday mask for schedule
-                int original_id; // Store original array position
-            } storage_data;
-
-            storage_data.hour = schedules[i].hour;
-            storage_data.minute = schedules[i].minute;
-            storage_data.song_index = schedules[i].song_index;
-            storage_data.weekday_mask = schedules[i].weekday_mask;
-            storage_data.original_id = i;
-
-            preferences.putBytes(key, &storage_data, sizeof(storage_data));
-            save_index++;
+            const msg_schedule_add_t* schedule = &schedules[i];
+            u32 second_of_day = (u32)(schedule->hour * 3600 + schedule->minute * 60 + schedule->second);
+            u8 schedule_id = schedulestore_add(second_of_day, schedule->weekday_mask, schedule->song_index);
+            ASSERT(schedule_id != SCHEDULESTORE_INVALID_ID); // Validated and the table was cleared
+            (void)schedule_id;
         }
+
+        // A bulk change is written right away - with a single write of the table
+        xTimerStop(persist_timer, 0);
+        schedulestore_save();
+        response.success = true;
+    }
+    response.nof_schedules = schedulestore_get_count();
+    xSemaphoreGive(schedule_mutex);
+
+    if (is_valid)
+    {
+        prv_request_reschedule();
+        LOG_INFO(MODULE_APPCONTROL, "Imported %d schedules", response.nof_schedules);
     }
 
-    preferences.end();
+    msg_t resp_msg;
+    resp_msg.msg_id = MSG_0410;
+    resp_msg.data_size = sizeof(msg_schedule_import_response_t);
+    resp_msg.data_bytes = (u8*)&response;
+    messagebroker_publish(&resp_msg);
+}
+
+static bool prv_is_valid_schedule(const msg_schedule_add_t* schedule)
+{
+    return (schedule->hour < 24) && (schedule->minute < 60) && (schedule->second < 60)
+           && ((schedule->weekday_mask & 0x7F) != 0) && (schedule->song_index <= SCHEDULESTORE_MAX_SONG_INDEX);
 }
 
-static void prv_load_schedules_from_flash(void)
+static void prv_publish_schedule_page(u16 start_index, module_id_e requested_by)
 {
-    preferences.begin(NVS_NAMESPACE, true); // Open in read-only mode
+    // Build the page directly in a payload block of the broker - no copy on the stack
+    msg_schedule_list_t* list = (msg_schedule_list_t*)messagebroker_loan(sizeof(msg_schedule_list_t));
+    if (list == NULL)
+    {
+        LOG_WARNING(MODULE_APPCONTROL, "No payload block available for the schedule list");
+        return;
+    }
 
-    // Get count of saved schedules
-    int saved_count = preferences.getInt(NVS_KEY_SCHEDULE_COUNT, 0);
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    list->total_count = schedulestore_get_count();
+    list->start_index = start_index;
+    list->requested_by = requested_by;
+    list->count = 0;
 
-    if (saved_count > 0)
+    u8 schedule_id;
+    schedule_record_t record;
+    while ((list->count < SCHEDULE_LIST_PAGE_SIZE) && ((start_index + list->count) < list->total_count)
+           && schedulestore_get_at((u8)(start_index + list->count), &schedule_id, &record))
     {
-        // Load each schedule
-        for (int i = 0; i < saved_count && i < MAX_SCHEDULES; i++)
-        {
-            char key[16];
-            snprintf(key, sizeof(key), "%s%d", NVS_KEY_SCHEDULE_PREFIX, i);
+        schedule_info_t* info = &list->schedules[list->count];
+        u32 second_of_day = schedulestore_get_second_of_day(record);
+        info->schedule_id = schedule_id;
+        info->hour = (u8)(second_of_day / 3600);
+        info->minute = (u8)((second_of_day / 60) % 60);
+        info->second = (u8)(second_of_day % 60);
+        info->song_index = schedulestore_get_song_index(record);
+        info->weekday_mask = schedulestore_get_weekday_mask(record);
+        list->count++;
+    }
+    xSemaphoreGive(schedule_mutex);
 
-            // Read stored data
-            struct
-            {
-                u8 hour;
-                u8 minute;
-                u16 song_index;
-                u8 weekday_mask;
-                int original_id;
-            } storage_data;
+    msg_t resp_msg;
+    resp_msg.msg_id = MSG_0406;
+    resp_msg.data_size = sizeof(msg_schedule_list_t);
+    resp_msg.data_bytes = (u8*)list;
+    if (!messagebroker_publish_loan(&resp_msg))
+    {
+        LOG_WARNING(MODULE_APPCONTROL, "Message queue is full, schedule list was dropped");
+    }
+}
 
-            size_t len = preferences.getBytes(key, &storage_data, sizeof(storage_data));
+static void prv_publish_exception_list(void)
+{
+    msg_schedule_exception_list_t list;
+    list.count = 0;
 
-            if (len == sizeof(storage_data))
-            {
-                // Try to restore to original position, or find next free slot
-                int target_slot = storage_data.original_id;
-                if (target_slot >= MAX_SCHEDULES || schedules[target_slot].active)
-                {
-                    // Find a free slot
-                    target_slot = -1;
-                    for (int j = 0; j < MAX_SCHEDULES; j++)
-                    {
-                        if (!schedules[j].active)
-                        {
-                            target_slot = j;
-                            break;
-                        }
-                    }
-                }
-
-                if (target_slot >= 0)
-                {
-                    schedules[target_slot].active = true;
-                    schedules[target_slot].hour = storage_data.hour;
-                    schedules[target_slot].minute = storage_data.minute;
-                    schedules[target_slot].song_index = storage_data.song_index;
-                    schedules[target_slot].weekday_mask = storage_data.weekday_mask;
-                    schedules[target_slot].triggered = false;
-                    schedules[target_slot].last_checked_min = 255;
-                }
-            }
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    schedule_exception_t exception;
+    for (u8 id = 0; (id < SCHEDULESTORE_MAX_EXCEPTIONS) && (list.count < SCHEDULE_MAX_EXCEPTIONS); id++)
+    {
+        if (schedulestore_get_exception(id, &exception))
+        {
+            schedule_exception_info_t* info = &list.exceptions[list.count];
+            info->exception_id = id;
+            info->first_date = exception.first_date;
+            info->last_date = exception.last_date;
+            list.count++;
         }
     }
+    xSemaphoreGive(schedule_mutex);
 
-    preferences.end();
+    msg_t resp_msg;
+    resp_msg.msg_id = MSG_0414;
+    resp_msg.data_size = sizeof(msg_schedule_exception_list_t);
+    resp_msg.data_bytes = (u8*)&list;
+    messagebroker_publish(&resp_msg);
 }
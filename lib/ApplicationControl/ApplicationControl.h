@@ -38,7 +38,9 @@ extern "C"
 {
 #endif
 
+#include <time.h>
 #include "custom_types.h"
+#include "MessageDefinitions.h"
 
     /**
      * @brief Initialize the Application Control module
@@ -48,13 +50,47 @@ extern "C"
     void appcontrol_init(void);
 
     /**
-     * @brief Run periodic Application Control tasks
+     * @brief Run the Application Control schedule engine
      *
-     * Should be called regularly from the main loop to check scheduled
-     * events and trigger song playback when needed.
+     * Blocks until the next schedule is due, the schedules were changed or the
+     * time was synchronized, then triggers the due songs and arms a timer for the
+     * next one. Call it from the main loop - no additional delay is needed.
      */
     void appcontrol_run(void);
 
+    /**
+     * @brief Write pending schedule changes to flash right away
+     *
+     * Changes are normally written out as one blob once they stopped coming in for a moment.
+     * Call this before a restart, so that the last changes are not lost.
+     */
+    void appcontrol_flush_schedules(void);
+
+    /**
+     * @brief Get the point in time up to which the schedules were handled
+     *
+     * Reads without taking the schedule lock - it is meant for the assertion handler, which may
+     * run while the lock is held.
+     * @return Unix timestamp, 0 if the schedules were not evaluated yet
+     */
+    time_t appcontrol_get_processed_until(void);
+
+    /**
+     * @brief Continue the evaluation where the previous run stopped before a reset
+     *
+     * Call it after appcontrol_init() and before the first appcontrol_run(). A schedule that was
+     * already played in the current minute is not played again, the ones that became due during
+     * the reset are caught up on within the late grace period.
+     * @param resume_after Value of appcontrol_get_processed_until() before the reset
+     */
+    void appcontrol_resume_after(time_t resume_after);
+
+    /**
+     * @brief Get the measured trigger errors - the content of MSG_0408, without publishing it
+     * @param timing Filled with the trigger count, the largest error and the most recent triggers (oldest first)
+     */
+    void appcontrol_get_trigger_timing(msg_schedule_timing_t* timing);
+
 #ifdef __cplusplus
 }
 #endif
@@ -45,6 +45,7 @@
 #define CLI_CANARY            (0xA5A5A5A5U)
 #define CLI_OK_PROMPT         "[OK] "
 #define CLI_FAIL_PROMPT       "[FAIL] "
+#define CLI_PRINT_BUFFER_SIZE (128)
 
 /* #############################################################################
  * # static variables
@@ -59,6 +60,9 @@ static cli_cfg_t* g_cli_cfg_reference = NULL;
 static void prv_write_string(const char* str);
 static void prv_write_char(char in_char);
 static void prv_put_char(char in_char);
+static void prv_flush_tx_buffer(void);
+static void prv_write_out(const char* in_buffer, size_t in_length);
+static void prv_write_direct(const char* in_string);
 static void prv_write_cli_prompt(void);
 static void prv_write_cmd_unknown(const char* const in_cmd_name);
 static void prv_plot_lines(char in_char, int length);
@@ -69,9 +73,7 @@ static char prv_get_last_recv_char_from_rx_buffer(void);
 
 static const cli_binding_t* prv_find_cmd(const char* const in_cmd_name);
 static uint8_t prv_get_args_from_rx_buffer(char* array_of_arguments[], uint8_t max_arguments);
-STATIC void prv_find_matching_strings(const char* in_partial_string, const char* const in_string_array[],
-                                      uint8_t in_nof_strings, const char* out_matches_array[],
-                                      uint8_t* out_nof_matches);
+STATIC uint8_t prv_find_first_binding_from(const char* const in_name);
 static bool prv_is_char_in_string(char character, const char* in_string, uint8_t string_length);
 static void prv_autocomplete_command(void);
 
@@ -96,7 +98,9 @@ void cli_init(cli_cfg_t* const inout_module_cfg, cli_put_char_fn in_put_char_fn)
     inout_module_cfg->end_canary_word = CLI_CANARY;
     inout_module_cfg->mid_canary_word = CLI_CANARY;
     inout_module_cfg->put_char_fn = in_put_char_fn;
+    inout_module_cfg->write_buffer_fn = NULL;
     inout_module_cfg->nof_stored_chars_in_rx_buffer = 0;
+    inout_module_cfg->nof_stored_chars_in_tx_buffer = 0;
     inout_module_cfg->nof_stored_cmd_bindings = 0;
 
     // Store the config locally in a static variable
@@ -105,15 +109,25 @@ void cli_init(cli_cfg_t* const inout_module_cfg, cli_put_char_fn in_put_char_fn)
     g_cli_cfg_reference->is_initialized = true;
 
     // Register the default commands
-    cli_binding_t help_cmd_binding = {"help", prv_cmd_handler_help, NULL, "List all commands"};
+    static const cli_binding_t help_cmd_binding = {"help", prv_cmd_handler_help, NULL, "List all commands"};
     cli_register(&help_cmd_binding);
 
     // Print the prompt
     prv_write_cli_prompt();
+    prv_flush_tx_buffer();
 
     return;
 }
 
+void cli_set_write_buffer_fn(cli_write_buffer_fn in_write_buffer_fn)
+{
+    prv_verify_object_integrity(g_cli_cfg_reference);
+
+    // Pending output still goes through the old path
+    prv_flush_tx_buffer();
+    g_cli_cfg_reference->write_buffer_fn = in_write_buffer_fn;
+}
+
 void cli_receive(char in_char)
 {
     prv_verify_object_integrity(g_cli_cfg_reference);
@@ -212,6 +226,8 @@ void cli_process()
         }
         else
         {
+            // cli_print() writes directly - everything buffered so far has to be out before the command runs
+            prv_flush_tx_buffer();
             cmd_status = ptCmdBinding->cmd_fn(argc, argv, ptCmdBinding->context);
         }
 
@@ -225,12 +241,20 @@ void cli_process()
     // Reset the cli buffer and write the prompt again for a new user input
     prv_reset_rx_buffer();
     prv_write_cli_prompt();
+    prv_flush_tx_buffer();
 }
 
 void cli_receive_and_process(char in_char)
 {
     cli_receive(in_char);
     cli_process();
+    prv_flush_tx_buffer();
+}
+
+void cli_flush(void)
+{
+    prv_verify_object_integrity(g_cli_cfg_reference);
+    prv_flush_tx_buffer();
 }
 
 void cli_register(const cli_binding_t* const in_cmd_binding)
@@ -245,36 +269,25 @@ void cli_register(const cli_binding_t* const in_cmd_binding)
         prv_verify_object_integrity(g_cli_cfg_reference);
     }
 
-    uint8_t does_binding_exist = false;
-    uint8_t is_binding_stored = false;
-
-    // Check whether the binding is already present - it must not be
-    for (uint8_t i = 0; i < g_cli_cfg_reference->nof_stored_cmd_bindings; i++)
+    ASSERT(g_cli_cfg_reference->nof_stored_cmd_bindings < CLI_MAX_NOF_CALLBACKS);
+    if (g_cli_cfg_reference->nof_stored_cmd_bindings >= CLI_MAX_NOF_CALLBACKS)
     {
-        const cli_binding_t* cmd_binding = &g_cli_cfg_reference->cmd_bindings_buffer[i];
-        if (0 == strncmp(cmd_binding->name, in_cmd_binding->name, CLI_MAX_CMD_NAME_LENGTH))
-        {
-            does_binding_exist = true;
-            break;
-        }
-    }
-    ASSERT(false == does_binding_exist);
-
-    if (g_cli_cfg_reference->nof_stored_cmd_bindings < CLI_MAX_NOF_CALLBACKS)
-    {
-        //  Deep Copy the binding into the buffer
-        uint8_t idx = g_cli_cfg_reference->nof_stored_cmd_bindings;
-        memcpy(&g_cli_cfg_reference->cmd_bindings_buffer[idx], in_cmd_binding, sizeof(cli_binding_t));
-        g_cli_cfg_reference->nof_stored_cmd_bindings++;
-
-        // Mark that the binding was stored
-        is_binding_stored = true;
+        return;
     }
 
-    ASSERT(true == is_binding_stored);
-
+    // Keep the table sorted by name - the binding must not be present yet
+    uint8_t pos = prv_find_first_binding_from(in_cmd_binding->name);
+    const char* const existing_name
+        = (pos < g_cli_cfg_reference->nof_stored_cmd_bindings) ? g_cli_cfg_reference->cmd_bindings[pos]->name : "";
+    const bool does_binding_exist = (0 == strncmp(existing_name, in_cmd_binding->name, CLI_MAX_CMD_NAME_LENGTH));
+    ASSERT(false == does_binding_exist);
     (void)does_binding_exist;
-    (void)is_binding_stored;
+
+    // Only the pointer is stored - make room for it at its sorted position
+    memmove(&g_cli_cfg_reference->cmd_bindings[pos + 1], &g_cli_cfg_reference->cmd_bindings[pos],
+            (g_cli_cfg_reference->nof_stored_cmd_bindings - pos) * sizeof(g_cli_cfg_reference->cmd_bindings[0]));
+    g_cli_cfg_reference->cmd_bindings[pos] = in_cmd_binding;
+    g_cli_cfg_reference->nof_stored_cmd_bindings++;
 
     return;
 }
@@ -300,21 +313,16 @@ void cli_unregister(const char* const in_cmd_name)
 
     uint8_t is_binding_found = false;
 
-    for (uint8_t i = 0; i < g_cli_cfg_reference->nof_stored_cmd_bindings; i++)
+    uint8_t pos = prv_find_first_binding_from(in_cmd_name);
+    if ((pos < g_cli_cfg_reference->nof_stored_cmd_bindings)
+        && (0 == strncmp(g_cli_cfg_reference->cmd_bindings[pos]->name, in_cmd_name, CLI_MAX_CMD_NAME_LENGTH)))
     {
-        cli_binding_t* cmd_binding = &g_cli_cfg_reference->cmd_bindings_buffer[i];
-        if (0 == strncmp(cmd_binding->name, in_cmd_name, CLI_MAX_CMD_NAME_LENGTH))
-        {
-            is_binding_found = true;
-            // Shift all following bindings one position to the left
-            for (uint8_t j = i; j < g_cli_cfg_reference->nof_stored_cmd_bindings - 1; j++)
-            {
-                memcpy(&g_cli_cfg_reference->cmd_bindings_buffer[j], &g_cli_cfg_reference->cmd_bindings_buffer[j + 1],
-                       sizeof(cli_binding_t));
-            }
-            g_cli_cfg_reference->nof_stored_cmd_bindings--;
-            break;
-        }
+        is_binding_found = true;
+
+        // Shift all following bindings one position to the left
+        g_cli_cfg_reference->nof_stored_cmd_bindings--;
+        memmove(&g_cli_cfg_reference->cmd_bindings[pos], &g_cli_cfg_reference->cmd_bindings[pos + 1],
+                (g_cli_cfg_reference->nof_stored_cmd_bindings - pos) * sizeof(g_cli_cfg_reference->cmd_bindings[0]));
     }
     ASSERT(true == is_binding_found);
 
@@ -330,14 +338,18 @@ void cli_print(const char* fmt, ...)
         ASSERT(fmt);
     }
 
-    char buffer[128]; // Temporary buffer for formatted string
+    char buffer[CLI_PRINT_BUFFER_SIZE]; // Temporary buffer for formatted string
     va_list args;
     va_start(args, fmt);
-    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    vsnprintf(buffer, sizeof(buffer) - 1, fmt, args); // Leaves room for the line break
     va_end(args);
 
-    prv_write_string(buffer);
-    prv_write_char('\n');
+    size_t length = strlen(buffer);
+    buffer[length] = '\n';
+    buffer[length + 1] = '\0';
+
+    // Called from the tasks of the other modules as well - bypass the shared tx buffer
+    prv_write_direct(buffer);
 }
 
 void cli_deinit(cli_cfg_t* const inout_module_cfg)
@@ -359,9 +371,6 @@ void cli_deinit(cli_cfg_t* const inout_module_cfg)
 
 static void prv_write_string(const char* in_string)
 {
-    {
-        prv_verify_object_integrity(g_cli_cfg_reference);
-    }
     for (const char* current_char = in_string; *current_char != '\0'; current_char++)
     {
         prv_write_char(*current_char);
@@ -370,9 +379,6 @@ static void prv_write_string(const char* in_string)
 
 static void prv_write_char(char in_char)
 {
-    { // Input Checks
-        prv_verify_object_integrity(g_cli_cfg_reference);
-    }
     if ('\n' == in_char) // User pressed Enter
     {
         prv_put_char('\r');
@@ -391,11 +397,79 @@ static void prv_write_char(char in_char)
 }
 
 static void prv_put_char(char in_char)
+{
+    // The integrity is verified once per flush, not per character
+    if (g_cli_cfg_reference->nof_stored_chars_in_tx_buffer >= CLI_MAX_TX_BUFFER_SIZE)
+    {
+        prv_flush_tx_buffer();
+    }
+
+    uint8_t idx = g_cli_cfg_reference->nof_stored_chars_in_tx_buffer;
+    g_cli_cfg_reference->tx_char_buffer[idx] = in_char;
+    g_cli_cfg_reference->nof_stored_chars_in_tx_buffer++;
+}
+
+static void prv_flush_tx_buffer(void)
 {
     { // Input Checks
         prv_verify_object_integrity(g_cli_cfg_reference);
     }
-    g_cli_cfg_reference->put_char_fn(in_char);
+
+    uint8_t nof_chars = g_cli_cfg_reference->nof_stored_chars_in_tx_buffer;
+    if (0 == nof_chars)
+    {
+        return;
+    }
+
+    prv_write_out(g_cli_cfg_reference->tx_char_buffer, nof_chars);
+    g_cli_cfg_reference->nof_stored_chars_in_tx_buffer = 0;
+}
+
+static void prv_write_out(const char* in_buffer, size_t in_length)
+{
+    if (NULL != g_cli_cfg_reference->write_buffer_fn)
+    {
+        // One bulk write to the driver
+        g_cli_cfg_reference->write_buffer_fn(in_buffer, in_length);
+        return;
+    }
+
+    for (size_t i = 0; i < in_length; i++)
+    {
+        g_cli_cfg_reference->put_char_fn(in_buffer[i]);
+    }
+}
+
+static void prv_write_direct(const char* in_string)
+{
+    { // Input Checks
+        ASSERT(in_string);
+        prv_verify_object_integrity(g_cli_cfg_reference);
+    }
+
+    // Convert the line breaks on the stack and write the result in as few blocks as possible
+    char block[CLI_PRINT_BUFFER_SIZE];
+    size_t block_length = 0;
+
+    for (const char* current_char = in_string; *current_char != '\0'; current_char++)
+    {
+        if (block_length >= (sizeof(block) - 1))
+        {
+            prv_write_out(block, block_length);
+            block_length = 0;
+        }
+
+        if ('\n' == *current_char)
+        {
+            block[block_length++] = '\r';
+        }
+        block[block_length++] = *current_char;
+    }
+
+    if (block_length > 0)
+    {
+        prv_write_out(block, block_length);
+    }
 }
 
 static void prv_write_cli_prompt()
@@ -451,13 +525,12 @@ static const cli_binding_t* prv_find_cmd(const char* const in_cmd_name)
         ASSERT(g_cli_cfg_reference->nof_stored_cmd_bindings > 0);
     }
 
-    for (uint8_t idx = 0; idx < g_cli_cfg_reference->nof_stored_cmd_bindings; ++idx)
+    // Binary search in the sorted table
+    uint8_t pos = prv_find_first_binding_from(in_cmd_name);
+    if ((pos < g_cli_cfg_reference->nof_stored_cmd_bindings)
+        && (0 == strncmp(g_cli_cfg_reference->cmd_bindings[pos]->name, in_cmd_name, CLI_MAX_CMD_NAME_LENGTH)))
     {
-        const cli_binding_t* cmd_binding = &g_cli_cfg_reference->cmd_bindings_buffer[idx];
-        if (0 == strncmp(cmd_binding->name, in_cmd_name, CLI_MAX_CMD_NAME_LENGTH))
-        {
-            return cmd_binding;
-        }
+        return g_cli_cfg_reference->cmd_bindings[pos];
     }
     return NULL;
 }
@@ -552,7 +625,7 @@ static int prv_cmd_handler_help(int argc, char* argv[], void* context)
     // Create a list of all registered commands
     for (uint8_t i = 0; i < g_cli_cfg_reference->nof_stored_cmd_bindings; ++i)
     {
-        const cli_binding_t* ptCmdBinding = &g_cli_cfg_reference->cmd_bindings_buffer[i];
+        const cli_binding_t* ptCmdBinding = g_cli_cfg_reference->cmd_bindings[i];
         prv_write_string("* ");
         prv_write_string(ptCmdBinding->name);
         prv_write_string(": \n              ");
@@ -577,6 +650,7 @@ static void prv_verify_object_integrity(const cli_cfg_t* const in_ptCfg)
     ASSERT(CLI_CANARY == in_ptCfg->mid_canary_word);
     ASSERT(CLI_CANARY == in_ptCfg->end_canary_word);
     ASSERT(in_ptCfg->nof_stored_chars_in_rx_buffer <= CLI_MAX_RX_BUFFER_SIZE);
+    ASSERT(in_ptCfg->nof_stored_chars_in_tx_buffer <= CLI_MAX_TX_BUFFER_SIZE);
 }
 
 static void prv_plot_lines(char in_char, int length)
@@ -590,35 +664,32 @@ static void prv_plot_lines(char in_char, int length)
     prv_write_char('\n');
 }
 
-STATIC void prv_find_matching_strings(const char* in_partial_string, const char* const in_string_array[],
-                                      uint8_t in_nof_strings, const char* out_matches_array[], uint8_t* out_nof_matches)
+STATIC uint8_t prv_find_first_binding_from(const char* const in_name)
 {
     { // Input checks
-        ASSERT(in_partial_string);
-        ASSERT(in_string_array);
-        ASSERT(in_nof_strings > 0);
-        ASSERT(out_matches_array);
-        ASSERT(out_nof_matches);
+        ASSERT(in_name);
+        prv_verify_object_integrity(g_cli_cfg_reference);
     }
-    uint8_t in_string_idx = 0;
-    uint8_t out_matches_idx = 0;
 
-    for (in_string_idx = 0; in_string_idx < in_nof_strings; ++in_string_idx)
-    {
-        // Get the current string
-        const char* current_string = in_string_array[in_string_idx];
+    // Lower bound: first binding whose name is not sorted before in_name
+    uint8_t low = 0;
+    uint8_t high = g_cli_cfg_reference->nof_stored_cmd_bindings;
 
-        // Check whether the partial string is in the current string
-        if (NULL != strstr(current_string, in_partial_string))
+    while (low < high)
+    {
+        uint8_t mid = (uint8_t)((low + high) / 2);
+        if (strncmp(g_cli_cfg_reference->cmd_bindings[mid]->name, in_name, CLI_MAX_CMD_NAME_LENGTH) < 0)
+        {
+            low = mid + 1;
+        }
+        else
         {
-            out_matches_array[out_matches_idx] = current_string;
-            out_matches_idx++;
+            high = mid;
         }
     }
 
-    *out_nof_matches = out_matches_idx;
-
-    ASSERT(*out_nof_matches <= in_nof_strings);
+    ASSERT(low <= g_cli_cfg_reference->nof_stored_cmd_bindings);
+    return low;
 }
 
 static bool prv_is_char_in_string(char character, const char* in_string, uint8_t string_length)
@@ -660,24 +731,33 @@ static void prv_autocomplete_command(void)
         return;
     }
 
-    // Create a copy of the command names and place them in an array
-    const char* command_names[CLI_MAX_NOF_CALLBACKS] = {0};
-    for (uint8_t i = 0; i < g_cli_cfg_reference->nof_stored_cmd_bindings; i++)
+    // A command name longer than any registered one cannot be completed
+    uint8_t prefix_length = g_cli_cfg_reference->nof_stored_chars_in_rx_buffer;
+    if (prefix_length >= CLI_MAX_CMD_NAME_LENGTH)
     {
-        command_names[i] = g_cli_cfg_reference->cmd_bindings_buffer[i].name;
+        return;
     }
 
-    const char* matches[CLI_MAX_NOF_CALLBACKS] = {0};
-    uint8_t nof_matches = 0;
+    char prefix[CLI_MAX_CMD_NAME_LENGTH] = {0};
+    memcpy(prefix, g_cli_cfg_reference->rx_char_buffer, prefix_length);
 
-    prv_find_matching_strings(g_cli_cfg_reference->rx_char_buffer, command_names,
-                              g_cli_cfg_reference->nof_stored_cmd_bindings, matches, &nof_matches);
-    if (nof_matches == 1)
-    {
-        ASSERT(strlen(matches[0]) > 0);
+    // All names starting with the prefix are next to each other in the sorted table
+    uint8_t first = prv_find_first_binding_from(prefix);
+    uint8_t nof_bindings = g_cli_cfg_reference->nof_stored_cmd_bindings;
 
-        // Only one match - autocomplete the command
-        // If there are more matches, then the user needs to provide more letters for specification
+    const bool is_first_match
+        = (first < nof_bindings)
+          && (0 == strncmp(g_cli_cfg_reference->cmd_bindings[first]->name, prefix, prefix_length));
+    const bool is_second_match
+        = ((first + 1) < nof_bindings)
+          && (0 == strncmp(g_cli_cfg_reference->cmd_bindings[first + 1]->name, prefix, prefix_length));
+
+    // Only one match - autocomplete the command
+    // If there are more matches, then the user needs to provide more letters for specification
+    if (is_first_match && !is_second_match)
+    {
+        const char* match = g_cli_cfg_reference->cmd_bindings[first]->name;
+        ASSERT(strlen(match) > 0);
 
         // Calculate how many characters we need to delete (current input)
         uint8_t chars_to_delete = g_cli_cfg_reference->nof_stored_chars_in_rx_buffer;
@@ -690,8 +770,8 @@ static void prv_autocomplete_command(void)
         }
 
         // Replace the content of the rx buffer with the match
-        strncpy(g_cli_cfg_reference->rx_char_buffer, matches[0], CLI_MAX_RX_BUFFER_SIZE);
-        g_cli_cfg_reference->nof_stored_chars_in_rx_buffer = strlen(matches[0]);
+        strncpy(g_cli_cfg_reference->rx_char_buffer, match, CLI_MAX_RX_BUFFER_SIZE);
+        g_cli_cfg_reference->nof_stored_chars_in_rx_buffer = strlen(match);
 
         // Write the autocompleted command to the console
         prv_write_string(g_cli_cfg_reference->rx_char_buffer);
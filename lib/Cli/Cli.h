@@ -36,11 +36,12 @@ extern "C"
 #define CLI_OK_STATUS                (0)
 #define CLI_FAIL_STATUS              (-1)
 
-#define CLI_MAX_NOF_CALLBACKS        (30)
+#define CLI_MAX_NOF_CALLBACKS        (64)
 #define CLI_MAX_CMD_NAME_LENGTH      (32)
 #define CLI_MAX_HELPER_STRING_LENGTH (100)
 
 #define CLI_MAX_RX_BUFFER_SIZE       (128)
+#define CLI_MAX_TX_BUFFER_SIZE       (128)
 
 #define CLI_GET_ARRAY_SIZE(arr)      (sizeof(arr) / sizeof(arr[0]))
 
@@ -48,6 +49,8 @@ extern "C"
 
     typedef int (*cli_put_char_fn)(char c);
 
+    typedef int (*cli_write_buffer_fn)(const char* buffer, size_t length);
+
     typedef struct
     {
         const char name[CLI_MAX_CMD_NAME_LENGTH];
@@ -60,19 +63,26 @@ extern "C"
     {
         uint32_t start_canary_word;
         cli_put_char_fn put_char_fn;
+        cli_write_buffer_fn write_buffer_fn; // Optional - output is written char by char without it
         uint8_t is_initialized;
 
         uint8_t nof_stored_chars_in_rx_buffer;
         char rx_char_buffer[CLI_MAX_RX_BUFFER_SIZE];
+
+        uint8_t nof_stored_chars_in_tx_buffer;
+        char tx_char_buffer[CLI_MAX_TX_BUFFER_SIZE];
         uint32_t mid_canary_word;
 
         uint8_t nof_stored_cmd_bindings;
-        cli_binding_t cmd_bindings_buffer[CLI_MAX_NOF_CALLBACKS];
+        const cli_binding_t* cmd_bindings[CLI_MAX_NOF_CALLBACKS]; // Sorted by name - the bindings stay in flash
         uint32_t end_canary_word;
     } cli_cfg_t;
 
     void cli_init(cli_cfg_t* const inout_module_cfg, cli_put_char_fn in_put_char_fn);
 
+    void cli_set_write_buffer_fn(cli_write_buffer_fn in_write_buffer_fn);
+
+    // The binding is referenced, not copied - it has to stay valid while it is registered (e.g. static const)
     void cli_register(const cli_binding_t* const in_binding);
 
     void cli_unregister(const char* const in_cmd_name);
@@ -83,6 +93,8 @@ extern "C"
 
     void cli_receive_and_process(char in_char);
 
+    void cli_flush(void);
+
     void cli_print(const char* const fmt, ...);
 
     void cli_deinit(cli_cfg_t* const inout_module_cfg);
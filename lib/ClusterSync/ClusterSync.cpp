@@ -0,0 +1,622 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file ClusterSync.cpp
+ * @brief Synchronized playback of several nodes over UDP multicast
+ *
+ * One node of a cluster is the leader. It keeps the schedules and announces every scheduled play to
+ * the multicast group a few seconds before it is due (MSG_0603 from the ApplicationControl at the
+ * pre-arm). The followers need neither schedules nor NTP: every packet carries the wall clock of the
+ * leader, from which a follower estimates the offset of the leader's clock to its own esp_timer. The
+ * announced point in time is converted with this offset and the song is started by an esp_timer.
+ *
+ * The receive delay only ever makes a sample look older, so the offset is the largest sample of a
+ * window of packets - beacons keep the estimate fresh between the plays. A follower only hears the
+ * leader while it is awake, so the low power mode should stay off on the followers.
+ *
+ * Packets are sent a few times - repeats of the same play share the sequence number. Both ends are
+ * ESP32s, so the packet layout is used as is (little-endian).
+ */
+
+#include "ClusterSync.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include "Logger.h"
+#include "MessageBroker.h"
+#include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "TimeSync.h"
+#include "custom_assert.h"
+#include "esp_timer.h"
+
+#include "lwip/sockets.h"
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// ###########################################################################
+// # Private defines
+// ###########################################################################
+#define PREFERENCES_NAMESPACE    "cluster"
+#define PREF_KEY_ROLE            "role"
+#define CLUSTER_MULTICAST_GROUP  "239.255.71.1"
+#define CLUSTER_PORT             47100
+#define CLUSTER_MAGIC            0x474E4741UL // "AGNG"
+#define CLUSTER_PROTOCOL_VERSION 1
+#define CLUSTER_BEACON_MS        5000      // A leader sends a beacon this often
+#define CLUSTER_RX_TIMEOUT_MS    1000      // A follower re-checks its role and the WiFi this often
+#define CLUSTER_PLAY_REPEATS     3         // Every play is sent this often
+#define CLUSTER_REPEAT_GAP_MS    20        // Pause between two repeats - WiFi losses come in bursts
+#define CLUSTER_OFFSET_WINDOW    8         // Packets per offset estimate
+#define CLUSTER_LATE_GRACE_US    1000000LL // A play that is overdue by more than this is dropped
+#define CLUSTER_MAX_PENDING      4         // Plays a follower has armed at the same time
+#define CLUSTER_ANNOUNCE_QUEUE   4         // Plays waiting to be sent by a leader
+#define US_PER_SECOND            1000000LL
+
+// Task notification bits
+#define CLUSTER_EVENT_BIT_CHANGED (1U << 0) // The role or the WiFi connection changed
+
+// ###########################################################################
+// # Type Definitions
+// ###########################################################################
+typedef enum
+{
+    CLUSTER_PACKET_BEACON = 0, // Only carries the clock of the leader
+    CLUSTER_PACKET_PLAY        // Play a song at play_at_us
+} cluster_packet_type_e;
+
+typedef struct __attribute__((packed))
+{
+    u32 magic;
+    u8 version;
+    u8 type;            // cluster_packet_type_e
+    u16 song_index;     // Play packets only
+    u32 sequence;       // Incremented per packet - repeats of a play share it
+    s64 leader_time_us; // Wall clock of the leader when the packet was sent
+    s64 play_at_us;     // Wall clock of the leader at which the song is due (play packets only)
+} cluster_packet_t;
+
+typedef struct
+{
+    s64 play_at_timer_us; // esp_timer at which the song is started (0 = free)
+    u16 song_index;
+} cluster_pending_play_t;
+
+// ###########################################################################
+// # Private function declarations
+// ###########################################################################
+static void prv_clustersync_task(void* parameter);
+static bool prv_open_socket(void);
+static void prv_close_socket(void);
+static void prv_run_leader(void);
+static void prv_run_follower(void);
+static void prv_send_packet(cluster_packet_type_e type, u16 song_index, u32 sequence, s64 play_at_us);
+static void prv_handle_packet(const cluster_packet_t* packet, s64 received_at_us);
+static void prv_update_offset(s64 sample_us);
+static void prv_arm_play(s64 play_at_timer_us, u16 song_index);
+static void prv_rearm_play_timer(void);
+static void prv_play_timer_callback(void* arg);
+static void prv_notify_task(void);
+static void prv_publish_status(void);
+
+// ###########################################################################
+// # Private Variables
+// ###########################################################################
+static bool is_initialized = false;
+static TaskHandle_t clustersync_task_handle = NULL;
+static QueueHandle_t announce_queue = NULL;    // msg_cluster_announce_t - filled by the message handler
+static SemaphoreHandle_t cluster_mutex = NULL; // Protects the pending plays and the statistics
+static esp_timer_handle_t play_timer = NULL;   // Fires when the earliest pending play is due
+static Preferences preferences;
+
+static volatile cluster_role_e cluster_role = CLUSTER_ROLE_OFF;
+static volatile bool is_wifi_connected = false;
+static int cluster_socket = -1;
+static struct sockaddr_in group_address;
+
+// Leader: sequence number of the next packet
+static u32 next_sequence = 1;
+
+// Follower: leader wall clock minus the esp_timer, estimated over a window of packets
+static bool is_offset_valid = false;
+static s64 leader_offset_us = 0;
+static s64 window_max_us = 0;
+static u8 window_count = 0;
+static u32 last_play_sequence = 0;
+static s64 last_packet_at_us = 0; // esp_timer of the last valid packet (0 = never)
+
+static cluster_pending_play_t pending_plays[CLUSTER_MAX_PENDING];
+
+static u32 nof_sent = 0;
+static u32 nof_received = 0;
+static u32 nof_plays = 0;
+static u32 nof_late_plays = 0;
+
+// ###########################################################################
+// # Public function implementations
+// ###########################################################################
+
+void clustersync_init(void)
+{
+    ASSERT(!is_initialized);
+
+    announce_queue = xQueueCreate(CLUSTER_ANNOUNCE_QUEUE, sizeof(msg_cluster_announce_t));
+    cluster_mutex = xSemaphoreCreateMutex();
+    ASSERT(announce_queue != NULL);
+    ASSERT(cluster_mutex != NULL);
+
+    esp_timer_create_args_t play_timer_args = {};
+    play_timer_args.callback = prv_play_timer_callback;
+    play_timer_args.dispatch_method = ESP_TIMER_TASK;
+    play_timer_args.name = "ClusterPlayTimer";
+    esp_timer_create(&play_timer_args, &play_timer);
+    ASSERT(play_timer != NULL);
+
+    memset(pending_plays, 0, sizeof(pending_plays));
+
+    memset(&group_address, 0, sizeof(group_address));
+    group_address.sin_family = AF_INET;
+    group_address.sin_port = htons(CLUSTER_PORT);
+    group_address.sin_addr.s_addr = inet_addr(CLUSTER_MULTICAST_GROUP);
+
+    // Load the persisted role
+    preferences.begin(PREFERENCES_NAMESPACE, false);
+    u8 role = preferences.getUChar(PREF_KEY_ROLE, CLUSTER_ROLE_OFF);
+    cluster_role = (role <= CLUSTER_ROLE_FOLLOWER) ? (cluster_role_e)role : CLUSTER_ROLE_OFF;
+
+    // Subscribe to messages
+    messagebroker_subscribe(MSG_0203, clustersync_message_handler); // WiFi connection status
+    messagebroker_subscribe(MSG_0600, clustersync_message_handler); // Set cluster role
+    messagebroker_subscribe(MSG_0601, clustersync_message_handler); // Request cluster status
+    messagebroker_subscribe(MSG_0603, clustersync_message_handler); // Upcoming scheduled play
+
+    is_initialized = true;
+}
+
+void clustersync_start_task(void)
+{
+    ASSERT(is_initialized);
+
+    if (clustersync_task_handle == NULL)
+    {
+        xTaskCreate(prv_clustersync_task, "ClusterSyncTask", 4096, NULL, 2, &clustersync_task_handle);
+    }
+}
+
+// ###########################################################################
+// # Private function implementations
+// ###########################################################################
+
+void clustersync_message_handler(const msg_t* const message)
+{
+    ASSERT(message != NULL);
+
+    switch (message->msg_id)
+    {
+        case MSG_0203: // WiFi connection status
+        {
+            msg_wifi_connection_status_t* status = (msg_wifi_connection_status_t*)message->data_bytes;
+
+            bool is_connected = (status->status == WIFI_STATUS_CONNECTED);
+            if (is_connected != is_wifi_connected)
+            {
+                is_wifi_connected = is_connected;
+                prv_notify_task();
+            }
+            break;
+        }
+
+        case MSG_0600: // Set cluster role
+        {
+            msg_cluster_set_role_t* cmd = (msg_cluster_set_role_t*)message->data_bytes;
+
+            if ((cmd->role <= CLUSTER_ROLE_FOLLOWER) && (cmd->role != cluster_role))
+            {
+                cluster_role = cmd->role;
+                preferences.putUChar(PREF_KEY_ROLE, (u8)cluster_role);
+                prv_notify_task();
+            }
+            prv_publish_status();
+            break;
+        }
+
+        case MSG_0601: // Request cluster status
+        {
+            prv_publish_status();
+            break;
+        }
+
+        case MSG_0603: // Upcoming scheduled play
+        {
+            if (cluster_role == CLUSTER_ROLE_LEADER)
+            {
+                // Sent by the ClusterSync task - the scheduler is not blocked by the socket
+                if (xQueueSend(announce_queue, message->data_bytes, 0) != pdTRUE)
+                {
+                    LOG_WARNING(MODULE_CLUSTERSYNC, "Announce queue is full, play was not sent to the cluster");
+                }
+            }
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static void prv_clustersync_task(void* parameter)
+{
+    (void)parameter;
+
+    while (1)
+    {
+        if ((cluster_role == CLUSTER_ROLE_OFF) || !is_wifi_connected)
+        {
+            prv_close_socket();
+
+            // Sleep until the role or the connection changes
+            xTaskNotifyWait(0, UINT32_MAX, NULL, portMAX_DELAY);
+            continue;
+        }
+
+        if ((cluster_socket < 0) && !prv_open_socket())
+        {
+            xTaskNotifyWait(0, UINT32_MAX, NULL, pdMS_TO_TICKS(CLUSTER_RX_TIMEOUT_MS));
+            continue;
+        }
+
+        if (cluster_role == CLUSTER_ROLE_LEADER)
+        {
+            prv_run_leader();
+        }
+        else
+        {
+            prv_run_follower();
+        }
+    }
+}
+
+static bool prv_open_socket(void)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+    {
+        LOG_ERROR(MODULE_CLUSTERSYNC, "Failed to create the cluster socket");
+        return false;
+    }
+
+    struct sockaddr_in local_address;
+    memset(&local_address, 0, sizeof(local_address));
+    local_address.sin_family = AF_INET;
+    local_address.sin_port = htons(CLUSTER_PORT);
+    local_address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    struct ip_mreq membership;
+    membership.imr_multiaddr.s_addr = group_address.sin_addr.s_addr;
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+
+    u8 ttl = 1; // The cluster stays in the local network
+    u8 loopback = 0;
+    struct timeval rx_timeout;
+    rx_timeout.tv_sec = CLUSTER_RX_TIMEOUT_MS / 1000;
+    rx_timeout.tv_usec = (CLUSTER_RX_TIMEOUT_MS % 1000) * 1000;
+
+    if ((bind(sock, (struct sockaddr*)&local_address, sizeof(local_address)) < 0)
+        || (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+        || (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)
+        || (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loopback, sizeof(loopback)) < 0)
+        || (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &rx_timeout, sizeof(rx_timeout)) < 0))
+    {
+        LOG_ERROR(MODULE_CLUSTERSYNC, "Failed to join the cluster multicast group");
+        close(sock);
+        return false;
+    }
+
+    cluster_socket = sock;
+    LOG_INFO(MODULE_CLUSTERSYNC, "Joined the cluster as %s",
+             (cluster_role == CLUSTER_ROLE_LEADER) ? "leader" : "follower");
+    return true;
+}
+
+static void prv_close_socket(void)
+{
+    if (cluster_socket >= 0)
+    {
+        close(cluster_socket);
+        cluster_socket = -1;
+        LOG_INFO(MODULE_CLUSTERSYNC, "Left the cluster");
+    }
+}
+
+static void prv_run_leader(void)
+{
+    // Wait for the next play to announce - without one a beacon keeps the clocks of the followers aligned
+    msg_cluster_announce_t announce;
+    if (xQueueReceive(announce_queue, &announce, pdMS_TO_TICKS(CLUSTER_BEACON_MS)) != pdTRUE)
+    {
+        prv_send_packet(CLUSTER_PACKET_BEACON, 0, next_sequence++, 0);
+        return;
+    }
+
+    u32 sequence = next_sequence++;
+    for (u8 i = 0; i < CLUSTER_PLAY_REPEATS; i++)
+    {
+        if (i > 0)
+        {
+            vTaskDelay(pdMS_TO_TICKS(CLUSTER_REPEAT_GAP_MS));
+        }
+        prv_send_packet(CLUSTER_PACKET_PLAY, announce.song_index, sequence, announce.play_at_us);
+    }
+
+    xSemaphoreTake(cluster_mutex, portMAX_DELAY);
+    nof_plays++;
+    xSemaphoreGive(cluster_mutex);
+
+    LOG_DEBUG(MODULE_CLUSTERSYNC, "Announced song %d to the cluster", announce.song_index);
+}
+
+static void prv_run_follower(void)
+{
+    cluster_packet_t packet;
+    int len = recv(cluster_socket, &packet, sizeof(packet), 0);
+    s64 received_at_us = esp_timer_get_time();
+
+    // A timeout just lets the task re-check its role and the connection
+    if ((len == (int)sizeof(packet)) && (packet.magic == CLUSTER_MAGIC)
+        && (packet.version == CLUSTER_PROTOCOL_VERSION))
+    {
+        prv_handle_packet(&packet, received_at_us);
+    }
+}
+
+static void prv_send_packet(cluster_packet_type_e type, u16 song_index, u32 sequence, s64 play_at_us)
+{
+    // The leader's clock is the clock of the cluster - without a valid time there is nothing to send
+    timesync_snapshot_t time_snapshot;
+    if (!timesync_get_snapshot(&time_snapshot))
+    {
+        return;
+    }
+
+    cluster_packet_t packet;
+    packet.magic = CLUSTER_MAGIC;
+    packet.version = CLUSTER_PROTOCOL_VERSION;
+    packet.type = (u8)type;
+    packet.song_index = song_index;
+    packet.sequence = sequence;
+    packet.leader_time_us = (s64)time_snapshot.epoch * US_PER_SECOND + time_snapshot.microseconds;
+    packet.play_at_us = play_at_us;
+
+    int len = sendto(cluster_socket, &packet, sizeof(packet), 0, (struct sockaddr*)&group_address,
+                     sizeof(group_address));
+
+    xSemaphoreTake(cluster_mutex, portMAX_DELAY);
+    if (len == (int)sizeof(packet))
+    {
+        nof_sent++;
+    }
+    xSemaphoreGive(cluster_mutex);
+}
+
+static void prv_handle_packet(const cluster_packet_t* packet, s64 received_at_us)
+{
+    xSemaphoreTake(cluster_mutex, portMAX_DELAY);
+    prv_update_offset(packet->leader_time_us - received_at_us);
+    s64 offset_us = leader_offset_us;
+    nof_received++;
+    last_packet_at_us = received_at_us;
+    xSemaphoreGive(cluster_mutex);
+
+    if ((packet->type != CLUSTER_PACKET_PLAY) || (packet->sequence == last_play_sequence))
+    {
+        return; // A beacon or the repeat of a play that was already armed
+    }
+    last_play_sequence = packet->sequence;
+
+    // The time at which the leader plays, on the esp_timer of this node
+    s64 play_at_timer_us = packet->play_at_us - offset_us;
+    if ((received_at_us - play_at_timer_us) > CLUSTER_LATE_GRACE_US)
+    {
+        xSemaphoreTake(cluster_mutex, portMAX_DELAY);
+        nof_late_plays++;
+        xSemaphoreGive(cluster_mutex);
+
+        LOG_WARNING(MODULE_CLUSTERSYNC, "Announced play of song %d arrived too late", packet->song_index);
+        return;
+    }
+
+    // Cue the song right away, so that the start itself is a single short command
+    msg_mp3_prepare_song_t prepare_cmd;
+    prepare_cmd.song_index = packet->song_index;
+
+    msg_t msg;
+    msg.msg_id = MSG_0309;
+    msg.data_size = sizeof(msg_mp3_prepare_song_t);
+    msg.data_bytes = (u8*)&prepare_cmd;
+
+    // Losing the preparation only costs latency - the song is still played cold
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        LOG_DEBUG(MODULE_CLUSTERSYNC, "Message queue is full, song was not prepared");
+    }
+
+    prv_arm_play(play_at_timer_us, packet->song_index);
+}
+
+static void prv_update_offset(s64 sample_us)
+{
+    // Called with the cluster_mutex taken
+    // The leader's clock was at least this far ahead when the packet arrived - the fastest packet wins
+    if ((window_count == 0) || (sample_us > window_max_us))
+    {
+        window_max_us = sample_us;
+    }
+    window_count++;
+
+    // The first packet gives a rough estimate, a full window a refined one
+    if (!is_offset_valid || (window_count >= CLUSTER_OFFSET_WINDOW))
+    {
+        leader_offset_us = window_max_us;
+        is_offset_valid = true;
+    }
+
+    if (window_count >= CLUSTER_OFFSET_WINDOW)
+    {
+        window_count = 0;
+    }
+}
+
+static void prv_arm_play(s64 play_at_timer_us, u16 song_index)
+{
+    xSemaphoreTake(cluster_mutex, portMAX_DELAY);
+
+    // Without a free slot the latest pending play is replaced
+    u8 slot = 0;
+    for (u8 i = 0; i < CLUSTER_MAX_PENDING; i++)
+    {
+        if (pending_plays[i].play_at_timer_us == 0)
+        {
+            slot = i;
+            break;
+        }
+        if (pending_plays[i].play_at_timer_us > pending_plays[slot].play_at_timer_us)
+        {
+            slot = i;
+        }
+    }
+
+    pending_plays[slot].play_at_timer_us = play_at_timer_us;
+    pending_plays[slot].song_index = song_index;
+    prv_rearm_play_timer();
+
+    xSemaphoreGive(cluster_mutex);
+}
+
+static void prv_rearm_play_timer(void)
+{
+    // Called with the cluster_mutex taken
+    s64 earliest_us = 0;
+    for (u8 i = 0; i < CLUSTER_MAX_PENDING; i++)
+    {
+        s64 play_at_us = pending_plays[i].play_at_timer_us;
+        if ((play_at_us != 0) && ((earliest_us == 0) || (play_at_us < earliest_us)))
+        {
+            earliest_us = play_at_us;
+        }
+    }
+
+    esp_timer_stop(play_timer); // Not running is fine
+    if (earliest_us != 0)
+    {
+        s64 delay_us = earliest_us - esp_timer_get_time();
+        esp_timer_start_once(play_timer, (delay_us > 0) ? (u64)delay_us : 1U);
+    }
+}
+
+static void prv_play_timer_callback(void* arg)
+{
+    (void)arg;
+
+    // Runs in the esp_timer task - start every pending play that is due
+    s64 now_us = esp_timer_get_time();
+
+    xSemaphoreTake(cluster_mutex, portMAX_DELAY);
+    for (u8 i = 0; i < CLUSTER_MAX_PENDING; i++)
+    {
+        if ((pending_plays[i].play_at_timer_us == 0) || (pending_plays[i].play_at_timer_us > now_us))
+        {
+            continue;
+        }
+
+        msg_mp3_play_song_t play_cmd;
+        play_cmd.song_index = pending_plays[i].song_index;
+        play_cmd.requested_at_us = now_us;
+
+        msg_t msg;
+        msg.msg_id = MSG_0302;
+        msg.data_size = sizeof(msg_mp3_play_song_t);
+        msg.data_bytes = (u8*)&play_cmd;
+
+        // Deferred, so that the timer task is not blocked by the UART exchange with the player
+        if (messagebroker_publish_deferred(&msg))
+        {
+            nof_plays++;
+        }
+        else
+        {
+            LOG_WARNING(MODULE_CLUSTERSYNC, "Message queue is full, announced song was dropped");
+        }
+
+        pending_plays[i].play_at_timer_us = 0;
+    }
+    prv_rearm_play_timer();
+    xSemaphoreGive(cluster_mutex);
+}
+
+static void prv_notify_task(void)
+{
+    if (clustersync_task_handle != NULL)
+    {
+        xTaskNotify(clustersync_task_handle, CLUSTER_EVENT_BIT_CHANGED, eSetBits);
+    }
+}
+
+static void prv_publish_status(void)
+{
+    msg_cluster_status_t status;
+    s64 now_us = esp_timer_get_time();
+
+    xSemaphoreTake(cluster_mutex, portMAX_DELAY);
+    status.role = cluster_role;
+    status.is_joined = (cluster_socket >= 0);
+    status.is_offset_valid = is_offset_valid && (cluster_role == CLUSTER_ROLE_FOLLOWER);
+    status.nof_sent = nof_sent;
+    status.nof_received = nof_received;
+    status.nof_plays = nof_plays;
+    status.nof_late_plays = nof_late_plays;
+    status.last_packet_age_ms
+        = (last_packet_at_us != 0) ? (u32)((now_us - last_packet_at_us) / 1000) : UINT32_MAX;
+    s64 offset_us = leader_offset_us;
+    xSemaphoreGive(cluster_mutex);
+
+    // How far the own wall clock (NTP or RTC) is off the leader's - 0 if either is unknown
+    status.leader_clock_diff_us = 0;
+    timesync_snapshot_t time_snapshot;
+    if (status.is_offset_valid && timesync_get_snapshot(&time_snapshot))
+    {
+        s64 local_wall_us = (s64)time_snapshot.epoch * US_PER_SECOND + time_snapshot.microseconds;
+        s64 diff_us = (esp_timer_get_time() + offset_us) - local_wall_us;
+        status.leader_clock_diff_us
+            = (diff_us > INT32_MAX) ? INT32_MAX : ((diff_us < INT32_MIN) ? INT32_MIN : (s32)diff_us);
+    }
+
+    msg_t msg;
+    msg.msg_id = MSG_0602;
+    msg.data_size = sizeof(msg_cluster_status_t);
+    msg.data_bytes = (u8*)&status;
+    messagebroker_publish(&msg);
+}
@@ -0,0 +1,52 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef CLUSTERSYNC_H
+#define CLUSTERSYNC_H
+
+#include "custom_types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+    /**
+     * @brief Initialize the ClusterSync module and load the persisted cluster role
+     */
+    void clustersync_init(void);
+
+    /**
+     * @brief Start the ClusterSync task
+     *
+     * A leader sends its upcoming scheduled plays (MSG_0603) and periodic beacons to the multicast
+     * group, a follower receives them and starts the same songs at the same point in time.
+     */
+    void clustersync_start_task(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // CLUSTERSYNC_H
@@ -31,40 +31,115 @@
  */
 
 #include "Console.h"
+#include "ApplicationControl.h"
 #include "Cli.h"
 #include "MessageBroker.h"
 #include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "PowerManager.h"
+#include "boot_timing.h"
 #include "custom_assert.h"
 #include "custom_types.h"
 
 // Include Arduino Serial for I/O
 #include <Arduino.h>
+#include <IPAddress.h>
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// ###########################################################################
+// # Private defines
+// ###########################################################################
+#define CONSOLE_BAUD_RATE      115200
+#define CONSOLE_RX_BUFFER_SIZE 1024 // Holds a pasted batch of commands while the CLI executes the previous one
+#define CONSOLE_RX_CHUNK_SIZE  64   // Bytes taken out of the driver buffer per read
+
+// Binary mode (see "Binary Protocol" below)
+#define CONSOLE_FRAME_SOF              0xA5
+#define CONSOLE_FRAME_PROTOCOL_VERSION 1
+#define CONSOLE_FRAME_CRC_SIZE         4
+#define CONSOLE_FRAME_MAX_RX_PAYLOAD   sizeof(msg_payload_t) // Every request fits into a payload block
+#define CONSOLE_FRAME_MAX_TX_PAYLOAD   1024                  // Largest response (MSG_0007) plus headroom
+#define CONSOLE_FRAME_RX_TIMEOUT_MS    100 // A frame that stalls this long is dropped - the parser resyncs
+
+// ###########################################################################
+// # Type Definitions
+// ###########################################################################
+
+typedef struct __attribute__((packed))
+{
+    u8 sof;      // CONSOLE_FRAME_SOF
+    u8 sequence; // Chosen by the host (1-255), echoed in the status frame and in synchronous responses
+    u16 msg_id;  // msg_id_e - 0 = control / status frame
+    u16 length;  // Payload bytes
+} console_frame_header_t;
+
+typedef struct __attribute__((packed))
+{
+    u8 status;  // console_frame_status_e
+    u8 version; // CONSOLE_FRAME_PROTOCOL_VERSION
+} console_frame_status_t;
+
+typedef enum
+{
+    CONSOLE_FRAME_STATUS_OK = 0,        // Published - all synchronous responses were sent before
+    CONSOLE_FRAME_STATUS_CRC_ERROR,     // The frame was corrupted
+    CONSOLE_FRAME_STATUS_UNKNOWN_TOPIC, // The topic cannot be published from the console
+    CONSOLE_FRAME_STATUS_BAD_LENGTH,    // The payload size does not match the struct of the topic
+    CONSOLE_FRAME_STATUS_TOO_LONG       // A frame exceeds the buffers
+} console_frame_status_e;
+
+typedef enum
+{
+    CONSOLE_CONTROL_PING = 0, // Answered with a status frame
+    CONSOLE_CONTROL_EXIT = 1  // Back to the text CLI
+} console_control_e;
+
+typedef struct
+{
+    msg_id_e msg_id;
+    u16 data_size; // sizeof the payload struct as compiled here (empty request structs are 1 byte)
+} console_binary_topic_t;
 
 // ###########################################################################
 // # Private function declarations
 // ###########################################################################
 static int prv_console_put_char(char in_char);
-static char prv_console_get_char(void);
+static int prv_console_write_buffer(const char* buffer, size_t length);
+#if ARDUINO_USB_CDC_ON_BOOT
+static void prv_console_rx_event_callback(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
+#else
+static void prv_console_rx_callback(void);
+#endif
 
 // System Commands
 static int prv_cmd_system_info(int argc, char* argv[], void* context);
 static int prv_cmd_reset_system(int argc, char* argv[], void* context);
+static int prv_cmd_boot_times(int argc, char* argv[], void* context);
+static int prv_cmd_crash_report(int argc, char* argv[], void* context);
 
 // Message Broker Test commands
-static void prv_msg_broker_callback(const msg_t* const message);
 static int prv_cmd_msgbroker_can_subscribe_and_publish(int argc, char* argv[], void* context);
+static int prv_cmd_msgbroker_stats(int argc, char* argv[], void* context);
+static int prv_cmd_sysprof(int argc, char* argv[], void* context);
+static const char* prv_get_task_state_name(u8 state);
+static const char* prv_get_handler_name(msg_callback_t callback);
 
 // Time Sync Commands
 static void prv_time_callback(const msg_t* const message);
 static int prv_cmd_time_get(int argc, char* argv[], void* context);
 
 // WiFi Commands
-static void prv_wifi_callback(const msg_t* const message);
 static int prv_cmd_wifi_set(int argc, char* argv[], void* context);
 static int prv_cmd_wifi_get(int argc, char* argv[], void* context);
+static int prv_cmd_wifi_ip(int argc, char* argv[], void* context);
 
 // MP3 Player Commands
-static void prv_mp3_callback(const msg_t* const message);
 static int prv_cmd_mp3_volume(int argc, char* argv[], void* context);
 static int prv_cmd_mp3_mode(int argc, char* argv[], void* context);
 static int prv_cmd_mp3_play(int argc, char* argv[], void* context);
@@ -73,23 +148,108 @@ static int prv_cmd_mp3_volume_down(int argc, char* argv[], void* context);
 static int prv_cmd_mp3_next(int argc, char* argv[], void* context);
 static int prv_cmd_mp3_previous(int argc, char* argv[], void* context);
 static int prv_cmd_mp3_pause(int argc, char* argv[], void* context);
+static int prv_cmd_sequence_set(int argc, char* argv[], void* context);
+static int prv_cmd_sequence_clear(int argc, char* argv[], void* context);
+static int prv_cmd_sequence_list(int argc, char* argv[], void* context);
+static void prv_publish_sequence(u8 sequence_id, const mp3_sequence_t* sequence);
+static int prv_parse_song(const char* text);
+static void prv_format_song(u16 song_index, char* buffer, size_t size);
 
 // Application Control Commands
-static void prv_schedule_callback(const msg_t* const message);
 static int prv_cmd_schedule_add(int argc, char* argv[], void* context);
 static int prv_cmd_schedule_remove(int argc, char* argv[], void* context);
 static int prv_cmd_schedule_list(int argc, char* argv[], void* context);
+static void prv_request_schedule_page(u16 start_index);
 static int prv_cmd_schedule_clear(int argc, char* argv[], void* context);
 static int prv_cmd_schedule_enable(int argc, char* argv[], void* context);
+static int prv_cmd_schedule_timing(int argc, char* argv[], void* context);
+static int prv_cmd_holiday_add(int argc, char* argv[], void* context);
+static int prv_cmd_holiday_remove(int argc, char* argv[], void* context);
+static int prv_cmd_holiday_list(int argc, char* argv[], void* context);
+static int prv_cmd_schedule_import_token(int argc, char* argv[], void* context);
+static bool prv_parse_date(const char* text, u32* date);
+
+// Power Management Commands
+static int prv_cmd_power_mode(int argc, char* argv[], void* context);
+static int prv_cmd_power_status(int argc, char* argv[], void* context);
+
+// Cluster Commands
+static int prv_cmd_cluster_mode(int argc, char* argv[], void* context);
+static int prv_cmd_cluster_status(int argc, char* argv[], void* context);
+static const char* prv_get_cluster_role_name(cluster_role_e role);
+
+// MQTT Bridge Commands
+static int prv_cmd_mqtt_set(int argc, char* argv[], void* context);
+static int prv_cmd_mqtt_off(int argc, char* argv[], void* context);
+static int prv_cmd_mqtt_status(int argc, char* argv[], void* context);
+static void prv_publish_mqtt_config(const char* uri, const char* base_topic, u16 telemetry_period_s);
 
 // Logging Commands
 static int prv_cmd_log(int argc, char* argv[], void* context);
 
+// Binary Protocol
+static int prv_cmd_binary_mode(int argc, char* argv[], void* context);
+static void prv_binary_receive(u8 byte);
+static void prv_binary_dispatch(u8 sequence, u16 msg_id, const u8* payload, u16 length);
+static bool prv_binary_forward(const msg_t* const message);
+static void prv_binary_send_status(u8 sequence, u8 status);
+static void prv_binary_send_frame(u8 sequence, u16 msg_id, const u8* payload, u16 length);
+
 // ###########################################################################
 // # Private Variables
 // ###########################################################################
 
 static bool is_initialized = false;
+static SemaphoreHandle_t rx_event = NULL; // Given by the serial driver when bytes were received
+
+// Binary mode - the receive side is only touched by the console task
+static volatile bool is_binary_mode = false;
+static SemaphoreHandle_t binary_tx_mutex = NULL; // Serializes the frames of the console and of other tasks
+static u8 binary_rx_frame[sizeof(console_frame_header_t) + CONSOLE_FRAME_MAX_RX_PAYLOAD + CONSOLE_FRAME_CRC_SIZE];
+static u16 binary_rx_length = 0;
+static u32 binary_rx_last_byte_ms = 0;
+static msg_payload_t binary_request_payload;       // Aligned copy of the received payload
+static u8 binary_tx_frame[sizeof(console_frame_header_t) + CONSOLE_FRAME_MAX_TX_PAYLOAD + CONSOLE_FRAME_CRC_SIZE];
+static volatile u8 binary_request_sequence = 0;    // Sequence of the request that is being published
+static TaskHandle_t binary_request_task = NULL;    // Task that publishes it - its responses are synchronous
+
+// Topics the host may publish, with the size of their payload
+static const console_binary_topic_t binary_topics[] = {
+    {MSG_0003, sizeof(msg_set_logging_t)},
+    {MSG_0004, sizeof(msg_system_get_status_t)},
+    {MSG_0006, sizeof(msg_system_get_profile_t)},
+    {MSG_0008, sizeof(msg_system_set_sampling_t)},
+    {MSG_0009, sizeof(msg_system_get_crash_record_t)},
+    {MSG_0200, sizeof(msg_wifi_set_credentials_t)},
+    {MSG_0201, sizeof(msg_wifi_get_credentials_t)},
+    {MSG_0204, sizeof(msg_wifi_set_ip_config_t)},
+    {MSG_0300, sizeof(msg_mp3_set_volume_t)},
+    {MSG_0301, sizeof(msg_mp3_set_playmode_t)},
+    {MSG_0302, sizeof(msg_mp3_play_song_t)},
+    {MSG_0303, 0},
+    {MSG_0304, 0},
+    {MSG_0305, 0},
+    {MSG_0306, 0},
+    {MSG_0307, 0},
+    {MSG_0310, sizeof(msg_mp3_set_sequence_t)},
+    {MSG_0311, sizeof(msg_mp3_get_sequences_t)},
+    {MSG_0400, sizeof(msg_schedule_add_t)},
+    {MSG_0401, sizeof(msg_schedule_remove_t)},
+    {MSG_0402, sizeof(msg_schedule_list_request_t)},
+    {MSG_0403, 0},
+    {MSG_0404, sizeof(msg_schedule_enable_t)},
+    {MSG_0407, 0},
+    {MSG_0411, sizeof(msg_schedule_add_exception_t)},
+    {MSG_0412, sizeof(msg_schedule_remove_exception_t)},
+    {MSG_0413, 0},
+    {MSG_0415, sizeof(msg_schedule_set_import_token_t)},
+    {MSG_0500, sizeof(msg_power_set_mode_t)},
+    {MSG_0502, sizeof(msg_power_get_stats_t)},
+    {MSG_0600, sizeof(msg_cluster_set_role_t)},
+    {MSG_0601, sizeof(msg_cluster_get_status_t)},
+    {MSG_0700, sizeof(msg_mqtt_set_config_t)},
+    {MSG_0701, sizeof(msg_mqtt_get_status_t)},
+};
 
 // embedded cli object - contains all data. This memory is to be managed by the user
 static cli_cfg_t g_cli_cfg = {0};
@@ -102,17 +262,24 @@ static cli_cfg_t g_cli_cfg = {0};
  * - The 'pointer to context' is the context which the user can provide to his handler function - this can also be NULL
  * - The 'help string' is the string that is printed when the help command is executed. (Have a look at the Readme.md file for an example)
  */
-static cli_binding_t cli_bindings[] = {
+static const cli_binding_t cli_bindings[] = {
     // System Commands
     {"system_info", prv_cmd_system_info, NULL, "Show system information"},
     {"restart", prv_cmd_reset_system, NULL, "Restart the system"},
+    {"boot_times", prv_cmd_boot_times, NULL, "Show when each boot stage was reached"},
+    {"crash_report", prv_cmd_crash_report, NULL,
+     "Show the assertion that failed before the last reset: crash_report [clear]"},
 
     // Message Broker Test Commands
     {"msgbroker_test", prv_cmd_msgbroker_can_subscribe_and_publish, NULL, "Test Message Broker subscribe and publish"},
+    {"msgbroker_stats", prv_cmd_msgbroker_stats, NULL,
+     "Show publish counts and handler latencies: msgbroker_stats [reset]"},
+    {"sysprof", prv_cmd_sysprof, NULL, "Show task stacks, CPU shares and heap: sysprof [sample <seconds|off>]"},
 
     // WiFi Commands
     {"wifi_set", prv_cmd_wifi_set, NULL, "Set WiFi credentials: wifi_set <ssid> <password> (use quotes for spaces)"},
     {"wifi_get", prv_cmd_wifi_get, NULL, "Get current WiFi credentials"},
+    {"wifi_ip", prv_cmd_wifi_ip, NULL, "Set IP configuration: wifi_ip <dhcp | <ip> <gateway> <subnet> [dns]>"},
 
     // MP3 Player Commands
     {"speaker_volume", prv_cmd_mp3_volume, NULL, "Set volume: speaker_volume <0-31>"},
@@ -124,16 +291,41 @@ static cli_binding_t cli_bindings[] = {
     {"speaker_next", prv_cmd_mp3_next, NULL, "Next song"},
     {"speaker_previous", prv_cmd_mp3_previous, NULL, "Previous song"},
     {"speaker_pause", prv_cmd_mp3_pause, NULL, "Pause or play"},
+    {"sequence_set", prv_cmd_sequence_set, NULL, "Define a sequence: sequence_set <0-7> <song[:volume[:gap_ms]]> ..."},
+    {"sequence_clear", prv_cmd_sequence_clear, NULL, "Delete a sequence: sequence_clear <0-7>"},
+    {"sequence_list", prv_cmd_sequence_list, NULL, "List the playback sequences"},
 
     // Application Control Commands
-    {"schedule_add", prv_cmd_schedule_add, NULL, "Add schedule: schedule_add <HHMM> <weekdays> <song_index>"},
+    {"schedule_add", prv_cmd_schedule_add, NULL, "Add schedule: schedule_add <HHMM[SS]> <weekdays> <song_index>"},
     {"schedule_remove", prv_cmd_schedule_remove, NULL, "Remove schedule: schedule_remove <id>"},
     {"schedule_list", prv_cmd_schedule_list, NULL, "List all schedules"},
     {"schedule_clear", prv_cmd_schedule_clear, NULL, "Clear all schedules"},
     {"schedule_enable", prv_cmd_schedule_enable, NULL, "Enable/disable scheduling: schedule_enable <0|1>"},
+    {"schedule_timing", prv_cmd_schedule_timing, NULL, "Show how late the most recent schedules were triggered"},
+    {"holiday_add", prv_cmd_holiday_add, NULL, "Add days without schedules: holiday_add <YYYY-MM-DD> [YYYY-MM-DD]"},
+    {"holiday_remove", prv_cmd_holiday_remove, NULL, "Remove days without schedules: holiday_remove <id|all>"},
+    {"holiday_list", prv_cmd_holiday_list, NULL, "List the days without schedules"},
+    {"schedule_import_token", prv_cmd_schedule_import_token, NULL,
+     "Allow the TCP import with a token: schedule_import_token <token|off>"},
+
+    // Power Management Commands
+    {"power_mode", prv_cmd_power_mode, NULL, "Enable/disable light sleep between schedules: power_mode <on|off>"},
+    {"power_status", prv_cmd_power_status, NULL, "Show the time spent in each power state"},
+
+    // Cluster Commands
+    {"cluster_mode", prv_cmd_cluster_mode, NULL, "Set the role in the cluster: cluster_mode <off|leader|follower>"},
+    {"cluster_status", prv_cmd_cluster_status, NULL, "Show the cluster role and the clock of the leader"},
+
+    // MQTT Bridge Commands
+    {"mqtt_set", prv_cmd_mqtt_set, NULL, "Connect to an MQTT broker: mqtt_set <uri> <base_topic> [period_s]"},
+    {"mqtt_off", prv_cmd_mqtt_off, NULL, "Disconnect from the MQTT broker and forget it"},
+    {"mqtt_status", prv_cmd_mqtt_status, NULL, "Show the MQTT connection and the queued events and samples"},
 
     // Logging Commands
-    {"log", prv_cmd_log, NULL, "Enable/disable logging: log <on|off> <module_name>"},
+    {"log", prv_cmd_log, NULL, "Enable/disable debug logging: log <on|off> <module_name>"},
+
+    // Binary Protocol
+    {"binary_mode", prv_cmd_binary_mode, NULL, "Switch to framed binary commands (a control frame switches back)"},
 
 };
 
@@ -145,17 +337,40 @@ void console_init(void)
 {
     ASSERT(!is_initialized);
 
-    // Initialize Serial communication
-    Serial.begin(115200);
+    rx_event = xSemaphoreCreateBinary();
+    ASSERT(rx_event != NULL);
+    binary_tx_mutex = xSemaphoreCreateMutex();
+    ASSERT(binary_tx_mutex != NULL);
+
+    // Initialize Serial communication - the driver signals received bytes, nothing is polled
+    Serial.setRxBufferSize(CONSOLE_RX_BUFFER_SIZE);
+#if ARDUINO_USB_CDC_ON_BOOT
+    Serial.onEvent(ARDUINO_HW_CDC_RX_EVENT, prv_console_rx_event_callback);
+    Serial.begin(CONSOLE_BAUD_RATE);
+#else
+    Serial.begin(CONSOLE_BAUD_RATE);
+    Serial.onReceive(prv_console_rx_callback);
+#endif
 
     // Subscribe to message broker responses
-    messagebroker_subscribe(MSG_0202, prv_wifi_callback);
-    messagebroker_subscribe(MSG_0203, prv_wifi_callback);
-    messagebroker_subscribe(MSG_0308, prv_mp3_callback);      // MP3 command responses
-    messagebroker_subscribe(MSG_0405, prv_schedule_callback); // Schedule responses
-    messagebroker_subscribe(MSG_0406, prv_schedule_callback); // Schedule list
+    messagebroker_subscribe(MSG_0202, console_wifi_message_handler);
+    messagebroker_subscribe(MSG_0203, console_wifi_message_handler);
+    messagebroker_subscribe(MSG_0308, console_mp3_message_handler);        // MP3 command responses
+    messagebroker_subscribe(MSG_0312, console_mp3_message_handler);        // Playback sequences
+    messagebroker_subscribe(MSG_0405, console_schedule_message_handler);   // Schedule responses
+    messagebroker_subscribe(MSG_0406, console_schedule_message_handler);   // Schedule list
+    messagebroker_subscribe(MSG_0408, console_schedule_message_handler);   // Schedule trigger timing
+    messagebroker_subscribe(MSG_0414, console_schedule_message_handler);   // Schedule exception list
+    messagebroker_subscribe(MSG_0503, console_power_message_handler);      // Power statistics
+    messagebroker_subscribe(MSG_0602, console_cluster_message_handler);    // Cluster status
+    messagebroker_subscribe(MSG_0702, console_mqtt_message_handler);       // MQTT bridge status
+    messagebroker_subscribe(MSG_0001, console_msgbroker_test_handler); // Message broker test
+    messagebroker_subscribe(MSG_0005, console_system_message_handler); // System status
+    messagebroker_subscribe(MSG_0007, console_system_message_handler); // System profile
+    messagebroker_subscribe(MSG_0010, console_system_message_handler); // Crash record
 
     cli_init(&g_cli_cfg, prv_console_put_char);
+    cli_set_write_buffer_fn(prv_console_write_buffer);
 
     // Register all commands
     for (size_t i = 0; i < CLI_GET_ARRAY_SIZE(cli_bindings); i++)
@@ -170,14 +385,36 @@ void console_run(void)
 {
     ASSERT(is_initialized);
 
-    // Check if there are characters available from Serial
-    if (Serial.available() > 0)
+    // Sleep until the serial driver received something
+    xSemaphoreTake(rx_event, portMAX_DELAY);
+
+    // Drain everything that arrived - a pasted batch of commands is handled in one pass
+    int nof_available = 0;
+    while ((nof_available = Serial.available()) > 0)
     {
-        // Get a character entered by the user
-        char c = prv_console_get_char();
+        // Keep the chip awake while the user is typing
+        powermanager_notify_activity();
+
+        u8 rx_chunk[CONSOLE_RX_CHUNK_SIZE];
+        size_t nof_bytes = (nof_available < CONSOLE_RX_CHUNK_SIZE) ? (size_t)nof_available : CONSOLE_RX_CHUNK_SIZE;
+        nof_bytes = Serial.read(rx_chunk, nof_bytes);
+
+        for (size_t i = 0; i < nof_bytes; i++)
+        {
+            // A command may switch the mode in the middle of a chunk
+            if (is_binary_mode)
+            {
+                prv_binary_receive(rx_chunk[i]);
+            }
+            else
+            {
+                cli_receive((char)rx_chunk[i]);
+                cli_process();
+            }
+        }
 
-        // Add the character to a queue and process it
-        cli_receive_and_process(c);
+        // Echo of the whole chunk in one write
+        cli_flush();
     }
 }
 
@@ -195,14 +432,29 @@ static int prv_console_put_char(char in_char)
     return 1; // Success
 }
 
-static char prv_console_get_char(void)
+static int prv_console_write_buffer(const char* buffer, size_t length)
 {
-    if (Serial.available() > 0)
-    {
-        return (char)Serial.read();
-    }
-    return 0; // No character available
+    return (int)Serial.write((const uint8_t*)buffer, length);
+}
+
+#if ARDUINO_USB_CDC_ON_BOOT
+static void prv_console_rx_event_callback(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
+{
+    (void)arg;
+    (void)event_base;
+    (void)event_id;
+    (void)event_data;
+
+    // Runs in the event loop task of the USB Serial/JTAG driver
+    xSemaphoreGive(rx_event);
+}
+#else
+static void prv_console_rx_callback(void)
+{
+    // Runs in the UART event task - on a FIFO threshold or when the line went idle
+    xSemaphoreGive(rx_event);
 }
+#endif
 
 // ============================
 // = Commands
@@ -220,12 +472,84 @@ static int prv_cmd_system_info(int argc, char* argv[], void* context)
     return CLI_OK_STATUS;
 }
 
+static int prv_cmd_boot_times(int argc, char* argv[], void* context)
+{
+    (void)argc;
+    (void)argv;
+    (void)context;
+
+    cli_print("Boot stages (ms since the application started):");
+    for (u8 stage = 0; stage < BOOT_STAGE_COUNT; stage++)
+    {
+        s64 at_us = 0;
+        if (boot_timing_get((boot_stage_e)stage, &at_us))
+        {
+            cli_print("  %-20s %8lu", boot_timing_get_stage_name((boot_stage_e)stage), (unsigned long)(at_us / 1000));
+        }
+        else
+        {
+            cli_print("  %-20s %8s", boot_timing_get_stage_name((boot_stage_e)stage), "-");
+        }
+    }
+
+    // A schedule can be played once it is armed and the player answers
+    s64 armed_us = 0;
+    s64 mp3_ready_us = 0;
+    if (boot_timing_get(BOOT_STAGE_SCHEDULES_ARMED, &armed_us) && boot_timing_get(BOOT_STAGE_MP3_READY, &mp3_ready_us))
+    {
+        cli_print("Ready to play schedules after %lu ms",
+                  (unsigned long)(((armed_us > mp3_ready_us) ? armed_us : mp3_ready_us) / 1000));
+    }
+    else
+    {
+        cli_print("Not ready to play schedules yet (no valid time or no answer from the MP3 player)");
+    }
+
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_crash_report(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    msg_system_get_crash_record_t request;
+    request.clear = false;
+
+    if ((argc == 2) && (strcmp(argv[1], "clear") == 0))
+    {
+        request.clear = true;
+    }
+    else if (argc != 1)
+    {
+        cli_print("Usage: crash_report [clear]");
+        return CLI_FAIL_STATUS;
+    }
+
+    // Answered synchronously by the CrashRecord (MSG_0009 -> MSG_0010)
+    msg_t msg;
+    msg.msg_id = MSG_0009;
+    msg.data_size = sizeof(msg_system_get_crash_record_t);
+    msg.data_bytes = (u8*)&request;
+
+    messagebroker_publish(&msg);
+
+    if (request.clear)
+    {
+        cli_print("Crash record cleared");
+    }
+
+    return CLI_OK_STATUS;
+}
+
 static int prv_cmd_reset_system(int argc, char* argv[], void* context)
 {
     (void)argc;
     (void)argv;
     (void)context;
 
+    // Pending schedule changes would be lost otherwise
+    appcontrol_flush_schedules();
+
     cli_print("Restarting system in ");
     for (int i = 3; i > 0; i--)
     {
@@ -238,7 +562,7 @@ static int prv_cmd_reset_system(int argc, char* argv[], void* context)
     return CLI_OK_STATUS;
 }
 
-static void prv_msg_broker_callback(const msg_t* const message)
+void console_msgbroker_test_handler(const msg_t* const message)
 {
     switch (message->msg_id)
     {
@@ -258,15 +582,8 @@ static int prv_cmd_msgbroker_can_subscribe_and_publish(int argc, char* argv[], v
     (void)argv;
     (void)context;
 
-    static bool run_once = true;
-
-    if (run_once)
-    {
-        // Subscribe to a test message
-        cli_print("Subscribed to MSG_0001 \n... \nNow publishing a test message. \n...");
-        messagebroker_subscribe(MSG_0001, prv_msg_broker_callback);
-        run_once = false;
-    }
+    // The console subscribed to MSG_0001 during init - the subscriber table is sealed by now
+    cli_print("Publishing a test message on MSG_0001 \n...");
 
     // Publish a test message
     msg_t test_msg;
@@ -280,12 +597,301 @@ static int prv_cmd_msgbroker_can_subscribe_and_publish(int argc, char* argv[], v
     return CLI_OK_STATUS;
 }
 
+void console_system_message_handler(const msg_t* const message)
+{
+    if (prv_binary_forward(message))
+    {
+        return;
+    }
+
+    switch (message->msg_id)
+    {
+        case MSG_0005:
+        {
+            msg_system_status_t* status = (msg_system_status_t*)message->data_bytes;
+
+            cli_print("Message broker:");
+            cli_print("  Publishes: %lu", (unsigned long)status->nof_publishes);
+            cli_print("  Deferred dropped: %lu", (unsigned long)status->nof_deferred_dropped);
+            cli_print("  Queue high-water mark: %u", status->queue_max_depth);
+            cli_print("  Free payload blocks low-water mark: %u", status->pool_min_free_blocks);
+            if (status->is_instrumented)
+            {
+                cli_print("  Slowest handler call: %lu us (topic %u)", (unsigned long)status->slowest_handler_us,
+                          status->slowest_topic);
+            }
+            break;
+        }
+
+        case MSG_0007:
+        {
+            msg_system_profile_t* profile = (msg_system_profile_t*)message->data_bytes;
+
+            cli_print("Heap: %lu bytes free, %lu min free, %lu largest block",
+                      (unsigned long)profile->current.heap_free, (unsigned long)profile->current.heap_min_free,
+                      (unsigned long)profile->current.heap_largest_block);
+
+            if (profile->is_cpu_valid)
+            {
+                cli_print("Tasks (CPU over the last %lu ms, load %u.%u%%):", (unsigned long)profile->cpu_interval_ms,
+                          profile->current.cpu_load_permille / 10, profile->current.cpu_load_permille % 10);
+            }
+            else
+            {
+                cli_print("Tasks (CPU shares not available):");
+            }
+            cli_print("  %-16s %4s %-9s %10s %6s", "Name", "Prio", "State", "Stack free", "CPU");
+            for (u8 i = 0; i < profile->nof_tasks; i++)
+            {
+                const system_task_info_t* task = &profile->tasks[i];
+                cli_print("  %-16s %4u %-9s %10lu %4u.%u%%", task->name, task->priority,
+                          prv_get_task_state_name(task->state), (unsigned long)task->stack_free_min,
+                          task->cpu_permille / 10, task->cpu_permille % 10);
+            }
+            if (profile->nof_tasks_total > profile->nof_tasks)
+            {
+                cli_print("  ... %u more tasks", profile->nof_tasks_total - profile->nof_tasks);
+            }
+
+            if (profile->sampling_period_s == 0)
+            {
+                break;
+            }
+
+            cli_print("History (every %lu s):", (unsigned long)profile->sampling_period_s);
+            cli_print("  %10s %10s %10s %10s %6s", "Uptime s", "Free", "Min free", "Largest", "CPU");
+            for (u8 i = 0; i < profile->nof_history; i++)
+            {
+                const system_profile_sample_t* sample = &profile->history[i];
+                cli_print("  %10lu %10lu %10lu %10lu %4u.%u%%", (unsigned long)sample->uptime_s,
+                          (unsigned long)sample->heap_free, (unsigned long)sample->heap_min_free,
+                          (unsigned long)sample->heap_largest_block, sample->cpu_load_permille / 10,
+                          sample->cpu_load_permille % 10);
+            }
+            break;
+        }
+
+        case MSG_0010:
+        {
+            msg_system_crash_record_t* record = (msg_system_crash_record_t*)message->data_bytes;
+
+            if (!record->is_valid)
+            {
+                cli_print("No failed assertion recorded (%lu boots)", (unsigned long)record->nof_boots);
+                break;
+            }
+
+            cli_print("%lu assertion resets in %lu boots, the latest:", (unsigned long)record->nof_assert_resets,
+                      (unsigned long)record->nof_boots);
+            cli_print("  %s:%lu - %s", record->file, (unsigned long)record->line, record->expr);
+            cli_print("  Task %s, %lu ms after boot", record->task_name, (unsigned long)record->uptime_ms);
+            if (record->timestamp != 0)
+            {
+                struct tm timeinfo;
+                localtime_r(&record->timestamp, &timeinfo);
+                cli_print("  At %04d-%02d-%02d %02d:%02d:%02d", timeinfo.tm_year + 1900, timeinfo.tm_mon + 1,
+                          timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
+            }
+
+            // The topic of a publish without a subscriber is the last one
+            char line[8 * SYSTEM_CRASH_TRACE_LENGTH];
+            line[0] = '\0';
+            int length = 0;
+            for (u8 i = 0; i < record->nof_trace; i++)
+            {
+                length += snprintf(&line[length], sizeof(line) - length, " %u", record->trace[i]);
+            }
+            cli_print("  Last published topics, oldest first:%s", line);
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static int prv_cmd_msgbroker_stats(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    if ((argc == 2) && (strcmp(argv[1], "reset") == 0))
+    {
+        messagebroker_reset_stats();
+        cli_print("Message broker statistics reset");
+        return CLI_OK_STATUS;
+    }
+    if (argc != 1)
+    {
+        cli_print("Usage: msgbroker_stats [reset]");
+        return CLI_FAIL_STATUS;
+    }
+
+    // The summary is answered synchronously by the broker (MSG_0004 -> MSG_0005)
+    msg_system_get_status_t request;
+
+    msg_t msg;
+    msg.msg_id = MSG_0004;
+    msg.data_size = sizeof(msg_system_get_status_t);
+    msg.data_bytes = (u8*)&request;
+
+    messagebroker_publish(&msg);
+
+    cli_print("Publishes per topic:");
+    for (u16 topic = (E_TOPIC_FIRST_TOPIC + 1); topic < E_TOPIC_LAST_TOPIC; topic++)
+    {
+        u32 count = messagebroker_get_publish_count((msg_id_e)topic);
+        if (count > 0)
+        {
+            cli_print("  topic %2u: %lu", topic, (unsigned long)count);
+        }
+    }
+
+    msg_handler_stats_t stats;
+    if (!messagebroker_get_handler_stats(0, &stats))
+    {
+        cli_print("Handler timing not available - build with MESSAGEBROKER_INSTRUMENTATION");
+        return CLI_OK_STATUS;
+    }
+
+    cli_print("Handlers (calls, avg / max us, histogram <16 <64 <256 <1k <4k <16k <64k >=64k us):");
+    for (u8 i = 0; messagebroker_get_handler_stats(i, &stats); i++)
+    {
+        cli_print("  %s", prv_get_handler_name(stats.callback));
+        cli_print("    %lu calls, %lu / %lu us (max on topic %u)", (unsigned long)stats.nof_calls,
+                  (unsigned long)((stats.nof_calls > 0) ? (stats.total_us / stats.nof_calls) : 0),
+                  (unsigned long)stats.max_us, (unsigned)stats.max_topic);
+        cli_print("    %lu %lu %lu %lu %lu %lu %lu %lu", (unsigned long)stats.histogram[0],
+                  (unsigned long)stats.histogram[1], (unsigned long)stats.histogram[2],
+                  (unsigned long)stats.histogram[3], (unsigned long)stats.histogram[4],
+                  (unsigned long)stats.histogram[5], (unsigned long)stats.histogram[6],
+                  (unsigned long)stats.histogram[7]);
+    }
+
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_sysprof(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    if ((argc == 3) && (strcmp(argv[1], "sample") == 0))
+    {
+        msg_system_set_sampling_t sampling;
+        if (strcmp(argv[2], "off") == 0)
+        {
+            sampling.period_s = 0;
+        }
+        else
+        {
+            int period_s = atoi(argv[2]);
+            if ((period_s < 1) || (period_s > 86400))
+            {
+                cli_print("Error: Sampling period must be between 1 and 86400 seconds");
+                return CLI_FAIL_STATUS;
+            }
+            sampling.period_s = (u32)period_s;
+        }
+
+        msg_t msg;
+        msg.msg_id = MSG_0008;
+        msg.data_size = sizeof(msg_system_set_sampling_t);
+        msg.data_bytes = (u8*)&sampling;
+
+        messagebroker_publish(&msg);
+
+        if (sampling.period_s == 0)
+        {
+            cli_print("Profile sampling disabled");
+        }
+        else
+        {
+            cli_print("Sampling heap and CPU load every %lu s", (unsigned long)sampling.period_s);
+        }
+        return CLI_OK_STATUS;
+    }
+    if (argc != 1)
+    {
+        cli_print("Usage: sysprof [sample <seconds|off>]");
+        return CLI_FAIL_STATUS;
+    }
+
+    // Answered synchronously by the SystemMonitor (MSG_0006 -> MSG_0007)
+    msg_system_get_profile_t request;
+
+    msg_t msg;
+    msg.msg_id = MSG_0006;
+    msg.data_size = sizeof(msg_system_get_profile_t);
+    msg.data_bytes = (u8*)&request;
+
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
+static const char* prv_get_task_state_name(u8 state)
+{
+    switch (state)
+    {
+        case eRunning: return "Running";
+        case eReady: return "Ready";
+        case eBlocked: return "Blocked";
+        case eSuspended: return "Suspended";
+        case eDeleted: return "Deleted";
+        default: return "Unknown";
+    }
+}
+
+static const char* prv_get_handler_name(msg_callback_t callback)
+{
+#define CONSOLE_HANDLER_NAME(handler) {handler, #handler}
+    static const struct
+    {
+        msg_callback_t callback;
+        const char* name;
+    } handler_names[] = {
+        CONSOLE_HANDLER_NAME(appcontrol_message_handler),
+        CONSOLE_HANDLER_NAME(mp3player_message_handler),
+        CONSOLE_HANDLER_NAME(timesync_message_handler),
+        CONSOLE_HANDLER_NAME(wifimanager_message_handler),
+        CONSOLE_HANDLER_NAME(powermanager_message_handler),
+        CONSOLE_HANDLER_NAME(clustersync_message_handler),
+        CONSOLE_HANDLER_NAME(scheduleserver_message_handler),
+        CONSOLE_HANDLER_NAME(mqttbridge_message_handler),
+        CONSOLE_HANDLER_NAME(systemmonitor_message_handler),
+        CONSOLE_HANDLER_NAME(logger_message_handler),
+        CONSOLE_HANDLER_NAME(messagebroker_message_handler),
+        CONSOLE_HANDLER_NAME(console_msgbroker_test_handler),
+        CONSOLE_HANDLER_NAME(console_wifi_message_handler),
+        CONSOLE_HANDLER_NAME(console_mp3_message_handler),
+        CONSOLE_HANDLER_NAME(console_schedule_message_handler),
+        CONSOLE_HANDLER_NAME(console_power_message_handler),
+        CONSOLE_HANDLER_NAME(console_system_message_handler),
+        CONSOLE_HANDLER_NAME(console_cluster_message_handler),
+        CONSOLE_HANDLER_NAME(console_mqtt_message_handler),
+    };
+#undef CONSOLE_HANDLER_NAME
+
+    for (size_t i = 0; i < CLI_GET_ARRAY_SIZE(handler_names); i++)
+    {
+        if (handler_names[i].callback == callback)
+        {
+            return handler_names[i].name;
+        }
+    }
+
+    return "(unnamed handler)";
+}
+
 // ============================
 // = WiFi Commands
 // ============================
 
-static void prv_wifi_callback(const msg_t* const message)
+void console_wifi_message_handler(const msg_t* const message)
 {
+    if (prv_binary_forward(message))
+    {
+        return;
+    }
+
     switch (message->msg_id)
     {
         case MSG_0202:
@@ -372,19 +978,92 @@ static int prv_cmd_wifi_get(int argc, char* argv[], void* context)
     return CLI_OK_STATUS;
 }
 
+static int prv_cmd_wifi_ip(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    msg_wifi_set_ip_config_t ip_config;
+    memset(&ip_config, 0, sizeof(ip_config));
+
+    if ((argc == 2) && (strcmp(argv[1], "dhcp") == 0))
+    {
+        ip_config.use_static_ip = false;
+    }
+    else if ((argc == 4) || (argc == 5))
+    {
+        IPAddress ip;
+        IPAddress gateway;
+        IPAddress subnet;
+        IPAddress dns;
+
+        if (!ip.fromString(argv[1]) || !gateway.fromString(argv[2]) || !subnet.fromString(argv[3]))
+        {
+            cli_print("Invalid IP address");
+            return CLI_FAIL_STATUS;
+        }
+
+        // Without an explicit DNS server the gateway is used
+        if (argc == 5)
+        {
+            if (!dns.fromString(argv[4]))
+            {
+                cli_print("Invalid DNS server address");
+                return CLI_FAIL_STATUS;
+            }
+        }
+        else
+        {
+            dns = gateway;
+        }
+
+        ip_config.use_static_ip = true;
+        ip_config.ip = (u32)ip;
+        ip_config.gateway = (u32)gateway;
+        ip_config.subnet = (u32)subnet;
+        ip_config.dns = (u32)dns;
+    }
+    else
+    {
+        cli_print("Usage: wifi_ip dhcp");
+        cli_print("       wifi_ip <ip> <gateway> <subnet> [dns]");
+        cli_print("Example: wifi_ip 192.168.1.50 192.168.1.1 255.255.255.0");
+        return CLI_FAIL_STATUS;
+    }
+
+    msg_t msg;
+    msg.msg_id = MSG_0204;
+    msg.data_size = sizeof(msg_wifi_set_ip_config_t);
+    msg.data_bytes = (u8*)&ip_config;
+
+    cli_print("IP configuration set to %s, reconnecting...", ip_config.use_static_ip ? "static" : "DHCP");
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
 // ============================
 // = MP3 Player Commands
 // ============================
 
-static void prv_mp3_callback(const msg_t* const message)
+void console_mp3_message_handler(const msg_t* const message)
 {
+    if (prv_binary_forward(message))
+    {
+        return;
+    }
+
     switch (message->msg_id)
     {
         case MSG_0308:
         {
             msg_mp3_command_response_t* response = (msg_mp3_command_response_t*)message->data_bytes;
 
-            if (response->success)
+            if (response->success && (response->latency_us != 0))
+            {
+                cli_print("MP3 Command successful (play latency: %lu ms, %s)",
+                          (unsigned long)(response->latency_us / 1000), response->was_prearmed ? "pre-armed" : "cold");
+            }
+            else if (response->success)
             {
                 cli_print("MP3 Command successful");
             }
@@ -395,13 +1074,43 @@ static void prv_mp3_callback(const msg_t* const message)
             break;
         }
 
-        default: break;
-    }
-}
+        case MSG_0312:
+        {
+            msg_mp3_sequence_list_t* list = (msg_mp3_sequence_list_t*)message->data_bytes;
 
-static int prv_cmd_mp3_volume(int argc, char* argv[], void* context)
-{
-    (void)context;
+            cli_print("Sequences (play with seq<id>, track: song / volume / gap after it):");
+            for (u8 id = 0; id < MP3_MAX_SEQUENCES; id++)
+            {
+                const mp3_sequence_t* sequence = &list->sequences[id];
+                if (sequence->nof_steps == 0)
+                {
+                    continue;
+                }
+
+                cli_print("  seq%u:", id);
+                for (u8 i = 0; i < sequence->nof_steps; i++)
+                {
+                    const mp3_sequence_step_t* step = &sequence->steps[i];
+                    if (step->volume == 0)
+                    {
+                        cli_print("    song %u / current volume / %u ms", step->song_index, step->gap_ms);
+                    }
+                    else
+                    {
+                        cli_print("    song %u / volume %u / %u ms", step->song_index, step->volume, step->gap_ms);
+                    }
+                }
+            }
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static int prv_cmd_mp3_volume(int argc, char* argv[], void* context)
+{
+    (void)context;
 
     if (argc != 2)
     {
@@ -425,7 +1134,11 @@ static int prv_cmd_mp3_volume(int argc, char* argv[], void* context)
     msg.data_bytes = (u8*)&vol_cmd;
 
     cli_print("Setting volume to: %d", volume);
-    messagebroker_publish(&msg);
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        cli_print("MP3 Player is busy, try again");
+        return CLI_FAIL_STATUS;
+    }
 
     return CLI_OK_STATUS;
 }
@@ -462,7 +1175,11 @@ static int prv_cmd_mp3_mode(int argc, char* argv[], void* context)
 
     const char* mode_names[] = {"", "Loop", "Single Loop", "Folder Loop", "Random", "Single Shot"};
     cli_print("Setting play mode to: %s", mode_names[mode]);
-    messagebroker_publish(&msg);
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        cli_print("MP3 Player is busy, try again");
+        return CLI_FAIL_STATUS;
+    }
 
     return CLI_OK_STATUS;
 }
@@ -473,27 +1190,34 @@ static int prv_cmd_mp3_play(int argc, char* argv[], void* context)
 
     if (argc != 2)
     {
-        cli_print("Usage: speaker_play <song_index>");
+        cli_print("Usage: speaker_play <song_index | seq<id>>");
         return CLI_FAIL_STATUS;
     }
 
-    int song_index = atoi(argv[1]);
-    if (song_index < 1)
+    int song_index = prv_parse_song(argv[1]);
+    if (song_index < 0)
     {
-        cli_print("Song index must be >= 1");
+        cli_print("Song must be an index >= 1 or seq0-seq%d", MP3_MAX_SEQUENCES - 1);
         return CLI_FAIL_STATUS;
     }
 
     msg_mp3_play_song_t play_cmd;
     play_cmd.song_index = (u16)song_index;
+    play_cmd.requested_at_us = esp_timer_get_time();
 
     msg_t msg;
     msg.msg_id = MSG_0302;
     msg.data_size = sizeof(msg_mp3_play_song_t);
     msg.data_bytes = (u8*)&play_cmd;
 
-    cli_print("Playing song: %d", song_index);
-    messagebroker_publish(&msg);
+    char song_label[16];
+    prv_format_song((u16)song_index, song_label, sizeof(song_label));
+    cli_print("Playing %s", song_label);
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        cli_print("MP3 Player is busy, try again");
+        return CLI_FAIL_STATUS;
+    }
 
     return CLI_OK_STATUS;
 }
@@ -510,7 +1234,11 @@ static int prv_cmd_mp3_volume_up(int argc, char* argv[], void* context)
     msg.data_bytes = NULL;
 
     cli_print("Volume up");
-    messagebroker_publish(&msg);
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        cli_print("MP3 Player is busy, try again");
+        return CLI_FAIL_STATUS;
+    }
 
     return CLI_OK_STATUS;
 }
@@ -527,7 +1255,11 @@ static int prv_cmd_mp3_volume_down(int argc, char* argv[], void* context)
     msg.data_bytes = NULL;
 
     cli_print("Volume down");
-    messagebroker_publish(&msg);
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        cli_print("MP3 Player is busy, try again");
+        return CLI_FAIL_STATUS;
+    }
 
     return CLI_OK_STATUS;
 }
@@ -544,7 +1276,11 @@ static int prv_cmd_mp3_next(int argc, char* argv[], void* context)
     msg.data_bytes = NULL;
 
     cli_print("Next song");
-    messagebroker_publish(&msg);
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        cli_print("MP3 Player is busy, try again");
+        return CLI_FAIL_STATUS;
+    }
 
     return CLI_OK_STATUS;
 }
@@ -561,7 +1297,11 @@ static int prv_cmd_mp3_previous(int argc, char* argv[], void* context)
     msg.data_bytes = NULL;
 
     cli_print("Previous song");
-    messagebroker_publish(&msg);
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        cli_print("MP3 Player is busy, try again");
+        return CLI_FAIL_STATUS;
+    }
 
     return CLI_OK_STATUS;
 }
@@ -578,17 +1318,168 @@ static int prv_cmd_mp3_pause(int argc, char* argv[], void* context)
     msg.data_bytes = NULL;
 
     cli_print("Pause or Play");
+    if (!messagebroker_publish_deferred(&msg))
+    {
+        cli_print("MP3 Player is busy, try again");
+        return CLI_FAIL_STATUS;
+    }
+
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_sequence_set(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    if ((argc < 3) || (argc > (2 + MP3_SEQUENCE_MAX_STEPS)))
+    {
+        cli_print("Usage: sequence_set <0-%d> <song[:volume[:gap_ms]]> ... (up to %d tracks)", MP3_MAX_SEQUENCES - 1,
+                  MP3_SEQUENCE_MAX_STEPS);
+        cli_print("  volume: 1-31, 0 = keep the current volume");
+        cli_print("  gap_ms: Silence after the track (0-60000 ms)");
+        cli_print("Example: sequence_set 0 1:25 2:20:500 (chime at volume 25, announcement 0.5 s later)");
+        return CLI_FAIL_STATUS;
+    }
+
+    int sequence_id = atoi(argv[1]);
+    if ((sequence_id < 0) || (sequence_id >= MP3_MAX_SEQUENCES))
+    {
+        cli_print("Sequence ID must be between 0 and %d", MP3_MAX_SEQUENCES - 1);
+        return CLI_FAIL_STATUS;
+    }
+
+    mp3_sequence_t sequence;
+    memset(&sequence, 0, sizeof(sequence));
+
+    for (int i = 2; i < argc; i++)
+    {
+        int song_index = 0;
+        int volume = 0;
+        int gap_ms = 0;
+        int consumed = 0;
+        int nof_fields = sscanf(argv[i], "%d%n:%d%n:%d%n", &song_index, &consumed, &volume, &consumed, &gap_ms,
+                                &consumed);
+
+        if ((nof_fields < 1) || (argv[i][consumed] != '\0') || (song_index < 1)
+            || (song_index >= MP3_SEQUENCE_SONG_BASE) || (volume < 0) || (volume > 31) || (gap_ms < 0)
+            || (gap_ms > 60000))
+        {
+            cli_print("Invalid track '%s' - expected song[:volume[:gap_ms]]", argv[i]);
+            return CLI_FAIL_STATUS;
+        }
+
+        mp3_sequence_step_t* step = &sequence.steps[sequence.nof_steps++];
+        step->song_index = (u16)song_index;
+        step->volume = (u8)volume;
+        step->gap_ms = (u16)gap_ms;
+    }
+
+    prv_publish_sequence((u8)sequence_id, &sequence);
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_sequence_clear(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    if (argc != 2)
+    {
+        cli_print("Usage: sequence_clear <0-%d>", MP3_MAX_SEQUENCES - 1);
+        return CLI_FAIL_STATUS;
+    }
+
+    int sequence_id = atoi(argv[1]);
+    if ((sequence_id < 0) || (sequence_id >= MP3_MAX_SEQUENCES))
+    {
+        cli_print("Sequence ID must be between 0 and %d", MP3_MAX_SEQUENCES - 1);
+        return CLI_FAIL_STATUS;
+    }
+
+    mp3_sequence_t sequence;
+    memset(&sequence, 0, sizeof(sequence));
+
+    prv_publish_sequence((u8)sequence_id, &sequence);
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_sequence_list(int argc, char* argv[], void* context)
+{
+    (void)argc;
+    (void)argv;
+    (void)context;
+
+    // Answered synchronously by the MP3Player (MSG_0311 -> MSG_0312)
+    msg_mp3_get_sequences_t request;
+
+    msg_t msg;
+    msg.msg_id = MSG_0311;
+    msg.data_size = sizeof(msg_mp3_get_sequences_t);
+    msg.data_bytes = (u8*)&request;
+
     messagebroker_publish(&msg);
 
     return CLI_OK_STATUS;
 }
 
+static void prv_publish_sequence(u8 sequence_id, const mp3_sequence_t* sequence)
+{
+    msg_mp3_set_sequence_t request;
+    request.sequence_id = sequence_id;
+    request.sequence = *sequence;
+
+    msg_t msg;
+    msg.msg_id = MSG_0310;
+    msg.data_size = sizeof(msg_mp3_set_sequence_t);
+    msg.data_bytes = (u8*)&request;
+
+    // The MP3Player stores it right away and answers with MSG_0308
+    messagebroker_publish(&msg);
+}
+
+static int prv_parse_song(const char* text)
+{
+    // A playback sequence is played through the song index range above the tracks
+    if (strncmp(text, "seq", 3) == 0)
+    {
+        char* end = NULL;
+        long sequence_id = strtol(text + 3, &end, 10);
+        if ((end == (text + 3)) || (*end != '\0') || (sequence_id < 0) || (sequence_id >= MP3_MAX_SEQUENCES))
+        {
+            return -1;
+        }
+        return MP3_SEQUENCE_SONG_BASE + (int)sequence_id;
+    }
+
+    int song_index = atoi(text);
+    return ((song_index >= 1) && (song_index < MP3_SEQUENCE_SONG_BASE)) ? song_index : -1;
+}
+
+static void prv_format_song(u16 song_index, char* buffer, size_t size)
+{
+    if (song_index >= MP3_SEQUENCE_SONG_BASE)
+    {
+        snprintf(buffer, size, "Sequence %u", (unsigned)(song_index - MP3_SEQUENCE_SONG_BASE));
+    }
+    else
+    {
+        snprintf(buffer, size, "Song %u", (unsigned)song_index);
+    }
+}
+
 // ============================
 // = Application Control Commands
 // ============================
 
-static void prv_schedule_callback(const msg_t* const message)
+void console_schedule_message_handler(const msg_t* const message)
 {
+    // Pages requested by another module are not for the host either
+    bool is_foreign_page = (message->msg_id == MSG_0406)
+                           && (((const msg_schedule_list_t*)message->data_bytes)->requested_by != MODULE_CONSOLE);
+    if (!is_foreign_page && prv_binary_forward(message))
+    {
+        return;
+    }
+
     switch (message->msg_id)
     {
         case MSG_0405:
@@ -616,14 +1507,22 @@ static void prv_schedule_callback(const msg_t* const message)
         case MSG_0406:
         {
             msg_schedule_list_t* list = (msg_schedule_list_t*)message->data_bytes;
+            if (list->requested_by != MODULE_CONSOLE)
+            {
+                break; // Requested by another module, e.g. an export over the network
+            }
 
-            if (list->count == 0)
+            if (list->total_count == 0)
             {
                 cli_print("No schedules configured");
             }
             else
             {
-                cli_print("Configured schedules:");
+                if (list->start_index == 0)
+                {
+                    cli_print("Configured schedules (%d):", list->total_count);
+                }
+
                 for (int i = 0; i < list->count; i++)
                 {
                     // Build weekday string
@@ -673,10 +1572,66 @@ static void prv_schedule_callback(const msg_t* const message)
                         }
                     }
 
-                    cli_print("  [%d] %02d:%02d -> Song %d (%s)", list->schedules[i].schedule_id,
-                              list->schedules[i].hour, list->schedules[i].minute, list->schedules[i].song_index,
-                              weekday_str);
+                    char song_label[16];
+                    prv_format_song(list->schedules[i].song_index, song_label, sizeof(song_label));
+                    cli_print("  [%d] %02d:%02d:%02d -> %s (%s)", list->schedules[i].schedule_id,
+                              list->schedules[i].hour, list->schedules[i].minute, list->schedules[i].second,
+                              song_label, weekday_str);
                 }
+
+                // Ask for the next page only now - a long list never floods the queue
+                u16 next_index = list->start_index + list->count;
+                if ((list->count > 0) && (next_index < list->total_count))
+                {
+                    prv_request_schedule_page(next_index);
+                }
+            }
+            break;
+        }
+
+        case MSG_0408:
+        {
+            msg_schedule_timing_t* timing = (msg_schedule_timing_t*)message->data_bytes;
+
+            if (timing->nof_triggers == 0)
+            {
+                cli_print("No schedules triggered since boot");
+                break;
+            }
+
+            cli_print("Schedules triggered at %lu points in time, largest error: %ld us",
+                      (unsigned long)timing->nof_triggers, (long)timing->max_error_us);
+
+            for (u8 i = 0; i < timing->count; i++)
+            {
+                const schedule_trigger_event_t* event = &timing->events[i];
+                struct tm timeinfo;
+                localtime_r(&event->due, &timeinfo);
+                cli_print("  %04d-%02d-%02d %02d:%02d:%02d: %+ld us (%u schedules)", timeinfo.tm_year + 1900,
+                          timeinfo.tm_mon + 1, timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec,
+                          (long)event->error_us, (unsigned)event->nof_schedules);
+            }
+            break;
+        }
+
+        case MSG_0414:
+        {
+            msg_schedule_exception_list_t* list = (msg_schedule_exception_list_t*)message->data_bytes;
+
+            if (list->count == 0)
+            {
+                cli_print("No days without schedules");
+                break;
+            }
+
+            cli_print("Days without schedules:");
+            for (u8 i = 0; i < list->count; i++)
+            {
+                const schedule_exception_info_t* info = &list->exceptions[i];
+                cli_print("  ID %2u: %04lu-%02lu-%02lu to %04lu-%02lu-%02lu", info->exception_id,
+                          (unsigned long)(info->first_date / 10000), (unsigned long)((info->first_date / 100) % 100),
+                          (unsigned long)(info->first_date % 100), (unsigned long)(info->last_date / 10000),
+                          (unsigned long)((info->last_date / 100) % 100), (unsigned long)(info->last_date % 100));
             }
             break;
         }
@@ -691,23 +1646,36 @@ static int prv_cmd_schedule_add(int argc, char* argv[], void* context)
 
     if (argc != 4)
     {
-        cli_print("Usage: schedule_add <HHMM> <weekdays> <song_index>");
-        cli_print("  HHMM: Time in 24h format (e.g., 1720 for 17:20)");
+        cli_print("Usage: schedule_add <HHMM[SS]> <weekdays> <song_index | seq<id>>");
+        cli_print("  HHMM[SS]: Time in 24h format (e.g., 1720 for 17:20 or 172030 for 17:20:30)");
         cli_print("  weekdays: Comma-separated list or '*' for all days");
         cli_print("    Valid days: Mon, Tue, Wed, Thu, Fri, Sat, Sun");
         cli_print("    Examples: 'Mon,Wed,Fri' or '*' or 'Mon,Tue,Wed,Thu,Fri'");
-        cli_print("  song_index: 1-9999");
+        cli_print("  song_index: 1-9999, or seq0-seq%d for a playback sequence", MP3_MAX_SEQUENCES - 1);
         cli_print("Examples:");
         cli_print("  schedule_add 1720 Mon,Tue,Wed 2");
         cli_print("  schedule_add 0830 * 1");
+        cli_print("  schedule_add 075945 Mon,Tue,Wed,Thu,Fri 3");
+        return CLI_FAIL_STATUS;
+    }
+
+    // Parse time from HHMM or HHMMSS format - the seconds are optional
+    size_t time_length = strlen(argv[1]);
+    if ((time_length != 4) && (time_length != 6))
+    {
+        cli_print("Time must be given as HHMM or HHMMSS");
         return CLI_FAIL_STATUS;
     }
 
-    // Parse time from HHMM format
     int time_value = atoi(argv[1]);
+    int second = (time_length == 6) ? (time_value % 100) : 0;
+    if (time_length == 6)
+    {
+        time_value /= 100;
+    }
     int hour = time_value / 100;
     int minute = time_value % 100;
-    int song_index = atoi(argv[3]);
+    int song_index = prv_parse_song(argv[3]);
 
     if (hour < 0 || hour > 23)
     {
@@ -721,9 +1689,15 @@ static int prv_cmd_schedule_add(int argc, char* argv[], void* context)
         return CLI_FAIL_STATUS;
     }
 
-    if (song_index < 1)
+    if (second < 0 || second > 59)
+    {
+        cli_print("Second must be between 0 and 59");
+        return CLI_FAIL_STATUS;
+    }
+
+    if (song_index < 0)
     {
-        cli_print("Song index must be >= 1");
+        cli_print("Song must be an index >= 1 or seq0-seq%d", MP3_MAX_SEQUENCES - 1);
         return CLI_FAIL_STATUS;
     }
 
@@ -799,6 +1773,7 @@ static int prv_cmd_schedule_add(int argc, char* argv[], void* context)
     msg_schedule_add_t schedule;
     schedule.hour = (u8)hour;
     schedule.minute = (u8)minute;
+    schedule.second = (u8)second;
     schedule.song_index = (u16)song_index;
     schedule.weekday_mask = weekday_mask;
 
@@ -807,7 +1782,10 @@ static int prv_cmd_schedule_add(int argc, char* argv[], void* context)
     msg.data_size = sizeof(msg_schedule_add_t);
     msg.data_bytes = (u8*)&schedule;
 
-    cli_print("Adding schedule: %02d:%02d -> Song %d (weekday mask: 0x%02X)", hour, minute, song_index, weekday_mask);
+    char song_label[16];
+    prv_format_song((u16)song_index, song_label, sizeof(song_label));
+    cli_print("Adding schedule: %02d:%02d:%02d -> %s (weekday mask: 0x%02X)", hour, minute, second, song_label,
+              weekday_mask);
     messagebroker_publish(&msg);
 
     return CLI_OK_STATUS;
@@ -845,14 +1823,24 @@ static int prv_cmd_schedule_list(int argc, char* argv[], void* context)
     (void)argv;
     (void)context;
 
+    // The schedules arrive page by page in console_schedule_message_handler()
+    prv_request_schedule_page(0);
+
+    return CLI_OK_STATUS;
+}
+
+static void prv_request_schedule_page(u16 start_index)
+{
+    msg_schedule_list_request_t request;
+    request.start_index = start_index;
+    request.requested_by = MODULE_CONSOLE;
+
     msg_t msg;
     msg.msg_id = MSG_0402;
-    msg.data_size = 0;
-    msg.data_bytes = NULL;
+    msg.data_size = sizeof(msg_schedule_list_request_t);
+    msg.data_bytes = (u8*)&request;
 
     messagebroker_publish(&msg);
-
-    return CLI_OK_STATUS;
 }
 
 static int prv_cmd_schedule_clear(int argc, char* argv[], void* context)
@@ -900,82 +1888,793 @@ static int prv_cmd_schedule_enable(int argc, char* argv[], void* context)
     return CLI_OK_STATUS;
 }
 
-// ============================
-// = Logging Commands
-// ============================
+static int prv_cmd_schedule_timing(int argc, char* argv[], void* context)
+{
+    (void)argc;
+    (void)argv;
+    (void)context;
 
-static int prv_cmd_log(int argc, char* argv[], void* context)
+    // The measured errors arrive in console_schedule_message_handler()
+    msg_t msg;
+    msg.msg_id = MSG_0407;
+    msg.data_size = 0;
+    msg.data_bytes = NULL;
+
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_holiday_add(int argc, char* argv[], void* context)
 {
     (void)context;
 
-    if (argc != 3)
+    msg_schedule_add_exception_t add_cmd;
+    if (((argc != 2) && (argc != 3)) || !prv_parse_date(argv[1], &add_cmd.first_date))
     {
-        cli_print("Usage: log <on|off> <module_name>");
-        cli_print("Available modules:");
-        cli_print("  appcontrol  - Application Control module");
-        cli_print("  mp3player   - MP3 Player module");
-        cli_print("  timesync    - Time Sync module");
-        cli_print("  wifimanager - WiFi Manager module");
-        cli_print("  all         - All modules");
+        cli_print("Usage: holiday_add <YYYY-MM-DD> [YYYY-MM-DD]");
         return CLI_FAIL_STATUS;
     }
 
-    bool enable = false;
-    if (strcmp(argv[1], "on") == 0)
-    {
-        enable = true;
-    }
-    else if (strcmp(argv[1], "off") == 0)
+    // A single day without the last date
+    add_cmd.last_date = add_cmd.first_date;
+    if ((argc == 3) && !prv_parse_date(argv[2], &add_cmd.last_date))
     {
-        enable = false;
-    }
-    else
-    {
-        cli_print("Invalid parameter. Use 'on' or 'off'");
+        cli_print("Usage: holiday_add <YYYY-MM-DD> [YYYY-MM-DD]");
         return CLI_FAIL_STATUS;
     }
 
-    msg_set_logging_t log_cmd;
-    log_cmd.enabled = enable;
+    msg_t msg;
+    msg.msg_id = MSG_0411;
+    msg.data_size = sizeof(msg_schedule_add_exception_t);
+    msg.data_bytes = (u8*)&add_cmd;
 
-    // Set module ID based on name
-    if (strcmp(argv[2], "appcontrol") == 0)
-    {
-        log_cmd.module_id = MODULE_APPCONTROL;
-    }
-    else if (strcmp(argv[2], "mp3player") == 0)
-    {
-        log_cmd.module_id = MODULE_MP3PLAYER;
-    }
-    else if (strcmp(argv[2], "timesync") == 0)
-    {
-        log_cmd.module_id = MODULE_TIMESYNC;
-    }
-    else if (strcmp(argv[2], "wifimanager") == 0)
-    {
-        log_cmd.module_id = MODULE_WIFIMANAGER;
-    }
-    else if (strcmp(argv[2], "all") == 0)
-    {
-        log_cmd.module_id = MODULE_ALL;
-    }
-    else
+    cli_print("Adding days without schedules: %s to %s", argv[1], argv[argc - 1]);
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_holiday_remove(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    if (argc != 2)
     {
-        cli_print("Unknown module: %s", argv[2]);
+        cli_print("Usage: holiday_remove <id|all>");
         return CLI_FAIL_STATUS;
     }
 
-    // Copy module name
-    strncpy(log_cmd.module_name, argv[2], MODULE_NAME_MAX_LENGTH - 1);
-    log_cmd.module_name[MODULE_NAME_MAX_LENGTH - 1] = '\0';
+    msg_schedule_remove_exception_t remove_cmd;
+    remove_cmd.exception_id = (strcmp(argv[1], "all") == 0) ? -1 : atoi(argv[1]);
 
     msg_t msg;
-    msg.msg_id = MSG_0003;
-    msg.data_size = sizeof(msg_set_logging_t);
-    msg.data_bytes = (u8*)&log_cmd;
+    msg.msg_id = MSG_0412;
+    msg.data_size = sizeof(msg_schedule_remove_exception_t);
+    msg.data_bytes = (u8*)&remove_cmd;
 
-    cli_print("Logging %s for module: %s", enable ? "enabled" : "disabled", argv[2]);
     messagebroker_publish(&msg);
 
     return CLI_OK_STATUS;
 }
+
+static int prv_cmd_holiday_list(int argc, char* argv[], void* context)
+{
+    (void)argc;
+    (void)argv;
+    (void)context;
+
+    // The list arrives in console_schedule_message_handler()
+    msg_t msg;
+    msg.msg_id = MSG_0413;
+    msg.data_size = 0;
+    msg.data_bytes = NULL;
+
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_schedule_import_token(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    if (argc != 2)
+    {
+        cli_print("Usage: schedule_import_token <token|off>");
+        cli_print("  token = sent by the client as \"IMPORT <token>\" to the schedule server");
+        cli_print("  off   = refuse every import");
+        return CLI_FAIL_STATUS;
+    }
+
+    msg_schedule_set_import_token_t cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    if (strcmp(argv[1], "off") != 0)
+    {
+        if (strlen(argv[1]) >= sizeof(cmd.token))
+        {
+            cli_print("Token too long (max %d characters)", SCHEDULE_IMPORT_TOKEN_MAX_LENGTH - 1);
+            return CLI_FAIL_STATUS;
+        }
+        strncpy(cmd.token, argv[1], sizeof(cmd.token) - 1);
+    }
+
+    msg_t msg;
+    msg.msg_id = MSG_0415;
+    msg.data_size = sizeof(msg_schedule_set_import_token_t);
+    msg.data_bytes = (u8*)&cmd;
+
+    messagebroker_publish(&msg);
+
+    cli_print("Schedule import %s", (cmd.token[0] != '\0') ? "enabled" : "disabled");
+    return CLI_OK_STATUS;
+}
+
+static bool prv_parse_date(const char* text, u32* date)
+{
+    // YYYY-MM-DD - the ranges are checked by the ScheduleStore
+    unsigned int year = 0;
+    unsigned int month = 0;
+    unsigned int day = 0;
+    char extra = '\0';
+    if ((sscanf(text, "%4u-%2u-%2u%c", &year, &month, &day, &extra) != 3) || (month > 99) || (day > 99))
+    {
+        return false;
+    }
+
+    *date = (u32)(year * 10000U + month * 100U + day); // YYYYMMDD
+    return true;
+}
+
+// ============================
+// = Power Management Commands
+// ============================
+
+void console_power_message_handler(const msg_t* const message)
+{
+    if (prv_binary_forward(message))
+    {
+        return;
+    }
+
+    switch (message->msg_id)
+    {
+        case MSG_0503:
+        {
+            msg_power_stats_t* stats = (msg_power_stats_t*)message->data_bytes;
+            u64 total_ms = stats->active_time_ms + stats->modem_sleep_time_ms + stats->sleep_allowed_time_ms;
+
+            cli_print("Low power mode: %s", stats->low_power_enabled ? "on" : "off");
+            cli_print("  Active:      %llu s", (unsigned long long)(stats->active_time_ms / 1000U));
+            cli_print("  Modem sleep: %llu s", (unsigned long long)(stats->modem_sleep_time_ms / 1000U));
+            cli_print("  Light sleep allowed: %llu s (%u%%)",
+                      (unsigned long long)(stats->sleep_allowed_time_ms / 1000U),
+                      (unsigned)((total_ms > 0) ? ((stats->sleep_allowed_time_ms * 100U) / total_ms) : 0));
+            cli_print("  Light sleep windows: %lu (ended by a deadline: %lu, by activity: %lu)",
+                      (unsigned long)stats->nof_sleep_windows, (unsigned long)stats->nof_deadline_wakes,
+                      (unsigned long)stats->nof_activity_wakes);
+
+            if (stats->next_wake_at != 0)
+            {
+                struct tm timeinfo;
+                localtime_r(&stats->next_wake_at, &timeinfo);
+                cli_print("  Next wake-up deadline: %02d:%02d:%02d", timeinfo.tm_hour, timeinfo.tm_min,
+                          timeinfo.tm_sec);
+            }
+            else
+            {
+                cli_print("  No wake-up deadline registered");
+            }
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static int prv_cmd_power_mode(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    if (argc != 2)
+    {
+        cli_print("Usage: power_mode <on|off>");
+        cli_print("  on  = light sleep while idle, awake around the schedules and NTP resyncs");
+        cli_print("  off = stay awake");
+        return CLI_FAIL_STATUS;
+    }
+
+    msg_power_set_mode_t mode_cmd;
+    if (strcmp(argv[1], "on") == 0)
+    {
+        mode_cmd.low_power_enabled = true;
+    }
+    else if (strcmp(argv[1], "off") == 0)
+    {
+        mode_cmd.low_power_enabled = false;
+    }
+    else
+    {
+        cli_print("Invalid parameter. Use 'on' or 'off'");
+        return CLI_FAIL_STATUS;
+    }
+
+    msg_t msg;
+    msg.msg_id = MSG_0500;
+    msg.data_size = sizeof(msg_power_set_mode_t);
+    msg.data_bytes = (u8*)&mode_cmd;
+
+    cli_print("Low power mode %s", mode_cmd.low_power_enabled ? "enabled" : "disabled");
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_power_status(int argc, char* argv[], void* context)
+{
+    (void)argc;
+    (void)argv;
+    (void)context;
+
+    msg_power_get_stats_t request;
+
+    msg_t msg;
+    msg.msg_id = MSG_0502;
+    msg.data_size = sizeof(msg_power_get_stats_t);
+    msg.data_bytes = (u8*)&request;
+
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
+// ============================
+// = Cluster Commands
+// ============================
+
+void console_cluster_message_handler(const msg_t* const message)
+{
+    if (prv_binary_forward(message))
+    {
+        return;
+    }
+
+    switch (message->msg_id)
+    {
+        case MSG_0602:
+        {
+            msg_cluster_status_t* status = (msg_cluster_status_t*)message->data_bytes;
+
+            cli_print("Cluster role: %s (%s)", prv_get_cluster_role_name(status->role),
+                      status->is_joined ? "joined" : "not joined");
+
+            if (status->role == CLUSTER_ROLE_LEADER)
+            {
+                cli_print("  Packets sent: %lu, plays announced: %lu", (unsigned long)status->nof_sent,
+                          (unsigned long)status->nof_plays);
+            }
+            else if (status->role == CLUSTER_ROLE_FOLLOWER)
+            {
+                cli_print("  Packets received: %lu, plays started: %lu, too late: %lu",
+                          (unsigned long)status->nof_received, (unsigned long)status->nof_plays,
+                          (unsigned long)status->nof_late_plays);
+
+                if (status->last_packet_age_ms != UINT32_MAX)
+                {
+                    cli_print("  Last packet of the leader: %lu ms ago", (unsigned long)status->last_packet_age_ms);
+                }
+                else
+                {
+                    cli_print("  Nothing heard from the leader yet");
+                }
+
+                if (status->is_offset_valid && (status->leader_clock_diff_us != 0))
+                {
+                    cli_print("  Leader clock vs. own clock: %+ld us", (long)status->leader_clock_diff_us);
+                }
+            }
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static int prv_cmd_cluster_mode(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    if (argc != 2)
+    {
+        cli_print("Usage: cluster_mode <off|leader|follower>");
+        cli_print("  off      = standalone node");
+        cli_print("  leader   = announce the own schedules to the followers");
+        cli_print("  follower = play what the leader announces (keep power_mode off)");
+        return CLI_FAIL_STATUS;
+    }
+
+    msg_cluster_set_role_t role_cmd;
+    if (strcmp(argv[1], "off") == 0)
+    {
+        role_cmd.role = CLUSTER_ROLE_OFF;
+    }
+    else if (strcmp(argv[1], "leader") == 0)
+    {
+        role_cmd.role = CLUSTER_ROLE_LEADER;
+    }
+    else if (strcmp(argv[1], "follower") == 0)
+    {
+        role_cmd.role = CLUSTER_ROLE_FOLLOWER;
+    }
+    else
+    {
+        cli_print("Invalid parameter. Use 'off', 'leader' or 'follower'");
+        return CLI_FAIL_STATUS;
+    }
+
+    msg_t msg;
+    msg.msg_id = MSG_0600;
+    msg.data_size = sizeof(msg_cluster_set_role_t);
+    msg.data_bytes = (u8*)&role_cmd;
+
+    // The ClusterSync answers with its status
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_cluster_status(int argc, char* argv[], void* context)
+{
+    (void)argc;
+    (void)argv;
+    (void)context;
+
+    msg_cluster_get_status_t request;
+
+    msg_t msg;
+    msg.msg_id = MSG_0601;
+    msg.data_size = sizeof(msg_cluster_get_status_t);
+    msg.data_bytes = (u8*)&request;
+
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
+static const char* prv_get_cluster_role_name(cluster_role_e role)
+{
+    switch (role)
+    {
+        case CLUSTER_ROLE_LEADER: return "leader";
+        case CLUSTER_ROLE_FOLLOWER: return "follower";
+        default: return "off";
+    }
+}
+
+// ============================
+// = MQTT Bridge Commands
+// ============================
+
+void console_mqtt_message_handler(const msg_t* const message)
+{
+    if (prv_binary_forward(message))
+    {
+        return;
+    }
+
+    switch (message->msg_id)
+    {
+        case MSG_0702:
+        {
+            msg_mqtt_status_t* status = (msg_mqtt_status_t*)message->data_bytes;
+
+            if (!status->is_enabled)
+            {
+                cli_print("MQTT bridge: off");
+                break;
+            }
+
+            cli_print("MQTT bridge: %s (%s)", status->uri, status->is_connected ? "connected" : "not connected");
+            cli_print("  Base topic: %s, telemetry every %u s", status->base_topic,
+                      (unsigned int)status->telemetry_period_s);
+            cli_print("  Batches published: %lu, commands received: %lu, rejected: %lu",
+                      (unsigned long)status->nof_published, (unsigned long)status->nof_received,
+                      (unsigned long)status->nof_rejected);
+            cli_print("  Queued: %u events, %u samples - dropped: %lu events, %lu samples",
+                      (unsigned int)status->nof_queued_events, (unsigned int)status->nof_queued_samples,
+                      (unsigned long)status->nof_dropped_events, (unsigned long)status->nof_dropped_samples);
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static int prv_cmd_mqtt_set(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    if ((argc != 3) && (argc != 4))
+    {
+        cli_print("Usage: mqtt_set <uri> <base_topic> [period_s]");
+        cli_print("  uri        = e.g. mqtt://192.168.1.10:1883");
+        cli_print("  base_topic = prefix of all topics of this node, e.g. airgong/hall");
+        cli_print("  period_s   = telemetry sampling period (default: keep the current one)");
+        return CLI_FAIL_STATUS;
+    }
+
+    if ((strlen(argv[1]) >= MQTT_URI_MAX_LENGTH) || (strlen(argv[2]) >= MQTT_TOPIC_MAX_LENGTH))
+    {
+        cli_print("URI or base topic too long (max %d / %d characters)", MQTT_URI_MAX_LENGTH - 1,
+                  MQTT_TOPIC_MAX_LENGTH - 1);
+        return CLI_FAIL_STATUS;
+    }
+
+    int period_s = 0;
+    if (argc == 4)
+    {
+        period_s = atoi(argv[3]);
+        if ((period_s < MQTT_MIN_PERIOD_S) || (period_s > UINT16_MAX))
+        {
+            cli_print("Invalid period. Use %d-65535 seconds", MQTT_MIN_PERIOD_S);
+            return CLI_FAIL_STATUS;
+        }
+    }
+
+    // The MqttBridge answers with its status
+    prv_publish_mqtt_config(argv[1], argv[2], (u16)period_s);
+
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_mqtt_off(int argc, char* argv[], void* context)
+{
+    (void)argc;
+    (void)argv;
+    (void)context;
+
+    prv_publish_mqtt_config("", "", 0);
+
+    return CLI_OK_STATUS;
+}
+
+static int prv_cmd_mqtt_status(int argc, char* argv[], void* context)
+{
+    (void)argc;
+    (void)argv;
+    (void)context;
+
+    msg_mqtt_get_status_t request;
+
+    msg_t msg;
+    msg.msg_id = MSG_0701;
+    msg.data_size = sizeof(msg_mqtt_get_status_t);
+    msg.data_bytes = (u8*)&request;
+
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
+static void prv_publish_mqtt_config(const char* uri, const char* base_topic, u16 telemetry_period_s)
+{
+    msg_mqtt_set_config_t config_cmd;
+    memset(&config_cmd, 0, sizeof(config_cmd));
+    strncpy(config_cmd.uri, uri, sizeof(config_cmd.uri) - 1);
+    strncpy(config_cmd.base_topic, base_topic, sizeof(config_cmd.base_topic) - 1);
+    config_cmd.telemetry_period_s = telemetry_period_s;
+
+    msg_t msg;
+    msg.msg_id = MSG_0700;
+    msg.data_size = sizeof(msg_mqtt_set_config_t);
+    msg.data_bytes = (u8*)&config_cmd;
+
+    messagebroker_publish(&msg);
+}
+
+// ============================
+// = Logging Commands
+// ============================
+
+static int prv_cmd_log(int argc, char* argv[], void* context)
+{
+    (void)context;
+
+    if (argc != 3)
+    {
+        cli_print("Usage: log <on|off> <module_name>");
+        cli_print("Available modules:");
+        cli_print("  appcontrol   - Application Control module");
+        cli_print("  mp3player    - MP3 Player module");
+        cli_print("  timesync     - Time Sync module");
+        cli_print("  wifimanager  - WiFi Manager module");
+        cli_print("  powermanager - Power Manager module");
+        cli_print("  clustersync  - Cluster Sync module");
+        cli_print("  schedserver  - Schedule Server module");
+        cli_print("  crashrecord  - Crash Record module");
+        cli_print("  mqttbridge   - MQTT Bridge module");
+        cli_print("  all          - All modules");
+        return CLI_FAIL_STATUS;
+    }
+
+    bool enable = false;
+    if (strcmp(argv[1], "on") == 0)
+    {
+        enable = true;
+    }
+    else if (strcmp(argv[1], "off") == 0)
+    {
+        enable = false;
+    }
+    else
+    {
+        cli_print("Invalid parameter. Use 'on' or 'off'");
+        return CLI_FAIL_STATUS;
+    }
+
+    msg_set_logging_t log_cmd;
+    log_cmd.enabled = enable;
+
+    // Set module ID based on name
+    if (strcmp(argv[2], "appcontrol") == 0)
+    {
+        log_cmd.module_id = MODULE_APPCONTROL;
+    }
+    else if (strcmp(argv[2], "mp3player") == 0)
+    {
+        log_cmd.module_id = MODULE_MP3PLAYER;
+    }
+    else if (strcmp(argv[2], "timesync") == 0)
+    {
+        log_cmd.module_id = MODULE_TIMESYNC;
+    }
+    else if (strcmp(argv[2], "wifimanager") == 0)
+    {
+        log_cmd.module_id = MODULE_WIFIMANAGER;
+    }
+    else if (strcmp(argv[2], "powermanager") == 0)
+    {
+        log_cmd.module_id = MODULE_POWERMANAGER;
+    }
+    else if (strcmp(argv[2], "clustersync") == 0)
+    {
+        log_cmd.module_id = MODULE_CLUSTERSYNC;
+    }
+    else if (strcmp(argv[2], "schedserver") == 0)
+    {
+        log_cmd.module_id = MODULE_SCHEDULESERVER;
+    }
+    else if (strcmp(argv[2], "crashrecord") == 0)
+    {
+        log_cmd.module_id = MODULE_CRASHRECORD;
+    }
+    else if (strcmp(argv[2], "mqttbridge") == 0)
+    {
+        log_cmd.module_id = MODULE_MQTTBRIDGE;
+    }
+    else if (strcmp(argv[2], "all") == 0)
+    {
+        log_cmd.module_id = MODULE_ALL;
+    }
+    else
+    {
+        cli_print("Unknown module: %s", argv[2]);
+        return CLI_FAIL_STATUS;
+    }
+
+    // Copy module name
+    strncpy(log_cmd.module_name, argv[2], MODULE_NAME_MAX_LENGTH - 1);
+    log_cmd.module_name[MODULE_NAME_MAX_LENGTH - 1] = '\0';
+
+    msg_t msg;
+    msg.msg_id = MSG_0003;
+    msg.data_size = sizeof(msg_set_logging_t);
+    msg.data_bytes = (u8*)&log_cmd;
+
+    cli_print("Logging %s for module: %s", enable ? "enabled" : "disabled", argv[2]);
+    messagebroker_publish(&msg);
+
+    return CLI_OK_STATUS;
+}
+
+// ============================
+// = Binary Protocol
+// ============================
+
+/**
+ * Machine mode on the console UART - "binary_mode" switches over, a control frame switches back.
+ *
+ * Frame (little-endian): console_frame_header_t, payload, CRC32 (esp_rom_crc32_le, seed 0) over
+ * all bytes after the SOF. The payload is the MessageDefinitions.h struct of the topic as compiled
+ * for the ESP32 - it is published as is, and every Console subscription is streamed back the same
+ * way. After a request was published, a status frame (msg_id 0) with the request's sequence follows,
+ * so the host can pipeline requests and match the synchronous responses, which carry the sequence of
+ * their request as well. Asynchronous events (e.g. MSG_0203) carry sequence 0.
+ *
+ * The Logger keeps writing text to the same UART - the host skips everything that is not a frame
+ * with a valid CRC.
+ */
+static int prv_cmd_binary_mode(int argc, char* argv[], void* context)
+{
+    (void)argc;
+    (void)argv;
+    (void)context;
+
+    cli_print("Binary mode - send a control frame to return to the text console");
+
+    // The following bytes of the chunk are already parsed as frames
+    binary_rx_length = 0;
+    is_binary_mode = true;
+
+    // Greeting - tells the host the mode switch happened and which protocol version is spoken
+    prv_binary_send_status(0, CONSOLE_FRAME_STATUS_OK);
+
+    return CLI_OK_STATUS;
+}
+
+static void prv_binary_receive(u8 byte)
+{
+    u32 now_ms = millis();
+    if ((binary_rx_length > 0) && ((now_ms - binary_rx_last_byte_ms) > CONSOLE_FRAME_RX_TIMEOUT_MS))
+    {
+        binary_rx_length = 0; // A stalled frame - look for the next start of frame
+    }
+    binary_rx_last_byte_ms = now_ms;
+
+    // Skip everything up to the next start of frame
+    if ((binary_rx_length == 0) && (byte != CONSOLE_FRAME_SOF))
+    {
+        return;
+    }
+
+    binary_rx_frame[binary_rx_length++] = byte;
+    if (binary_rx_length < sizeof(console_frame_header_t))
+    {
+        return;
+    }
+
+    console_frame_header_t header;
+    memcpy(&header, binary_rx_frame, sizeof(header));
+
+    if (header.length > CONSOLE_FRAME_MAX_RX_PAYLOAD)
+    {
+        binary_rx_length = 0;
+        prv_binary_send_status(header.sequence, CONSOLE_FRAME_STATUS_TOO_LONG);
+        return;
+    }
+
+    u16 frame_length = sizeof(console_frame_header_t) + header.length + CONSOLE_FRAME_CRC_SIZE;
+    if (binary_rx_length < frame_length)
+    {
+        return;
+    }
+    binary_rx_length = 0;
+
+    u32 received_crc = 0;
+    memcpy(&received_crc, &binary_rx_frame[frame_length - CONSOLE_FRAME_CRC_SIZE], sizeof(received_crc));
+    u32 crc = esp_rom_crc32_le(0, &binary_rx_frame[1], frame_length - CONSOLE_FRAME_CRC_SIZE - 1);
+    if (crc != received_crc)
+    {
+        prv_binary_send_status(header.sequence, CONSOLE_FRAME_STATUS_CRC_ERROR);
+        return;
+    }
+
+    prv_binary_dispatch(header.sequence, header.msg_id, &binary_rx_frame[sizeof(console_frame_header_t)],
+                        header.length);
+}
+
+static void prv_binary_dispatch(u8 sequence, u16 msg_id, const u8* payload, u16 length)
+{
+    // Control frames are handled by the console itself
+    if (msg_id == E_TOPIC_FIRST_TOPIC)
+    {
+        if ((length == 1) && (payload[0] == CONSOLE_CONTROL_EXIT))
+        {
+            prv_binary_send_status(sequence, CONSOLE_FRAME_STATUS_OK);
+            is_binary_mode = false;
+            cli_print("Text console");
+            cli_flush();
+        }
+        else if ((length == 1) && (payload[0] == CONSOLE_CONTROL_PING))
+        {
+            prv_binary_send_status(sequence, CONSOLE_FRAME_STATUS_OK);
+        }
+        else
+        {
+            prv_binary_send_status(sequence, CONSOLE_FRAME_STATUS_BAD_LENGTH);
+        }
+        return;
+    }
+
+    const console_binary_topic_t* topic = NULL;
+    for (size_t i = 0; i < CLI_GET_ARRAY_SIZE(binary_topics); i++)
+    {
+        if (binary_topics[i].msg_id == msg_id)
+        {
+            topic = &binary_topics[i];
+            break;
+        }
+    }
+
+    if (topic == NULL)
+    {
+        prv_binary_send_status(sequence, CONSOLE_FRAME_STATUS_UNKNOWN_TOPIC);
+        return;
+    }
+    if (length != topic->data_size)
+    {
+        prv_binary_send_status(sequence, CONSOLE_FRAME_STATUS_BAD_LENGTH);
+        return;
+    }
+
+    // The frame buffer gives no alignment guarantee for the struct fields
+    memcpy(&binary_request_payload, payload, length);
+
+    msg_t msg;
+    msg.msg_id = (msg_id_e)msg_id;
+    msg.data_size = length;
+    msg.data_bytes = (length > 0) ? (u8*)&binary_request_payload : NULL;
+
+    // The responses that are published within this call belong to the request
+    binary_request_task = xTaskGetCurrentTaskHandle();
+    binary_request_sequence = sequence;
+    messagebroker_publish(&msg);
+    binary_request_sequence = 0;
+    binary_request_task = NULL;
+
+    prv_binary_send_status(sequence, CONSOLE_FRAME_STATUS_OK);
+}
+
+static bool prv_binary_forward(const msg_t* const message)
+{
+    if (!is_binary_mode)
+    {
+        return false;
+    }
+
+    u8 sequence = (xTaskGetCurrentTaskHandle() == binary_request_task) ? binary_request_sequence : 0;
+    prv_binary_send_frame(sequence, (u16)message->msg_id, message->data_bytes, (u16)message->data_size);
+    return true;
+}
+
+static void prv_binary_send_status(u8 sequence, u8 status)
+{
+    console_frame_status_t frame_status;
+    frame_status.status = status;
+    frame_status.version = CONSOLE_FRAME_PROTOCOL_VERSION;
+
+    prv_binary_send_frame(sequence, E_TOPIC_FIRST_TOPIC, (const u8*)&frame_status, sizeof(frame_status));
+}
+
+static void prv_binary_send_frame(u8 sequence, u16 msg_id, const u8* payload, u16 length)
+{
+    if (length > CONSOLE_FRAME_MAX_TX_PAYLOAD)
+    {
+        prv_binary_send_status(sequence, CONSOLE_FRAME_STATUS_TOO_LONG);
+        return;
+    }
+
+    xSemaphoreTake(binary_tx_mutex, portMAX_DELAY);
+
+    console_frame_header_t header;
+    header.sof = CONSOLE_FRAME_SOF;
+    header.sequence = sequence;
+    header.msg_id = msg_id;
+    header.length = length;
+
+    memcpy(binary_tx_frame, &header, sizeof(header));
+    if (length > 0)
+    {
+        memcpy(&binary_tx_frame[sizeof(header)], payload, length);
+    }
+
+    u16 frame_length = sizeof(header) + length;
+    u32 crc = esp_rom_crc32_le(0, &binary_tx_frame[1], frame_length - 1);
+    memcpy(&binary_tx_frame[frame_length], &crc, sizeof(crc));
+    frame_length += CONSOLE_FRAME_CRC_SIZE;
+
+    // A single write - the driver does not interleave it with the text of the Logger
+    Serial.write(binary_tx_frame, frame_length);
+
+    xSemaphoreGive(binary_tx_mutex);
+}
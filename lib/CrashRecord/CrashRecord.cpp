@@ -0,0 +1,261 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file CrashRecord.cpp
+ * @brief Record of the last failed assertion, kept in RTC memory across the restart
+ *
+ * A failed assertion restarts the gong instead of parking it, so one bad message does not take it
+ * offline until somebody power-cycles it. Before the restart the location of the assertion, the
+ * failing task and the topics published right before it are written into RTC memory, which is not
+ * initialized by a software reset. The next boot logs the record and the console reports it
+ * (MSG_0009 -> MSG_0010) until it is cleared.
+ *
+ * The record also keeps how far the schedules were handled, so the evaluation is resumed after the
+ * restart - a schedule of the current minute is not played twice and the ones that became due while
+ * the gong restarted are caught up on.
+ */
+
+#include "CrashRecord.h"
+#include <Arduino.h>
+#include <stddef.h>
+#include <string.h>
+#include "Logger.h"
+#include "MessageBroker.h"
+#include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "TimeSync.h"
+#include "custom_assert.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// ###########################################################################
+// # Private defines
+// ###########################################################################
+#define CRASHRECORD_MAGIC 0x43525348UL // "CRSH"
+#define US_PER_MS         1000LL
+
+// ###########################################################################
+// # Type Definitions
+// ###########################################################################
+typedef struct
+{
+    u32 magic;
+    msg_system_crash_record_t record;
+    bool is_assert_reset;   // Set right before the restart, consumed by the next boot
+    time_t processed_until; // Schedule progress at the failed assertion
+    u32 crc;                // Over everything above - the RTC memory is undefined after a power-on reset
+} retained_record_t;
+
+// ###########################################################################
+// # Private function declarations
+// ###########################################################################
+static void prv_publish_record(void);
+static void prv_clear_record(void);
+static void prv_seal_record(void);
+static bool prv_is_record_intact(void);
+static void prv_copy_tail(char* destination, size_t size, const char* source);
+
+// ###########################################################################
+// # Private Variables
+// ###########################################################################
+static bool is_initialized = false;
+
+// Survives a software reset - not touched by the startup code
+RTC_NOINIT_ATTR static retained_record_t retained;
+
+// State of the current boot, taken from the retained record by crashrecord_init()
+static bool is_assert_boot = false;
+static time_t resume_point = 0;
+
+// ###########################################################################
+// # Public function implementations
+// ###########################################################################
+
+void crashrecord_init(void)
+{
+    ASSERT(!is_initialized);
+
+    if (!prv_is_record_intact())
+    {
+        prv_clear_record();
+        retained.record.nof_boots = 0;
+    }
+
+    is_assert_boot = retained.is_assert_reset;
+    resume_point = retained.processed_until;
+
+    retained.is_assert_reset = false;
+    retained.processed_until = 0;
+    retained.record.nof_boots++;
+    prv_seal_record();
+
+    messagebroker_subscribe(MSG_0009, crashrecord_message_handler); // Crash record request
+
+    is_initialized = true;
+
+    if (is_assert_boot)
+    {
+        const msg_system_crash_record_t* record = &retained.record;
+        LOG_ERROR(MODULE_CRASHRECORD, "Restarted after a failed assertion in %s: %s:%lu - %s", record->task_name,
+                  record->file, (unsigned long)record->line, record->expr);
+        LOG_ERROR(MODULE_CRASHRECORD, "%lu assertion resets in %lu boots - crash_report shows the details",
+                  (unsigned long)record->nof_assert_resets, (unsigned long)record->nof_boots);
+    }
+}
+
+void crashrecord_save(const char* file, u32 line, const char* expr, time_t processed_until)
+{
+    if (!prv_is_record_intact())
+    {
+        prv_clear_record(); // Asserted before crashrecord_init()
+    }
+
+    msg_system_crash_record_t* record = &retained.record;
+
+    record->is_valid = true;
+    record->nof_assert_resets++;
+    prv_copy_tail(record->file, sizeof(record->file), (file != NULL) ? file : "");
+    record->line = line;
+    strncpy(record->expr, (expr != NULL) ? expr : "", sizeof(record->expr) - 1);
+    record->expr[sizeof(record->expr) - 1] = '\0';
+
+    const char* task_name = pcTaskGetName(NULL);
+    strncpy(record->task_name, (task_name != NULL) ? task_name : "", sizeof(record->task_name) - 1);
+    record->task_name[sizeof(record->task_name) - 1] = '\0';
+
+    record->uptime_ms = (u32)(esp_timer_get_time() / US_PER_MS);
+    record->timestamp = timesync_get_timestamp();
+
+    msg_trace_entry_t trace[MESSAGE_BROKER_TRACE_SIZE];
+    u8 nof_trace = messagebroker_get_trace(trace, MESSAGE_BROKER_TRACE_SIZE);
+    u8 first = (nof_trace > SYSTEM_CRASH_TRACE_LENGTH) ? (u8)(nof_trace - SYSTEM_CRASH_TRACE_LENGTH) : 0;
+    record->nof_trace = (u8)(nof_trace - first);
+    for (u8 i = 0; i < record->nof_trace; i++)
+    {
+        record->trace[i] = trace[first + i].msg_id;
+    }
+
+    retained.is_assert_reset = true;
+    retained.processed_until = processed_until;
+    prv_seal_record();
+}
+
+bool crashrecord_get_resume_point(time_t* processed_until)
+{
+    ASSERT(is_initialized);
+    ASSERT(processed_until != NULL);
+
+    if (!is_assert_boot || (resume_point == 0))
+    {
+        return false;
+    }
+
+    *processed_until = resume_point;
+    return true;
+}
+
+// ###########################################################################
+// # Private function implementations
+// ###########################################################################
+
+void crashrecord_message_handler(const msg_t* const message)
+{
+    ASSERT(message != NULL);
+    ASSERT(is_initialized);
+
+    switch (message->msg_id)
+    {
+        case MSG_0009: // Request crash record
+        {
+            ASSERT(message->data_size == sizeof(msg_system_get_crash_record_t));
+            const msg_system_get_crash_record_t* request = (const msg_system_get_crash_record_t*)message->data_bytes;
+
+            prv_publish_record();
+            if (request->clear)
+            {
+                prv_clear_record();
+                retained.record.nof_boots = 1; // The current one
+                prv_seal_record();
+            }
+            break;
+        }
+
+        default:
+            ASSERT(false);
+            break;
+    }
+}
+
+static void prv_publish_record(void)
+{
+    // A copy - the reply is handled synchronously, but an assertion might rewrite the record meanwhile
+    msg_system_crash_record_t record = retained.record;
+
+    msg_t msg;
+    msg.msg_id = MSG_0010;
+    msg.data_size = sizeof(msg_system_crash_record_t);
+    msg.data_bytes = (u8*)&record;
+
+    messagebroker_publish(&msg);
+}
+
+static void prv_clear_record(void)
+{
+    u32 nof_boots = retained.record.nof_boots;
+
+    memset(&retained, 0, sizeof(retained));
+    retained.magic = CRASHRECORD_MAGIC;
+    retained.record.nof_boots = nof_boots;
+
+    prv_seal_record();
+}
+
+static void prv_seal_record(void)
+{
+    retained.crc = esp_rom_crc32_le(0, (const u8*)&retained, offsetof(retained_record_t, crc));
+}
+
+static bool prv_is_record_intact(void)
+{
+    return (retained.magic == CRASHRECORD_MAGIC)
+           && (retained.crc == esp_rom_crc32_le(0, (const u8*)&retained, offsetof(retained_record_t, crc)));
+}
+
+static void prv_copy_tail(char* destination, size_t size, const char* source)
+{
+    // The end of a path tells more than its beginning
+    size_t length = strlen(source);
+    if (length >= size)
+    {
+        source += length - (size - 1);
+    }
+
+    strncpy(destination, source, size - 1);
+    destination[size - 1] = '\0';
+}
@@ -0,0 +1,68 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef CRASHRECORD_H
+#define CRASHRECORD_H
+
+#include <time.h>
+#include "custom_types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+    /**
+     * @brief Initialize the CrashRecord module
+     *
+     * Validates the record kept in RTC memory (a power-on reset leaves it undefined), logs the failed
+     * assertion if it caused the current boot and answers crash record requests (MSG_0009 -> MSG_0010).
+     * Call it before appcontrol_init(), so the schedule evaluation can be resumed.
+     */
+    void crashrecord_init(void);
+
+    /**
+     * @brief Store a failed assertion in RTC memory
+     *
+     * Called from the assertion handler right before the restart - takes no locks and does not
+     * allocate, so it works from any task, with the scheduler suspended and from an ISR.
+     * @param file Source file of the assertion
+     * @param line Line of the assertion
+     * @param expr Expression that failed
+     * @param processed_until Point in time up to which the schedules were handled (see appcontrol)
+     */
+    void crashrecord_save(const char* file, u32 line, const char* expr, time_t processed_until);
+
+    /**
+     * @brief Get the point the schedule evaluation stopped at before a reset by a failed assertion
+     * @param processed_until Filled with the value that was passed to crashrecord_save()
+     * @return true if the current boot was caused by a failed assertion and the schedules were evaluated before
+     */
+    bool crashrecord_get_resume_point(time_t* processed_until);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // CRASHRECORD_H
@@ -0,0 +1,599 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file Logger.cpp
+ * @brief Deferred logging for all modules
+ *
+ * A log call only checks the level mask of its module and, if enabled, copies the format pointer
+ * and the raw argument words into a slot of a lock-free ring buffer (multiple producers, one
+ * consumer). The formatting and the UART write happen later in the Logger task, which runs at the
+ * lowest priority - so enabling the logs neither shifts the gong timing nor blocks the ConsoleTask.
+ * When the ring buffer is full, messages are dropped and the number of drops is reported.
+ *
+ * MSG_0003 (log on|off <module>) switches the debug level of a module on or off.
+ */
+
+#include "Logger.h"
+#include <Arduino.h>
+#include <atomic>
+#include <ctype.h>
+#include <stdarg.h>
+#include <string.h>
+#include "MessageBroker.h"
+#include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "custom_assert.h"
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// ###########################################################################
+// # Private defines
+// ###########################################################################
+#define LOG_RING_SIZE          32   // Number of messages in flight - must be a power of two
+#define LOG_MAX_ARG_WORDS      6    // 32 bit words per message (64 bit values and doubles take two)
+#define LOG_STRING_AREA_SIZE   48   // Bytes per message for copies of %s arguments (e.g. an SSID)
+#define LOG_LINE_BUFFER_SIZE   192  // Formatted line incl. prefix
+#define LOG_SPEC_BUFFER_SIZE   24   // A single rewritten conversion specification
+#define LOG_NO_STRING          0xFF // String offset of a %s argument that did not fit anymore
+#define LOGGER_TASK_STACK_SIZE 4096
+#define LOGGER_TASK_PRIORITY   0 // Below all other tasks - only uses spare CPU time
+
+// ###########################################################################
+// # Private types
+// ###########################################################################
+typedef struct
+{
+    // Vyukov sequence: == position -> free for a producer, == position + 1 -> ready for the consumer
+    std::atomic<u32> sequence;
+    u32 timestamp_ms;
+    const char* fmt;
+    u8 module_id;
+    u8 level;
+    u8 nof_words;
+    u8 strings_size;
+    u32 words[LOG_MAX_ARG_WORDS];
+    char strings[LOG_STRING_AREA_SIZE];
+} log_entry_t;
+
+typedef struct
+{
+    u8 length;     // Characters of the specification incl. the '%'
+    char conversion;
+    u8 nof_stars;  // Width and / or precision passed as an argument
+    bool is_64bit; // 64 bit integer argument
+} log_spec_t;
+
+// ###########################################################################
+// # Private function declarations
+// ###########################################################################
+static void prv_logger_task(void* parameter);
+static bool prv_parse_spec(const char* fmt, log_spec_t* spec);
+static u8 prv_get_nof_words(const log_spec_t* spec);
+static void prv_capture_args(log_entry_t* entry, const char* fmt, va_list args);
+static bool prv_write_next_entry(void);
+static size_t prv_format_entry(const log_entry_t* entry, char* line, size_t size);
+static size_t prv_format_spec(const log_entry_t* entry, const char* fmt, const log_spec_t* spec, u8* word,
+                              char* out, size_t size);
+
+// ###########################################################################
+// # Private Variables
+// ###########################################################################
+static bool is_initialized = false;
+static TaskHandle_t logger_task_handle = NULL;
+
+static log_entry_t ring[LOG_RING_SIZE];
+static std::atomic<u32> write_position(0); // Next slot claimed by a producer
+static u32 read_position = 0;              // Next slot written by the Logger task (task only)
+static std::atomic<u32> nof_dropped(0);
+
+static const char* const module_tags[MODULE_ALL] = {
+    "AppControl",   "MP3Player",   "TimeSync",    "WiFiManager", "Console",
+    "PowerManager", "ClusterSync", "SchedServer", "CrashRecord", "MqttBridge",
+};
+static const char level_tags[LOG_LEVEL_COUNT] = {'E', 'W', 'I', 'D'};
+
+// ###########################################################################
+// # Public Variables
+// ###########################################################################
+
+// Everything but the debug output is shown by default - MSG_0003 enables the debug level
+volatile u8 logger_level_masks[MODULE_ALL] = {
+    LOG_LEVEL_MASK_DEFAULT, LOG_LEVEL_MASK_DEFAULT, LOG_LEVEL_MASK_DEFAULT, LOG_LEVEL_MASK_DEFAULT,
+    LOG_LEVEL_MASK_DEFAULT, LOG_LEVEL_MASK_DEFAULT, LOG_LEVEL_MASK_DEFAULT, LOG_LEVEL_MASK_DEFAULT,
+    LOG_LEVEL_MASK_DEFAULT, LOG_LEVEL_MASK_DEFAULT,
+};
+
+// ###########################################################################
+// # Public function implementations
+// ###########################################################################
+
+void logger_init(void)
+{
+    ASSERT(!is_initialized);
+    ASSERT((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0);
+
+    for (u32 i = 0; i < LOG_RING_SIZE; i++)
+    {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    messagebroker_subscribe(MSG_0003, logger_message_handler); // Logging control
+
+    is_initialized = true;
+}
+
+void logger_start_task(void)
+{
+    ASSERT(is_initialized);
+
+    if (logger_task_handle == NULL)
+    {
+        xTaskCreate(prv_logger_task, "LoggerTask", LOGGER_TASK_STACK_SIZE, NULL, LOGGER_TASK_PRIORITY,
+                    &logger_task_handle);
+    }
+}
+
+void logger_set_level_mask(module_id_e module_id, u8 level_mask)
+{
+    ASSERT(module_id <= MODULE_ALL);
+
+    for (int i = 0; i < MODULE_ALL; i++)
+    {
+        if (module_id == MODULE_ALL || module_id == i)
+        {
+            logger_level_masks[i] = level_mask & LOG_LEVEL_MASK_ALL;
+        }
+    }
+}
+
+void logger_write(module_id_e module_id, log_level_e level, const char* fmt, ...)
+{
+    if (!is_initialized || fmt == NULL)
+    {
+        return;
+    }
+
+    // Claim a slot - fails instead of waiting when the Logger task has fallen behind
+    u32 position = write_position.load(std::memory_order_relaxed);
+    log_entry_t* entry = NULL;
+    while (true)
+    {
+        entry = &ring[position & (LOG_RING_SIZE - 1)];
+        u32 sequence = entry->sequence.load(std::memory_order_acquire);
+        s32 difference = (s32)(sequence - position);
+
+        if (difference == 0)
+        {
+            if (write_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            nof_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            position = write_position.load(std::memory_order_relaxed);
+        }
+    }
+
+    entry->timestamp_ms = millis();
+    entry->fmt = fmt;
+    entry->module_id = (u8)module_id;
+    entry->level = (u8)level;
+
+    va_list args;
+    va_start(args, fmt);
+    prv_capture_args(entry, fmt, args);
+    va_end(args);
+
+    // Publish the slot to the Logger task
+    entry->sequence.store(position + 1, std::memory_order_release);
+
+    if (logger_task_handle != NULL)
+    {
+        xTaskNotifyGive(logger_task_handle);
+    }
+}
+
+// ###########################################################################
+// # Private function implementations
+// ###########################################################################
+
+static void prv_logger_task(void* parameter)
+{
+    (void)parameter;
+
+    while (1)
+    {
+        while (prv_write_next_entry())
+        {
+        }
+
+        u32 dropped = nof_dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0)
+        {
+            Serial.printf("[Logger] %lu messages dropped\n", (unsigned long)dropped);
+        }
+
+        // Sleep until the next message was queued
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+static bool prv_parse_spec(const char* fmt, log_spec_t* spec)
+{
+    ASSERT(fmt != NULL && *fmt == '%');
+    ASSERT(spec != NULL);
+
+    const char* p = fmt + 1;
+    spec->nof_stars = 0;
+    spec->is_64bit = false;
+
+    // Flags, width, precision
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL)
+    {
+        p++;
+    }
+    if (*p == '*')
+    {
+        spec->nof_stars++;
+        p++;
+    }
+    while (isdigit((unsigned char)*p))
+    {
+        p++;
+    }
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*')
+        {
+            spec->nof_stars++;
+            p++;
+        }
+        while (isdigit((unsigned char)*p))
+        {
+            p++;
+        }
+    }
+
+    // Length modifier - only the resulting argument size matters
+    if (p[0] == 'l' && p[1] == 'l')
+    {
+        spec->is_64bit = true;
+        p += 2;
+    }
+    else if (p[0] == 'h' && p[1] == 'h')
+    {
+        p += 2;
+    }
+    else if (*p == 'l')
+    {
+        spec->is_64bit = sizeof(long) > sizeof(u32);
+        p++;
+    }
+    else if (*p == 'z' || *p == 't')
+    {
+        spec->is_64bit = sizeof(size_t) > sizeof(u32);
+        p++;
+    }
+    else if (*p == 'j')
+    {
+        spec->is_64bit = true;
+        p++;
+    }
+    else if (*p == 'h')
+    {
+        p++;
+    }
+
+    if (*p == '\0')
+    {
+        return false;
+    }
+
+    spec->conversion = *p;
+    spec->length = (u8)(p - fmt + 1);
+    return true;
+}
+
+static u8 prv_get_nof_words(const log_spec_t* spec)
+{
+    ASSERT(spec != NULL);
+
+    u8 nof_words = 0;
+    if (strchr("diouxXc", spec->conversion) != NULL)
+    {
+        nof_words = spec->is_64bit ? 2 : 1;
+    }
+    else if (strchr("fFeEgGaA", spec->conversion) != NULL || spec->conversion == 'p')
+    {
+        nof_words = 2; // double / pointer stored as 64 bit
+    }
+    else if (spec->conversion == 's')
+    {
+        nof_words = 1; // Offset into the string area
+    }
+    else
+    {
+        return 0; // Not supported
+    }
+
+    return nof_words + spec->nof_stars;
+}
+
+static void prv_capture_args(log_entry_t* entry, const char* fmt, va_list args)
+{
+    u8 nof_words = 0;
+    u8 strings_size = 0;
+
+    for (const char* p = fmt; *p != '\0'; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            p++;
+            continue;
+        }
+
+        log_spec_t spec;
+        if (!prv_parse_spec(p, &spec))
+        {
+            break;
+        }
+        u8 needed_words = prv_get_nof_words(&spec);
+        if (needed_words == 0 || nof_words + needed_words > LOG_MAX_ARG_WORDS)
+        {
+            break; // The Logger task prints the rest of the format unformatted
+        }
+        p += spec.length - 1;
+
+        for (u8 i = 0; i < spec.nof_stars; i++)
+        {
+            entry->words[nof_words++] = (u32)va_arg(args, int);
+        }
+
+        if (spec.conversion == 's')
+        {
+            const char* str = va_arg(args, const char*);
+            if (str == NULL)
+            {
+                str = "(null)";
+            }
+
+            if (strings_size < LOG_STRING_AREA_SIZE)
+            {
+                size_t length = strnlen(str, LOG_STRING_AREA_SIZE - strings_size - 1);
+                memcpy(&entry->strings[strings_size], str, length);
+                entry->strings[strings_size + length] = '\0';
+                entry->words[nof_words++] = strings_size;
+                strings_size += (u8)(length + 1);
+            }
+            else
+            {
+                entry->words[nof_words++] = LOG_NO_STRING;
+            }
+        }
+        else
+        {
+            u64 value = 0;
+            if (strchr("fFeEgGaA", spec.conversion) != NULL)
+            {
+                double number = va_arg(args, double);
+                memcpy(&value, &number, sizeof(value));
+            }
+            else if (spec.conversion == 'p')
+            {
+                value = (u64)(uintptr_t)va_arg(args, void*);
+            }
+            else if (spec.is_64bit)
+            {
+                value = va_arg(args, unsigned long long);
+            }
+            else
+            {
+                value = va_arg(args, unsigned int);
+            }
+
+            entry->words[nof_words++] = (u32)value;
+            if (needed_words - spec.nof_stars == 2)
+            {
+                entry->words[nof_words++] = (u32)(value >> 32);
+            }
+        }
+    }
+
+    entry->nof_words = nof_words;
+    entry->strings_size = strings_size;
+}
+
+static bool prv_write_next_entry(void)
+{
+    log_entry_t* entry = &ring[read_position & (LOG_RING_SIZE - 1)];
+    if (entry->sequence.load(std::memory_order_acquire) != read_position + 1)
+    {
+        return false; // Empty (or the producer has not finished the slot yet)
+    }
+
+    char line[LOG_LINE_BUFFER_SIZE];
+    size_t length = prv_format_entry(entry, line, sizeof(line));
+
+    // Hand the slot back to the producers before the (slow) UART write
+    entry->sequence.store(read_position + LOG_RING_SIZE, std::memory_order_release);
+    read_position++;
+
+    Serial.write((const u8*)line, length);
+    return true;
+}
+
+static size_t prv_format_entry(const log_entry_t* entry, char* line, size_t size)
+{
+    ASSERT(entry->module_id < MODULE_ALL && entry->level < LOG_LEVEL_COUNT);
+
+    int prefix = snprintf(line, size, "%lu.%03lu %c [%s] ", (unsigned long)(entry->timestamp_ms / 1000),
+                          (unsigned long)(entry->timestamp_ms % 1000), level_tags[entry->level],
+                          module_tags[entry->module_id]);
+    size_t length = (prefix > 0) ? (size_t)prefix : 0;
+    size_t limit = size - 2; // Room for the newline and the terminator
+
+    u8 word = 0;
+    const char* p = entry->fmt;
+    while (*p != '\0' && length < limit)
+    {
+        if (*p != '%')
+        {
+            line[length++] = *p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            line[length++] = '%';
+            p += 2;
+            continue;
+        }
+
+        log_spec_t spec;
+        u8 needed_words = prv_parse_spec(p, &spec) ? prv_get_nof_words(&spec) : 0;
+        if (needed_words == 0 || word + needed_words > entry->nof_words)
+        {
+            // Arguments were not captured - print the remaining format as it is
+            while (*p != '\0' && length < limit)
+            {
+                line[length++] = *p++;
+            }
+            break;
+        }
+
+        length += prv_format_spec(entry, p, &spec, &word, &line[length], limit - length + 1);
+        p += spec.length;
+    }
+
+    // The messages are written without a trailing newline, older call sites may still carry one
+    if (length == 0 || line[length - 1] != '\n')
+    {
+        line[length++] = '\n';
+    }
+    line[length] = '\0';
+
+    return length;
+}
+
+static size_t prv_format_spec(const log_entry_t* entry, const char* fmt, const log_spec_t* spec, u8* word,
+                              char* out, size_t size)
+{
+    // Rebuild the specification with the widths resolved and a uniform length modifier,
+    // so that each argument can be passed with a known type
+    char spec_text[LOG_SPEC_BUFFER_SIZE];
+    size_t spec_length = 0;
+    for (u8 i = 0; i < spec->length - 1 && spec_length < sizeof(spec_text) - 12; i++)
+    {
+        if (fmt[i] == '*')
+        {
+            spec_length += snprintf(&spec_text[spec_length], sizeof(spec_text) - spec_length, "%d",
+                                    (int)entry->words[(*word)++]);
+        }
+        else if (strchr("lztj", fmt[i]) == NULL)
+        {
+            spec_text[spec_length++] = fmt[i];
+        }
+    }
+
+    bool is_integer = strchr("diouxXc", spec->conversion) != NULL;
+    if (is_integer && spec->is_64bit)
+    {
+        spec_text[spec_length++] = 'l';
+        spec_text[spec_length++] = 'l';
+    }
+    spec_text[spec_length++] = spec->conversion;
+    spec_text[spec_length] = '\0';
+
+    int written = 0;
+    if (spec->conversion == 's')
+    {
+        u32 offset = entry->words[(*word)++];
+        const char* str = (offset < entry->strings_size) ? &entry->strings[offset] : "";
+        written = snprintf(out, size, spec_text, str);
+    }
+    else if (is_integer && !spec->is_64bit)
+    {
+        written = snprintf(out, size, spec_text, (unsigned int)entry->words[(*word)++]);
+    }
+    else
+    {
+        u64 value = (u64)entry->words[*word] | ((u64)entry->words[*word + 1] << 32);
+        *word += 2;
+
+        if (is_integer)
+        {
+            written = snprintf(out, size, spec_text, (unsigned long long)value);
+        }
+        else if (spec->conversion == 'p')
+        {
+            written = snprintf(out, size, spec_text, (void*)(uintptr_t)value);
+        }
+        else
+        {
+            double number;
+            memcpy(&number, &value, sizeof(number));
+            written = snprintf(out, size, spec_text, number);
+        }
+    }
+
+    if (written < 0)
+    {
+        return 0;
+    }
+    return ((size_t)written < size) ? (size_t)written : size - 1;
+}
+
+void logger_message_handler(const msg_t* const message)
+{
+    ASSERT(message != NULL);
+
+    switch (message->msg_id)
+    {
+        case MSG_0003: // Set logging
+        {
+            ASSERT(message->data_size == sizeof(msg_set_logging_t));
+            const msg_set_logging_t* cmd = (const msg_set_logging_t*)message->data_bytes;
+
+            logger_set_level_mask(cmd->module_id, cmd->enabled ? LOG_LEVEL_MASK_ALL : LOG_LEVEL_MASK_DEFAULT);
+            break;
+        }
+
+        default:
+            ASSERT(false);
+            break;
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "MessageDefinitions.h"
+#include "custom_types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+    typedef enum
+    {
+        LOG_LEVEL_ERROR = 0,
+        LOG_LEVEL_WARNING,
+        LOG_LEVEL_INFO,
+        LOG_LEVEL_DEBUG,
+        LOG_LEVEL_COUNT
+    } log_level_e;
+
+#define LOG_LEVEL_BIT(level)   ((u8)(1U << (level)))
+#define LOG_LEVEL_MASK_ALL     ((u8)((1U << LOG_LEVEL_COUNT) - 1U))
+#define LOG_LEVEL_MASK_DEFAULT ((u8)(LOG_LEVEL_MASK_ALL & ~LOG_LEVEL_BIT(LOG_LEVEL_DEBUG))) // Debug output is opt-in
+
+    // Enabled levels per module (bit n = log_level_e n) - read by the LOG_* macros
+    extern volatile u8 logger_level_masks[MODULE_ALL];
+
+    /**
+     * @brief Check whether a level is enabled for a module - a single load, cheap enough for every hot path
+     */
+    static inline bool logger_is_enabled(module_id_e module_id, log_level_e level)
+    {
+        return (logger_level_masks[module_id] & LOG_LEVEL_BIT(level)) != 0;
+    }
+
+    /**
+     * @brief Initialize the Logger module (call before any other module logs)
+     */
+    void logger_init(void);
+
+    /**
+     * @brief Start the Logger task
+     *
+     * The task runs at the lowest priority and writes the queued messages to the console UART.
+     */
+    void logger_start_task(void);
+
+    /**
+     * @brief Set the enabled levels of a module
+     *
+     * @param module_id Module to configure - MODULE_ALL configures every module
+     * @param level_mask Enabled levels (bit n = log_level_e n)
+     */
+    void logger_set_level_mask(module_id_e module_id, u8 level_mask);
+
+    /**
+     * @brief Queue a log message - use the LOG_* macros instead of calling this directly
+     *
+     * The arguments are captured in binary form and only formatted by the Logger task, so this
+     * neither formats nor blocks. When the ring buffer is full, the message is dropped and counted.
+     *
+     * @param fmt printf style format - must be a string literal, as only the pointer is stored.
+     *            %s arguments are copied (truncated to a few bytes), %n and long double are not supported
+     */
+    void logger_write(module_id_e module_id, log_level_e level, const char* fmt, ...)
+        __attribute__((format(printf, 3, 4)));
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#define LOGGER_LOG(module_id, level, ...)                                                                              \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (logger_is_enabled((module_id), (level)))                                                                   \
+        {                                                                                                              \
+            logger_write((module_id), (level), __VA_ARGS__);                                                           \
+        }                                                                                                              \
+    } while (0)
+
+#define LOG_ERROR(module_id, ...)   LOGGER_LOG(module_id, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARNING(module_id, ...) LOGGER_LOG(module_id, LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_INFO(module_id, ...)    LOGGER_LOG(module_id, LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(module_id, ...)   LOGGER_LOG(module_id, LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif // LOGGER_H
@@ -28,31 +28,141 @@
  *
  * This module implements the interface to control the WT2605C MP3 player.
  * For ESP32C6, Serial0 is used for communication with the MP3 player.
+ *
+ * A playback sequence (e.g. a chime followed by an announcement) is played by the MP3 task on its
+ * own: the WT2605C is switched to single shot, so it stops at the end of every track, and its status
+ * is polled to start the next track right after the previous one ended. Every poll counts as activity
+ * for the PowerManager, so light sleep cannot stall a running sequence. Any other playback command
+ * cancels a running sequence. The sequences are stored in NVS and addressed by song indices from
+ * MP3_SEQUENCE_SONG_BASE on, so schedules and the cluster announcements can refer to them as well.
  */
 
 #include "MP3Player.h"
+#include "Logger.h"
 #include "MessageBroker.h"
 #include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "PowerManager.h"
+#include "boot_timing.h"
 #include "custom_assert.h"
 
 #include <Arduino.h>
+#include <Preferences.h>
 #include "WT2605C_Player.h"
+#include "esp_timer.h"
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// ###########################################################################
+// # Private defines
+// ###########################################################################
+#define MP3_DEFAULT_VOLUME 20
+#define MP3_MAX_VOLUME     31
+#define TASK_STACK_SIZE    4096
+#define TASK_PRIORITY      1
+
+#define PREFERENCES_NAMESPACE           "mp3"
+#define PREF_KEY_SEQUENCES              "sequences"
+#define MP3_SEQUENCE_POLL_MS            20        // Status query interval while a sequence plays
+#define MP3_SEQUENCE_START_TIMEOUT_US   2000000LL // A track that did not start by then is skipped
+#define MP3_STATUS_PLAYING              0x01      // Answers of the WT2605C status query
+#define MP3_STATUS_STOPPED              0x02
+
+// ###########################################################################
+// # Type Definitions
+// ###########################################################################
+
+/**
+ * Commands that were received but not yet sent to the WT2605C. There is one slot per kind of
+ * command, so the backlog is bounded and redundant commands merge instead of queueing up:
+ * - volume up/down are folded into one absolute volume
+ * - a newer play replaces a pending one and drops the pending next/previous/pause
+ * - next/previous add up to one signed track offset, two pause toggles cancel out
+ * - a newer prepare replaces a pending one, it does not owe a response
+ */
+typedef struct
+{
+    bool has_volume;
+    u8 volume;
+    bool has_play_mode;
+    mp3_play_mode_e play_mode;
+    bool has_prepare;
+    u16 prepare_song_index;
+    bool has_play;
+    u16 song_index;
+    s64 play_requested_at_us; // 0 = latency not measured
+    s16 track_offset; // > 0 = next, < 0 = previous
+    bool toggle_pause;
+    u8 nof_responses; // Number of MSG_0308 responses owed to the requesters
+} mp3_pending_commands_t;
+
+typedef enum
+{
+    SEQUENCE_IDLE = 0, // No sequence is running
+    SEQUENCE_STARTING, // A track was started, the player does not report it as playing yet
+    SEQUENCE_PLAYING,  // The player reports the track as playing - its end is awaited
+    SEQUENCE_GAP       // Silence between two tracks
+} sequence_phase_e;
+
+// The running sequence - only touched by the MP3 task
+typedef struct
+{
+    sequence_phase_e phase;
+    mp3_sequence_t sequence; // Copy taken at the start - a redefinition does not disturb it
+    u8 step;                 // Current track
+    s64 phase_started_us;    // esp_timer when the current phase began
+    bool volume_changed;     // A track overrode the volume - restore it at the end
+} sequence_state_t;
 
 // ###########################################################################
 // # Private function declarations
 // ###########################################################################
-static void prv_mp3_message_handler(const msg_t* const message);
+static void prv_mp3player_task(void* parameter);
+static void prv_execute_commands(const mp3_pending_commands_t* commands);
+static void prv_cue_song(u16 song_index);
+static u8 prv_get_current_volume(void);
+static int prv_send_play_mode(mp3_play_mode_e play_mode);
+static int prv_start_sequence(u16 sequence_id, bool* was_prearmed);
+static void prv_start_sequence_step(bool is_cued);
+static void prv_run_sequence(void);
+static void prv_finish_sequence_step(s64 now_us);
+static void prv_stop_sequence(void);
+static bool prv_is_sequence(u16 song_index);
+static void prv_set_sequence(const msg_mp3_set_sequence_t* request);
+static void prv_publish_sequences(void);
+static void prv_publish_response(int result, u32 latency_us, bool was_prearmed);
 
 // ###########################################################################
 // # Private Variables
 // ###########################################################################
 
 static bool is_initialized = false;
-static bool g_logging_is_active = false; // Logging initially disabled
 
 // MP3 Player instance - für ESP32C6 verwenden wir HardwareSerial
 static WT2605C<HardwareSerial> mp3_player;
 
+static TaskHandle_t mp3player_task_handle = NULL;
+static SemaphoreHandle_t pending_mutex = NULL; // Protects pending_commands and current_volume
+static mp3_pending_commands_t pending_commands;
+static u8 current_volume = MP3_DEFAULT_VOLUME; // Last volume sent to the player (or pending)
+
+// Cued song - only touched by the MP3 task
+static bool cue_is_valid = false;
+static u16 cued_song_index = 0;
+
+// Play mode requested by the user and the one the player is in - they differ while a sequence is played
+// or cued. The WT2605C starts up in loop mode. Only touched by the MP3 task.
+static mp3_play_mode_e current_play_mode = MP3_MODE_LOOP;
+static mp3_play_mode_e player_play_mode = MP3_MODE_LOOP;
+
+// Stored sequences (protected by pending_mutex) and the running one
+static Preferences preferences;
+static mp3_sequence_t sequences[MP3_MAX_SEQUENCES];
+static sequence_state_t sequence_state;
+
 // ###########################################################################
 // # Public function implementations
 // ###########################################################################
@@ -61,28 +171,55 @@ void mp3player_init(void)
 {
     ASSERT(!is_initialized);
 
+    pending_mutex = xSemaphoreCreateMutex();
+    ASSERT(pending_mutex != NULL);
+
     // Initialize Serial0 for communication with WT2605C (115200 baud)
     Serial0.begin(115200);
 
     // Initialize the MP3 player
     mp3_player.init(Serial0);
 
+    // Load the stored sequences - a table with another layout is dropped
+    preferences.begin(PREFERENCES_NAMESPACE, false);
+    if (preferences.getBytes(PREF_KEY_SEQUENCES, sequences, sizeof(sequences)) != sizeof(sequences))
+    {
+        memset(sequences, 0, sizeof(sequences));
+    }
+    memset(&sequence_state, 0, sizeof(sequence_state));
+
     // Subscribe to MP3 control messages
-    messagebroker_subscribe(MSG_0003, prv_mp3_message_handler); // Logging control
-    messagebroker_subscribe(MSG_0300, prv_mp3_message_handler); // Set volume
-    messagebroker_subscribe(MSG_0301, prv_mp3_message_handler); // Set play mode
-    messagebroker_subscribe(MSG_0302, prv_mp3_message_handler); // Play song by index
-    messagebroker_subscribe(MSG_0303, prv_mp3_message_handler); // Volume up
-    messagebroker_subscribe(MSG_0304, prv_mp3_message_handler); // Volume down
-    messagebroker_subscribe(MSG_0305, prv_mp3_message_handler); // Next song
-    messagebroker_subscribe(MSG_0306, prv_mp3_message_handler); // Previous song
-    messagebroker_subscribe(MSG_0307, prv_mp3_message_handler); // Pause or play
+    messagebroker_subscribe(MSG_0300, mp3player_message_handler); // Set volume
+    messagebroker_subscribe(MSG_0301, mp3player_message_handler); // Set play mode
+    messagebroker_subscribe(MSG_0302, mp3player_message_handler); // Play song by index
+    messagebroker_subscribe(MSG_0303, mp3player_message_handler); // Volume up
+    messagebroker_subscribe(MSG_0304, mp3player_message_handler); // Volume down
+    messagebroker_subscribe(MSG_0305, mp3player_message_handler); // Next song
+    messagebroker_subscribe(MSG_0306, mp3player_message_handler); // Previous song
+    messagebroker_subscribe(MSG_0307, mp3player_message_handler); // Pause or play
+    messagebroker_subscribe(MSG_0309, mp3player_message_handler); // Prepare song
+    messagebroker_subscribe(MSG_0310, mp3player_message_handler); // Define sequence
+    messagebroker_subscribe(MSG_0311, mp3player_message_handler); // Request sequences
+
+    // The default volume is the first command of the task - the UART round trip does not delay the boot
+    pending_commands.has_volume = true;
+    pending_commands.volume = MP3_DEFAULT_VOLUME;
+    current_volume = MP3_DEFAULT_VOLUME;
 
     is_initialized = true;
+}
 
-    // Set the default volume to 20
-    u8 result = mp3_player.volume(20);
-    ASSERT(result == 0);
+void mp3player_start_task(void)
+{
+    ASSERT(is_initialized);
+
+    if (mp3player_task_handle == NULL)
+    {
+        xTaskCreate(prv_mp3player_task, "MP3PlayerTask", TASK_STACK_SIZE, NULL, TASK_PRIORITY, &mp3player_task_handle);
+
+        // Send the commands that were queued during the init phase
+        xTaskNotifyGive(mp3player_task_handle);
+    }
 }
 
 void mp3player_run(void)
@@ -97,189 +234,540 @@ void mp3player_run(void)
 // # Private function implementations
 // ###########################################################################
 
-static void prv_mp3_message_handler(const msg_t* const message)
+static void prv_mp3player_task(void* parameter)
+{
+    (void)parameter;
+
+    while (1)
+    {
+        // Sleep until a command is pending - while a sequence plays, wake up to watch for the end of the track
+        bool is_sequence_running = (sequence_state.phase != SEQUENCE_IDLE);
+        if (ulTaskNotifyTake(pdTRUE, is_sequence_running ? pdMS_TO_TICKS(MP3_SEQUENCE_POLL_MS) : portMAX_DELAY) > 0)
+        {
+            // Take over everything that was merged so far - new commands collect in the empty slots meanwhile
+            xSemaphoreTake(pending_mutex, portMAX_DELAY);
+            mp3_pending_commands_t commands = pending_commands;
+            memset(&pending_commands, 0, sizeof(pending_commands));
+            xSemaphoreGive(pending_mutex);
+
+            prv_execute_commands(&commands);
+        }
+
+        if (sequence_state.phase != SEQUENCE_IDLE)
+        {
+            // The steps are timed by this poll and the status reply over UART - keep the chip out of light sleep
+            powermanager_notify_activity();
+            prv_run_sequence();
+        }
+    }
+}
+
+static void prv_execute_commands(const mp3_pending_commands_t* commands)
 {
+    ASSERT(commands != NULL);
+
+    // Only the UART transactions happen here, every requester still gets its response
     int result = 0;
+    u32 latency_us = 0;
+    bool was_prearmed = false;
 
-    switch (message->msg_id)
+    // Playing something else, navigating or changing the mode ends a running sequence
+    if ((sequence_state.phase != SEQUENCE_IDLE)
+        && (commands->has_play || commands->has_play_mode || (commands->track_offset != 0) || commands->toggle_pause))
     {
-        case MSG_0003: // Set logging
+        prv_stop_sequence();
+    }
+
+    if (commands->has_prepare)
+    {
+        u16 song_index = commands->prepare_song_index;
+        if (prv_is_sequence(song_index))
         {
-            msg_set_logging_t* cmd = (msg_set_logging_t*)message->data_bytes;
+            // A sequence is cued with its first track - at the volume of that track
+            xSemaphoreTake(pending_mutex, portMAX_DELAY);
+            mp3_sequence_t sequence = sequences[song_index - MP3_SEQUENCE_SONG_BASE];
+            xSemaphoreGive(pending_mutex);
 
-            // Check if this message is for us
-            if (cmd->module_id == MODULE_MP3PLAYER || cmd->module_id == MODULE_ALL
-                || strncmp(cmd->module_name, "mp3player", MODULE_NAME_MAX_LENGTH) == 0)
+            if (sequence.nof_steps > 0)
             {
-                g_logging_is_active = cmd->enabled;
-                if (g_logging_is_active)
+                // Switch to single shot first - the switch may stop a cued song
+                if (player_play_mode != MP3_MODE_SINGLE_SHOT)
                 {
-                    Serial.println("[MP3Player] Logging enabled");
+                    prv_send_play_mode(MP3_MODE_SINGLE_SHOT);
+                }
+                prv_cue_song(sequence.steps[0].song_index);
+                if (sequence.steps[0].volume != 0)
+                {
+                    mp3_player.volume(sequence.steps[0].volume);
                 }
             }
-            break;
         }
-
-        case MSG_0300: // Set volume
+        else
         {
-            msg_mp3_set_volume_t* cmd = (msg_mp3_set_volume_t*)message->data_bytes;
-            result = mp3_player.volume(cmd->volume);
-
-            if (g_logging_is_active)
+            if (player_play_mode != current_play_mode)
             {
-                Serial.printf("[MP3Player] Set volume to %d, result: %d\n", cmd->volume, result);
+                prv_send_play_mode(current_play_mode);
             }
+            prv_cue_song(song_index);
+        }
+    }
 
-            // Send response
-            msg_mp3_command_response_t response;
-            response.success = (result == 0);
-            response.error_code = result;
+    if (commands->has_play_mode)
+    {
+        cue_is_valid = false; // The mode change may stop the cued song
+        int mode_result = prv_send_play_mode(commands->play_mode);
+        if (mode_result != 0)
+        {
+            result = mode_result;
+        }
+        else
+        {
+            current_play_mode = commands->play_mode;
+        }
+    }
 
-            msg_t resp_msg;
-            resp_msg.msg_id = MSG_0308;
-            resp_msg.data_size = sizeof(msg_mp3_command_response_t);
-            resp_msg.data_bytes = (u8*)&response;
-            messagebroker_publish(&resp_msg);
-            break;
+    if (commands->has_play && prv_is_sequence(commands->song_index))
+    {
+        int sequence_result = prv_start_sequence(commands->song_index - MP3_SEQUENCE_SONG_BASE, &was_prearmed);
+        if (sequence_result != 0)
+        {
+            result = sequence_result;
+        }
+        else if (commands->play_requested_at_us != 0)
+        {
+            latency_us = (u32)(esp_timer_get_time() - commands->play_requested_at_us);
+        }
+    }
+    else if (commands->has_play)
+    {
+        // A cued sequence left the player in single shot
+        if (player_play_mode != current_play_mode)
+        {
+            cue_is_valid = false;
+            prv_send_play_mode(current_play_mode);
         }
 
-        case MSG_0301: // Set play mode
+        if (cue_is_valid && (cued_song_index == commands->song_index))
         {
-            msg_mp3_set_playmode_t* cmd = (msg_mp3_set_playmode_t*)message->data_bytes;
+            // The song is already loaded and paused - resuming it is a single short command
+            mp3_player.pause_or_play();
+            was_prearmed = true;
+        }
+        else
+        {
+            mp3_player.playSDRootSong(commands->song_index);
+        }
+        cue_is_valid = false;
 
-            switch (cmd->mode)
-            {
-                case MP3_MODE_LOOP: result = mp3_player.playMode(WT2605C_CYCLE); break;
-                case MP3_MODE_SINGLE_LOOP: result = mp3_player.playMode(WT2605C_SINGLE_CYCLE); break;
-                case MP3_MODE_FOLDER_LOOP: result = mp3_player.playMode(WT2605C_DIR_CYCLE); break;
-                case MP3_MODE_RANDOM: result = mp3_player.playMode(WT2605C_RANDOM); break;
-                case MP3_MODE_SINGLE_SHOT: result = mp3_player.playMode(WT2605C_SINGLE_SHOT); break;
-                default:
-                    result = -1; // Invalid mode
-                    break;
-            }
+        if (commands->play_requested_at_us != 0)
+        {
+            latency_us = (u32)(esp_timer_get_time() - commands->play_requested_at_us);
+        }
+
+        LOG_DEBUG(MODULE_MP3PLAYER, "Playing song %d (%s, latency: %lu us)", commands->song_index,
+                  was_prearmed ? "pre-armed" : "cold", (unsigned long)latency_us);
+    }
 
-            // Send response
-            msg_mp3_command_response_t response;
-            response.success = (result == 0);
-            response.error_code = result;
+    if ((commands->track_offset != 0) || commands->toggle_pause)
+    {
+        cue_is_valid = false; // Navigating or resuming plays something else than the cue
+    }
 
-            msg_t resp_msg;
-            resp_msg.msg_id = MSG_0308;
-            resp_msg.data_size = sizeof(msg_mp3_command_response_t);
-            resp_msg.data_bytes = (u8*)&response;
-            messagebroker_publish(&resp_msg);
+    for (s16 i = 0; i < commands->track_offset; i++)
+    {
+        mp3_player.next();
+    }
+    for (s16 i = 0; i > commands->track_offset; i--)
+    {
+        mp3_player.previous();
+    }
+
+    if (commands->toggle_pause)
+    {
+        mp3_player.pause_or_play();
+    }
+
+    if (commands->has_volume)
+    {
+        int volume_result = mp3_player.volume(commands->volume);
+        if (volume_result != 0)
+        {
+            result = volume_result;
+        }
+        else
+        {
+            boot_timing_mark(BOOT_STAGE_MP3_READY);
+        }
+
+        LOG_DEBUG(MODULE_MP3PLAYER, "Set volume to %d, result: %d", commands->volume, volume_result);
+    }
+
+    for (u8 i = 0; i < commands->nof_responses; i++)
+    {
+        prv_publish_response(result, latency_us, was_prearmed);
+    }
+}
+
+static void prv_cue_song(u16 song_index)
+{
+    // The WT2605C has no cue command: start the song muted and pause it right away, so it only
+    // needs to be resumed when it is due. Volume and the SD card are woken up along the way.
+    u8 volume = prv_get_current_volume();
+    mp3_player.volume(0);
+    mp3_player.playSDRootSong(song_index);
+    mp3_player.pause_or_play();
+    int volume_result = mp3_player.volume(volume);
+
+    cue_is_valid = (volume_result == 0);
+    cued_song_index = song_index;
+
+    LOG_DEBUG(MODULE_MP3PLAYER, "Cued song %d, result: %d", song_index, volume_result);
+}
+
+static int prv_send_play_mode(mp3_play_mode_e play_mode)
+{
+    int result = 0;
+    switch (play_mode)
+    {
+        case MP3_MODE_LOOP: result = mp3_player.playMode(WT2605C_CYCLE); break;
+        case MP3_MODE_SINGLE_LOOP: result = mp3_player.playMode(WT2605C_SINGLE_CYCLE); break;
+        case MP3_MODE_FOLDER_LOOP: result = mp3_player.playMode(WT2605C_DIR_CYCLE); break;
+        case MP3_MODE_RANDOM: result = mp3_player.playMode(WT2605C_RANDOM); break;
+        case MP3_MODE_SINGLE_SHOT: result = mp3_player.playMode(WT2605C_SINGLE_SHOT); break;
+        default:
+            result = -1; // Invalid mode
             break;
+    }
+
+    if (result == 0)
+    {
+        player_play_mode = play_mode;
+    }
+
+    return result;
+}
+
+static int prv_start_sequence(u16 sequence_id, bool* was_prearmed)
+{
+    ASSERT(sequence_id < MP3_MAX_SEQUENCES);
+    ASSERT(was_prearmed != NULL);
+
+    xSemaphoreTake(pending_mutex, portMAX_DELAY);
+    sequence_state.sequence = sequences[sequence_id];
+    xSemaphoreGive(pending_mutex);
+
+    if (sequence_state.sequence.nof_steps == 0)
+    {
+        LOG_WARNING(MODULE_MP3PLAYER, "Sequence %d is not defined", sequence_id);
+        return -1;
+    }
+
+    // The player has to stop at the end of every track, so that the end can be detected.
+    // current_play_mode keeps the mode of the user - it is restored when the sequence ends.
+    if (player_play_mode != MP3_MODE_SINGLE_SHOT)
+    {
+        prv_send_play_mode(MP3_MODE_SINGLE_SHOT);
+        cue_is_valid = false; // The mode change may stop the cued song
+    }
+
+    *was_prearmed = cue_is_valid && (cued_song_index == sequence_state.sequence.steps[0].song_index);
+
+    sequence_state.step = 0;
+    sequence_state.volume_changed = false;
+    prv_start_sequence_step(*was_prearmed);
+
+    LOG_DEBUG(MODULE_MP3PLAYER, "Playing sequence %d (%d tracks, %s)", sequence_id, sequence_state.sequence.nof_steps,
+              *was_prearmed ? "pre-armed" : "cold");
+    return 0;
+}
+
+static void prv_start_sequence_step(bool is_cued)
+{
+    const mp3_sequence_step_t* step = &sequence_state.sequence.steps[sequence_state.step];
+
+    if (step->volume != 0)
+    {
+        sequence_state.volume_changed = true;
+    }
+
+    if (is_cued)
+    {
+        // The cue already set the volume of the first track
+        mp3_player.pause_or_play();
+    }
+    else
+    {
+        if (step->volume != 0)
+        {
+            mp3_player.volume(step->volume);
         }
+        mp3_player.playSDRootSong(step->song_index);
+    }
+    cue_is_valid = false;
 
-        case MSG_0302: // Play song by index
+    sequence_state.phase = SEQUENCE_STARTING;
+    sequence_state.phase_started_us = esp_timer_get_time();
+}
+
+static void prv_run_sequence(void)
+{
+    s64 now_us = esp_timer_get_time();
+
+    switch (sequence_state.phase)
+    {
+        case SEQUENCE_STARTING:
+        case SEQUENCE_PLAYING:
         {
-            msg_mp3_play_song_t* cmd = (msg_mp3_play_song_t*)message->data_bytes;
-            mp3_player.playSDRootSong(cmd->song_index);
+            u8 status = mp3_player.getStatus();
+            if (status == MP3_STATUS_PLAYING)
+            {
+                sequence_state.phase = SEQUENCE_PLAYING;
+            }
+            else if ((sequence_state.phase == SEQUENCE_PLAYING) && (status == MP3_STATUS_STOPPED))
+            {
+                // The track ended
+                prv_finish_sequence_step(now_us);
+            }
+            else if ((sequence_state.phase == SEQUENCE_STARTING)
+                     && ((now_us - sequence_state.phase_started_us) > MP3_SEQUENCE_START_TIMEOUT_US))
+            {
+                LOG_WARNING(MODULE_MP3PLAYER, "Sequence track %d did not start - skipped",
+                            sequence_state.sequence.steps[sequence_state.step].song_index);
+                prv_finish_sequence_step(now_us);
+            }
+            break;
+        }
 
-            if (g_logging_is_active)
+        case SEQUENCE_GAP:
+        {
+            u16 gap_ms = sequence_state.sequence.steps[sequence_state.step - 1].gap_ms;
+            if ((now_us - sequence_state.phase_started_us) >= ((s64)gap_ms * 1000))
             {
-                Serial.printf("[MP3Player] Playing song %d\n", cmd->song_index);
+                prv_start_sequence_step(false);
             }
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static void prv_finish_sequence_step(s64 now_us)
+{
+    u16 gap_ms = sequence_state.sequence.steps[sequence_state.step].gap_ms;
+    sequence_state.step++;
+
+    if (sequence_state.step >= sequence_state.sequence.nof_steps)
+    {
+        prv_stop_sequence();
+    }
+    else if (gap_ms > 0)
+    {
+        sequence_state.phase = SEQUENCE_GAP;
+        sequence_state.phase_started_us = now_us;
+    }
+    else
+    {
+        prv_start_sequence_step(false);
+    }
+}
+
+static void prv_stop_sequence(void)
+{
+    sequence_state.phase = SEQUENCE_IDLE;
+
+    // Back to the mode and the volume of the user
+    if (player_play_mode != current_play_mode)
+    {
+        prv_send_play_mode(current_play_mode);
+    }
+    if (sequence_state.volume_changed)
+    {
+        mp3_player.volume(prv_get_current_volume());
+    }
+}
+
+static u8 prv_get_current_volume(void)
+{
+    // Written by the broker task when a volume command is merged
+    xSemaphoreTake(pending_mutex, portMAX_DELAY);
+    u8 volume = current_volume;
+    xSemaphoreGive(pending_mutex);
+
+    return volume;
+}
 
-            // Send response
-            msg_mp3_command_response_t response;
-            response.success = true;
-            response.error_code = 0;
+static bool prv_is_sequence(u16 song_index)
+{
+    return (song_index >= MP3_SEQUENCE_SONG_BASE) && (song_index < (MP3_SEQUENCE_SONG_BASE + MP3_MAX_SEQUENCES));
+}
+
+static void prv_set_sequence(const msg_mp3_set_sequence_t* request)
+{
+    ASSERT(request != NULL);
+
+    bool is_valid = (request->sequence_id < MP3_MAX_SEQUENCES)
+                    && (request->sequence.nof_steps <= MP3_SEQUENCE_MAX_STEPS);
+    for (u8 i = 0; is_valid && (i < request->sequence.nof_steps); i++)
+    {
+        const mp3_sequence_step_t* step = &request->sequence.steps[i];
+        is_valid = (step->song_index >= 1) && !prv_is_sequence(step->song_index) && (step->volume <= MP3_MAX_VOLUME);
+    }
+
+    if (is_valid)
+    {
+        xSemaphoreTake(pending_mutex, portMAX_DELAY);
+        sequences[request->sequence_id] = request->sequence;
+        memset(&sequences[request->sequence_id].steps[request->sequence.nof_steps], 0,
+               (MP3_SEQUENCE_MAX_STEPS - request->sequence.nof_steps) * sizeof(mp3_sequence_step_t));
+        preferences.putBytes(PREF_KEY_SEQUENCES, sequences, sizeof(sequences));
+        xSemaphoreGive(pending_mutex);
+
+        LOG_INFO(MODULE_MP3PLAYER, "Sequence %d %s", request->sequence_id,
+                 (request->sequence.nof_steps > 0) ? "stored" : "deleted");
+    }
+
+    prv_publish_response(is_valid ? 0 : -1, 0, false);
+}
 
-            msg_t resp_msg;
-            resp_msg.msg_id = MSG_0308;
-            resp_msg.data_size = sizeof(msg_mp3_command_response_t);
-            resp_msg.data_bytes = (u8*)&response;
-            messagebroker_publish(&resp_msg);
+static void prv_publish_sequences(void)
+{
+    msg_mp3_sequence_list_t list;
+
+    xSemaphoreTake(pending_mutex, portMAX_DELAY);
+    memcpy(list.sequences, sequences, sizeof(list.sequences));
+    xSemaphoreGive(pending_mutex);
+
+    msg_t msg;
+    msg.msg_id = MSG_0312;
+    msg.data_size = sizeof(msg_mp3_sequence_list_t);
+    msg.data_bytes = (u8*)&list;
+    messagebroker_publish(&msg);
+}
+
+static void prv_publish_response(int result, u32 latency_us, bool was_prearmed)
+{
+    msg_mp3_command_response_t response;
+    response.success = (result == 0);
+    response.error_code = result;
+    response.latency_us = latency_us;
+    response.was_prearmed = was_prearmed;
+
+    msg_t resp_msg;
+    resp_msg.msg_id = MSG_0308;
+    resp_msg.data_size = sizeof(msg_mp3_command_response_t);
+    resp_msg.data_bytes = (u8*)&response;
+    messagebroker_publish(&resp_msg);
+}
+
+void mp3player_message_handler(const msg_t* const message)
+{
+    ASSERT(message != NULL);
+
+    // The sequence table does not involve the player - it is handled right away
+    if (message->msg_id == MSG_0310)
+    {
+        ASSERT(message->data_size == sizeof(msg_mp3_set_sequence_t));
+        prv_set_sequence((const msg_mp3_set_sequence_t*)message->data_bytes);
+        return;
+    }
+    if (message->msg_id == MSG_0311)
+    {
+        prv_publish_sequences();
+        return;
+    }
+
+    // Merge the command into the pending ones - the MP3 task talks to the player
+    xSemaphoreTake(pending_mutex, portMAX_DELAY);
+
+    switch (message->msg_id)
+    {
+        case MSG_0300: // Set volume
+        {
+            msg_mp3_set_volume_t* cmd = (msg_mp3_set_volume_t*)message->data_bytes;
+            pending_commands.has_volume = true;
+            pending_commands.volume = (cmd->volume > MP3_MAX_VOLUME) ? MP3_MAX_VOLUME : cmd->volume;
             break;
         }
 
-        case MSG_0303: // Volume up
+        case MSG_0301: // Set play mode
         {
-            result = mp3_player.volumeUp();
-
-            // Send response
-            msg_mp3_command_response_t response;
-            response.success = (result == 0);
-            response.error_code = result;
-
-            msg_t resp_msg;
-            resp_msg.msg_id = MSG_0308;
-            resp_msg.data_size = sizeof(msg_mp3_command_response_t);
-            resp_msg.data_bytes = (u8*)&response;
-            messagebroker_publish(&resp_msg);
+            msg_mp3_set_playmode_t* cmd = (msg_mp3_set_playmode_t*)message->data_bytes;
+            pending_commands.has_play_mode = true;
+            pending_commands.play_mode = cmd->mode;
             break;
         }
 
+        case MSG_0302: // Play song by index
+        {
+            msg_mp3_play_song_t* cmd = (msg_mp3_play_song_t*)message->data_bytes;
+            pending_commands.has_play = true;
+            pending_commands.song_index = cmd->song_index;
+            pending_commands.play_requested_at_us = cmd->requested_at_us;
+            pending_commands.track_offset = 0;
+            pending_commands.toggle_pause = false;
+            break;
+        }
+
+        case MSG_0303: // Volume up
         case MSG_0304: // Volume down
         {
-            result = mp3_player.volumeDown();
-
-            // Send response
-            msg_mp3_command_response_t response;
-            response.success = (result == 0);
-            response.error_code = result;
-
-            msg_t resp_msg;
-            resp_msg.msg_id = MSG_0308;
-            resp_msg.data_size = sizeof(msg_mp3_command_response_t);
-            resp_msg.data_bytes = (u8*)&response;
-            messagebroker_publish(&resp_msg);
+            u8 volume = pending_commands.has_volume ? pending_commands.volume : current_volume;
+            if ((message->msg_id == MSG_0303) && (volume < MP3_MAX_VOLUME))
+            {
+                volume++;
+            }
+            else if ((message->msg_id == MSG_0304) && (volume > 0))
+            {
+                volume--;
+            }
+            pending_commands.has_volume = true;
+            pending_commands.volume = volume;
             break;
         }
 
         case MSG_0305: // Next song
         {
-            mp3_player.next();
-
-            // Send response
-            msg_mp3_command_response_t response;
-            response.success = true;
-            response.error_code = 0;
-
-            msg_t resp_msg;
-            resp_msg.msg_id = MSG_0308;
-            resp_msg.data_size = sizeof(msg_mp3_command_response_t);
-            resp_msg.data_bytes = (u8*)&response;
-            messagebroker_publish(&resp_msg);
+            pending_commands.track_offset++;
             break;
         }
 
         case MSG_0306: // Previous song
         {
-            mp3_player.previous();
-
-            // Send response
-            msg_mp3_command_response_t response;
-            response.success = true;
-            response.error_code = 0;
-
-            msg_t resp_msg;
-            resp_msg.msg_id = MSG_0308;
-            resp_msg.data_size = sizeof(msg_mp3_command_response_t);
-            resp_msg.data_bytes = (u8*)&response;
-            messagebroker_publish(&resp_msg);
+            pending_commands.track_offset--;
             break;
         }
 
         case MSG_0307: // Pause or play
         {
-            mp3_player.pause_or_play();
-
-            // Send response
-            msg_mp3_command_response_t response;
-            response.success = true;
-            response.error_code = 0;
+            pending_commands.toggle_pause = !pending_commands.toggle_pause;
+            break;
+        }
 
-            msg_t resp_msg;
-            resp_msg.msg_id = MSG_0308;
-            resp_msg.data_size = sizeof(msg_mp3_command_response_t);
-            resp_msg.data_bytes = (u8*)&response;
-            messagebroker_publish(&resp_msg);
+        case MSG_0309: // Prepare song
+        {
+            msg_mp3_prepare_song_t* cmd = (msg_mp3_prepare_song_t*)message->data_bytes;
+            pending_commands.has_prepare = true;
+            pending_commands.prepare_song_index = cmd->song_index;
             break;
         }
 
         default: break;
     }
+
+    if (pending_commands.has_volume)
+    {
+        current_volume = pending_commands.volume;
+    }
+    if ((message->msg_id != MSG_0309) && (pending_commands.nof_responses < UINT8_MAX))
+    {
+        pending_commands.nof_responses++;
+    }
+
+    xSemaphoreGive(pending_mutex);
+
+    if (mp3player_task_handle != NULL)
+    {
+        xTaskNotifyGive(mp3player_task_handle);
+    }
 }
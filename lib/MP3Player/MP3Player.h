@@ -28,7 +28,7 @@
  *
  * This module provides an interface to control the WT2605C MP3 player module
  * through the message broker system. It supports play mode control, volume control,
- * and playback navigation.
+ * playback navigation and sequences of tracks (MSG_0310).
  */
 
 #ifndef MP3PLAYER_H
@@ -49,6 +49,14 @@ extern "C"
      */
     void mp3player_init(void);
 
+    /**
+     * @brief Start the MP3 player task
+     *
+     * The message handler only merges the received commands - this task sends them to the
+     * WT2605C and publishes the responses (MSG_0308).
+     */
+    void mp3player_start_task(void);
+
     /**
      * @brief Run periodic MP3 player tasks
      *
@@ -1,26 +1,104 @@
 #include "MessageBroker.h"
+#include "MessageRoutes.h"
 #include "custom_assert.h"
 
+#ifdef MESSAGEBROKER_INSTRUMENTATION
+#include "esp_timer.h"
+#endif
+
+#include <stdatomic.h>
+#include <string.h>
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
 // ---------------------------------------------------------------------------
 // Defines and Macros
 // ---------------------------------------------------------------------------
 #define MESSAGE_BROKER_CALLBACK_ARRAY_SIZE 10U
+#define MESSAGE_BROKER_QUEUE_LENGTH        8U
+#define MESSAGE_BROKER_POOL_NOF_BLOCKS     8U
+#define MESSAGE_BROKER_TASK_STACK_SIZE     4096U
+#define MESSAGE_BROKER_TASK_PRIORITY       1U
+#define MESSAGE_BROKER_MAX_NOF_HANDLERS    16U // Distinct handlers with statistics (instrumented builds)
 
 // ---------------------------------------------------------------------------
 // Private Types
 // ---------------------------------------------------------------------------
+#ifdef MESSAGEBROKER_STATIC_ROUTING
+typedef struct
+{
+    const msg_callback_t* callback_array;
+    u8 nof_callbacks;
+} msg_route_t;
+#else
 typedef struct
 {
     msg_id_e msg_id;
     msg_callback_t callback_array[MESSAGE_BROKER_CALLBACK_ARRAY_SIZE];
+    atomic_uint_fast8_t nof_callbacks; // Published after the slot was written - readers never see empty slots
 } msg_topic_t;
+#endif
+
+// ---------------------------------------------------------------------------
+// Private Function Declarations
+// ---------------------------------------------------------------------------
+static void prv_dispatcher_task(void* parameter);
+static u8 prv_get_block_index(const u8* data_bytes);
+static void prv_publish_system_status(void);
+#ifdef MESSAGEBROKER_INSTRUMENTATION
+static void prv_register_handler_stats(msg_callback_t callback);
+static void prv_record_handler_call(msg_callback_t callback, msg_id_e topic, u32 elapsed_us);
+static u8 prv_get_histogram_bucket(u32 elapsed_us);
+#endif
 
 // ---------------------------------------------------------------------------
 // Private Variables
 // ---------------------------------------------------------------------------
-static msg_topic_t* topic_library[E_TOPIC_LAST_TOPIC] = {NULL};
-static msg_topic_t topics[E_TOPIC_LAST_TOPIC] = {0};
+#ifdef MESSAGEBROKER_STATIC_ROUTING
+// One const handler list per routed topic and a (topic -> handler list) table - all generated into flash
+#define MESSAGE_BROKER_ROUTE_HANDLERS(topic, ...) static const msg_callback_t topic##_handlers[] = {__VA_ARGS__};
+#define MESSAGE_BROKER_ROUTE_ENTRY(topic, ...)                                                                         \
+    [topic] = {topic##_handlers, (u8)(sizeof(topic##_handlers) / sizeof(topic##_handlers[0]))},
+
+MESSAGE_ROUTES(MESSAGE_BROKER_ROUTE_HANDLERS)
+
+static const msg_route_t routes[E_TOPIC_LAST_TOPIC] = {MESSAGE_ROUTES(MESSAGE_BROKER_ROUTE_ENTRY)};
+#else
+static msg_topic_t topics[E_TOPIC_LAST_TOPIC];
+static portMUX_TYPE subscribe_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+static atomic_uint_fast32_t publish_counts[E_TOPIC_LAST_TOPIC];
 static bool is_initialized = false;
+static atomic_bool is_sealed = false;
+static QueueHandle_t deferred_queue = NULL;
+static TaskHandle_t dispatcher_task_handle = NULL;
+
+// Payload pool - fixed size blocks with a stack of free block indices and a reference count per block
+static msg_payload_t pool_blocks[MESSAGE_BROKER_POOL_NOF_BLOCKS];
+static u8 pool_refcounts[MESSAGE_BROKER_POOL_NOF_BLOCKS] = {0};
+static u8 pool_free_stack[MESSAGE_BROKER_POOL_NOF_BLOCKS] = {0};
+static u8 pool_nof_free_blocks = 0;
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Load of the deferred path - always kept, it only costs a few instructions per message
+static atomic_uint_fast32_t nof_deferred_dropped;
+static u8 queue_max_depth = 0;
+static u8 pool_min_free_blocks = 0;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED; // Protects the watermarks and the handler statistics
+
+// Trace of the recent publish calls - a concurrent publish may overwrite an entry that is being read
+static msg_trace_entry_t trace[MESSAGE_BROKER_TRACE_SIZE];
+static atomic_uint_fast32_t trace_position; // Number of publish calls traced so far
+
+#ifdef MESSAGEBROKER_INSTRUMENTATION
+// One entry per distinct handler - registered at subscription, so the set is fixed after sealing
+static msg_handler_stats_t handler_stats[MESSAGE_BROKER_MAX_NOF_HANDLERS];
+static u8 nof_handler_stats = 0;
+#endif
 
 // ---------------------------------------------------------------------------
 // Public Function Implementations
@@ -31,6 +109,7 @@ void messagebroker_init(void)
 
     for (u16 msg_id = (E_TOPIC_FIRST_TOPIC + 1); msg_id < E_TOPIC_LAST_TOPIC; msg_id++)
     {
+#ifndef MESSAGEBROKER_STATIC_ROUTING
         topics[msg_id].msg_id = msg_id;
 
         for (u16 i = 0; i < MESSAGE_BROKER_CALLBACK_ARRAY_SIZE; i++)
@@ -38,9 +117,41 @@ void messagebroker_init(void)
             topics[msg_id].callback_array[i] = NULL;
         }
 
-        topic_library[msg_id] = &topics[msg_id];
+        atomic_init(&topics[msg_id].nof_callbacks, 0);
+#endif
+        atomic_init(&publish_counts[msg_id], 0);
     }
+
+    for (u8 i = 0; i < MESSAGE_BROKER_POOL_NOF_BLOCKS; i++)
+    {
+        pool_refcounts[i] = 0;
+        pool_free_stack[i] = i;
+    }
+    pool_nof_free_blocks = MESSAGE_BROKER_POOL_NOF_BLOCKS;
+    pool_min_free_blocks = MESSAGE_BROKER_POOL_NOF_BLOCKS;
+    queue_max_depth = 0;
+    atomic_init(&nof_deferred_dropped, 0);
+    atomic_init(&trace_position, 0);
+
+    // Messages published deferred are queued until the dispatcher task drains them.
+    // Only the message header is queued - the payload stays in its pool block.
+    deferred_queue = xQueueCreate(MESSAGE_BROKER_QUEUE_LENGTH, sizeof(msg_t));
+    ASSERT(deferred_queue != NULL);
+
     is_initialized = true;
+
+    messagebroker_subscribe(MSG_0004, messagebroker_message_handler); // System status request
+}
+
+void messagebroker_start_task(void)
+{
+    ASSERT(is_initialized);
+
+    if (dispatcher_task_handle == NULL)
+    {
+        xTaskCreate(prv_dispatcher_task, "MsgBrokerTask", MESSAGE_BROKER_TASK_STACK_SIZE, NULL,
+                    MESSAGE_BROKER_TASK_PRIORITY, &dispatcher_task_handle);
+    }
 }
 
 void messagebroker_subscribe(msg_id_e topic, msg_callback_t in_function_ptr)
@@ -50,28 +161,67 @@ void messagebroker_subscribe(msg_id_e topic, msg_callback_t in_function_ptr)
         ASSERT(topic < E_TOPIC_LAST_TOPIC);
         ASSERT(in_function_ptr != NULL);
         ASSERT(is_initialized);
+        ASSERT(!atomic_load(&is_sealed)); // The subscriber table is immutable after the init phase
     }
 
-    bool is_subscribed = false;
-    bool is_already_subscribed = false;
+#ifdef MESSAGEBROKER_STATIC_ROUTING
+    // The routes are fixed at compile time - only check that the table matches the module's expectation
+    bool is_routed = false;
+    const msg_route_t* const route = &routes[topic];
 
-    for (u16 i = 0; i < MESSAGE_BROKER_CALLBACK_ARRAY_SIZE; i++)
+    for (u8 i = 0; i < route->nof_callbacks; i++)
     {
-        if (topic_library[topic]->callback_array[i] == NULL)
+        if (route->callback_array[i] == in_function_ptr)
         {
-            topic_library[topic]->callback_array[i] = in_function_ptr;
-            is_subscribed = true;
+            is_routed = true;
             break;
         }
-        else if (topic_library[topic]->callback_array[i] == in_function_ptr)
+    }
+
+    ASSERT(is_routed);
+#ifdef MESSAGEBROKER_INSTRUMENTATION
+    prv_register_handler_stats(in_function_ptr);
+#endif
+#else
+    bool is_subscribed = false;
+    bool is_already_subscribed = false;
+    msg_topic_t* const msg_topic = &topics[topic];
+
+    // Writers are serialized - publishers read the table without taking this lock
+    portENTER_CRITICAL(&subscribe_lock);
+
+    u8 nof_callbacks = (u8)atomic_load_explicit(&msg_topic->nof_callbacks, memory_order_relaxed);
+    for (u8 i = 0; i < nof_callbacks; i++)
+    {
+        if (msg_topic->callback_array[i] == in_function_ptr)
         {
             is_already_subscribed = true;
             break;
         }
     }
 
+    if (!is_already_subscribed && (nof_callbacks < MESSAGE_BROKER_CALLBACK_ARRAY_SIZE))
+    {
+        msg_topic->callback_array[nof_callbacks] = in_function_ptr;
+        atomic_store_explicit(&msg_topic->nof_callbacks, nof_callbacks + 1, memory_order_release);
+        is_subscribed = true;
+    }
+
+    portEXIT_CRITICAL(&subscribe_lock);
+
     ASSERT(is_subscribed);
     ASSERT(false == is_already_subscribed);
+#ifdef MESSAGEBROKER_INSTRUMENTATION
+    prv_register_handler_stats(in_function_ptr);
+#endif
+#endif
+}
+
+void messagebroker_seal(void)
+{
+    ASSERT(is_initialized);
+
+    atomic_store(&is_sealed, true);
 }
 
 void messagebroker_publish(const msg_t* const message)
@@ -83,17 +233,420 @@ void messagebroker_publish(const msg_t* const message)
         ASSERT(message->msg_id < E_TOPIC_LAST_TOPIC);
     }
 
-    msg_id_e topic = message->msg_id;
-    bool is_anyone_listening = false;
+    atomic_fetch_add_explicit(&publish_counts[message->msg_id], 1, memory_order_relaxed);
+
+    u32 trace_slot = (u32)atomic_fetch_add_explicit(&trace_position, 1, memory_order_relaxed);
+    trace[trace_slot & (MESSAGE_BROKER_TRACE_SIZE - 1)].msg_id = (u16)message->msg_id;
+    trace[trace_slot & (MESSAGE_BROKER_TRACE_SIZE - 1)].data_size = message->data_size;
+
+#ifdef MESSAGEBROKER_STATIC_ROUTING
+    const msg_route_t* const route = &routes[message->msg_id];
+    const msg_callback_t* const callback_array = route->callback_array;
+    const u8 nof_callbacks = route->nof_callbacks;
+#else
+    // Only the slots that were completely written before the count was published are visited
+    const msg_callback_t* const callback_array = topics[message->msg_id].callback_array;
+    const u8 nof_callbacks = (u8)atomic_load_explicit(&topics[message->msg_id].nof_callbacks, memory_order_acquire);
+#endif
+    ASSERT(nof_callbacks > 0); // Someone must be listening
+
+    for (u8 i = 0; i < nof_callbacks; i++)
+    {
+#ifdef MESSAGEBROKER_INSTRUMENTATION
+        s64 start_us = esp_timer_get_time();
+        callback_array[i](message);
+        prv_record_handler_call(callback_array[i], message->msg_id, (u32)(esp_timer_get_time() - start_us));
+#else
+        callback_array[i](message);
+#endif
+    }
+}
+
+u32 messagebroker_get_publish_count(msg_id_e topic)
+{
+    { // Input Checks
+        ASSERT(topic > E_TOPIC_FIRST_TOPIC);
+        ASSERT(topic < E_TOPIC_LAST_TOPIC);
+        ASSERT(is_initialized);
+    }
+
+    return (u32)atomic_load_explicit(&publish_counts[topic], memory_order_relaxed);
+}
+
+void messagebroker_get_status(msg_system_status_t* status)
+{
+    { // Input Checks
+        ASSERT(is_initialized);
+        ASSERT(status != NULL);
+    }
+
+    memset(status, 0, sizeof(*status));
+
+    for (u16 msg_id = (E_TOPIC_FIRST_TOPIC + 1); msg_id < E_TOPIC_LAST_TOPIC; msg_id++)
+    {
+        status->nof_publishes += (u32)atomic_load_explicit(&publish_counts[msg_id], memory_order_relaxed);
+    }
+    status->nof_deferred_dropped = (u32)atomic_load_explicit(&nof_deferred_dropped, memory_order_relaxed);
+
+    portENTER_CRITICAL(&stats_lock);
+    status->queue_max_depth = queue_max_depth;
+    status->pool_min_free_blocks = pool_min_free_blocks;
+#ifdef MESSAGEBROKER_INSTRUMENTATION
+    status->is_instrumented = true;
+    for (u8 i = 0; i < nof_handler_stats; i++)
+    {
+        if (handler_stats[i].max_us > status->slowest_handler_us)
+        {
+            status->slowest_handler_us = handler_stats[i].max_us;
+            status->slowest_topic = (u16)handler_stats[i].max_topic;
+        }
+    }
+#endif
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+bool messagebroker_get_handler_stats(u8 index, msg_handler_stats_t* stats)
+{
+    { // Input Checks
+        ASSERT(is_initialized);
+        ASSERT(stats != NULL);
+    }
+
+#ifdef MESSAGEBROKER_INSTRUMENTATION
+    bool is_valid = false;
+
+    portENTER_CRITICAL(&stats_lock);
+    if (index < nof_handler_stats)
+    {
+        *stats = handler_stats[index];
+        is_valid = true;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+
+    return is_valid;
+#else
+    (void)index;
+    return false;
+#endif
+}
+
+u8 messagebroker_get_trace(msg_trace_entry_t* entries, u8 max_entries)
+{
+    { // Input Checks
+        ASSERT(entries != NULL);
+    }
+
+    u32 position = (u32)atomic_load_explicit(&trace_position, memory_order_relaxed);
+    u32 nof_entries = (position < MESSAGE_BROKER_TRACE_SIZE) ? position : MESSAGE_BROKER_TRACE_SIZE;
+    if (nof_entries > max_entries)
+    {
+        nof_entries = max_entries;
+    }
+
+    for (u32 i = 0; i < nof_entries; i++)
+    {
+        entries[i] = trace[(position - nof_entries + i) & (MESSAGE_BROKER_TRACE_SIZE - 1)];
+    }
+
+    return (u8)nof_entries;
+}
+
+void messagebroker_reset_stats(void)
+{
+    ASSERT(is_initialized);
+
+    for (u16 msg_id = (E_TOPIC_FIRST_TOPIC + 1); msg_id < E_TOPIC_LAST_TOPIC; msg_id++)
+    {
+        atomic_store_explicit(&publish_counts[msg_id], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&nof_deferred_dropped, 0, memory_order_relaxed);
+
+    portENTER_CRITICAL(&pool_lock);
+    u8 nof_free_blocks = pool_nof_free_blocks;
+    portEXIT_CRITICAL(&pool_lock);
+
+    portENTER_CRITICAL(&stats_lock);
+    queue_max_depth = (u8)uxQueueMessagesWaiting(deferred_queue);
+    pool_min_free_blocks = nof_free_blocks;
+#ifdef MESSAGEBROKER_INSTRUMENTATION
+    for (u8 i = 0; i < nof_handler_stats; i++)
+    {
+        msg_callback_t callback = handler_stats[i].callback;
+        memset(&handler_stats[i], 0, sizeof(handler_stats[i]));
+        handler_stats[i].callback = callback;
+    }
+#endif
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+bool messagebroker_publish_deferred(const msg_t* const message)
+{
+    { // Input Checks
+        ASSERT(is_initialized);
+        ASSERT(message != NULL);
+        ASSERT(message->msg_id > E_TOPIC_FIRST_TOPIC);
+        ASSERT(message->msg_id < E_TOPIC_LAST_TOPIC);
+        ASSERT(message->data_size <= MESSAGE_BROKER_MAX_PAYLOAD_SIZE);
+        ASSERT((message->data_size == 0) || (message->data_bytes != NULL));
+    }
+
+    msg_t loaned_message;
+    loaned_message.msg_id = message->msg_id;
+    loaned_message.data_size = message->data_size;
+    loaned_message.data_bytes = NULL;
+
+    if (message->data_size > 0)
+    {
+        loaned_message.data_bytes = messagebroker_loan(message->data_size);
+        if (loaned_message.data_bytes == NULL)
+        {
+            return false; // Counted as dropped by the loan
+        }
+        memcpy(loaned_message.data_bytes, message->data_bytes, message->data_size);
+    }
+
+    return messagebroker_publish_loan(&loaned_message);
+}
+
+u8* messagebroker_loan(u16 size)
+{
+    { // Input Checks
+        ASSERT(is_initialized);
+        ASSERT(size <= MESSAGE_BROKER_MAX_PAYLOAD_SIZE);
+    }
+
+    u8* block = NULL;
+
+    portENTER_CRITICAL(&pool_lock);
+    if (pool_nof_free_blocks > 0)
+    {
+        pool_nof_free_blocks--;
+        u8 idx = pool_free_stack[pool_nof_free_blocks];
+        pool_refcounts[idx] = 1;
+        block = (u8*)&pool_blocks[idx];
+    }
+    u8 nof_free_blocks = pool_nof_free_blocks;
+    portEXIT_CRITICAL(&pool_lock);
 
-    for (u8 i = 0; i < MESSAGE_BROKER_CALLBACK_ARRAY_SIZE; i++)
+    if (block == NULL)
+    {
+        atomic_fetch_add_explicit(&nof_deferred_dropped, 1, memory_order_relaxed);
+    }
+    else
     {
-        msg_callback_t callback = topic_library[topic]->callback_array[i];
-        if (callback != NULL)
+        portENTER_CRITICAL(&stats_lock);
+        if (nof_free_blocks < pool_min_free_blocks)
         {
-            is_anyone_listening = true;
-            callback(message);
+            pool_min_free_blocks = nof_free_blocks;
         }
+        portEXIT_CRITICAL(&stats_lock);
+    }
+
+    return block;
+}
+
+bool messagebroker_publish_loan(const msg_t* const message)
+{
+    { // Input Checks
+        ASSERT(is_initialized);
+        ASSERT(message != NULL);
+        ASSERT(message->msg_id > E_TOPIC_FIRST_TOPIC);
+        ASSERT(message->msg_id < E_TOPIC_LAST_TOPIC);
+        ASSERT(message->data_size <= MESSAGE_BROKER_MAX_PAYLOAD_SIZE);
+        ASSERT((message->data_size == 0) || (message->data_bytes != NULL));
+    }
+
+    // Never block the publisher - a full queue is reported to the caller instead
+    if (xQueueSend(deferred_queue, message, 0) != pdTRUE)
+    {
+        if (message->data_bytes != NULL)
+        {
+            messagebroker_release(message->data_bytes);
+        }
+        atomic_fetch_add_explicit(&nof_deferred_dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    u8 depth = (u8)uxQueueMessagesWaiting(deferred_queue);
+    portENTER_CRITICAL(&stats_lock);
+    if (depth > queue_max_depth)
+    {
+        queue_max_depth = depth;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+
+    return true;
+}
+
+void messagebroker_retain(const u8* data_bytes)
+{
+    u8 idx = prv_get_block_index(data_bytes);
+
+    portENTER_CRITICAL(&pool_lock);
+    u8 refcount = pool_refcounts[idx];
+    if (refcount > 0)
+    {
+        pool_refcounts[idx]++;
+    }
+    portEXIT_CRITICAL(&pool_lock);
+
+    // A block that is not loaned out must not be retained
+    ASSERT(refcount > 0);
+}
+
+void messagebroker_release(const u8* data_bytes)
+{
+    u8 idx = prv_get_block_index(data_bytes);
+
+    portENTER_CRITICAL(&pool_lock);
+    u8 refcount = pool_refcounts[idx];
+    if (refcount > 0)
+    {
+        pool_refcounts[idx]--;
+        if (pool_refcounts[idx] == 0)
+        {
+            // Last reference is gone - hand the block back to the pool
+            pool_free_stack[pool_nof_free_blocks] = idx;
+            pool_nof_free_blocks++;
+        }
+    }
+    portEXIT_CRITICAL(&pool_lock);
+
+    // Releasing a block twice is a programming error
+    ASSERT(refcount > 0);
+}
+
+// ---------------------------------------------------------------------------
+// Private Function Implementations
+// ---------------------------------------------------------------------------
+static void prv_dispatcher_task(void* parameter)
+{
+    (void)parameter;
+
+    msg_t message;
+
+    while (1)
+    {
+        if (xQueueReceive(deferred_queue, &message, portMAX_DELAY) == pdTRUE)
+        {
+            // Run the subscribers on the dispatcher task instead of the publisher's task
+            messagebroker_publish(&message);
+
+            // The broker's reference is dropped once every subscriber was called
+            if (message.data_bytes != NULL)
+            {
+                messagebroker_release(message.data_bytes);
+            }
+        }
+    }
+}
+
+static u8 prv_get_block_index(const u8* data_bytes)
+{
+    const u8* pool_start = (const u8*)&pool_blocks[0];
+    const u8* pool_end = (const u8*)&pool_blocks[MESSAGE_BROKER_POOL_NOF_BLOCKS];
+
+    { // Input Checks
+        ASSERT(data_bytes >= pool_start);
+        ASSERT(data_bytes < pool_end);
+        ASSERT(((size_t)(data_bytes - pool_start) % sizeof(msg_payload_t)) == 0);
+    }
+
+    return (u8)((size_t)(data_bytes - pool_start) / sizeof(msg_payload_t));
+}
+
+static void prv_publish_system_status(void)
+{
+    msg_system_status_t status;
+    messagebroker_get_status(&status);
+
+    msg_t msg;
+    msg.msg_id = MSG_0005;
+    msg.data_size = sizeof(msg_system_status_t);
+    msg.data_bytes = (u8*)&status;
+
+    messagebroker_publish(&msg);
+}
+
+#ifdef MESSAGEBROKER_INSTRUMENTATION
+static void prv_register_handler_stats(msg_callback_t callback)
+{
+    portENTER_CRITICAL(&stats_lock);
+
+    bool is_registered = false;
+    for (u8 i = 0; i < nof_handler_stats; i++)
+    {
+        if (handler_stats[i].callback == callback)
+        {
+            is_registered = true;
+            break;
+        }
+    }
+
+    bool has_room = (nof_handler_stats < MESSAGE_BROKER_MAX_NOF_HANDLERS);
+    if (!is_registered && has_room)
+    {
+        memset(&handler_stats[nof_handler_stats], 0, sizeof(handler_stats[nof_handler_stats]));
+        handler_stats[nof_handler_stats].callback = callback;
+        nof_handler_stats++;
+    }
+
+    portEXIT_CRITICAL(&stats_lock);
+
+    ASSERT(is_registered || has_room);
+}
+
+static void prv_record_handler_call(msg_callback_t callback, msg_id_e topic, u32 elapsed_us)
+{
+    u8 bucket = prv_get_histogram_bucket(elapsed_us);
+
+    portENTER_CRITICAL(&stats_lock);
+    for (u8 i = 0; i < nof_handler_stats; i++)
+    {
+        msg_handler_stats_t* const stats = &handler_stats[i];
+        if (stats->callback == callback)
+        {
+            stats->nof_calls++;
+            stats->total_us += elapsed_us;
+            stats->histogram[bucket]++;
+            if (elapsed_us > stats->max_us)
+            {
+                stats->max_us = elapsed_us;
+                stats->max_topic = topic;
+            }
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+static u8 prv_get_histogram_bucket(u32 elapsed_us)
+{
+    u8 bucket = 0;
+    u32 value = elapsed_us / MESSAGE_BROKER_HISTOGRAM_FIRST_US;
+
+    while ((value > 0) && (bucket < (MESSAGE_BROKER_HISTOGRAM_NOF_BUCKETS - 1)))
+    {
+        value >>= 2;
+        bucket++;
+    }
+
+    return bucket;
+}
+#endif
+
+void messagebroker_message_handler(const msg_t* const message)
+{
+    ASSERT(message != NULL);
+
+    switch (message->msg_id)
+    {
+        case MSG_0004: // Request system status
+            prv_publish_system_status();
+            break;
+
+        default:
+            ASSERT(false);
+            break;
     }
-    ASSERT(is_anyone_listening != false);
 }
@@ -1,6 +1,7 @@
 #ifndef MESSAGEBROKER_H
 #define MESSAGEBROKER_H
 
+#include "MessageDefinitions.h"
 #include "MessageIDs.h"
 #include "custom_types.h"
 
@@ -9,6 +10,9 @@ extern "C"
 {
 #endif /* __cplusplus */
 
+// Largest payload that can be carried by a deferred message (one block of the payload pool)
+#define MESSAGE_BROKER_MAX_PAYLOAD_SIZE (sizeof(msg_payload_t))
+
     typedef struct
     {
         msg_id_e msg_id;
@@ -18,12 +22,133 @@ extern "C"
 
     typedef void (*msg_callback_t)(const msg_t* const message);
 
+// Buckets of the handler latency histogram: < 16 us, < 64 us, ... (x4 per bucket), the last one is open ended
+#define MESSAGE_BROKER_HISTOGRAM_NOF_BUCKETS 8U
+#define MESSAGE_BROKER_HISTOGRAM_FIRST_US    16U
+
+    typedef struct
+    {
+        msg_callback_t callback;
+        u32 nof_calls;
+        u64 total_us; // Cumulative execution time - includes handlers it published to synchronously
+        u32 max_us;
+        msg_id_e max_topic; // Topic that was dispatched during the longest call
+        u32 histogram[MESSAGE_BROKER_HISTOGRAM_NOF_BUCKETS];
+    } msg_handler_stats_t;
+
+// Publishes kept in the trace - a power of two
+#define MESSAGE_BROKER_TRACE_SIZE 16U
+
+    typedef struct
+    {
+        u16 msg_id; // msg_id_e
+        u16 data_size;
+    } msg_trace_entry_t;
+
     void messagebroker_init(void);
 
     void messagebroker_subscribe(msg_id_e topic, msg_callback_t callback);
 
     void messagebroker_publish(const msg_t* const message);
 
+    /**
+     * @brief Seal the subscriber table at the end of the init phase
+     *
+     * After sealing the table is immutable and further subscriptions assert.
+     * Publishing is safe from any task, before and after sealing.
+     */
+    void messagebroker_seal(void);
+
+    /**
+     * @brief Get the number of times a topic was published
+     * @param topic Topic to query
+     * @return Number of publish calls since init
+     */
+    u32 messagebroker_get_publish_count(msg_id_e topic);
+
+    /**
+     * @brief Get the summary of the broker statistics - the content of MSG_0005, without publishing it
+     * @param status Filled with the publish totals, the queue / pool watermarks and the slowest handler
+     */
+    void messagebroker_get_status(msg_system_status_t* status);
+
+    /**
+     * @brief Get the execution time statistics of a subscribed handler
+     *
+     * Only available when built with MESSAGEBROKER_INSTRUMENTATION - every handler call is timed then.
+     * @param index Handler index (0 .. number of subscribed handlers - 1)
+     * @param stats Filled with a consistent copy of the statistics
+     * @return true if the index is valid, false otherwise or if the instrumentation is not compiled in
+     */
+    bool messagebroker_get_handler_stats(u8 index, msg_handler_stats_t* stats);
+
+    /**
+     * @brief Get the most recent publish calls, the oldest one first
+     *
+     * A publish is traced before its subscribers are called, so a topic nobody listens to is the
+     * last entry when the broker asserts. Lock free - safe to call from an assertion handler.
+     * @param entries Filled with up to max_entries publish calls
+     * @param max_entries Size of entries
+     * @return Number of entries written
+     */
+    u8 messagebroker_get_trace(msg_trace_entry_t* entries, u8 max_entries);
+
+    /**
+     * @brief Reset the handler statistics, the publish counts and the queue / pool watermarks
+     */
+    void messagebroker_reset_stats(void);
+
+    /**
+     * @brief Start the dispatcher task that delivers deferred messages
+     */
+    void messagebroker_start_task(void);
+
+    /**
+     * @brief Publish a message asynchronously
+     *
+     * The payload is copied into a block of the payload pool and the subscribers are called later
+     * from the dispatcher task, so the publisher returns immediately.
+     * @param message Message to publish (data_size must not exceed MESSAGE_BROKER_MAX_PAYLOAD_SIZE)
+     * @return true if the message was queued, false if the pool or the queue is exhausted
+     */
+    bool messagebroker_publish_deferred(const msg_t* const message);
+
+    /**
+     * @brief Loan a payload block from the broker's payload pool
+     *
+     * The payload can be built directly in the block and then handed over with
+     * messagebroker_publish_loan() - no copy is made.
+     * @param size Required payload size (must not exceed MESSAGE_BROKER_MAX_PAYLOAD_SIZE)
+     * @return Pointer to the block, or NULL if the pool is exhausted
+     */
+    u8* messagebroker_loan(u16 size);
+
+    /**
+     * @brief Publish a message with a loaned payload asynchronously
+     *
+     * Ownership of the loaned block passes to the broker, which releases it after
+     * all subscribers were called. The block is also released if queuing fails.
+     * @param message Message whose data_bytes points to a block from messagebroker_loan()
+     * @return true if the message was queued, false if the queue is full
+     */
+    bool messagebroker_publish_loan(const msg_t* const message);
+
+    /**
+     * @brief Take an additional reference to a loaned payload block
+     *
+     * Subscribers use this to keep a deferred payload beyond their callback.
+     * @param data_bytes Pointer to a block from the payload pool
+     */
+    void messagebroker_retain(const u8* data_bytes);
+
+    /**
+     * @brief Drop a reference to a loaned payload block
+     *
+     * The block returns to the pool when its last reference is released.
+     * @param data_bytes Pointer to a block from the payload pool
+     */
+    void messagebroker_release(const u8* data_bytes);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
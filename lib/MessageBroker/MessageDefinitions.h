@@ -17,6 +17,11 @@ typedef enum
     MODULE_TIMESYNC,
     MODULE_WIFIMANAGER,
     MODULE_CONSOLE,
+    MODULE_POWERMANAGER,
+    MODULE_CLUSTERSYNC,
+    MODULE_SCHEDULESERVER,
+    MODULE_CRASHRECORD,
+    MODULE_MQTTBRIDGE,
     MODULE_ALL // Special value for all modules
 } module_id_e;
 
@@ -27,21 +32,105 @@ typedef struct
     char module_name[MODULE_NAME_MAX_LENGTH]; // Module name as string (alternative to ID)
 } msg_set_logging_t;
 
-// =============================
-// Time Sync Message Structures
-// =============================
+typedef struct
+{
+    // Empty - just a request
+} msg_system_get_status_t;
+
+typedef struct
+{
+    u32 nof_publishes;        // Publish calls over all topics since init
+    u32 nof_deferred_dropped; // Deferred messages that found the payload pool or the queue exhausted
+    u8 queue_max_depth;       // High-water mark of the deferred queue
+    u8 pool_min_free_blocks;  // Low-water mark of the payload pool
+    bool is_instrumented;     // Handler timing is compiled in (MESSAGEBROKER_INSTRUMENTATION)
+    u32 slowest_handler_us;   // Longest single handler call since the last reset (instrumented builds)
+    u16 slowest_topic;        // Topic (msg_id_e) that was dispatched during that call
+} msg_system_status_t;
+
+#define SYSTEM_PROFILE_MAX_TASKS    24 // Tasks reported per profile - the list is cut beyond
+#define SYSTEM_PROFILE_HISTORY_SIZE 12 // Periodic samples kept by the SystemMonitor
+#define SYSTEM_TASK_NAME_LENGTH     16 // Incl. the terminating zero (configMAX_TASK_NAME_LEN)
 
 typedef struct
 {
     // Empty - just a request
-} msg_time_get_request_t;
+} msg_system_get_profile_t;
 
 typedef struct
 {
-    time_t timestamp;   // Unix timestamp
-    struct tm timeinfo; // Broken-down time
-    bool time_valid;    // Whether time has been synchronized
-} msg_time_get_response_t;
+    u32 period_s; // Sample the heap and the CPU load this often into the history (0 = off)
+} msg_system_set_sampling_t;
+
+typedef struct
+{
+    char name[SYSTEM_TASK_NAME_LENGTH];
+    u32 stack_free_min; // Stack high-water mark - the least free stack in bytes since the task was created
+    u16 cpu_permille;   // Share of the CPU time since the previous profile
+    u8 priority;        // Current priority
+    u8 state;           // eTaskState
+} system_task_info_t;
+
+typedef struct
+{
+    u32 uptime_s;           // Seconds since boot when the sample was taken
+    u32 heap_free;          // Free heap in bytes
+    u32 heap_min_free;      // Low-water mark of the free heap since boot
+    u32 heap_largest_block; // Largest block that can be allocated - shows the fragmentation
+    u16 cpu_load_permille;  // CPU time not spent in the idle task since the previous sample
+} system_profile_sample_t;
+
+// MSG_0007 is published synchronously only, it does not fit into a payload block
+typedef struct
+{
+    bool is_cpu_valid;                                  // The CPU shares are valid (run-time stats compiled in)
+    u32 cpu_interval_ms;                                // Period the CPU shares refer to
+    u8 nof_tasks;                                       // Valid entries in tasks
+    u8 nof_tasks_total;                                 // Tasks in the system - more than nof_tasks if cut
+    system_task_info_t tasks[SYSTEM_PROFILE_MAX_TASKS]; // In the order of the task list of the kernel
+    system_profile_sample_t current;                    // Taken with this profile
+    u32 sampling_period_s;                              // Period of the history (0 = sampling off)
+    u8 nof_history;                                     // Valid entries in history
+
+    // Periodic samples, oldest first
+    system_profile_sample_t history[SYSTEM_PROFILE_HISTORY_SIZE];
+} msg_system_profile_t;
+
+#define SYSTEM_CRASH_FILE_LENGTH  32 // Incl. the terminating zero - the end of a longer path is kept
+#define SYSTEM_CRASH_EXPR_LENGTH  64 // Incl. the terminating zero
+#define SYSTEM_CRASH_TRACE_LENGTH 16 // Topics published right before the assertion failed
+
+typedef struct
+{
+    bool clear; // Forget the record after it was reported
+} msg_system_get_crash_record_t;
+
+// MSG_0010 is published synchronously only
+typedef struct
+{
+    bool is_valid;                           // An assertion failed since the record was cleared
+    u32 nof_assert_resets;                   // Resets by failed assertions since the record was cleared
+    u32 nof_boots;                           // Boots since the record was cleared, incl. the current one
+    char file[SYSTEM_CRASH_FILE_LENGTH];     // Of the latest failed assertion
+    u32 line;
+    char expr[SYSTEM_CRASH_EXPR_LENGTH];
+    char task_name[SYSTEM_TASK_NAME_LENGTH]; // Task that failed the assertion
+    u32 uptime_ms;                           // Time since boot when it failed
+    time_t timestamp;                        // Unix timestamp when it failed (0 = time was not valid)
+    u8 nof_trace;                            // Valid entries in trace
+    u16 trace[SYSTEM_CRASH_TRACE_LENGTH];    // Published topics (msg_id_e), oldest first
+} msg_system_crash_record_t;
+
+// =============================
+// Time Sync Message Structures
+// =============================
+
+typedef struct
+{
+    time_t timestamp; // Unix timestamp right after the synchronization
+    s32 clock_step_s; // Step of the clock detected at this sync (> 0 = forward, 0 = slewed or first sync)
+    bool is_slewing;  // The remaining offset is being slewed out smoothly
+} msg_time_sync_notification_t;
 
 // =============================
 // WiFi Credentials Message Structures
@@ -83,6 +172,15 @@ typedef struct
     int rssi; // Signal strength
 } msg_wifi_connection_status_t;
 
+typedef struct
+{
+    bool use_static_ip; // false = DHCP, the addresses below are ignored
+    u32 ip;             // IPv4 addresses as stored by IPAddress (network byte order)
+    u32 gateway;
+    u32 subnet;
+    u32 dns;
+} msg_wifi_set_ip_config_t;
+
 // =============================
 // MP3 Player Message Structures
 // =============================
@@ -108,13 +206,55 @@ typedef struct
 
 typedef struct
 {
-    u16 song_index; // Song index to play
+    u16 song_index;      // Song index to play
+    s64 requested_at_us; // esp_timer time of the request for the latency measurement (0 = not measured)
 } msg_mp3_play_song_t;
 
 typedef struct
 {
-    bool success;   // Whether command was successful
-    int error_code; // Error code if not successful
+    u16 song_index; // Song index to cue for the next play
+} msg_mp3_prepare_song_t;
+
+#define MP3_SEQUENCE_MAX_STEPS 4      // Tracks per playback sequence
+#define MP3_MAX_SEQUENCES      8      // Playback sequences stored by the MP3Player
+#define MP3_SEQUENCE_SONG_BASE 0x3FF8 // Song indices from here on play sequence (index - base) - fits a schedule
+
+typedef struct
+{
+    u16 song_index; // Track on the SD card
+    u8 volume;      // Volume of this track (0 = keep the current volume)
+    u16 gap_ms;     // Silence after this track before the next one starts
+} mp3_sequence_step_t;
+
+typedef struct
+{
+    u8 nof_steps; // 0 = not defined
+    mp3_sequence_step_t steps[MP3_SEQUENCE_MAX_STEPS];
+} mp3_sequence_t;
+
+typedef struct
+{
+    u8 sequence_id;          // 0 - (MP3_MAX_SEQUENCES - 1)
+    mp3_sequence_t sequence; // No steps = delete the sequence
+} msg_mp3_set_sequence_t;
+
+typedef struct
+{
+    // Empty - just a request
+} msg_mp3_get_sequences_t;
+
+// MSG_0312 is published synchronously only, it does not fit into a payload block
+typedef struct
+{
+    mp3_sequence_t sequences[MP3_MAX_SEQUENCES]; // Indexed by the sequence ID
+} msg_mp3_sequence_list_t;
+
+typedef struct
+{
+    bool success;      // Whether command was successful
+    int error_code;    // Error code if not successful
+    u32 latency_us;    // Time from the play request until the player acknowledged it (0 = no play)
+    bool was_prearmed; // Whether the play only had to resume a cued song
 } msg_mp3_command_response_t;
 
 // =============================
@@ -125,6 +265,7 @@ typedef struct
 {
     u8 hour;         // Hour (0-23)
     u8 minute;       // Minute (0-59)
+    u8 second;       // Second (0-59) - 0 schedules at the start of the minute
     u16 song_index;  // Song index to play
     u8 weekday_mask; // Weekday mask: Bit 0=Monday, Bit 1=Tuesday, ..., Bit 6=Sunday (0x7F = all days)
 } msg_schedule_add_t;
@@ -145,19 +286,261 @@ typedef struct
     int schedule_id; // Schedule ID (-1 if not applicable)
 } msg_schedule_response_t;
 
+#define SCHEDULE_LIST_PAGE_SIZE 8 // Schedules per MSG_0406 page
+
 typedef struct
 {
-    int schedule_id;
+    u16 start_index;          // Position in the time sorted list of the first schedule to send
+    module_id_e requested_by; // Module the page is meant for - the other MSG_0406 subscribers ignore it
+} msg_schedule_list_request_t;
+
+typedef struct
+{
+    u16 schedule_id;
     u8 hour;
     u8 minute;
+    u8 second;
     u16 song_index;
     u8 weekday_mask; // Weekday mask: Bit 0=Monday, Bit 1=Tuesday, ..., Bit 6=Sunday
 } schedule_info_t;
 
 typedef struct
 {
-    u8 count;                      // Number of schedules
-    schedule_info_t schedules[20]; // Schedule entries
+    u16 total_count;                                    // Number of schedules in total
+    u16 start_index;                                    // Position of schedules[0] in the time sorted list
+    u8 count;                                           // Number of schedules on this page
+    module_id_e requested_by;                           // Module that requested the page
+    schedule_info_t schedules[SCHEDULE_LIST_PAGE_SIZE]; // Schedule entries
 } msg_schedule_list_t;
 
+#define SCHEDULE_TIMING_LOG_SIZE 8 // Most recent triggers in MSG_0408
+
+typedef struct
+{
+    // Empty - just a request
+} msg_schedule_get_timing_t;
+
+typedef struct
+{
+    time_t due;       // Unix timestamp the schedules were due at
+    s32 error_us;     // Measured trigger time minus the due time
+    u8 nof_schedules; // Schedules played at this point in time
+} schedule_trigger_event_t;
+
+typedef struct
+{
+    u32 nof_triggers;                                          // Points in time triggered since boot
+    s32 max_error_us;                                          // Largest trigger error since boot
+    u8 count;                                                  // Valid entries in events, oldest first
+    schedule_trigger_event_t events[SCHEDULE_TIMING_LOG_SIZE]; // Most recent triggers
+} msg_schedule_timing_t;
+
+// MSG_0409 carries an array of msg_schedule_add_t - data_size / sizeof(msg_schedule_add_t) entries.
+// It is published synchronously only, the array does not fit into a payload block.
+
+typedef struct
+{
+    bool success;      // All schedules were replaced and written to flash
+    u16 nof_schedules; // Number of schedules now configured
+    u16 error_index;   // First rejected entry (if not successful)
+} msg_schedule_import_response_t;
+
+#define SCHEDULE_MAX_EXCEPTIONS 16 // Exception calendar entries - all of them fit into one MSG_0414
+
+typedef struct
+{
+    u32 first_date; // First date without schedules as YYYYMMDD (e.g. 20261221)
+    u32 last_date;  // Last date without schedules as YYYYMMDD (same as first_date for a single day)
+} msg_schedule_add_exception_t;
+
+typedef struct
+{
+    int exception_id; // ID of the exception to remove (-1 = all)
+} msg_schedule_remove_exception_t;
+
+typedef struct
+{
+    // Empty - just a request
+} msg_schedule_get_exceptions_t;
+
+typedef struct
+{
+    u8 exception_id;
+    u32 first_date; // YYYYMMDD
+    u32 last_date;  // YYYYMMDD
+} schedule_exception_info_t;
+
+// MSG_0414 is published synchronously only
+typedef struct
+{
+    u8 count;                                                      // Valid entries in exceptions
+    schedule_exception_info_t exceptions[SCHEDULE_MAX_EXCEPTIONS]; // Sorted by their ID
+} msg_schedule_exception_list_t;
+
+#define SCHEDULE_IMPORT_TOKEN_MAX_LENGTH 32 // Including the terminator
+
+typedef struct
+{
+    char token[SCHEDULE_IMPORT_TOKEN_MAX_LENGTH]; // Required after IMPORT (empty = TCP import disabled)
+} msg_schedule_set_import_token_t;
+
+// =============================
+// Power Management Message Structures
+// =============================
+
+typedef struct
+{
+    bool low_power_enabled; // Enable or disable light sleep between wake-up deadlines
+} msg_power_set_mode_t;
+
+typedef struct
+{
+    module_id_e module_id; // Module that needs the CPU at wake_at
+    time_t wake_at;        // Unix timestamp of the deadline (0 = no deadline)
+} msg_power_wake_deadline_t;
+
+typedef struct
+{
+    // Empty - just a request
+} msg_power_get_stats_t;
+
+typedef struct
+{
+    bool low_power_enabled;
+    u64 active_time_ms;        // Time spent awake with full power WiFi
+    u64 modem_sleep_time_ms;   // Time kept awake with WiFi modem sleep (around deadlines and activity)
+    u64 sleep_allowed_time_ms; // Time the awake lock was released - the chip only sleeps while all tasks are idle
+    u32 nof_sleep_windows;     // Number of windows with the awake lock released
+    u32 nof_deadline_wakes;    // Windows ended by a wake-up deadline
+    u32 nof_activity_wakes;    // Windows ended by console or module activity (e.g. a playing sequence)
+    time_t next_wake_at;       // Earliest registered deadline (0 = none)
+} msg_power_stats_t;
+
+typedef struct
+{
+    bool low_power_enabled; // Current power mode
+    bool woke_from_sleep;   // Set when the notification is sent at the end of a light sleep window
+    u32 slept_ms;           // Duration of that window
+} msg_power_state_t;
+
+// =============================
+// Cluster Message Structures
+// =============================
+
+typedef enum
+{
+    CLUSTER_ROLE_OFF = 0, // Standalone node
+    CLUSTER_ROLE_LEADER,  // Announces its scheduled plays to the followers
+    CLUSTER_ROLE_FOLLOWER // Plays what the leader announces
+} cluster_role_e;
+
+typedef struct
+{
+    cluster_role_e role; // New role - persisted
+} msg_cluster_set_role_t;
+
+typedef struct
+{
+    // Empty - just a request
+} msg_cluster_get_status_t;
+
+typedef struct
+{
+    cluster_role_e role;
+    bool is_joined;           // Connected and member of the multicast group
+    bool is_offset_valid;     // A follower heard the leader and knows its clock
+    s32 leader_clock_diff_us; // Leader wall clock minus the local wall clock (follower, 0 if unknown)
+    u32 last_packet_age_ms;   // Time since the last packet of the leader (follower, UINT32_MAX = never)
+    u32 nof_sent;             // Packets sent (leader)
+    u32 nof_received;         // Valid packets received (follower)
+    u32 nof_plays;            // Plays announced (leader) or started (follower)
+    u32 nof_late_plays;       // Announcements that arrived too late to be played (follower)
+} msg_cluster_status_t;
+
+typedef struct
+{
+    u16 song_index; // Song to play
+    s64 play_at_us; // Wall clock in us since the epoch at which the song is due
+} msg_cluster_announce_t;
+
+// =============================
+// MQTT Bridge Message Structures
+// =============================
+
+#define MQTT_URI_MAX_LENGTH   64 // Incl. the terminating zero
+#define MQTT_TOPIC_MAX_LENGTH 32 // Incl. the terminating zero
+#define MQTT_MIN_PERIOD_S     10 // Shortest telemetry period - the telemetry must not load the WiFi
+
+typedef struct
+{
+    char uri[MQTT_URI_MAX_LENGTH];          // Broker, e.g. "mqtt://192.168.1.10:1883" (empty = bridge off) - persisted
+    char base_topic[MQTT_TOPIC_MAX_LENGTH]; // Prefix of all topics of this node, e.g. "airgong/hall"
+    u16 telemetry_period_s;                 // Sample the telemetry this often (0 = keep the current period)
+} msg_mqtt_set_config_t;
+
+typedef struct
+{
+    // Empty - just a request
+} msg_mqtt_get_status_t;
+
+// MSG_0702 is published synchronously only
+typedef struct
+{
+    bool is_enabled;   // A broker is configured
+    bool is_connected; // Connected to the broker
+    char uri[MQTT_URI_MAX_LENGTH];
+    char base_topic[MQTT_TOPIC_MAX_LENGTH];
+    u16 telemetry_period_s;
+    u32 nof_published;       // Event and telemetry batches sent to the broker
+    u32 nof_received;        // Commands received and published on the message broker
+    u32 nof_rejected;        // Commands with an unknown topic, a wrong size or above the rate limit
+    u16 nof_queued_events;   // Events waiting for the next batch
+    u16 nof_queued_samples;  // Telemetry samples waiting for the next batch
+    u32 nof_dropped_events;  // Events dropped because the queue was full
+    u32 nof_dropped_samples; // Oldest samples overwritten while the broker was not reachable
+} msg_mqtt_status_t;
+
+// =============================
+// Payload Pool Sizing
+// =============================
+
+// Union of all message payloads - its size is the block size of the broker's payload pool
+typedef union
+{
+    msg_set_logging_t set_logging;
+    msg_system_status_t system_status;
+    msg_system_set_sampling_t system_set_sampling;
+    msg_system_get_crash_record_t system_get_crash_record;
+    msg_time_sync_notification_t time_sync_notification;
+    msg_wifi_set_credentials_t wifi_set_credentials;
+    msg_wifi_credentials_response_t wifi_credentials_response;
+    msg_wifi_connection_status_t wifi_connection_status;
+    msg_wifi_set_ip_config_t wifi_set_ip_config;
+    msg_mp3_set_volume_t mp3_set_volume;
+    msg_mp3_set_playmode_t mp3_set_playmode;
+    msg_mp3_play_song_t mp3_play_song;
+    msg_mp3_prepare_song_t mp3_prepare_song;
+    msg_mp3_set_sequence_t mp3_set_sequence;
+    msg_mp3_command_response_t mp3_command_response;
+    msg_schedule_add_t schedule_add;
+    msg_schedule_remove_t schedule_remove;
+    msg_schedule_enable_t schedule_enable;
+    msg_schedule_response_t schedule_response;
+    msg_schedule_list_request_t schedule_list_request;
+    msg_schedule_list_t schedule_list;
+    msg_schedule_timing_t schedule_timing;
+    msg_schedule_import_response_t schedule_import_response;
+    msg_schedule_add_exception_t schedule_add_exception;
+    msg_schedule_remove_exception_t schedule_remove_exception;
+    msg_schedule_set_import_token_t schedule_set_import_token;
+    msg_power_set_mode_t power_set_mode;
+    msg_power_wake_deadline_t power_wake_deadline;
+    msg_power_stats_t power_stats;
+    msg_power_state_t power_state;
+    msg_cluster_set_role_t cluster_set_role;
+    msg_cluster_status_t cluster_status;
+    msg_cluster_announce_t cluster_announce;
+    msg_mqtt_set_config_t mqtt_set_config;
+} msg_payload_t;
+
 #endif // MESSAGE_DEFINITIONS_H
@@ -12,19 +12,27 @@ typedef enum
     MSG_0001, // Chaos Elephant (Placeholder)
     MSG_0002, // Tickly Giraffe (Placeholder)
     MSG_0003, // Toggle Logging in Module
-    MSG_0004, // Request System Status
+    MSG_0004, // Request System Status (message broker statistics)
+    MSG_0005, // System Status response
+    MSG_0006, // Request system profile (tasks, stacks, heap)
+    MSG_0007, // System profile response
+    MSG_0008, // Set system profile sampling period
+    MSG_0009, // Request the crash record (failed assertion before the last reset)
+    MSG_0010, // Crash record response
 
     // Messages for the Modules
 
     // Time Sync Messages
-    MSG_0100, // Request current time
-    MSG_0101, // Response with current time
+    MSG_0100, // Request current time (unused - replaced by timesync_get_snapshot())
+    MSG_0101, // Response with current time (unused - replaced by timesync_get_snapshot())
+    MSG_0102, // Time synchronized notification
 
     // WiFi Credentials Messages
     MSG_0200, // Set WiFi SSID and Password
     MSG_0201, // Get current WiFi credentials
     MSG_0202, // Response with WiFi credentials
     MSG_0203, // WiFi connection status update
+    MSG_0204, // Set IP configuration (DHCP or static)
 
     // MP3 Player Messages
     MSG_0300, // Set volume
@@ -36,15 +44,46 @@ typedef enum
     MSG_0306, // Previous song
     MSG_0307, // Pause or play
     MSG_0308, // Command response
+    MSG_0309, // Prepare song (pre-arm before a scheduled play)
+    MSG_0310, // Define or delete a playback sequence
+    MSG_0311, // Request all playback sequences
+    MSG_0312, // Playback sequence list response
 
     // Application Control Messages
     MSG_0400, // Add schedule
     MSG_0401, // Remove schedule
-    MSG_0402, // List schedules
+    MSG_0402, // List schedules (one page)
     MSG_0403, // Clear all schedules
     MSG_0404, // Enable/disable scheduling
     MSG_0405, // Schedule command response
-    MSG_0406, // Schedule list response
+    MSG_0406, // Schedule list response (one page)
+    MSG_0407, // Request schedule trigger timing
+    MSG_0408, // Schedule trigger timing response
+    MSG_0409, // Replace all schedules (bulk import)
+    MSG_0410, // Bulk import response
+    MSG_0411, // Add schedule exception (date range without schedules)
+    MSG_0412, // Remove schedule exception
+    MSG_0413, // List schedule exceptions
+    MSG_0414, // Schedule exception list response
+    MSG_0415, // Set the import token of the ScheduleServer
+
+    // Power Management Messages
+    MSG_0500, // Set power mode
+    MSG_0501, // Register wake-up deadline
+    MSG_0502, // Request power statistics
+    MSG_0503, // Power statistics response
+    MSG_0504, // Power state notification
+
+    // Cluster Messages
+    MSG_0600, // Set cluster role
+    MSG_0601, // Request cluster status
+    MSG_0602, // Cluster status response
+    MSG_0603, // Upcoming scheduled play (announced to the followers by a leader)
+
+    // MQTT Bridge Messages
+    MSG_0700, // Set MQTT broker configuration
+    MSG_0701, // Request MQTT bridge status
+    MSG_0702, // MQTT bridge status response
 
     E_TOPIC_LAST_TOPIC // Last Topic - DO NOT USE (Only for boundary checks)
 } msg_id_e;
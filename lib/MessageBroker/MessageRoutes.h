@@ -0,0 +1,104 @@
+#ifndef MESSAGEROUTES_H_
+#define MESSAGEROUTES_H_
+
+#include "MessageBroker.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+    // Message handlers of the modules - referenced by the static routing table below
+    void appcontrol_message_handler(const msg_t* const message);
+    void mp3player_message_handler(const msg_t* const message);
+    void timesync_message_handler(const msg_t* const message);
+    void wifimanager_message_handler(const msg_t* const message);
+    void console_msgbroker_test_handler(const msg_t* const message);
+    void console_wifi_message_handler(const msg_t* const message);
+    void console_mp3_message_handler(const msg_t* const message);
+    void console_schedule_message_handler(const msg_t* const message);
+    void powermanager_message_handler(const msg_t* const message);
+    void console_power_message_handler(const msg_t* const message);
+    void logger_message_handler(const msg_t* const message);
+    void messagebroker_message_handler(const msg_t* const message);
+    void console_system_message_handler(const msg_t* const message);
+    void clustersync_message_handler(const msg_t* const message);
+    void console_cluster_message_handler(const msg_t* const message);
+    void scheduleserver_message_handler(const msg_t* const message);
+    void systemmonitor_message_handler(const msg_t* const message);
+    void crashrecord_message_handler(const msg_t* const message);
+    void mqttbridge_message_handler(const msg_t* const message);
+    void console_mqtt_message_handler(const msg_t* const message);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+/**
+ * Static Routing Table - ROUTE(topic, handler, ...)
+ *
+ * Only used when MESSAGEBROKER_STATIC_ROUTING is defined. The broker then builds its
+ * (topic -> handler list) map from this table at compile time and places it in flash.
+ * The modules keep calling messagebroker_subscribe() - in static mode this only verifies
+ * that the subscription is present in the table. Keep it in sync with the subscribe calls.
+ */
+#define MESSAGE_ROUTES(ROUTE)                                                                                          \
+    ROUTE(MSG_0001, console_msgbroker_test_handler)                                                                    \
+    ROUTE(MSG_0003, logger_message_handler)                                                                            \
+    ROUTE(MSG_0004, messagebroker_message_handler)                                                                     \
+    ROUTE(MSG_0005, console_system_message_handler)                                                                    \
+    ROUTE(MSG_0006, systemmonitor_message_handler)                                                                     \
+    ROUTE(MSG_0007, console_system_message_handler)                                                                    \
+    ROUTE(MSG_0008, systemmonitor_message_handler)                                                                     \
+    ROUTE(MSG_0009, crashrecord_message_handler)                                                                       \
+    ROUTE(MSG_0010, console_system_message_handler)                                                                    \
+    ROUTE(MSG_0102, appcontrol_message_handler, powermanager_message_handler)                                          \
+    ROUTE(MSG_0200, wifimanager_message_handler)                                                                       \
+    ROUTE(MSG_0201, wifimanager_message_handler)                                                                       \
+    ROUTE(MSG_0202, console_wifi_message_handler)                                                                      \
+    ROUTE(MSG_0203, console_wifi_message_handler, timesync_message_handler, clustersync_message_handler,               \
+          scheduleserver_message_handler, mqttbridge_message_handler)                                                  \
+    ROUTE(MSG_0204, wifimanager_message_handler)                                                                       \
+    ROUTE(MSG_0300, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0301, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0302, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0303, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0304, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0305, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0306, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0307, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0308, console_mp3_message_handler, mqttbridge_message_handler)                                           \
+    ROUTE(MSG_0309, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0310, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0311, mp3player_message_handler)                                                                         \
+    ROUTE(MSG_0312, console_mp3_message_handler)                                                                       \
+    ROUTE(MSG_0400, appcontrol_message_handler)                                                                        \
+    ROUTE(MSG_0401, appcontrol_message_handler)                                                                        \
+    ROUTE(MSG_0402, appcontrol_message_handler)                                                                        \
+    ROUTE(MSG_0403, appcontrol_message_handler)                                                                        \
+    ROUTE(MSG_0404, appcontrol_message_handler)                                                                        \
+    ROUTE(MSG_0405, console_schedule_message_handler, mqttbridge_message_handler)                                      \
+    ROUTE(MSG_0406, console_schedule_message_handler, scheduleserver_message_handler)                                  \
+    ROUTE(MSG_0407, appcontrol_message_handler)                                                                        \
+    ROUTE(MSG_0408, console_schedule_message_handler)                                                                  \
+    ROUTE(MSG_0409, appcontrol_message_handler)                                                                        \
+    ROUTE(MSG_0410, scheduleserver_message_handler)                                                                    \
+    ROUTE(MSG_0411, appcontrol_message_handler)                                                                        \
+    ROUTE(MSG_0412, appcontrol_message_handler)                                                                        \
+    ROUTE(MSG_0413, appcontrol_message_handler)                                                                        \
+    ROUTE(MSG_0414, console_schedule_message_handler)                                                                  \
+    ROUTE(MSG_0415, scheduleserver_message_handler)                                                                    \
+    ROUTE(MSG_0500, powermanager_message_handler)                                                                      \
+    ROUTE(MSG_0501, powermanager_message_handler)                                                                      \
+    ROUTE(MSG_0502, powermanager_message_handler)                                                                      \
+    ROUTE(MSG_0503, console_power_message_handler)                                                                     \
+    ROUTE(MSG_0504, appcontrol_message_handler, wifimanager_message_handler, timesync_message_handler)                 \
+    ROUTE(MSG_0600, clustersync_message_handler)                                                                       \
+    ROUTE(MSG_0601, clustersync_message_handler)                                                                       \
+    ROUTE(MSG_0602, console_cluster_message_handler)                                                                   \
+    ROUTE(MSG_0603, clustersync_message_handler)                                                                       \
+    ROUTE(MSG_0700, mqttbridge_message_handler)                                                                        \
+    ROUTE(MSG_0701, mqttbridge_message_handler)                                                                        \
+    ROUTE(MSG_0702, console_mqtt_message_handler)
+
+#endif /* MESSAGEROUTES_H_ */
@@ -0,0 +1,899 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file MqttBridge.cpp
+ * @brief Bridge between the message broker and an MQTT broker
+ *
+ * All topics of a node start with the configured base topic:
+ *   <base>/online      "1" while connected, "0" otherwise (retained, the broker sends it as last will)
+ *   <base>/cmd/<NNNN>  Publishes MSG_<NNNN> - the payload is the message struct as is (little-endian,
+ *                      the layout of MessageDefinitions.h). Only the topics of inbound_topics are accepted.
+ *   <base>/evt         Batch of events - one record [u16 msg_id][u16 data_size][payload] per message
+ *   <base>/tlm         Batch of telemetry samples, see below
+ *
+ * The broker handler only appends an event to a buffer and wakes the task, all MQTT traffic is sent by
+ * the MqttBridge task. Events are collected for up to a second and leave as one MQTT message. While the
+ * broker is not reachable the buffer keeps them - once it is full further events are dropped. The
+ * commands are published in the MQTT client task and are rate limited, so that a flooding client cannot
+ * keep the dispatch path busy.
+ *
+ * The telemetry is sampled every period and sent once MQTTBRIDGE_TLM_BATCH samples were collected. The
+ * period runs on the esp_timer, and the next sample is registered with the PowerManager as a wake-up
+ * deadline (MSG_0501). While the broker is not reachable the ring keeps the latest MQTTBRIDGE_TLM_HISTORY
+ * samples. A batch is
+ * delta encoded:
+ *   header   u8 version, u8 nof_fields, u8 nof_samples, u16 period_s (little-endian)
+ *   samples  nof_fields zigzag varints per sample (in the order of tlm_field_e), oldest sample first.
+ *            The first sample carries the values, the later ones the difference to the previous sample
+ *            modulo 2^32. Apart from the uptime most fields hardly change, so most of them take a byte.
+ */
+
+#include "MqttBridge.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <WiFi.h>
+#include <time.h>
+#include "ApplicationControl.h"
+#include "Logger.h"
+#include "MessageBroker.h"
+#include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "custom_assert.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "mqtt_client.h"
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// ###########################################################################
+// # Private defines
+// ###########################################################################
+#define PREFERENCES_NAMESPACE        "mqtt"
+#define PREF_KEY_CONFIG              "config"
+#define MQTTBRIDGE_DEFAULT_PERIOD_S  60    // Telemetry sampling period until one is configured
+#define MQTTBRIDGE_KEEPALIVE_S       120
+#define MQTTBRIDGE_RETRY_MS          10000 // Wait time after the MQTT client could not be started
+#define MQTTBRIDGE_CLIENT_STACK_SIZE 6144  // The commands are published from the MQTT client task
+#define MQTTBRIDGE_TOPIC_LENGTH      (MQTT_TOPIC_MAX_LENGTH + 16) // Base topic plus the longest suffix
+#define US_PER_SECOND                1000000LL
+#define TIMESTAMP_VALID_MIN          1000000000 // Timestamp after year 2001
+
+// Events
+#define MQTTBRIDGE_EVENT_BUFFER_SIZE 1024
+#define MQTTBRIDGE_EVENT_FLUSH_LEVEL 768  // A batch beyond this is sent right away (3/4 of the buffer)
+#define MQTTBRIDGE_EVENT_WINDOW_MS   1000 // Events are collected this long after the first one of a batch
+
+// Telemetry
+#define MQTTBRIDGE_TLM_VERSION     1
+#define MQTTBRIDGE_TLM_BATCH       10  // Samples per telemetry batch
+#define MQTTBRIDGE_TLM_HISTORY     60  // Samples kept while the broker is not reachable
+#define MQTTBRIDGE_PUBLISH_GAP_MS  200 // Pause between two batches of a backlog
+#define MQTTBRIDGE_VARINT_MAX_SIZE 5   // Bytes of a 32 bit value
+
+// Command rate limit
+#define MQTTBRIDGE_RX_BURST     8   // Commands accepted at once
+#define MQTTBRIDGE_RX_REFILL_MS 250 // One more command is accepted after this time
+
+// Task notification bits
+#define MQTTBRIDGE_EVENT_BIT_CHANGED (1U << 0) // The configuration, the WiFi or the broker connection changed
+#define MQTTBRIDGE_EVENT_BIT_QUEUED  (1U << 1) // An event was queued
+
+// ###########################################################################
+// # Type Definitions
+// ###########################################################################
+typedef struct
+{
+    msg_id_e msg_id;
+    u16 number; // NNNN of the command topic
+    u16 data_size;
+} mqtt_inbound_topic_t;
+
+typedef struct __attribute__((packed))
+{
+    u16 msg_id; // msg_id_e
+    u16 data_size;
+} mqtt_event_record_header_t;
+
+typedef struct __attribute__((packed))
+{
+    u8 version;
+    u8 nof_fields;
+    u8 nof_samples;
+    u16 period_s;
+} mqtt_tlm_header_t;
+
+typedef enum
+{
+    TLM_FIELD_UPTIME_S = 0,          // Seconds since boot
+    TLM_FIELD_RSSI,                  // dBm (0 = WiFi not connected)
+    TLM_FIELD_HEAP_FREE,             // Bytes
+    TLM_FIELD_HEAP_MIN_FREE,         // Low-water mark of the heap
+    TLM_FIELD_NOF_PUBLISHES,         // Broker: publish calls since boot
+    TLM_FIELD_NOF_DEFERRED_DROPPED,  // Broker: deferred messages dropped since boot
+    TLM_FIELD_QUEUE_MAX_DEPTH,       // Broker: high-water mark of the deferred queue
+    TLM_FIELD_POOL_MIN_FREE_BLOCKS,  // Broker: low-water mark of the payload pool
+    TLM_FIELD_SLOWEST_HANDLER_US,    // Broker: longest handler call (instrumented builds)
+    TLM_FIELD_NOF_TRIGGERS,          // Schedules: points in time triggered since boot
+    TLM_FIELD_MAX_TRIGGER_ERROR_US,  // Schedules: largest trigger error since boot
+    TLM_FIELD_LAST_TRIGGER_ERROR_US, // Schedules: error of the latest trigger
+    TLM_FIELD_COUNT
+} tlm_field_e;
+
+typedef struct
+{
+    u32 values[TLM_FIELD_COUNT];
+} tlm_sample_t;
+
+// ###########################################################################
+// # Private function declarations
+// ###########################################################################
+static void prv_mqttbridge_task(void* parameter);
+static TickType_t prv_service(void);
+static void prv_apply_config(void);
+static bool prv_start_client(void);
+static void prv_stop_client(void);
+static void prv_mqtt_event_handler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data);
+static void prv_handle_command(esp_mqtt_event_handle_t event);
+static bool prv_take_rx_token(void);
+static void prv_queue_event(const msg_t* const message);
+static void prv_flush_events(TickType_t now);
+static void prv_take_sample(void);
+static void prv_publish_wake_deadline(s64 until_sample_us);
+static bool prv_flush_telemetry(void);
+static u16 prv_put_varint(u8* buffer, u32 value);
+static bool prv_publish(const char* suffix, const u8* data, u16 length);
+static bool prv_is_valid_config(const msg_mqtt_set_config_t* candidate);
+static void prv_notify_task(u32 bits);
+static void prv_publish_status(void);
+
+// ###########################################################################
+// # Private Variables
+// ###########################################################################
+static bool is_initialized = false;
+static TaskHandle_t mqttbridge_task_handle = NULL;
+static SemaphoreHandle_t bridge_mutex = NULL; // Protects the configuration, the queues and the statistics
+static Preferences preferences;
+
+static msg_mqtt_set_config_t config;            // Persisted configuration (protected by bridge_mutex)
+static volatile bool is_config_changed = false; // Set by MSG_0700, the task restarts the client
+static volatile bool is_wifi_connected = false;
+static volatile bool is_mqtt_connected = false;
+
+// MQTT client - only started and stopped by the MqttBridge task
+static esp_mqtt_client_handle_t mqtt_client = NULL;
+static char client_uri[MQTT_URI_MAX_LENGTH];
+static char client_base_topic[MQTT_TOPIC_MAX_LENGTH];
+static char online_topic[MQTTBRIDGE_TOPIC_LENGTH];
+static char command_filter[MQTTBRIDGE_TOPIC_LENGTH]; // <base>/cmd/+
+static u16 command_prefix_length = 0;                // Length of "<base>/cmd/"
+
+// Command rate limit - only touched by the MQTT client task
+static u8 rx_tokens = MQTTBRIDGE_RX_BURST;
+static TickType_t rx_refill_tick = 0;
+static msg_payload_t command_payload; // Aligned copy of the received payload
+
+// Queued events (protected by bridge_mutex)
+static u8 event_buffer[MQTTBRIDGE_EVENT_BUFFER_SIZE];
+static u16 event_length = 0;
+static u16 nof_queued_events = 0;
+static TickType_t first_event_tick = 0; // When the first event of the batch was queued
+
+// Telemetry ring (protected by bridge_mutex)
+static tlm_sample_t tlm_history[MQTTBRIDGE_TLM_HISTORY];
+static u8 tlm_next = 0;
+static u8 tlm_count = 0;
+static s64 next_sample_us = 0;   // esp_timer time of the next sample - only used by the task
+static s64 sample_period_us = 0; // Only used by the task
+
+// Encoded batch on its way to the MQTT client - only used by the task
+static u8 tx_buffer[MQTTBRIDGE_EVENT_BUFFER_SIZE];
+
+static u32 nof_published = 0;
+static u32 nof_received = 0;
+static u32 nof_rejected = 0;
+static u32 nof_dropped_events = 0;
+static u32 nof_dropped_samples = 0;
+
+// Commands a client may send, with the size of their payload. The playback and the schedules can be
+// controlled, the credentials and the network configuration only over the console.
+static const mqtt_inbound_topic_t inbound_topics[] = {
+    {MSG_0300, 300, sizeof(msg_mp3_set_volume_t)},
+    {MSG_0301, 301, sizeof(msg_mp3_set_playmode_t)},
+    {MSG_0302, 302, sizeof(msg_mp3_play_song_t)},
+    {MSG_0303, 303, 0},
+    {MSG_0304, 304, 0},
+    {MSG_0305, 305, 0},
+    {MSG_0306, 306, 0},
+    {MSG_0307, 307, 0},
+    {MSG_0400, 400, sizeof(msg_schedule_add_t)},
+    {MSG_0401, 401, sizeof(msg_schedule_remove_t)},
+    {MSG_0403, 403, 0},
+    {MSG_0404, 404, sizeof(msg_schedule_enable_t)},
+    {MSG_0411, 411, sizeof(msg_schedule_add_exception_t)},
+    {MSG_0412, 412, sizeof(msg_schedule_remove_exception_t)},
+};
+
+// ###########################################################################
+// # Public function implementations
+// ###########################################################################
+
+void mqttbridge_init(void)
+{
+    ASSERT(!is_initialized);
+
+    bridge_mutex = xSemaphoreCreateMutex();
+    ASSERT(bridge_mutex != NULL);
+
+    // A telemetry batch is encoded into the tx buffer in one go
+    ASSERT((sizeof(mqtt_tlm_header_t) + (MQTTBRIDGE_TLM_BATCH * TLM_FIELD_COUNT * MQTTBRIDGE_VARINT_MAX_SIZE))
+           <= sizeof(tx_buffer));
+
+    // Load the persisted configuration - without one the bridge stays off
+    preferences.begin(PREFERENCES_NAMESPACE, false);
+    if ((preferences.getBytes(PREF_KEY_CONFIG, &config, sizeof(config)) != sizeof(config))
+        || !prv_is_valid_config(&config))
+    {
+        memset(&config, 0, sizeof(config));
+        config.telemetry_period_s = MQTTBRIDGE_DEFAULT_PERIOD_S;
+    }
+
+    // Subscribe to messages
+    messagebroker_subscribe(MSG_0203, mqttbridge_message_handler); // WiFi connection status
+    messagebroker_subscribe(MSG_0308, mqttbridge_message_handler); // MP3 command response
+    messagebroker_subscribe(MSG_0405, mqttbridge_message_handler); // Schedule command response
+    messagebroker_subscribe(MSG_0700, mqttbridge_message_handler); // Set MQTT broker configuration
+    messagebroker_subscribe(MSG_0701, mqttbridge_message_handler); // Request MQTT bridge status
+
+    is_initialized = true;
+}
+
+void mqttbridge_start_task(void)
+{
+    ASSERT(is_initialized);
+
+    if (mqttbridge_task_handle == NULL)
+    {
+        xTaskCreate(prv_mqttbridge_task, "MqttBridgeTask", 4096, NULL, 1, &mqttbridge_task_handle);
+    }
+}
+
+// ###########################################################################
+// # Private function implementations
+// ###########################################################################
+
+void mqttbridge_message_handler(const msg_t* const message)
+{
+    ASSERT(message != NULL);
+
+    switch (message->msg_id)
+    {
+        case MSG_0203: // WiFi connection status
+        {
+            msg_wifi_connection_status_t* status = (msg_wifi_connection_status_t*)message->data_bytes;
+
+            bool is_connected = (status->status == WIFI_STATUS_CONNECTED);
+            if (is_connected != is_wifi_connected)
+            {
+                is_wifi_connected = is_connected;
+                prv_notify_task(MQTTBRIDGE_EVENT_BIT_CHANGED);
+            }
+            prv_queue_event(message);
+            break;
+        }
+
+        case MSG_0308: // MP3 command response
+        case MSG_0405: // Schedule command response
+        {
+            prv_queue_event(message);
+            break;
+        }
+
+        case MSG_0700: // Set MQTT broker configuration
+        {
+            msg_mqtt_set_config_t* cmd = (msg_mqtt_set_config_t*)message->data_bytes;
+
+            xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+            msg_mqtt_set_config_t new_config = *cmd;
+            if (new_config.telemetry_period_s == 0)
+            {
+                new_config.telemetry_period_s = config.telemetry_period_s;
+            }
+            bool is_valid = prv_is_valid_config(&new_config);
+            if (is_valid)
+            {
+                config = new_config;
+            }
+            xSemaphoreGive(bridge_mutex);
+
+            if (is_valid)
+            {
+                preferences.putBytes(PREF_KEY_CONFIG, &new_config, sizeof(new_config));
+                is_config_changed = true;
+                prv_notify_task(MQTTBRIDGE_EVENT_BIT_CHANGED);
+            }
+            else
+            {
+                LOG_WARNING(MODULE_MQTTBRIDGE, "Invalid MQTT configuration was rejected");
+            }
+            prv_publish_status();
+            break;
+        }
+
+        case MSG_0701: // Request MQTT bridge status
+        {
+            prv_publish_status();
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static void prv_mqttbridge_task(void* parameter)
+{
+    (void)parameter;
+
+    is_config_changed = true; // Apply the persisted configuration
+    while (1)
+    {
+        TickType_t wait = prv_service();
+        xTaskNotifyWait(0, UINT32_MAX, NULL, wait);
+    }
+}
+
+static TickType_t prv_service(void)
+{
+    if (is_config_changed)
+    {
+        is_config_changed = false;
+        prv_apply_config();
+    }
+
+    if (client_uri[0] == '\0')
+    {
+        return portMAX_DELAY; // Bridge is off - MSG_0700 wakes us up again
+    }
+
+    TickType_t now = xTaskGetTickCount();
+    s64 now_us = esp_timer_get_time();
+    TickType_t wait = portMAX_DELAY;
+
+    // The client is started once, from then on it reconnects by itself
+    if ((mqtt_client == NULL) && is_wifi_connected && !prv_start_client())
+    {
+        wait = pdMS_TO_TICKS(MQTTBRIDGE_RETRY_MS);
+    }
+
+    // Telemetry is sampled whether the broker is reachable or not
+    if (now_us >= next_sample_us)
+    {
+        prv_take_sample();
+        next_sample_us += sample_period_us;
+        if (now_us >= next_sample_us)
+        {
+            next_sample_us = now_us + sample_period_us; // Fell behind
+        }
+        prv_publish_wake_deadline(next_sample_us - now_us);
+    }
+    s64 until_sample_us = next_sample_us - now_us;
+    TickType_t until_sample = (TickType_t)((until_sample_us * configTICK_RATE_HZ + US_PER_SECOND - 1) / US_PER_SECOND);
+    wait = (until_sample < wait) ? until_sample : wait;
+
+    if (!is_mqtt_connected)
+    {
+        return wait;
+    }
+
+    // The events go first, a backlog of telemetry is sent one batch at a time
+    prv_flush_events(now);
+    if (prv_flush_telemetry())
+    {
+        wait = pdMS_TO_TICKS(MQTTBRIDGE_PUBLISH_GAP_MS);
+    }
+    else
+    {
+        xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+        if (nof_queued_events > 0)
+        {
+            TickType_t age = xTaskGetTickCount() - first_event_tick;
+            TickType_t window = pdMS_TO_TICKS(MQTTBRIDGE_EVENT_WINDOW_MS);
+            TickType_t until_flush = (age < window) ? (window - age) : 0;
+            wait = (until_flush < wait) ? until_flush : wait;
+        }
+        xSemaphoreGive(bridge_mutex);
+    }
+    return wait;
+}
+
+static void prv_apply_config(void)
+{
+    prv_stop_client();
+
+    xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+    memcpy(client_uri, config.uri, sizeof(client_uri)); // Both are terminated, prv_is_valid_config() checked it
+    memcpy(client_base_topic, config.base_topic, sizeof(client_base_topic));
+    sample_period_us = (s64)config.telemetry_period_s * US_PER_SECOND;
+    bool is_off = (client_uri[0] == '\0');
+    if (is_off)
+    {
+        // Nothing will be delivered any more
+        event_length = 0;
+        nof_queued_events = 0;
+        tlm_count = 0;
+    }
+    xSemaphoreGive(bridge_mutex);
+
+    // The first sample is taken right away - a bridge that is off needs no wake-up
+    next_sample_us = esp_timer_get_time();
+    if (is_off)
+    {
+        prv_publish_wake_deadline(-1);
+    }
+}
+
+static bool prv_start_client(void)
+{
+    snprintf(online_topic, sizeof(online_topic), "%s/online", client_base_topic);
+    snprintf(command_filter, sizeof(command_filter), "%s/cmd/+", client_base_topic);
+    command_prefix_length = (u16)(strlen(command_filter) - 1);
+
+    esp_mqtt_client_config_t mqtt_cfg = {};
+    mqtt_cfg.broker.address.uri = client_uri;
+    mqtt_cfg.session.keepalive = MQTTBRIDGE_KEEPALIVE_S;
+    mqtt_cfg.session.last_will.topic = online_topic;
+    mqtt_cfg.session.last_will.msg = "0";
+    mqtt_cfg.session.last_will.msg_len = 1;
+    mqtt_cfg.session.last_will.qos = 1;
+    mqtt_cfg.session.last_will.retain = 1;
+    mqtt_cfg.task.stack_size = MQTTBRIDGE_CLIENT_STACK_SIZE;
+
+    mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
+    if (mqtt_client == NULL)
+    {
+        LOG_ERROR(MODULE_MQTTBRIDGE, "Failed to create the MQTT client for %s", client_uri);
+        return false;
+    }
+
+    esp_mqtt_client_register_event(mqtt_client, MQTT_EVENT_ANY, prv_mqtt_event_handler, NULL);
+    if (esp_mqtt_client_start(mqtt_client) != ESP_OK)
+    {
+        LOG_ERROR(MODULE_MQTTBRIDGE, "Failed to start the MQTT client");
+        esp_mqtt_client_destroy(mqtt_client);
+        mqtt_client = NULL;
+        return false;
+    }
+
+    LOG_INFO(MODULE_MQTTBRIDGE, "Connecting to %s as %s", client_uri, client_base_topic);
+    return true;
+}
+
+static void prv_stop_client(void)
+{
+    if (mqtt_client == NULL)
+    {
+        return;
+    }
+
+    if (is_mqtt_connected)
+    {
+        // QoS 0 is written out right away - the last will is only sent on a lost connection
+        esp_mqtt_client_publish(mqtt_client, online_topic, "0", 1, 0, 1);
+    }
+    esp_mqtt_client_stop(mqtt_client);
+    esp_mqtt_client_destroy(mqtt_client);
+    mqtt_client = NULL;
+    is_mqtt_connected = false;
+
+    LOG_INFO(MODULE_MQTTBRIDGE, "Disconnected from the MQTT broker");
+}
+
+static void prv_mqtt_event_handler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data)
+{
+    (void)handler_args;
+    (void)base;
+
+    // Runs in the MQTT client task
+    esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)event_data;
+    switch ((esp_mqtt_event_id_t)event_id)
+    {
+        case MQTT_EVENT_CONNECTED:
+        {
+            esp_mqtt_client_subscribe(event->client, command_filter, 1);
+            esp_mqtt_client_publish(event->client, online_topic, "1", 1, 1, 1);
+            is_mqtt_connected = true;
+            prv_notify_task(MQTTBRIDGE_EVENT_BIT_CHANGED);
+            LOG_INFO(MODULE_MQTTBRIDGE, "Connected to the MQTT broker");
+            break;
+        }
+
+        case MQTT_EVENT_DISCONNECTED:
+        {
+            if (is_mqtt_connected)
+            {
+                is_mqtt_connected = false;
+                prv_notify_task(MQTTBRIDGE_EVENT_BIT_CHANGED);
+                LOG_WARNING(MODULE_MQTTBRIDGE, "Lost the MQTT broker, queueing until it is back");
+            }
+            break;
+        }
+
+        case MQTT_EVENT_DATA:
+        {
+            prv_handle_command(event);
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static void prv_handle_command(esp_mqtt_event_handle_t event)
+{
+    // All commands fit a single MQTT message - a larger one arrives in fragments and is rejected once
+    if (event->data_len != event->total_data_len)
+    {
+        if (event->current_data_offset == 0)
+        {
+            xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+            nof_rejected++;
+            xSemaphoreGive(bridge_mutex);
+        }
+        return;
+    }
+
+    // <base>/cmd/NNNN
+    const mqtt_inbound_topic_t* topic = NULL;
+    if ((event->topic_len == (int)(command_prefix_length + 4))
+        && (strncmp(event->topic, command_filter, command_prefix_length) == 0))
+    {
+        u16 number = 0;
+        bool is_number = true;
+        for (u8 i = 0; i < 4; i++)
+        {
+            char c = event->topic[command_prefix_length + i];
+            is_number = is_number && (c >= '0') && (c <= '9');
+            number = (u16)(number * 10 + (c - '0'));
+        }
+
+        for (size_t i = 0; is_number && (i < sizeof(inbound_topics) / sizeof(inbound_topics[0])); i++)
+        {
+            if (inbound_topics[i].number == number)
+            {
+                topic = &inbound_topics[i];
+                break;
+            }
+        }
+    }
+
+    if ((topic == NULL) || (event->data_len != (int)topic->data_size) || !prv_take_rx_token())
+    {
+        xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+        nof_rejected++;
+        xSemaphoreGive(bridge_mutex);
+        LOG_DEBUG(MODULE_MQTTBRIDGE, "Rejected an MQTT command of %d bytes", event->data_len);
+        return;
+    }
+
+    memcpy(&command_payload, event->data, topic->data_size);
+    if (topic->msg_id == MSG_0302)
+    {
+        // The client does not know our esp_timer - the latency is measured from the arrival
+        command_payload.mp3_play_song.requested_at_us = esp_timer_get_time();
+    }
+
+    msg_t msg;
+    msg.msg_id = topic->msg_id;
+    msg.data_size = topic->data_size;
+    msg.data_bytes = (u8*)&command_payload;
+    messagebroker_publish(&msg);
+
+    xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+    nof_received++;
+    xSemaphoreGive(bridge_mutex);
+}
+
+static bool prv_take_rx_token(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t refill_ticks = pdMS_TO_TICKS(MQTTBRIDGE_RX_REFILL_MS);
+    u32 nof_refills = (u32)((now - rx_refill_tick) / refill_ticks);
+
+    if (nof_refills > 0)
+    {
+        u32 tokens = rx_tokens + nof_refills;
+        rx_tokens = (tokens > MQTTBRIDGE_RX_BURST) ? MQTTBRIDGE_RX_BURST : (u8)tokens;
+        rx_refill_tick += nof_refills * refill_ticks;
+    }
+
+    if (rx_tokens == 0)
+    {
+        return false;
+    }
+    rx_tokens--;
+    return true;
+}
+
+static void prv_queue_event(const msg_t* const message)
+{
+    u16 record_size = (u16)(sizeof(mqtt_event_record_header_t) + message->data_size);
+    bool should_wake = false;
+
+    xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+    if (config.uri[0] == '\0')
+    {
+        // Bridge is off
+    }
+    else if ((event_length + record_size) > sizeof(event_buffer))
+    {
+        nof_dropped_events++;
+    }
+    else
+    {
+        mqtt_event_record_header_t header;
+        header.msg_id = (u16)message->msg_id;
+        header.data_size = message->data_size;
+        memcpy(&event_buffer[event_length], &header, sizeof(header));
+        memcpy(&event_buffer[event_length + sizeof(header)], message->data_bytes, message->data_size);
+
+        if (nof_queued_events == 0)
+        {
+            first_event_tick = xTaskGetTickCount();
+        }
+        event_length = (u16)(event_length + record_size);
+        nof_queued_events++;
+
+        // The task only has to be woken for the first event of a batch and for a full buffer
+        should_wake = (nof_queued_events == 1) || (event_length >= MQTTBRIDGE_EVENT_FLUSH_LEVEL);
+    }
+    xSemaphoreGive(bridge_mutex);
+
+    if (should_wake)
+    {
+        prv_notify_task(MQTTBRIDGE_EVENT_BIT_QUEUED);
+    }
+}
+
+static void prv_flush_events(TickType_t now)
+{
+    xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+    bool is_due = (nof_queued_events > 0)
+                  && ((event_length >= MQTTBRIDGE_EVENT_FLUSH_LEVEL)
+                      || ((now - first_event_tick) >= pdMS_TO_TICKS(MQTTBRIDGE_EVENT_WINDOW_MS)));
+    if (!is_due)
+    {
+        xSemaphoreGive(bridge_mutex);
+        return;
+    }
+
+    // The handlers keep queueing into the buffer while the batch is on its way
+    u16 length = event_length;
+    u16 nof_events = nof_queued_events;
+    memcpy(tx_buffer, event_buffer, length);
+    event_length = 0;
+    nof_queued_events = 0;
+    xSemaphoreGive(bridge_mutex);
+
+    if (!prv_publish("evt", tx_buffer, length))
+    {
+        xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+        nof_dropped_events += nof_events;
+        xSemaphoreGive(bridge_mutex);
+    }
+}
+
+static void prv_publish_wake_deadline(s64 until_sample_us)
+{
+    // The deadline is a wall clock time - without a valid clock the PowerManager cannot use it (-1 = none)
+    time_t now = time(NULL);
+
+    msg_power_wake_deadline_t deadline;
+    deadline.module_id = MODULE_MQTTBRIDGE;
+    deadline.wake_at = 0;
+    if ((until_sample_us >= 0) && (now >= TIMESTAMP_VALID_MIN))
+    {
+        deadline.wake_at = now + (time_t)((until_sample_us + US_PER_SECOND - 1) / US_PER_SECOND);
+    }
+
+    msg_t msg;
+    msg.msg_id = MSG_0501;
+    msg.data_size = sizeof(msg_power_wake_deadline_t);
+    msg.data_bytes = (u8*)&deadline;
+
+    messagebroker_publish(&msg);
+}
+
+static void prv_take_sample(void)
+{
+    msg_system_status_t broker_status;
+    messagebroker_get_status(&broker_status);
+
+    msg_schedule_timing_t timing;
+    appcontrol_get_trigger_timing(&timing);
+
+    tlm_sample_t sample;
+    sample.values[TLM_FIELD_UPTIME_S] = (u32)(esp_timer_get_time() / US_PER_SECOND);
+    sample.values[TLM_FIELD_RSSI] = is_wifi_connected ? (u32)(s32)WiFi.RSSI() : 0;
+    sample.values[TLM_FIELD_HEAP_FREE] = (u32)heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    sample.values[TLM_FIELD_HEAP_MIN_FREE] = (u32)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    sample.values[TLM_FIELD_NOF_PUBLISHES] = broker_status.nof_publishes;
+    sample.values[TLM_FIELD_NOF_DEFERRED_DROPPED] = broker_status.nof_deferred_dropped;
+    sample.values[TLM_FIELD_QUEUE_MAX_DEPTH] = broker_status.queue_max_depth;
+    sample.values[TLM_FIELD_POOL_MIN_FREE_BLOCKS] = broker_status.pool_min_free_blocks;
+    sample.values[TLM_FIELD_SLOWEST_HANDLER_US] = broker_status.slowest_handler_us;
+    sample.values[TLM_FIELD_NOF_TRIGGERS] = timing.nof_triggers;
+    sample.values[TLM_FIELD_MAX_TRIGGER_ERROR_US] = (u32)timing.max_error_us;
+    sample.values[TLM_FIELD_LAST_TRIGGER_ERROR_US]
+        = (timing.count > 0) ? (u32)timing.events[timing.count - 1].error_us : 0;
+
+    xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+    tlm_history[tlm_next] = sample;
+    tlm_next = (u8)((tlm_next + 1) % MQTTBRIDGE_TLM_HISTORY);
+    if (tlm_count < MQTTBRIDGE_TLM_HISTORY)
+    {
+        tlm_count++;
+    }
+    else
+    {
+        nof_dropped_samples++; // The oldest sample was overwritten
+    }
+    xSemaphoreGive(bridge_mutex);
+}
+
+static bool prv_flush_telemetry(void)
+{
+    mqtt_tlm_header_t header;
+    header.version = MQTTBRIDGE_TLM_VERSION;
+    header.nof_fields = TLM_FIELD_COUNT;
+    header.nof_samples = 0;
+
+    xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+    if (tlm_count < MQTTBRIDGE_TLM_BATCH)
+    {
+        xSemaphoreGive(bridge_mutex);
+        return false;
+    }
+
+    header.period_s = config.telemetry_period_s;
+    u16 length = sizeof(header);
+    u8 oldest = (u8)((tlm_next + MQTTBRIDGE_TLM_HISTORY - tlm_count) % MQTTBRIDGE_TLM_HISTORY);
+    const tlm_sample_t* previous = NULL;
+    for (u8 i = 0; i < MQTTBRIDGE_TLM_BATCH; i++)
+    {
+        const tlm_sample_t* sample = &tlm_history[(oldest + i) % MQTTBRIDGE_TLM_HISTORY];
+        for (u8 field = 0; field < TLM_FIELD_COUNT; field++)
+        {
+            // Zigzag, so that a small negative difference takes as few bytes as a small positive one
+            s32 delta = (s32)(sample->values[field] - ((previous != NULL) ? previous->values[field] : 0));
+            u32 zigzag = ((u32)delta << 1) ^ (u32)(delta >> 31);
+            length = (u16)(length + prv_put_varint(&tx_buffer[length], zigzag));
+        }
+        previous = sample;
+    }
+    header.nof_samples = MQTTBRIDGE_TLM_BATCH;
+    tlm_count = (u8)(tlm_count - MQTTBRIDGE_TLM_BATCH);
+    xSemaphoreGive(bridge_mutex);
+
+    memcpy(tx_buffer, &header, sizeof(header));
+    if (!prv_publish("tlm", tx_buffer, length))
+    {
+        xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+        nof_dropped_samples += MQTTBRIDGE_TLM_BATCH;
+        xSemaphoreGive(bridge_mutex);
+    }
+
+    xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+    bool has_backlog = (tlm_count >= MQTTBRIDGE_TLM_BATCH);
+    xSemaphoreGive(bridge_mutex);
+    return has_backlog;
+}
+
+static u16 prv_put_varint(u8* buffer, u32 value)
+{
+    // 7 bits per byte, least significant first - the top bit marks that another byte follows
+    u16 length = 0;
+    while (value >= 0x80U)
+    {
+        buffer[length++] = (u8)(value | 0x80U);
+        value >>= 7;
+    }
+    buffer[length++] = (u8)value;
+    return length;
+}
+
+static bool prv_publish(const char* suffix, const u8* data, u16 length)
+{
+    char topic[MQTTBRIDGE_TOPIC_LENGTH];
+    snprintf(topic, sizeof(topic), "%s/%s", client_base_topic, suffix);
+
+    // QoS 1 - the client repeats a batch that was not acknowledged, the outbox only holds the batches
+    // in flight since nothing is handed to it while the broker is not reachable
+    int result = esp_mqtt_client_publish(mqtt_client, topic, (const char*)data, length, 1, 0);
+    if (result < 0)
+    {
+        LOG_WARNING(MODULE_MQTTBRIDGE, "Failed to publish %u bytes to %s", length, topic);
+        return false;
+    }
+
+    xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+    nof_published++;
+    xSemaphoreGive(bridge_mutex);
+    return true;
+}
+
+static bool prv_is_valid_config(const msg_mqtt_set_config_t* candidate)
+{
+    size_t uri_length = strnlen(candidate->uri, MQTT_URI_MAX_LENGTH);
+    size_t base_length = strnlen(candidate->base_topic, MQTT_TOPIC_MAX_LENGTH);
+
+    if ((uri_length == MQTT_URI_MAX_LENGTH) || (base_length == MQTT_TOPIC_MAX_LENGTH))
+    {
+        return false; // Not terminated
+    }
+    if (uri_length == 0)
+    {
+        return true; // Bridge off
+    }
+
+    // The base topic must not contain wildcards - the command filter is derived from it
+    return (base_length > 0) && (strpbrk(candidate->base_topic, "+#") == NULL)
+           && (candidate->telemetry_period_s >= MQTT_MIN_PERIOD_S);
+}
+
+static void prv_notify_task(u32 bits)
+{
+    if (mqttbridge_task_handle != NULL)
+    {
+        xTaskNotify(mqttbridge_task_handle, bits, eSetBits);
+    }
+}
+
+static void prv_publish_status(void)
+{
+    msg_mqtt_status_t status;
+
+    xSemaphoreTake(bridge_mutex, portMAX_DELAY);
+    status.is_enabled = (config.uri[0] != '\0');
+    status.is_connected = is_mqtt_connected;
+    memcpy(status.uri, config.uri, sizeof(status.uri));
+    memcpy(status.base_topic, config.base_topic, sizeof(status.base_topic));
+    status.telemetry_period_s = config.telemetry_period_s;
+    status.nof_published = nof_published;
+    status.nof_received = nof_received;
+    status.nof_rejected = nof_rejected;
+    status.nof_queued_events = nof_queued_events;
+    status.nof_queued_samples = tlm_count;
+    status.nof_dropped_events = nof_dropped_events;
+    status.nof_dropped_samples = nof_dropped_samples;
+    xSemaphoreGive(bridge_mutex);
+
+    msg_t msg;
+    msg.msg_id = MSG_0702;
+    msg.data_size = sizeof(msg_mqtt_status_t);
+    msg.data_bytes = (u8*)&status;
+    messagebroker_publish(&msg);
+}
@@ -0,0 +1,498 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file PowerManager.cpp
+ * @brief Automatic light sleep between wake-up deadlines for battery powered devices
+ *
+ * The modules register the next point in time at which they need the CPU (MSG_0501) - the
+ * ApplicationControl its next due schedule, the TimeSync its next NTP resync. While the low power
+ * mode is enabled the power management of ESP-IDF puts the chip into light sleep whenever all tasks
+ * are blocked. WiFi uses maximum modem sleep meanwhile and stays associated - the radio wakes up for
+ * the DTIM beacons of the access point. The FreeRTOS tick and the esp_timer are compensated for the
+ * time spent asleep, so the timers of the modules keep working.
+ *
+ * Around a deadline, after console activity and while a module reports activity, the PowerManager
+ * holds a lock that keeps the chip awake, so that the schedules play without the wake-up latency.
+ * The task only runs when the next of these windows starts or ends, or when it is notified of a
+ * change. MSG_0504 is published when a window without the lock ends.
+ *
+ * Automatic light sleep needs CONFIG_PM_ENABLE and CONFIG_FREERTOS_USE_TICKLESS_IDLE in the
+ * sdkconfig. Without them the low power mode only enables the modem sleep.
+ */
+
+#include "PowerManager.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <time.h>
+#include "Logger.h"
+#include "MessageBroker.h"
+#include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "custom_assert.h"
+
+#include "driver/uart.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// ###########################################################################
+// # Private defines
+// ###########################################################################
+#define PREFERENCES_NAMESPACE       "power"
+#define PREF_KEY_LOW_POWER          "low_power"
+#define POWER_IDLE_TIMEOUT_MS       30000      // Stay awake this long after console activity or a deadline
+#define POWER_WAKE_AHEAD_S          5          // Stay awake from this long before a deadline
+#define POWER_MIN_SLEEP_S           5          // Shorter windows are not worth the wake-up overhead
+#define POWER_USB_RECHECK_MS        60000      // How often a connected USB host is checked for
+#define POWER_CONSOLE_UART_NUM      UART_NUM_0
+#define POWER_UART_WAKEUP_THRESHOLD 3          // Number of RX edges that wake the chip up
+#define TIMESTAMP_VALID_MIN         1000000000 // Timestamp after year 2001
+
+// Task notification bits
+#define POWER_EVENT_BIT_CHANGED (1U << 0) // The mode, a deadline, the activity or the clock changed
+
+// ###########################################################################
+// # Private function declarations
+// ###########################################################################
+static void prv_powermanager_task(void* parameter);
+static void prv_configure_light_sleep(void);
+static bool prv_may_sleep(TickType_t* recheck_after, bool* is_deadline);
+static time_t prv_get_next_deadline(time_t now);
+static void prv_allow_light_sleep(void);
+static void prv_prevent_light_sleep(bool is_deadline);
+static void prv_account_awake_time(s64 now_us);
+static void prv_notify_task(void);
+static void prv_publish_power_state(bool woke_from_sleep, u32 slept_ms);
+static void prv_publish_power_stats(void);
+
+// ###########################################################################
+// # Private Variables
+// ###########################################################################
+static bool is_initialized = false;
+static bool low_power_enabled = false;
+static TaskHandle_t powermanager_task_handle = NULL;
+static SemaphoreHandle_t power_mutex = NULL; // Protects the deadlines and the statistics
+static Preferences preferences;
+
+// Held while the chip has to stay awake (only acquired and released by the task)
+static esp_pm_lock_handle_t awake_lock = NULL;
+static bool is_light_sleep_supported = false;
+static volatile bool is_sleep_allowed = false;
+static s64 sleep_allowed_since_us = 0;
+
+// Wake-up deadline per module (0 = no deadline)
+static time_t wake_deadlines[MODULE_ALL];
+
+// Last console activity or deadline - millis() keeps counting during light sleep
+static volatile u32 last_activity_ms = 0;
+
+// Time spent in each power state - the real light sleep time is not measured, only the time the lock
+// was released
+static s64 awake_since_us = 0;
+static u64 active_time_us = 0;
+static u64 modem_sleep_time_us = 0;
+static u64 sleep_allowed_time_us = 0;
+static u32 nof_sleep_windows = 0;
+static u32 nof_deadline_wakes = 0;
+static u32 nof_activity_wakes = 0;
+
+// ###########################################################################
+// # Public function implementations
+// ###########################################################################
+
+void powermanager_init(void)
+{
+    ASSERT(!is_initialized);
+
+    power_mutex = xSemaphoreCreateMutex();
+    ASSERT(power_mutex != NULL);
+
+    for (int i = 0; i < MODULE_ALL; i++)
+    {
+        wake_deadlines[i] = 0;
+    }
+
+    // Load the persisted power mode
+    preferences.begin(PREFERENCES_NAMESPACE, false);
+    low_power_enabled = preferences.getBool(PREF_KEY_LOW_POWER, false);
+
+    awake_since_us = esp_timer_get_time();
+    last_activity_ms = millis();
+
+    prv_configure_light_sleep();
+
+    // Subscribe to power management messages
+    messagebroker_subscribe(MSG_0102, powermanager_message_handler); // Time synchronized
+    messagebroker_subscribe(MSG_0500, powermanager_message_handler); // Set power mode
+    messagebroker_subscribe(MSG_0501, powermanager_message_handler); // Register wake-up deadline
+    messagebroker_subscribe(MSG_0502, powermanager_message_handler); // Request power statistics
+
+    is_initialized = true;
+
+    LOG_INFO(MODULE_POWERMANAGER, "Low power mode %s", low_power_enabled ? "enabled" : "disabled");
+}
+
+void powermanager_start_task(void)
+{
+    ASSERT(is_initialized);
+
+    if (powermanager_task_handle == NULL)
+    {
+        xTaskCreate(prv_powermanager_task, "PowerManagerTask", 4096, NULL, 1, &powermanager_task_handle);
+    }
+}
+
+void powermanager_notify_activity(void)
+{
+    last_activity_ms = millis();
+
+    // Cheap enough for every poll of a busy module - the task only has to act if the chip may sleep
+    if (is_sleep_allowed)
+    {
+        prv_notify_task();
+    }
+}
+
+// ###########################################################################
+// # Private function implementations
+// ###########################################################################
+
+static void prv_powermanager_task(void* parameter)
+{
+    (void)parameter;
+
+    // Announce the persisted power mode - the WiFiManager applies the matching modem sleep
+    prv_publish_power_state(false, 0);
+
+    while (1)
+    {
+        TickType_t recheck_after = portMAX_DELAY;
+        bool is_deadline = false;
+
+        if (prv_may_sleep(&recheck_after, &is_deadline))
+        {
+            prv_allow_light_sleep();
+        }
+        else
+        {
+            prv_prevent_light_sleep(is_deadline);
+        }
+
+        // Sleep until the current window ends or something changed
+        xTaskNotifyWait(0, UINT32_MAX, NULL, recheck_after);
+    }
+}
+
+static void prv_configure_light_sleep(void)
+{
+    // The lock is taken right away - the chip only sleeps once the task released it
+    if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "PowerManager", &awake_lock) != ESP_OK)
+    {
+        LOG_WARNING(MODULE_POWERMANAGER, "Power management is not compiled in, low power mode is modem sleep only");
+        return;
+    }
+    esp_pm_lock_acquire(awake_lock);
+
+    // Only the light sleep - a changing CPU clock would add jitter to the schedules
+    esp_pm_config_t pm_config = {};
+    pm_config.max_freq_mhz = (int)getCpuFrequencyMhz();
+    pm_config.min_freq_mhz = (int)getCpuFrequencyMhz();
+    pm_config.light_sleep_enable = true;
+    if (esp_pm_configure(&pm_config) != ESP_OK)
+    {
+        LOG_WARNING(MODULE_POWERMANAGER, "Tickless idle is not compiled in, low power mode is modem sleep only");
+        return;
+    }
+
+#if !ARDUINO_USB_CDC_ON_BOOT
+    // Typing on a UART console wakes the chip up - the first character is lost
+    uart_set_wakeup_threshold(POWER_CONSOLE_UART_NUM, POWER_UART_WAKEUP_THRESHOLD);
+    esp_sleep_enable_uart_wakeup(POWER_CONSOLE_UART_NUM);
+#endif
+
+    is_light_sleep_supported = true;
+}
+
+static bool prv_may_sleep(TickType_t* recheck_after, bool* is_deadline)
+{
+    ASSERT(recheck_after != NULL);
+    ASSERT(is_deadline != NULL);
+
+    if (!low_power_enabled || !is_light_sleep_supported)
+    {
+        return false; // MSG_0500 wakes us up again
+    }
+
+#if ARDUINO_USB_CDC_ON_BOOT
+    // The USB Serial/JTAG console cannot wake the chip and the host drops the port during a light sleep
+    if (Serial)
+    {
+        *recheck_after = pdMS_TO_TICKS(POWER_USB_RECHECK_MS);
+        return false;
+    }
+#endif
+
+    u32 idle_ms = millis() - last_activity_ms;
+    if (idle_ms < POWER_IDLE_TIMEOUT_MS)
+    {
+        *recheck_after = pdMS_TO_TICKS(POWER_IDLE_TIMEOUT_MS - idle_ms);
+        return false;
+    }
+
+    // Without a valid wall clock the deadlines are meaningless - stay awake until MSG_0102
+    time_t now = time(NULL);
+    if (now < TIMESTAMP_VALID_MIN)
+    {
+        return false;
+    }
+
+    time_t next_deadline = prv_get_next_deadline(now);
+    if (next_deadline == 0)
+    {
+        return true; // The next MSG_0501 wakes us up again
+    }
+
+    time_t until_wake_s = next_deadline - now - POWER_WAKE_AHEAD_S;
+    if (until_wake_s < POWER_MIN_SLEEP_S)
+    {
+        // Stay awake through the deadline - the idle timeout starts now
+        last_activity_ms = millis();
+        *recheck_after = pdMS_TO_TICKS(POWER_IDLE_TIMEOUT_MS);
+        *is_deadline = true;
+        return false;
+    }
+
+    *recheck_after = (TickType_t)until_wake_s * pdMS_TO_TICKS(1000);
+    return true;
+}
+
+static time_t prv_get_next_deadline(time_t now)
+{
+    time_t next_deadline = 0;
+
+    xSemaphoreTake(power_mutex, portMAX_DELAY);
+    for (int i = 0; i < MODULE_ALL; i++)
+    {
+        // Deadlines in the past were handled (or missed) while the chip was awake
+        if ((wake_deadlines[i] > now) && ((next_deadline == 0) || (wake_deadlines[i] < next_deadline)))
+        {
+            next_deadline = wake_deadlines[i];
+        }
+    }
+    xSemaphoreGive(power_mutex);
+
+    return next_deadline;
+}
+
+static void prv_allow_light_sleep(void)
+{
+    if (is_sleep_allowed)
+    {
+        return;
+    }
+
+    LOG_DEBUG(MODULE_POWERMANAGER, "Light sleep allowed");
+
+    // Drain the console output - the UART is clock gated during a light sleep
+    Serial.flush();
+
+    xSemaphoreTake(power_mutex, portMAX_DELAY);
+    sleep_allowed_since_us = esp_timer_get_time();
+    prv_account_awake_time(sleep_allowed_since_us);
+    is_sleep_allowed = true;
+    xSemaphoreGive(power_mutex);
+
+    esp_pm_lock_release(awake_lock);
+}
+
+static void prv_prevent_light_sleep(bool is_deadline)
+{
+    if (!is_sleep_allowed)
+    {
+        return;
+    }
+
+    esp_pm_lock_acquire(awake_lock);
+
+    // The esp_timer is compensated for the time spent in light sleep
+    s64 now_us = esp_timer_get_time();
+
+    xSemaphoreTake(power_mutex, portMAX_DELAY);
+    prv_account_awake_time(now_us);
+    is_sleep_allowed = false;
+    nof_sleep_windows++;
+    if (is_deadline)
+    {
+        nof_deadline_wakes++;
+    }
+    else
+    {
+        nof_activity_wakes++; // Console or module activity
+    }
+    xSemaphoreGive(power_mutex);
+
+    u32 slept_ms = (u32)((now_us - sleep_allowed_since_us) / 1000);
+
+    LOG_DEBUG(MODULE_POWERMANAGER, "Awake lock taken after %lu ms (%s)", (unsigned long)slept_ms,
+              is_deadline ? "deadline" : "activity");
+
+    prv_publish_power_state(true, slept_ms);
+}
+
+static void prv_account_awake_time(s64 now_us)
+{
+    // Called with power_mutex taken
+    u64 elapsed_us = (u64)(now_us - awake_since_us);
+
+    if (is_sleep_allowed)
+    {
+        sleep_allowed_time_us += elapsed_us;
+    }
+    else if (low_power_enabled)
+    {
+        modem_sleep_time_us += elapsed_us;
+    }
+    else
+    {
+        active_time_us += elapsed_us;
+    }
+
+    awake_since_us = now_us;
+}
+
+static void prv_notify_task(void)
+{
+    if (powermanager_task_handle != NULL)
+    {
+        xTaskNotify(powermanager_task_handle, POWER_EVENT_BIT_CHANGED, eSetBits);
+    }
+}
+
+static void prv_publish_power_state(bool woke_from_sleep, u32 slept_ms)
+{
+    msg_power_state_t state;
+    state.low_power_enabled = low_power_enabled;
+    state.woke_from_sleep = woke_from_sleep;
+    state.slept_ms = slept_ms;
+
+    msg_t msg;
+    msg.msg_id = MSG_0504;
+    msg.data_size = sizeof(msg_power_state_t);
+    msg.data_bytes = (u8*)&state;
+
+    messagebroker_publish(&msg);
+}
+
+static void prv_publish_power_stats(void)
+{
+    msg_power_stats_t stats;
+
+    xSemaphoreTake(power_mutex, portMAX_DELAY);
+    prv_account_awake_time(esp_timer_get_time());
+    stats.low_power_enabled = low_power_enabled;
+    stats.active_time_ms = active_time_us / 1000U;
+    stats.modem_sleep_time_ms = modem_sleep_time_us / 1000U;
+    stats.sleep_allowed_time_ms = sleep_allowed_time_us / 1000U;
+    stats.nof_sleep_windows = nof_sleep_windows;
+    stats.nof_deadline_wakes = nof_deadline_wakes;
+    stats.nof_activity_wakes = nof_activity_wakes;
+    xSemaphoreGive(power_mutex);
+
+    stats.next_wake_at = prv_get_next_deadline(time(NULL));
+
+    msg_t msg;
+    msg.msg_id = MSG_0503;
+    msg.data_size = sizeof(msg_power_stats_t);
+    msg.data_bytes = (u8*)&stats;
+
+    messagebroker_publish(&msg);
+}
+
+void powermanager_message_handler(const msg_t* const message)
+{
+    ASSERT(message != NULL);
+
+    switch (message->msg_id)
+    {
+        case MSG_0102: // Time synchronized
+        {
+            // The deadlines are valid from now on
+            prv_notify_task();
+            break;
+        }
+
+        case MSG_0500: // Set power mode
+        {
+            msg_power_set_mode_t* cmd = (msg_power_set_mode_t*)message->data_bytes;
+
+            xSemaphoreTake(power_mutex, portMAX_DELAY);
+            bool mode_changed = (cmd->low_power_enabled != low_power_enabled);
+            prv_account_awake_time(esp_timer_get_time());
+            low_power_enabled = cmd->low_power_enabled;
+            xSemaphoreGive(power_mutex);
+
+            if (mode_changed)
+            {
+                preferences.putBool(PREF_KEY_LOW_POWER, low_power_enabled);
+                prv_publish_power_state(false, 0);
+                prv_notify_task();
+            }
+
+            LOG_DEBUG(MODULE_POWERMANAGER, "Low power mode %s", low_power_enabled ? "enabled" : "disabled");
+            break;
+        }
+
+        case MSG_0501: // Register wake-up deadline
+        {
+            msg_power_wake_deadline_t* cmd = (msg_power_wake_deadline_t*)message->data_bytes;
+            ASSERT(cmd->module_id < MODULE_ALL);
+
+            xSemaphoreTake(power_mutex, portMAX_DELAY);
+            bool is_changed = (wake_deadlines[cmd->module_id] != cmd->wake_at);
+            wake_deadlines[cmd->module_id] = cmd->wake_at;
+            xSemaphoreGive(power_mutex);
+
+            // The task may be waiting for a later deadline
+            if (is_changed)
+            {
+                prv_notify_task();
+            }
+            break;
+        }
+
+        case MSG_0502: // Request power statistics
+        {
+            prv_publish_power_stats();
+            break;
+        }
+
+        default: break;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef POWERMANAGER_H
+#define POWERMANAGER_H
+
+#include "custom_types.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+    /**
+     * @brief Initialize the PowerManager module and load the persisted power mode
+     */
+    void powermanager_init(void);
+
+    /**
+     * @brief Start the PowerManager task
+     *
+     * As long as the low power mode is enabled, the task lets the chip light sleep whenever it is idle.
+     * It keeps the chip awake around the registered wake-up deadlines (MSG_0501) and after activity.
+     */
+    void powermanager_start_task(void);
+
+    /**
+     * @brief Report activity (e.g. console input, a playing sequence) - keeps the chip awake for a while
+     *
+     * Cheap enough to be called on every poll of a busy module.
+     */
+    void powermanager_notify_activity(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // POWERMANAGER_H
@@ -0,0 +1,603 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file ScheduleServer.cpp
+ * @brief Bulk import and export of the schedule table over TCP
+ *
+ * A plain line protocol, so that a whole timetable can be loaded with standard tools, e.g.
+ * "(echo IMPORT <token>; cat table.csv; echo END) | nc <ip> 4711". One client is served at a time.
+ * The import stays disabled until a token was set with MSG_0415 - it is kept in NVS.
+ *
+ * The import is parsed into a buffer first and handed to the ApplicationControl with a single
+ * synchronous MSG_0409. It validates all entries, swaps the table and writes it to flash once.
+ * The export pages through the table with MSG_0402 like the console does - the pages arrive in
+ * the broker task and are written to the socket by the ScheduleServer task.
+ */
+
+#include "ScheduleServer.h"
+#include <Arduino.h>
+#include <Preferences.h>
+#include <stdarg.h>
+#include "Logger.h"
+#include "MessageBroker.h"
+#include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "ScheduleStore.h"
+#include "custom_assert.h"
+
+#include "lwip/sockets.h"
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// ###########################################################################
+// # Private defines
+// ###########################################################################
+#define SERVER_ACCEPT_TIMEOUT_MS 1000 // The task re-checks the WiFi connection this often
+#define SERVER_CLIENT_TIMEOUT_MS 5000 // A client that stays silent for this long is dropped
+#define SERVER_PAGE_TIMEOUT_MS   1000 // Wait time for a page of the export
+#define SERVER_LINE_LENGTH       64
+#define SERVER_REPLY_LENGTH      96 // Longer replies are cut
+#define SERVER_RX_BUFFER_SIZE    256
+#define PREFERENCES_NAMESPACE    "schedserver"
+#define PREF_KEY_IMPORT_TOKEN    "import_token"
+
+// Task notification bits
+#define SERVER_EVENT_BIT_WIFI_CHANGED (1U << 0) // The WiFi connection changed
+#define SERVER_EVENT_BIT_PAGE         (1U << 1) // A page of the export arrived
+
+// ###########################################################################
+// # Type Definitions
+// ###########################################################################
+
+// Buffered reader of the client socket
+typedef struct
+{
+    int socket;
+    u8 buffer[SERVER_RX_BUFFER_SIZE];
+    int length;
+    int position;
+} server_reader_t;
+
+// ###########################################################################
+// # Private function declarations
+// ###########################################################################
+static void prv_scheduleserver_task(void* parameter);
+static bool prv_open_listen_socket(void);
+static void prv_close_listen_socket(void);
+static void prv_serve_client(int client_socket);
+static void prv_export_schedules(int client_socket);
+static void prv_import_schedules(server_reader_t* reader);
+static bool prv_is_import_token(const char* token);
+static bool prv_parse_schedule(const char* line, msg_schedule_add_t* schedule);
+static bool prv_read_line(server_reader_t* reader, char* line, size_t size, bool* is_too_long);
+static bool prv_send_line(int client_socket, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void prv_notify_task(u32 event_bits);
+
+// ###########################################################################
+// # Private Variables
+// ###########################################################################
+static bool is_initialized = false;
+static volatile bool is_wifi_connected = false;
+static TaskHandle_t scheduleserver_task_handle = NULL;
+static int listen_socket = -1;
+static Preferences preferences;
+
+// Token a client has to send after IMPORT - empty while the import is disabled (protected by token_mutex)
+static char import_token[SCHEDULE_IMPORT_TOKEN_MAX_LENGTH];
+static SemaphoreHandle_t token_mutex = NULL;
+
+// Entries of the import in progress - handed over to the ApplicationControl as a whole
+static msg_schedule_add_t import_buffer[SCHEDULESTORE_MAX_SCHEDULES];
+
+// Latest page of the export - written by the broker task, read by the ScheduleServer task after the notification
+static msg_schedule_list_t export_page;
+
+// Answer to MSG_0409 - published synchronously, so it is set before the publish returns
+static msg_schedule_import_response_t import_response;
+
+// ###########################################################################
+// # Public function implementations
+// ###########################################################################
+
+void scheduleserver_init(void)
+{
+    ASSERT(!is_initialized);
+
+    token_mutex = xSemaphoreCreateMutex();
+    ASSERT(token_mutex != NULL);
+
+    memset(import_token, 0, sizeof(import_token));
+    preferences.begin(PREFERENCES_NAMESPACE, false);
+    size_t length = preferences.getBytes(PREF_KEY_IMPORT_TOKEN, import_token, sizeof(import_token));
+    if ((length != sizeof(import_token)) || (import_token[sizeof(import_token) - 1] != '\0'))
+    {
+        memset(import_token, 0, sizeof(import_token));
+    }
+
+    // Subscribe to messages
+    messagebroker_subscribe(MSG_0203, scheduleserver_message_handler); // WiFi connection status
+    messagebroker_subscribe(MSG_0406, scheduleserver_message_handler); // Schedule list page
+    messagebroker_subscribe(MSG_0410, scheduleserver_message_handler); // Bulk import response
+    messagebroker_subscribe(MSG_0415, scheduleserver_message_handler); // Set the import token
+
+    is_initialized = true;
+}
+
+void scheduleserver_start_task(void)
+{
+    ASSERT(is_initialized);
+
+    if (scheduleserver_task_handle == NULL)
+    {
+        xTaskCreate(prv_scheduleserver_task, "SchedServerTask", 4096, NULL, 1, &scheduleserver_task_handle);
+    }
+}
+
+// ###########################################################################
+// # Private function implementations
+// ###########################################################################
+
+void scheduleserver_message_handler(const msg_t* const message)
+{
+    ASSERT(message != NULL);
+
+    switch (message->msg_id)
+    {
+        case MSG_0203: // WiFi connection status
+        {
+            msg_wifi_connection_status_t* status = (msg_wifi_connection_status_t*)message->data_bytes;
+
+            bool is_connected = (status->status == WIFI_STATUS_CONNECTED);
+            if (is_connected != is_wifi_connected)
+            {
+                is_wifi_connected = is_connected;
+                prv_notify_task(SERVER_EVENT_BIT_WIFI_CHANGED);
+            }
+            break;
+        }
+
+        case MSG_0406: // Schedule list page
+        {
+            msg_schedule_list_t* list = (msg_schedule_list_t*)message->data_bytes;
+            if (list->requested_by == MODULE_SCHEDULESERVER)
+            {
+                export_page = *list;
+                prv_notify_task(SERVER_EVENT_BIT_PAGE);
+            }
+            break;
+        }
+
+        case MSG_0410: // Bulk import response
+        {
+            import_response = *(msg_schedule_import_response_t*)message->data_bytes;
+            break;
+        }
+
+        case MSG_0415: // Set the import token
+        {
+            msg_schedule_set_import_token_t* cmd = (msg_schedule_set_import_token_t*)message->data_bytes;
+            if (cmd->token[sizeof(cmd->token) - 1] != '\0')
+            {
+                LOG_WARNING(MODULE_SCHEDULESERVER, "Import token is not terminated, ignored");
+                break;
+            }
+
+            xSemaphoreTake(token_mutex, portMAX_DELAY);
+            memcpy(import_token, cmd->token, sizeof(import_token));
+            xSemaphoreGive(token_mutex);
+
+            preferences.putBytes(PREF_KEY_IMPORT_TOKEN, cmd->token, sizeof(cmd->token));
+            LOG_INFO(MODULE_SCHEDULESERVER, "Schedule import %s", (cmd->token[0] != '\0') ? "enabled" : "disabled");
+            break;
+        }
+
+        default: break;
+    }
+}
+
+static void prv_scheduleserver_task(void* parameter)
+{
+    (void)parameter;
+
+    while (1)
+    {
+        if (!is_wifi_connected)
+        {
+            prv_close_listen_socket();
+
+            // Sleep until WiFi is up
+            xTaskNotifyWait(0, SERVER_EVENT_BIT_WIFI_CHANGED, NULL, portMAX_DELAY);
+            continue;
+        }
+
+        if ((listen_socket < 0) && !prv_open_listen_socket())
+        {
+            xTaskNotifyWait(0, SERVER_EVENT_BIT_WIFI_CHANGED, NULL, pdMS_TO_TICKS(SERVER_ACCEPT_TIMEOUT_MS));
+            continue;
+        }
+
+        // Times out regularly, so that a lost connection closes the listening socket
+        int client_socket = accept(listen_socket, NULL, NULL);
+        if (client_socket < 0)
+        {
+            continue;
+        }
+
+        struct timeval rx_timeout;
+        rx_timeout.tv_sec = SERVER_CLIENT_TIMEOUT_MS / 1000;
+        rx_timeout.tv_usec = 0;
+        setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &rx_timeout, sizeof(rx_timeout));
+        setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &rx_timeout, sizeof(rx_timeout));
+
+        prv_serve_client(client_socket);
+        close(client_socket);
+    }
+}
+
+static bool prv_open_listen_socket(void)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0)
+    {
+        LOG_ERROR(MODULE_SCHEDULESERVER, "Failed to create the server socket");
+        return false;
+    }
+
+    struct sockaddr_in local_address;
+    memset(&local_address, 0, sizeof(local_address));
+    local_address.sin_family = AF_INET;
+    local_address.sin_port = htons(SCHEDULESERVER_PORT);
+    local_address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    int reuse = 1;
+    struct timeval accept_timeout;
+    accept_timeout.tv_sec = SERVER_ACCEPT_TIMEOUT_MS / 1000;
+    accept_timeout.tv_usec = (SERVER_ACCEPT_TIMEOUT_MS % 1000) * 1000;
+
+    if ((setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0)
+        || (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &accept_timeout, sizeof(accept_timeout)) < 0)
+        || (bind(sock, (struct sockaddr*)&local_address, sizeof(local_address)) < 0) || (listen(sock, 1) < 0))
+    {
+        LOG_ERROR(MODULE_SCHEDULESERVER, "Failed to listen on port %d", SCHEDULESERVER_PORT);
+        close(sock);
+        return false;
+    }
+
+    listen_socket = sock;
+    LOG_INFO(MODULE_SCHEDULESERVER, "Schedule import/export listening on port %d", SCHEDULESERVER_PORT);
+    return true;
+}
+
+static void prv_close_listen_socket(void)
+{
+    if (listen_socket >= 0)
+    {
+        close(listen_socket);
+        listen_socket = -1;
+    }
+}
+
+static void prv_serve_client(int client_socket)
+{
+    server_reader_t reader;
+    reader.socket = client_socket;
+    reader.length = 0;
+    reader.position = 0;
+
+    char line[SERVER_LINE_LENGTH];
+    bool is_too_long = false;
+    if (!prv_read_line(&reader, line, sizeof(line), &is_too_long))
+    {
+        return;
+    }
+
+    if (is_too_long)
+    {
+        prv_send_line(client_socket, "ERROR: line longer than %d characters", SERVER_LINE_LENGTH - 1);
+        return;
+    }
+
+    if (strcmp(line, "EXPORT") == 0)
+    {
+        prv_export_schedules(client_socket);
+    }
+    else if ((strcmp(line, "IMPORT") == 0) || (strncmp(line, "IMPORT ", 7) == 0))
+    {
+        if (prv_is_import_token((line[6] == ' ') ? &line[7] : ""))
+        {
+            prv_import_schedules(&reader);
+        }
+        else
+        {
+            LOG_WARNING(MODULE_SCHEDULESERVER, "Schedule import with a wrong token was refused");
+            prv_send_line(client_socket, "ERROR: import is disabled or the token is wrong, use IMPORT <token>");
+        }
+    }
+    else
+    {
+        prv_send_line(client_socket, "ERROR: unknown command, use EXPORT or IMPORT <token>");
+    }
+}
+
+static void prv_export_schedules(int client_socket)
+{
+    u16 start_index = 0;
+    u16 nof_sent = 0;
+
+    while (1)
+    {
+        msg_schedule_list_request_t request;
+        request.start_index = start_index;
+        request.requested_by = MODULE_SCHEDULESERVER;
+
+        msg_t msg;
+        msg.msg_id = MSG_0402;
+        msg.data_size = sizeof(msg_schedule_list_request_t);
+        msg.data_bytes = (u8*)&request;
+
+        ulTaskNotifyValueClear(NULL, SERVER_EVENT_BIT_PAGE);
+        messagebroker_publish(&msg);
+
+        // The page is published deferred - wait for it, a WiFi event in between does not end the wait
+        u32 received_bits = 0;
+        u32 event_bits = 0;
+        while (((received_bits & SERVER_EVENT_BIT_PAGE) == 0)
+               && (xTaskNotifyWait(0, SERVER_EVENT_BIT_PAGE, &event_bits, pdMS_TO_TICKS(SERVER_PAGE_TIMEOUT_MS))
+                   == pdTRUE))
+        {
+            received_bits |= event_bits;
+        }
+
+        if ((received_bits & SERVER_EVENT_BIT_PAGE) == 0)
+        {
+            prv_send_line(client_socket, "ERROR: the schedule list did not arrive");
+            return;
+        }
+
+        for (u8 i = 0; i < export_page.count; i++)
+        {
+            const schedule_info_t* info = &export_page.schedules[i];
+            if (!prv_send_line(client_socket, "%02u:%02u:%02u,%02X,%u", info->hour, info->minute, info->second,
+                               info->weekday_mask, info->song_index))
+            {
+                return;
+            }
+            nof_sent++;
+        }
+
+        start_index = export_page.start_index + export_page.count;
+        if ((export_page.count == 0) || (start_index >= export_page.total_count))
+        {
+            break;
+        }
+    }
+
+    prv_send_line(client_socket, "END %u", nof_sent);
+    LOG_INFO(MODULE_SCHEDULESERVER, "Exported %d schedules", nof_sent);
+}
+
+static void prv_import_schedules(server_reader_t* reader)
+{
+    char line[SERVER_LINE_LENGTH];
+    u16 nof_schedules = 0;
+    u16 line_number = 1; // The IMPORT line
+    bool is_too_long = false;
+
+    while (1)
+    {
+        if (!prv_read_line(reader, line, sizeof(line), &is_too_long))
+        {
+            // Nothing is changed unless the table arrived completely
+            prv_send_line(reader->socket, "ERROR line %u: connection closed before END", line_number);
+            return;
+        }
+        line_number++;
+
+        // The beginning of an overlong line could parse as a different schedule
+        if (is_too_long)
+        {
+            prv_send_line(reader->socket, "ERROR line %u: longer than %d characters", line_number,
+                          SERVER_LINE_LENGTH - 1);
+            return;
+        }
+
+        if ((line[0] == '\0') || (line[0] == '#'))
+        {
+            continue;
+        }
+
+        if (strcmp(line, "END") == 0)
+        {
+            break;
+        }
+
+        if (nof_schedules >= SCHEDULESTORE_MAX_SCHEDULES)
+        {
+            prv_send_line(reader->socket, "ERROR line %u: more than %d schedules", line_number,
+                          SCHEDULESTORE_MAX_SCHEDULES);
+            return;
+        }
+
+        if (!prv_parse_schedule(line, &import_buffer[nof_schedules]))
+        {
+            prv_send_line(reader->socket, "ERROR line %u: expected HH:MM[:SS],<weekday mask>,<song index>",
+                          line_number);
+            return;
+        }
+        nof_schedules++;
+    }
+
+    msg_t msg;
+    msg.msg_id = MSG_0409;
+    msg.data_size = (u16)(nof_schedules * sizeof(msg_schedule_add_t));
+    msg.data_bytes = (u8*)import_buffer;
+
+    import_response.success = false;
+    import_response.nof_schedules = 0;
+    import_response.error_index = 0;
+    messagebroker_publish(&msg);
+
+    if (import_response.success)
+    {
+        prv_send_line(reader->socket, "OK %u", import_response.nof_schedules);
+    }
+    else
+    {
+        prv_send_line(reader->socket, "ERROR: schedule %u was rejected", import_response.error_index + 1U);
+    }
+}
+
+static bool prv_is_import_token(const char* token)
+{
+    xSemaphoreTake(token_mutex, portMAX_DELAY);
+    bool is_enabled = (import_token[0] != '\0');
+
+    // Compares all characters, so that the time does not tell how much of the token was right
+    u8 difference = 0;
+    size_t length = strlen(token);
+    for (size_t i = 0; i < sizeof(import_token); i++)
+    {
+        char c = (i < length) ? token[i] : '\0';
+        difference |= (u8)(c ^ import_token[i]);
+    }
+    xSemaphoreGive(token_mutex);
+
+    return is_enabled && (length < sizeof(import_token)) && (difference == 0);
+}
+
+static bool prv_parse_schedule(const char* line, msg_schedule_add_t* schedule)
+{
+    unsigned hour = 0;
+    unsigned minute = 0;
+    unsigned second = 0;
+    unsigned weekday_mask = 0;
+    unsigned song_index = 0;
+    int consumed = 0;
+
+    // HH:MM:SS,mask,song - the seconds are optional
+    int nof_fields = sscanf(line, "%u:%u:%u,%x,%u%n", &hour, &minute, &second, &weekday_mask, &song_index, &consumed);
+    if (nof_fields != 5)
+    {
+        second = 0;
+        consumed = 0;
+        nof_fields = sscanf(line, "%u:%u,%x,%u%n", &hour, &minute, &weekday_mask, &song_index, &consumed) + 1;
+    }
+
+    if (nof_fields != 5)
+    {
+        return false;
+    }
+
+    if ((line[consumed] != '\0') || (hour >= 24) || (minute >= 60) || (second >= 60) || ((weekday_mask & 0x7F) == 0)
+        || (weekday_mask > 0x7F) || (song_index > SCHEDULESTORE_MAX_SONG_INDEX))
+    {
+        return false;
+    }
+
+    schedule->hour = (u8)hour;
+    schedule->minute = (u8)minute;
+    schedule->second = (u8)second;
+    schedule->weekday_mask = (u8)weekday_mask;
+    schedule->song_index = (u16)song_index;
+    return true;
+}
+
+static bool prv_read_line(server_reader_t* reader, char* line, size_t size, bool* is_too_long)
+{
+    size_t length = 0;
+    *is_too_long = false;
+
+    while (1)
+    {
+        if (reader->position >= reader->length)
+        {
+            reader->length = recv(reader->socket, reader->buffer, sizeof(reader->buffer), 0);
+            reader->position = 0;
+            if (reader->length <= 0)
+            {
+                return false; // Closed or timed out
+            }
+        }
+
+        char c = (char)reader->buffer[reader->position++];
+        if (c == '\n')
+        {
+            break;
+        }
+
+        // Carriage returns of Windows line endings are dropped, the rest of an overlong line is discarded
+        if (c == '\r')
+        {
+            continue;
+        }
+
+        if (length < (size - 1))
+        {
+            line[length++] = c;
+        }
+        else
+        {
+            *is_too_long = true;
+        }
+    }
+
+    line[length] = '\0';
+    return true;
+}
+
+static bool prv_send_line(int client_socket, const char* format, ...)
+{
+    char line[SERVER_REPLY_LENGTH];
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line) - 1, format, args);
+    va_end(args);
+
+    if (length < 0)
+    {
+        return false;
+    }
+
+    // An overlong reply is cut - the client still gets the line and its newline
+    if (length >= (int)(sizeof(line) - 1))
+    {
+        length = (int)(sizeof(line) - 2);
+    }
+    line[length++] = '\n';
+
+    return send(client_socket, line, length, 0) == length;
+}
+
+static void prv_notify_task(u32 event_bits)
+{
+    if (scheduleserver_task_handle != NULL)
+    {
+        xTaskNotify(scheduleserver_task_handle, event_bits, eSetBits);
+    }
+}
@@ -0,0 +1,62 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef SCHEDULESERVER_H
+#define SCHEDULESERVER_H
+
+#include "custom_types.h"
+
+#define SCHEDULESERVER_PORT 4711 // TCP port of the import/export endpoint
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+    /**
+     * @brief Initialize the ScheduleServer module
+     */
+    void scheduleserver_init(void);
+
+    /**
+     * @brief Start the ScheduleServer task
+     *
+     * While WiFi is connected, the task accepts TCP connections on SCHEDULESERVER_PORT. A client sends
+     * one command line:
+     *
+     * - "EXPORT": the schedules are sent back as "HH:MM:SS,<weekday mask hex>,<song index>" lines,
+     *   followed by "END <count>"
+     * - "IMPORT <token>": followed by lines in the same format (the seconds are optional) and a final "END".
+     *   The whole table is validated and replaced at once, the answer is "OK <count>" or "ERROR ...: <reason>".
+     *   The token is set with MSG_0415 - without one, the import is refused
+     *
+     * Bit 0 of the weekday mask is Monday. Empty lines and lines starting with '#' are skipped.
+     */
+    void scheduleserver_start_task(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // SCHEDULESERVER_H
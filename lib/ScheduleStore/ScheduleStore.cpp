@@ -0,0 +1,764 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file ScheduleStore.cpp
+ * @brief Compact storage of the schedules with a time sorted index
+ *
+ * The table in RAM has the same layout as the blob in flash: a small header followed by one
+ * packed record per slot. Saving writes the used part of it with a single NVS write, loading
+ * reads it back with a single read. No copy of the table is needed for either.
+ *
+ * The exception calendar is small, it is always written completely as a blob of its own.
+ */
+
+#include "ScheduleStore.h"
+#include "Logger.h"
+#include "custom_assert.h"
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "esp_rom_crc.h"
+
+// ###########################################################################
+// # Private defines
+// ###########################################################################
+#define NVS_NAMESPACE           "appcontrol"
+#define NVS_KEY_SCHEDULE_BLOB   "sched_blob"
+#define NVS_KEY_SCHEDULE_COUNT  "sched_cnt" // Legacy layout: count plus one key per schedule
+#define NVS_KEY_SCHEDULE_PREFIX "sched_"
+#define NVS_KEY_EXCEPTION_BLOB  "sched_except"
+#define STORE_VERSION           4
+#define STORE_VERSION_V3        3 // One 8 byte record per slot
+#define STORE_VERSION_V2        2 // One 4 byte record per slot, resolved to the minute
+#define STORE_VERSION_V1        1 // One 6 byte record per active schedule
+#define STORE_V1_MAX_SCHEDULES  20
+#define EXCEPTION_STORE_VERSION 1
+
+// ###########################################################################
+// # Type Definitions
+// ###########################################################################
+
+// Table in RAM and blob in flash - only the header and the first nof_slots slots are written
+typedef struct
+{
+    u8 version;
+    u8 nof_slots; // Slots up to the highest used schedule ID
+    u16 reserved;
+    u32 crc; // CRC32 over the written slots
+    u8 slots[SCHEDULESTORE_MAX_SCHEDULES][SCHEDULESTORE_RECORD_SIZE]; // Little-endian records
+} schedule_table_t;
+
+#define TABLE_HEADER_SIZE (offsetof(schedule_table_t, slots))
+
+// Exception calendar in RAM and blob in flash
+typedef struct
+{
+    u8 version;
+    u8 reserved[3];
+    u32 crc; // CRC32 over the slots
+    schedule_exception_t slots[SCHEDULESTORE_MAX_EXCEPTIONS];
+} exception_table_t;
+
+// Blob layout of version 1
+typedef struct __attribute__((packed))
+{
+    u8 schedule_id;
+    u8 hour;
+    u8 minute;
+    u8 weekday_mask;
+    u16 song_index;
+} schedule_record_v1_t;
+
+typedef struct __attribute__((packed))
+{
+    u8 version;
+    u8 nof_records;
+    u32 crc;
+    schedule_record_v1_t records[STORE_V1_MAX_SCHEDULES];
+} schedule_blob_v1_t;
+
+// ###########################################################################
+// # Private function declarations
+// ###########################################################################
+static schedule_record_t prv_get_slot(u8 schedule_id);
+static void prv_set_slot(u8 schedule_id, schedule_record_t record);
+static u8 prv_find_first_index_of(schedule_record_t record);
+static void prv_insert_into_index(u8 schedule_id);
+static void prv_rebuild_index(void);
+static void prv_update_nof_slots(void);
+static bool prv_load_table(void);
+static bool prv_migrate_blob_v1(const u8* blob, size_t len);
+static bool prv_migrate_blob_v2(size_t len);
+static bool prv_migrate_blob_v3(const u8* slots_v3, u8 nof_slots, u32 crc, size_t len);
+static bool prv_migrate_large_blob_v3(size_t len);
+static void prv_migrate_legacy_keys(void);
+static void prv_save_table(void);
+static void prv_save_exceptions(void);
+static bool prv_load_exceptions(void);
+static bool prv_is_valid_date(u32 date);
+
+// ###########################################################################
+// # Private Variables
+// ###########################################################################
+static bool is_initialized = false;
+static bool is_dirty = false; // The table differs from the blob in flash
+static Preferences preferences;
+
+static schedule_table_t table;
+
+// IDs of the used slots, sorted by their record - i.e. by the time of day
+static u8 time_index[SCHEDULESTORE_MAX_SCHEDULES];
+static u8 nof_schedules = 0;
+
+static exception_table_t exceptions;
+static bool is_exceptions_dirty = false; // The exceptions differ from the blob in flash
+
+// Changed with every change of the schedules or the exceptions
+static u32 revision = 0;
+
+// ###########################################################################
+// # Public function implementations
+// ###########################################################################
+
+void schedulestore_init(void)
+{
+    ASSERT(!is_initialized);
+
+    memset(&table, 0, sizeof(table));
+    table.version = STORE_VERSION;
+
+    if (!prv_load_table())
+    {
+        // Older layouts are converted once and written in the current layout
+        memset(&table, 0, sizeof(table));
+        table.version = STORE_VERSION;
+        prv_migrate_legacy_keys();
+        is_dirty = true;
+    }
+
+    prv_rebuild_index();
+
+    if (!prv_load_exceptions())
+    {
+        memset(&exceptions, 0, sizeof(exceptions));
+    }
+
+    revision++;
+    is_initialized = true;
+
+    schedulestore_save();
+}
+
+u8 schedulestore_add(u32 second_of_day, u8 weekday_mask, u16 song_index)
+{
+    if ((second_of_day >= SCHEDULESTORE_SECONDS_PER_DAY) || ((weekday_mask & 0x7F) == 0)
+        || (song_index > SCHEDULESTORE_MAX_SONG_INDEX))
+    {
+        return SCHEDULESTORE_INVALID_ID;
+    }
+
+    // The lowest free slot keeps the written part of the table short
+    for (u8 id = 0; id < SCHEDULESTORE_MAX_SCHEDULES; id++)
+    {
+        if (prv_get_slot(id) == 0)
+        {
+            prv_set_slot(id, schedulestore_pack(second_of_day, weekday_mask, song_index));
+            prv_insert_into_index(id);
+            prv_update_nof_slots();
+            is_dirty = true;
+            revision++;
+            return id;
+        }
+    }
+
+    return SCHEDULESTORE_INVALID_ID;
+}
+
+bool schedulestore_remove(u8 schedule_id)
+{
+    if ((schedule_id >= SCHEDULESTORE_MAX_SCHEDULES) || (prv_get_slot(schedule_id) == 0))
+    {
+        return false;
+    }
+
+    // Equal records are next to each other in the index - search the ID among them
+    u8 pos = prv_find_first_index_of(prv_get_slot(schedule_id));
+    while ((pos < nof_schedules) && (time_index[pos] != schedule_id))
+    {
+        pos++;
+    }
+    ASSERT(pos < nof_schedules);
+
+    memmove(&time_index[pos], &time_index[pos + 1], nof_schedules - pos - 1);
+    nof_schedules--;
+
+    prv_set_slot(schedule_id, 0);
+    prv_update_nof_slots();
+    is_dirty = true;
+    revision++;
+    return true;
+}
+
+void schedulestore_clear(void)
+{
+    memset(table.slots, 0, sizeof(table.slots));
+    table.nof_slots = 0;
+    nof_schedules = 0;
+    is_dirty = true;
+    revision++;
+}
+
+u8 schedulestore_get_count(void) { return nof_schedules; }
+
+u8 schedulestore_find_first_at(u32 second_of_day)
+{
+    // The second of the day is in the most significant bits of a record
+    return prv_find_first_index_of(schedulestore_pack(second_of_day, 0, 0));
+}
+
+bool schedulestore_get_at(u8 position, u8* out_schedule_id, schedule_record_t* out_record)
+{
+    ASSERT(out_schedule_id != NULL);
+    ASSERT(out_record != NULL);
+
+    if (position >= nof_schedules)
+    {
+        return false;
+    }
+
+    *out_schedule_id = time_index[position];
+    *out_record = prv_get_slot(time_index[position]);
+    return true;
+}
+
+u8 schedulestore_add_exception(u32 first_date, u32 last_date)
+{
+    if (!prv_is_valid_date(first_date) || !prv_is_valid_date(last_date) || (last_date < first_date))
+    {
+        return SCHEDULESTORE_INVALID_ID;
+    }
+
+    for (u8 id = 0; id < SCHEDULESTORE_MAX_EXCEPTIONS; id++)
+    {
+        if (exceptions.slots[id].first_date == 0)
+        {
+            exceptions.slots[id].first_date = first_date;
+            exceptions.slots[id].last_date = last_date;
+            is_exceptions_dirty = true;
+            revision++;
+            return id;
+        }
+    }
+
+    return SCHEDULESTORE_INVALID_ID;
+}
+
+bool schedulestore_remove_exception(u8 exception_id)
+{
+    if ((exception_id >= SCHEDULESTORE_MAX_EXCEPTIONS) || (exceptions.slots[exception_id].first_date == 0))
+    {
+        return false;
+    }
+
+    memset(&exceptions.slots[exception_id], 0, sizeof(exceptions.slots[exception_id]));
+    is_exceptions_dirty = true;
+    revision++;
+    return true;
+}
+
+void schedulestore_clear_exceptions(void)
+{
+    memset(exceptions.slots, 0, sizeof(exceptions.slots));
+    is_exceptions_dirty = true;
+    revision++;
+}
+
+bool schedulestore_get_exception(u8 exception_id, schedule_exception_t* out_exception)
+{
+    ASSERT(out_exception != NULL);
+
+    if ((exception_id >= SCHEDULESTORE_MAX_EXCEPTIONS) || (exceptions.slots[exception_id].first_date == 0))
+    {
+        return false;
+    }
+
+    *out_exception = exceptions.slots[exception_id];
+    return true;
+}
+
+bool schedulestore_is_exception_date(u32 date)
+{
+    for (u8 id = 0; id < SCHEDULESTORE_MAX_EXCEPTIONS; id++)
+    {
+        const schedule_exception_t* exception = &exceptions.slots[id];
+        if ((exception->first_date != 0) && (date >= exception->first_date) && (date <= exception->last_date))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+u32 schedulestore_get_revision(void) { return revision; }
+
+void schedulestore_save(void)
+{
+    ASSERT(is_initialized);
+
+    if (is_dirty)
+    {
+        prv_save_table();
+    }
+
+    if (is_exceptions_dirty)
+    {
+        prv_save_exceptions();
+    }
+}
+
+// ###########################################################################
+// # Private function implementations
+// ###########################################################################
+
+static schedule_record_t prv_get_slot(u8 schedule_id)
+{
+    schedule_record_t record = 0;
+    for (u8 i = 0; i < SCHEDULESTORE_RECORD_SIZE; i++)
+    {
+        record |= (schedule_record_t)table.slots[schedule_id][i] << (8 * i);
+    }
+    return record;
+}
+
+static void prv_set_slot(u8 schedule_id, schedule_record_t record)
+{
+    for (u8 i = 0; i < SCHEDULESTORE_RECORD_SIZE; i++)
+    {
+        table.slots[schedule_id][i] = (u8)(record >> (8 * i));
+    }
+}
+
+static u8 prv_find_first_index_of(schedule_record_t record)
+{
+    // Binary search for the first indexed schedule whose record is not sorted before the given one
+    u8 low = 0;
+    u8 high = nof_schedules;
+
+    while (low < high)
+    {
+        u8 mid = (u8)((low + high) / 2);
+        if (prv_get_slot(time_index[mid]) < record)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+static void prv_insert_into_index(u8 schedule_id)
+{
+    ASSERT(nof_schedules < SCHEDULESTORE_MAX_SCHEDULES);
+
+    u8 pos = prv_find_first_index_of(prv_get_slot(schedule_id));
+    memmove(&time_index[pos + 1], &time_index[pos], nof_schedules - pos);
+    time_index[pos] = schedule_id;
+    nof_schedules++;
+}
+
+static void prv_rebuild_index(void)
+{
+    nof_schedules = 0;
+
+    for (u8 id = 0; id < table.nof_slots; id++)
+    {
+        if (prv_get_slot(id) != 0)
+        {
+            prv_insert_into_index(id);
+        }
+    }
+}
+
+static void prv_update_nof_slots(void)
+{
+    u8 nof_slots = SCHEDULESTORE_MAX_SCHEDULES;
+    while ((nof_slots > 0) && (prv_get_slot(nof_slots - 1) == 0))
+    {
+        nof_slots--;
+    }
+    table.nof_slots = nof_slots;
+}
+
+static bool prv_load_table(void)
+{
+    // Read straight into the table - it has the layout of the blob
+    preferences.begin(NVS_NAMESPACE, true); // Open in read-only mode
+    size_t len = preferences.getBytes(NVS_KEY_SCHEDULE_BLOB, &table, sizeof(table));
+    size_t blob_len = (len == 0) ? preferences.getBytesLength(NVS_KEY_SCHEDULE_BLOB) : len;
+    preferences.end();
+
+    if (blob_len > sizeof(table))
+    {
+        // Only a v3 blob of more than 156 slots is larger than the table - it cannot be read in place
+        bool is_migrated = prv_migrate_large_blob_v3(blob_len);
+        is_dirty = is_migrated;
+        return is_migrated;
+    }
+
+    if ((len >= 1) && (table.version == STORE_VERSION_V1))
+    {
+        // The v1 blob is smaller than the table - convert it from a copy
+        u8 blob[sizeof(schedule_blob_v1_t)];
+        memcpy(blob, &table, (len < sizeof(blob)) ? len : sizeof(blob));
+        memset(&table, 0, sizeof(table));
+        table.version = STORE_VERSION;
+
+        bool is_migrated = prv_migrate_blob_v1(blob, len);
+        is_dirty = is_migrated;
+        return is_migrated;
+    }
+
+    if ((len >= TABLE_HEADER_SIZE) && (table.version == STORE_VERSION_V2))
+    {
+        bool is_migrated = prv_migrate_blob_v2(len);
+        is_dirty = is_migrated;
+        return is_migrated;
+    }
+
+    if ((len >= TABLE_HEADER_SIZE) && (table.version == STORE_VERSION_V3))
+    {
+        // Narrowed in place - a 5 byte slot only overwrites 8 byte slots that were already converted
+        bool is_migrated = prv_migrate_blob_v3(table.slots[0], table.nof_slots, table.crc, len);
+        is_dirty = is_migrated;
+        return is_migrated;
+    }
+
+    if ((len < TABLE_HEADER_SIZE) || (table.version != STORE_VERSION)
+        || (table.nof_slots > SCHEDULESTORE_MAX_SCHEDULES)
+        || (len != (TABLE_HEADER_SIZE + table.nof_slots * SCHEDULESTORE_RECORD_SIZE)))
+    {
+        return false;
+    }
+
+    if (table.crc != esp_rom_crc32_le(0, table.slots[0], table.nof_slots * SCHEDULESTORE_RECORD_SIZE))
+    {
+        LOG_ERROR(MODULE_APPCONTROL, "Schedule blob in flash is corrupted - ignoring it");
+        return false;
+    }
+
+    // The slots behind the blob must not contain leftovers of the read
+    memset(table.slots[table.nof_slots], 0,
+           (SCHEDULESTORE_MAX_SCHEDULES - table.nof_slots) * SCHEDULESTORE_RECORD_SIZE);
+
+    for (u8 id = 0; id < table.nof_slots; id++)
+    {
+        if ((schedulestore_get_second_of_day(prv_get_slot(id)) >= SCHEDULESTORE_SECONDS_PER_DAY)
+            || (schedulestore_get_weekday_mask(prv_get_slot(id)) == 0))
+        {
+            prv_set_slot(id, 0); // Out of range - drop it
+        }
+    }
+    prv_update_nof_slots();
+
+    return true;
+}
+
+static bool prv_migrate_blob_v1(const u8* blob, size_t len)
+{
+    schedule_blob_v1_t blob_v1;
+    const size_t header_size = offsetof(schedule_blob_v1_t, records);
+
+    if ((len < header_size) || (len > sizeof(blob_v1)))
+    {
+        return false;
+    }
+    memcpy(&blob_v1, blob, len);
+
+    size_t records_size = blob_v1.nof_records * sizeof(schedule_record_v1_t);
+    if ((blob_v1.nof_records > STORE_V1_MAX_SCHEDULES) || (len != (header_size + records_size))
+        || (blob_v1.crc != esp_rom_crc32_le(0, (const u8*)blob_v1.records, records_size)))
+    {
+        return false;
+    }
+
+    for (u8 i = 0; i < blob_v1.nof_records; i++)
+    {
+        const schedule_record_v1_t* record = &blob_v1.records[i];
+        if ((record->schedule_id < SCHEDULESTORE_MAX_SCHEDULES) && (record->hour < 24) && (record->minute < 60)
+            && ((record->weekday_mask & 0x7F) != 0) && (record->song_index <= SCHEDULESTORE_MAX_SONG_INDEX))
+        {
+            u32 second_of_day = (u32)(record->hour * 3600 + record->minute * 60);
+            prv_set_slot(record->schedule_id,
+                         schedulestore_pack(second_of_day, record->weekday_mask, record->song_index));
+        }
+    }
+    prv_update_nof_slots();
+
+    return true;
+}
+
+static bool prv_migrate_blob_v2(size_t len)
+{
+    // The v2 blob has the same header, but 4 byte slots: bits 31..21 minute of the day, 20..14 weekday
+    // mask and 13..0 song index. It was read into the table, so it is widened in place.
+    u8* slots_v2 = table.slots[0];
+    u8 nof_slots = table.nof_slots;
+    size_t slots_size = nof_slots * sizeof(u32);
+
+    if ((nof_slots > SCHEDULESTORE_MAX_SCHEDULES) || (len != (TABLE_HEADER_SIZE + slots_size))
+        || (table.crc != esp_rom_crc32_le(0, slots_v2, slots_size)))
+    {
+        return false;
+    }
+
+    // Back to front - a widened slot only overwrites v2 slots that were already converted
+    for (int id = (int)nof_slots - 1; id >= 0; id--)
+    {
+        u32 record_v2;
+        memcpy(&record_v2, &slots_v2[id * sizeof(u32)], sizeof(record_v2));
+
+        u32 minute_of_day = record_v2 >> 21;
+        u8 weekday_mask = (u8)((record_v2 >> 14) & 0x7F);
+        u16 song_index = (u16)(record_v2 & 0x3FFF);
+
+        bool is_valid = (record_v2 != 0) && (minute_of_day < 1440) && (weekday_mask != 0);
+        prv_set_slot((u8)id, is_valid ? schedulestore_pack(minute_of_day * 60, weekday_mask, song_index) : 0);
+    }
+
+    memset(table.slots[nof_slots], 0, (SCHEDULESTORE_MAX_SCHEDULES - nof_slots) * SCHEDULESTORE_RECORD_SIZE);
+    table.version = STORE_VERSION;
+    prv_update_nof_slots();
+
+    return true;
+}
+
+static bool prv_migrate_blob_v3(const u8* slots_v3, u8 nof_slots, u32 crc, size_t len)
+{
+    // The v3 blob has the same header, but 8 byte slots: bits 63..32 second of the day, 22..16 weekday
+    // mask and 13..0 song index
+    size_t slots_size = nof_slots * sizeof(u64);
+
+    if ((nof_slots > SCHEDULESTORE_MAX_SCHEDULES) || (len != (TABLE_HEADER_SIZE + slots_size))
+        || (crc != esp_rom_crc32_le(0, slots_v3, slots_size)))
+    {
+        return false;
+    }
+
+    // Front to back - the slot is read completely before its narrowed record is written
+    for (u8 id = 0; id < nof_slots; id++)
+    {
+        u64 record_v3;
+        memcpy(&record_v3, &slots_v3[id * sizeof(u64)], sizeof(record_v3));
+
+        u32 second_of_day = (u32)(record_v3 >> 32);
+        u8 weekday_mask = (u8)((record_v3 >> 16) & 0x7F);
+        u16 song_index = (u16)(record_v3 & 0x3FFF);
+
+        bool is_valid = (record_v3 != 0) && (second_of_day < SCHEDULESTORE_SECONDS_PER_DAY) && (weekday_mask != 0);
+        prv_set_slot(id, is_valid ? schedulestore_pack(second_of_day, weekday_mask, song_index) : 0);
+    }
+
+    memset(table.slots[nof_slots], 0, (SCHEDULESTORE_MAX_SCHEDULES - nof_slots) * SCHEDULESTORE_RECORD_SIZE);
+    table.version = STORE_VERSION;
+    prv_update_nof_slots();
+
+    return true;
+}
+
+static bool prv_migrate_large_blob_v3(size_t len)
+{
+    // Read once into a temporary buffer - the migration runs a single time, on the first boot after an update
+    u8* blob = (u8*)malloc(len);
+    if (blob == NULL)
+    {
+        return false;
+    }
+
+    preferences.begin(NVS_NAMESPACE, true); // Open in read-only mode
+    size_t read_len = preferences.getBytes(NVS_KEY_SCHEDULE_BLOB, blob, len);
+    preferences.end();
+
+    bool is_migrated = false;
+    if ((read_len == len) && (blob[offsetof(schedule_table_t, version)] == STORE_VERSION_V3))
+    {
+        u8 nof_slots = blob[offsetof(schedule_table_t, nof_slots)];
+        u32 crc;
+        memcpy(&crc, &blob[offsetof(schedule_table_t, crc)], sizeof(crc));
+
+        memset(&table, 0, sizeof(table));
+        is_migrated = prv_migrate_blob_v3(&blob[TABLE_HEADER_SIZE], nof_slots, crc, len);
+    }
+
+    free(blob);
+    return is_migrated;
+}
+
+static void prv_migrate_legacy_keys(void)
+{
+    preferences.begin(NVS_NAMESPACE, false); // Read-write - the legacy keys are removed afterwards
+
+    // Get count of saved schedules
+    int saved_count = preferences.getInt(NVS_KEY_SCHEDULE_COUNT, 0);
+
+    // Load each schedule
+    for (int i = 0; (i < saved_count) && (i < STORE_V1_MAX_SCHEDULES); i++)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), "%s%d", NVS_KEY_SCHEDULE_PREFIX, i);
+
+        // Read stored data
+        struct
+        {
+            u8 hour;
+            u8 minute;
+            u16 song_index;
+            u8 weekday_mask;
+            int original_id;
+        } storage_data;
+
+        size_t len = preferences.getBytes(key, &storage_data, sizeof(storage_data));
+        preferences.remove(key);
+
+        if ((len != sizeof(storage_data)) || (storage_data.hour >= 24) || (storage_data.minute >= 60)
+            || ((storage_data.weekday_mask & 0x7F) == 0) || (storage_data.song_index > SCHEDULESTORE_MAX_SONG_INDEX))
+        {
+            continue;
+        }
+
+        // Try to restore to original position, or find next free slot
+        int target_slot = storage_data.original_id;
+        if ((target_slot < 0) || (target_slot >= SCHEDULESTORE_MAX_SCHEDULES) || (prv_get_slot(target_slot) != 0))
+        {
+            target_slot = -1;
+            for (int j = 0; j < SCHEDULESTORE_MAX_SCHEDULES; j++)
+            {
+                if (prv_get_slot(j) == 0)
+                {
+                    target_slot = j;
+                    break;
+                }
+            }
+        }
+
+        if (target_slot >= 0)
+        {
+            prv_set_slot((u8)target_slot,
+                         schedulestore_pack((u32)(storage_data.hour * 3600 + storage_data.minute * 60),
+                                            storage_data.weekday_mask, storage_data.song_index));
+        }
+    }
+
+    preferences.remove(NVS_KEY_SCHEDULE_COUNT);
+    preferences.end();
+
+    prv_update_nof_slots();
+}
+
+static void prv_save_table(void)
+{
+    size_t slots_size = table.nof_slots * SCHEDULESTORE_RECORD_SIZE;
+    table.version = STORE_VERSION;
+    table.crc = esp_rom_crc32_le(0, table.slots[0], slots_size);
+
+    // One NVS write for the whole table
+    preferences.begin(NVS_NAMESPACE, false); // Open in read-write mode
+    size_t written = preferences.putBytes(NVS_KEY_SCHEDULE_BLOB, &table, TABLE_HEADER_SIZE + slots_size);
+    preferences.end();
+
+    if (written != (TABLE_HEADER_SIZE + slots_size))
+    {
+        // Stays dirty - the next change tries again
+        LOG_ERROR(MODULE_APPCONTROL, "Failed to save the schedules to flash");
+        return;
+    }
+
+    is_dirty = false;
+}
+
+static void prv_save_exceptions(void)
+{
+    exceptions.version = EXCEPTION_STORE_VERSION;
+    exceptions.crc = esp_rom_crc32_le(0, (const u8*)exceptions.slots, sizeof(exceptions.slots));
+
+    preferences.begin(NVS_NAMESPACE, false); // Open in read-write mode
+    size_t written = preferences.putBytes(NVS_KEY_EXCEPTION_BLOB, &exceptions, sizeof(exceptions));
+    preferences.end();
+
+    if (written != sizeof(exceptions))
+    {
+        // Stays dirty - the next change tries again
+        LOG_ERROR(MODULE_APPCONTROL, "Failed to save the schedule exceptions to flash");
+        return;
+    }
+
+    is_exceptions_dirty = false;
+}
+
+static bool prv_load_exceptions(void)
+{
+    preferences.begin(NVS_NAMESPACE, true); // Open in read-only mode
+    size_t len = preferences.getBytes(NVS_KEY_EXCEPTION_BLOB, &exceptions, sizeof(exceptions));
+    preferences.end();
+
+    if (len == 0)
+    {
+        return false; // None stored yet
+    }
+
+    if ((len != sizeof(exceptions)) || (exceptions.version != EXCEPTION_STORE_VERSION)
+        || (exceptions.crc != esp_rom_crc32_le(0, (const u8*)exceptions.slots, sizeof(exceptions.slots))))
+    {
+        LOG_ERROR(MODULE_APPCONTROL, "Schedule exceptions in flash are corrupted - ignoring them");
+        return false;
+    }
+
+    for (u8 id = 0; id < SCHEDULESTORE_MAX_EXCEPTIONS; id++)
+    {
+        schedule_exception_t* exception = &exceptions.slots[id];
+        if ((exception->first_date != 0)
+            && (!prv_is_valid_date(exception->first_date) || !prv_is_valid_date(exception->last_date)
+                || (exception->last_date < exception->first_date)))
+        {
+            memset(exception, 0, sizeof(*exception)); // Out of range - drop it
+        }
+    }
+
+    return true;
+}
+
+static bool prv_is_valid_date(u32 date)
+{
+    // The day is not checked against the month - a 31st that does not exist simply never matches
+    u32 year = date / 10000UL;
+    u32 month = (date / 100UL) % 100UL;
+    u32 day = date % 100UL;
+
+    return (year >= 2000) && (year <= 2099) && (month >= 1) && (month <= 12) && (day >= 1) && (day <= 31);
+}
@@ -0,0 +1,187 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file ScheduleStore.h
+ * @brief Compact storage of the schedules with a time sorted index
+ *
+ * Every schedule is packed into 5 bytes. The schedule ID is the slot in the table, so it stays
+ * stable while other schedules are added or removed. The module is not thread-safe - the caller
+ * (ApplicationControl) serializes all accesses.
+ *
+ * Next to the schedules the store keeps the exception calendar - date ranges on which no schedule
+ * is played, e.g. holidays. It is written to flash as a blob of its own.
+ */
+
+#ifndef SCHEDULESTORE_H
+#define SCHEDULESTORE_H
+
+#include "custom_types.h"
+
+#define SCHEDULESTORE_MAX_SCHEDULES   250 // IDs and positions fit into a u8
+#define SCHEDULESTORE_INVALID_ID      0xFF
+#define SCHEDULESTORE_MAX_SONG_INDEX  0x3FFF
+#define SCHEDULESTORE_SECONDS_PER_DAY 86400UL
+#define SCHEDULESTORE_MAX_EXCEPTIONS  16
+#define SCHEDULESTORE_RECORD_SIZE     5 // Bytes of a record in the table and in flash
+
+/**
+ * Packed schedule - sorting the raw values sorts the schedules by their time of day
+ *
+ * Bits 37..21: second of the day (0-86399)
+ * Bits 20..14: weekday mask (bit 0 = Monday, ..., bit 6 = Sunday)
+ * Bits 13..0:  song index (0-16383)
+ *
+ * The 38 bits are kept in SCHEDULESTORE_RECORD_SIZE bytes per slot and handled as a u64 value.
+ * A schedule has at least one weekday, so a record of 0 marks a free slot.
+ */
+typedef u64 schedule_record_t;
+
+static inline schedule_record_t schedulestore_pack(u32 second_of_day, u8 weekday_mask, u16 song_index)
+{
+    return ((u64)(second_of_day & 0x1FFFF) << 21) | ((u64)(weekday_mask & 0x7F) << 14) | (u64)(song_index & 0x3FFF);
+}
+
+static inline u32 schedulestore_get_second_of_day(schedule_record_t record) { return (u32)(record >> 21); }
+
+static inline u16 schedulestore_get_minute_of_day(schedule_record_t record)
+{
+    return (u16)(schedulestore_get_second_of_day(record) / 60);
+}
+
+static inline u8 schedulestore_get_weekday_mask(schedule_record_t record) { return (u8)((record >> 14) & 0x7F); }
+
+static inline u16 schedulestore_get_song_index(schedule_record_t record) { return (u16)(record & 0x3FFF); }
+
+/**
+ * Exception - no schedule is played from the first to the last date, both included
+ *
+ * The dates are YYYYMMDD numbers, so comparing two of them compares the dates. A first date of 0
+ * marks a free slot.
+ */
+typedef struct
+{
+    u32 first_date;
+    u32 last_date;
+} schedule_exception_t;
+
+static inline u32 schedulestore_pack_date(u16 year, u8 month, u8 day)
+{
+    return (u32)year * 10000UL + (u32)month * 100UL + (u32)day;
+}
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+    /**
+     * @brief Load the schedules from flash (migrates older layouts) and build the time index
+     */
+    void schedulestore_init(void);
+
+    /**
+     * @brief Add a schedule
+     * @return Schedule ID, SCHEDULESTORE_INVALID_ID if the table is full or the values are out of range
+     */
+    u8 schedulestore_add(u32 second_of_day, u8 weekday_mask, u16 song_index);
+
+    /**
+     * @brief Remove a schedule
+     * @return false if there is no schedule with this ID
+     */
+    bool schedulestore_remove(u8 schedule_id);
+
+    /**
+     * @brief Remove all schedules
+     */
+    void schedulestore_clear(void);
+
+    /**
+     * @brief Number of schedules
+     */
+    u8 schedulestore_get_count(void);
+
+    /**
+     * @brief Position of the first schedule at or after the given second of the day in the time index
+     *
+     * Binary search - returns schedulestore_get_count() if there is none.
+     */
+    u8 schedulestore_find_first_at(u32 second_of_day);
+
+    /**
+     * @brief Read a schedule by its position in the time index
+     * @return false if the position is out of range
+     */
+    bool schedulestore_get_at(u8 position, u8* out_schedule_id, schedule_record_t* out_record);
+
+    /**
+     * @brief Add an exception
+     * @param first_date First date without schedules (YYYYMMDD)
+     * @param last_date Last date without schedules (YYYYMMDD, not before first_date)
+     * @return Exception ID, SCHEDULESTORE_INVALID_ID if the calendar is full or a date is invalid
+     */
+    u8 schedulestore_add_exception(u32 first_date, u32 last_date);
+
+    /**
+     * @brief Remove an exception
+     * @return false if there is no exception with this ID
+     */
+    bool schedulestore_remove_exception(u8 exception_id);
+
+    /**
+     * @brief Remove all exceptions
+     */
+    void schedulestore_clear_exceptions(void);
+
+    /**
+     * @brief Read an exception by its ID
+     * @return false if there is no exception with this ID
+     */
+    bool schedulestore_get_exception(u8 exception_id, schedule_exception_t* out_exception);
+
+    /**
+     * @brief Check whether no schedule is played on a date
+     * @param date Date to check (YYYYMMDD)
+     */
+    bool schedulestore_is_exception_date(u32 date);
+
+    /**
+     * @brief Revision of the schedules and the exceptions
+     *
+     * Changes with every change of either - a cache built from the store is valid while it stays the same.
+     */
+    u32 schedulestore_get_revision(void);
+
+    /**
+     * @brief Write the table and the exceptions to flash, each as a single blob, if they were changed since
+     * the last save
+     */
+    void schedulestore_save(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // SCHEDULESTORE_H
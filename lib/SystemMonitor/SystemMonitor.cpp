@@ -0,0 +1,427 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * @file SystemMonitor.cpp
+ * @brief Task, stack and heap profile of the running system
+ *
+ * A profile (MSG_0006 -> MSG_0007) lists the stack high-water mark of every task - the base for
+ * right-sizing the task stacks - the share of the CPU time every task got since the previous profile
+ * and the free heap, its low-water mark and the largest free block. The CPU shares come from the
+ * FreeRTOS run-time stats, without configGENERATE_RUN_TIME_STATS only the stacks and the heap are
+ * reported.
+ *
+ * Optionally the heap statistics and the CPU load are sampled periodically by a software timer into
+ * a small history (MSG_0008), which shows a slow leak or a load peak that a single profile misses.
+ *
+ * ESP-IDF counts the task stacks in bytes, so the high-water marks are bytes as well. The shares
+ * refer to a single core, which is all the ESP32-C6 has.
+ */
+
+#include "SystemMonitor.h"
+#include <Arduino.h>
+#include <string.h>
+#include "MessageBroker.h"
+#include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "custom_assert.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+// FreeRTOS includes
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#if (configUSE_TRACE_FACILITY != 1)
+#error "The SystemMonitor needs uxTaskGetSystemState() - enable configUSE_TRACE_FACILITY"
+#endif
+
+// ###########################################################################
+// # Private defines
+// ###########################################################################
+#define SYSMON_MAX_TRACKED_TASKS 32            // Tasks whose run-time counters are kept between two profiles
+#define SYSMON_TASK_LIST_SLACK   2             // Room for tasks created while the list is allocated
+#define SYSMON_COUNTER_RANGE_US  4294967296LL  // The 32 bit run-time counter (esp_timer, 1 MHz) wraps after this
+#define SYSMON_IDLE_TASK_PREFIX  "IDLE"        // Name of the idle task(s) - one per core
+#define PERMILLE                 1000U
+#define US_PER_MS                1000LL
+#define US_PER_SECOND            1000000LL
+
+#if (configGENERATE_RUN_TIME_STATS == 1)
+#define SYSMON_HAS_RUN_TIME_STATS true
+#else
+#define SYSMON_HAS_RUN_TIME_STATS false
+#endif
+
+// ###########################################################################
+// # Type Definitions
+// ###########################################################################
+typedef struct
+{
+    TaskHandle_t handle;
+    u32 run_time;
+} task_run_time_t;
+
+typedef struct
+{
+    task_run_time_t tasks[SYSMON_MAX_TRACKED_TASKS];
+    u8 nof_tasks;
+    u32 total_run_time;
+    s64 taken_at_us;
+} run_time_baseline_t;
+
+// ###########################################################################
+// # Private function declarations
+// ###########################################################################
+static void prv_publish_profile(void);
+static void prv_set_sampling_period(u32 period_s);
+static void prv_sampling_timer_callback(TimerHandle_t timer);
+static void prv_take_sample(bool is_stored);
+static void prv_read_heap(system_profile_sample_t* sample);
+static TaskStatus_t* prv_get_task_states(u32* nof_tasks, u32* total_run_time);
+static u32 prv_get_run_time(const TaskStatus_t* status);
+static u32 prv_get_run_time_since(const run_time_baseline_t* baseline, const TaskStatus_t* status);
+static void prv_update_baseline(run_time_baseline_t* baseline, const TaskStatus_t* states, u32 nof_tasks,
+                                u32 total_run_time, s64 now_us);
+static bool prv_is_idle_task(const TaskStatus_t* status);
+
+// ###########################################################################
+// # Private Variables
+// ###########################################################################
+static bool is_initialized = false;
+static SemaphoreHandle_t monitor_mutex = NULL; // Protects the baselines, the history and the profile
+static TimerHandle_t sampling_timer = NULL;
+static u32 sampling_period_s = 0;
+
+// Run-time counters at the previous profile and at the previous sample of the history
+static run_time_baseline_t profile_baseline;
+static run_time_baseline_t sample_baseline;
+
+// Ring buffer of the periodic samples
+static system_profile_sample_t history[SYSTEM_PROFILE_HISTORY_SIZE];
+static u8 history_head = 0; // Next slot to write
+static u8 nof_history = 0;
+
+// Kept off the stack of the requesting task - it takes most of a kilobyte
+static msg_system_profile_t profile;
+
+// ###########################################################################
+// # Public function implementations
+// ###########################################################################
+
+void systemmonitor_init(void)
+{
+    ASSERT(!is_initialized);
+
+    monitor_mutex = xSemaphoreCreateMutex();
+    ASSERT(monitor_mutex != NULL);
+
+    // The period is set when the sampling is enabled
+    sampling_timer = xTimerCreate("SysMonSample", pdMS_TO_TICKS(1000), pdTRUE, NULL, prv_sampling_timer_callback);
+    ASSERT(sampling_timer != NULL);
+
+    memset(&profile_baseline, 0, sizeof(profile_baseline));
+    memset(&sample_baseline, 0, sizeof(sample_baseline));
+
+    messagebroker_subscribe(MSG_0006, systemmonitor_message_handler); // Profile request
+    messagebroker_subscribe(MSG_0008, systemmonitor_message_handler); // Sampling period
+
+    is_initialized = true;
+}
+
+// ###########################################################################
+// # Private function implementations
+// ###########################################################################
+
+void systemmonitor_message_handler(const msg_t* const message)
+{
+    ASSERT(message != NULL);
+    ASSERT(is_initialized);
+
+    switch (message->msg_id)
+    {
+        case MSG_0006: // Request system profile
+            prv_publish_profile();
+            break;
+
+        case MSG_0008: // Set sampling period
+        {
+            ASSERT(message->data_size == sizeof(msg_system_set_sampling_t));
+            const msg_system_set_sampling_t* request = (const msg_system_set_sampling_t*)message->data_bytes;
+            prv_set_sampling_period(request->period_s);
+            break;
+        }
+
+        default:
+            ASSERT(false);
+            break;
+    }
+}
+
+static void prv_publish_profile(void)
+{
+    xSemaphoreTake(monitor_mutex, portMAX_DELAY);
+
+    memset(&profile, 0, sizeof(profile));
+
+    // Read the heap before the task list is allocated from it
+    prv_read_heap(&profile.current);
+
+    u32 nof_tasks = 0;
+    u32 total_run_time = 0;
+    TaskStatus_t* states = prv_get_task_states(&nof_tasks, &total_run_time);
+    s64 now_us = esp_timer_get_time();
+
+    if (states != NULL)
+    {
+        u32 elapsed_run_time = total_run_time - profile_baseline.total_run_time;
+        s64 elapsed_us = now_us - profile_baseline.taken_at_us;
+        u32 idle_run_time = 0;
+
+        profile.is_cpu_valid = SYSMON_HAS_RUN_TIME_STATS && (elapsed_run_time > 0) &&
+                               (elapsed_us < SYSMON_COUNTER_RANGE_US);
+        profile.cpu_interval_ms = (u32)(elapsed_us / US_PER_MS);
+        profile.nof_tasks_total = (u8)nof_tasks;
+
+        for (u32 i = 0; i < nof_tasks; i++)
+        {
+            u32 run_time = prv_get_run_time_since(&profile_baseline, &states[i]);
+            if (prv_is_idle_task(&states[i]))
+            {
+                idle_run_time += run_time;
+            }
+
+            if (profile.nof_tasks >= SYSTEM_PROFILE_MAX_TASKS)
+            {
+                continue;
+            }
+
+            system_task_info_t* task = &profile.tasks[profile.nof_tasks++];
+            strncpy(task->name, states[i].pcTaskName, SYSTEM_TASK_NAME_LENGTH - 1);
+            task->name[SYSTEM_TASK_NAME_LENGTH - 1] = '\0';
+            task->stack_free_min = (u32)states[i].usStackHighWaterMark;
+            task->priority = (u8)states[i].uxCurrentPriority;
+            task->state = (u8)states[i].eCurrentState;
+            if (profile.is_cpu_valid)
+            {
+                task->cpu_permille = (u16)(((u64)run_time * PERMILLE) / elapsed_run_time);
+            }
+        }
+
+        if (profile.is_cpu_valid && (idle_run_time <= elapsed_run_time))
+        {
+            profile.current.cpu_load_permille =
+                (u16)(PERMILLE - (((u64)idle_run_time * PERMILLE) / elapsed_run_time));
+        }
+
+        prv_update_baseline(&profile_baseline, states, nof_tasks, total_run_time, now_us);
+        vPortFree(states);
+    }
+
+    // Copy the history, oldest sample first
+    profile.sampling_period_s = sampling_period_s;
+    profile.nof_history = nof_history;
+    u8 oldest = (u8)((history_head + SYSTEM_PROFILE_HISTORY_SIZE - nof_history) % SYSTEM_PROFILE_HISTORY_SIZE);
+    for (u8 i = 0; i < nof_history; i++)
+    {
+        profile.history[i] = history[(oldest + i) % SYSTEM_PROFILE_HISTORY_SIZE];
+    }
+
+    msg_t msg;
+    msg.msg_id = MSG_0007;
+    msg.data_size = sizeof(msg_system_profile_t);
+    msg.data_bytes = (u8*)&profile;
+
+    messagebroker_publish(&msg);
+
+    xSemaphoreGive(monitor_mutex);
+}
+
+static void prv_set_sampling_period(u32 period_s)
+{
+    xSemaphoreTake(monitor_mutex, portMAX_DELAY);
+
+    // A new period starts a new history
+    sampling_period_s = period_s;
+    history_head = 0;
+    nof_history = 0;
+
+    if (period_s == 0)
+    {
+        xTimerStop(sampling_timer, portMAX_DELAY);
+    }
+    else
+    {
+        // The first sample measures the load from here on
+        prv_take_sample(false);
+        xTimerChangePeriod(sampling_timer, pdMS_TO_TICKS(period_s * 1000UL), portMAX_DELAY);
+    }
+
+    xSemaphoreGive(monitor_mutex);
+}
+
+static void prv_sampling_timer_callback(TimerHandle_t timer)
+{
+    (void)timer;
+
+    // Runs in the timer service task, which must not block - skip the sample while a profile is printed
+    if (xSemaphoreTake(monitor_mutex, 0) != pdTRUE)
+    {
+        return;
+    }
+
+    prv_take_sample(true);
+
+    xSemaphoreGive(monitor_mutex);
+}
+
+static void prv_take_sample(bool is_stored)
+{
+    system_profile_sample_t sample;
+    prv_read_heap(&sample);
+
+    u32 nof_tasks = 0;
+    u32 total_run_time = 0;
+    TaskStatus_t* states = prv_get_task_states(&nof_tasks, &total_run_time);
+    s64 now_us = esp_timer_get_time();
+
+    sample.cpu_load_permille = 0;
+    if (states != NULL)
+    {
+        u32 elapsed_run_time = total_run_time - sample_baseline.total_run_time;
+        u32 idle_run_time = 0;
+
+        for (u32 i = 0; i < nof_tasks; i++)
+        {
+            if (prv_is_idle_task(&states[i]))
+            {
+                idle_run_time += prv_get_run_time_since(&sample_baseline, &states[i]);
+            }
+        }
+
+        if (SYSMON_HAS_RUN_TIME_STATS && (elapsed_run_time > 0) && (idle_run_time <= elapsed_run_time))
+        {
+            sample.cpu_load_permille = (u16)(PERMILLE - (((u64)idle_run_time * PERMILLE) / elapsed_run_time));
+        }
+
+        prv_update_baseline(&sample_baseline, states, nof_tasks, total_run_time, now_us);
+        vPortFree(states);
+    }
+
+    if (is_stored)
+    {
+        history[history_head] = sample;
+        history_head = (u8)((history_head + 1) % SYSTEM_PROFILE_HISTORY_SIZE);
+        if (nof_history < SYSTEM_PROFILE_HISTORY_SIZE)
+        {
+            nof_history++;
+        }
+    }
+}
+
+static void prv_read_heap(system_profile_sample_t* sample)
+{
+    ASSERT(sample != NULL);
+
+    sample->uptime_s = (u32)(esp_timer_get_time() / US_PER_SECOND);
+    sample->heap_free = (u32)heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    sample->heap_min_free = (u32)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    sample->heap_largest_block = (u32)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+    sample->cpu_load_permille = 0;
+}
+
+static TaskStatus_t* prv_get_task_states(u32* nof_tasks, u32* total_run_time)
+{
+    ASSERT(nof_tasks != NULL);
+    ASSERT(total_run_time != NULL);
+
+    // Only allocated while a profile or a sample is taken - no RAM is reserved for the task list
+    UBaseType_t capacity = uxTaskGetNumberOfTasks() + SYSMON_TASK_LIST_SLACK;
+    TaskStatus_t* states = (TaskStatus_t*)pvPortMalloc(capacity * sizeof(TaskStatus_t));
+    if (states == NULL)
+    {
+        return NULL;
+    }
+
+    uint32_t run_time = 0;
+    *nof_tasks = (u32)uxTaskGetSystemState(states, capacity, &run_time);
+    *total_run_time = (u32)run_time;
+
+    // 0 = more tasks were created meanwhile than the slack covers
+    if (*nof_tasks == 0)
+    {
+        vPortFree(states);
+        return NULL;
+    }
+
+    return states;
+}
+
+static u32 prv_get_run_time(const TaskStatus_t* status)
+{
+#if (configGENERATE_RUN_TIME_STATS == 1)
+    return (u32)status->ulRunTimeCounter;
+#else
+    (void)status;
+    return 0;
+#endif
+}
+
+static u32 prv_get_run_time_since(const run_time_baseline_t* baseline, const TaskStatus_t* status)
+{
+    u32 run_time = prv_get_run_time(status);
+
+    for (u8 i = 0; i < baseline->nof_tasks; i++)
+    {
+        if (baseline->tasks[i].handle == status->xHandle)
+        {
+            return run_time - baseline->tasks[i].run_time;
+        }
+    }
+
+    // Created after the baseline - all of its run time falls into the interval
+    return run_time;
+}
+
+static void prv_update_baseline(run_time_baseline_t* baseline, const TaskStatus_t* states, u32 nof_tasks,
+                                u32 total_run_time, s64 now_us)
+{
+    baseline->nof_tasks = 0;
+    for (u32 i = 0; (i < nof_tasks) && (baseline->nof_tasks < SYSMON_MAX_TRACKED_TASKS); i++)
+    {
+        baseline->tasks[baseline->nof_tasks].handle = states[i].xHandle;
+        baseline->tasks[baseline->nof_tasks].run_time = prv_get_run_time(&states[i]);
+        baseline->nof_tasks++;
+    }
+
+    baseline->total_run_time = total_run_time;
+    baseline->taken_at_us = now_us;
+}
+
+static bool prv_is_idle_task(const TaskStatus_t* status)
+{
+    return strncmp(status->pcTaskName, SYSMON_IDLE_TASK_PREFIX, strlen(SYSMON_IDLE_TASK_PREFIX)) == 0;
+}
@@ -25,6 +25,12 @@
 /**
  * @file TimeSync.cpp
  * @brief Time synchronization module using NTP over WiFi
+ *
+ * The SNTP client of the IDF runs in the lwIP task and resyncs on its own every SYNC_INTERVAL_MS.
+ * Its sync notification callback only wakes the TimeSync task, which publishes the result. After the
+ * first sync the clock is slewed (adjtime) instead of stepped, so a correction never jumps over a
+ * scheduled minute. Only corrections that are too large for slewing still step the clock - the
+ * notification reports the size of such a step.
  */
 
 #include "TimeSync.h"
@@ -32,9 +38,16 @@
 #include <WiFi.h>
 #include <sys/time.h>
 #include <time.h>
+#include "Logger.h"
 #include "MessageBroker.h"
 #include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "boot_timing.h"
 #include "custom_assert.h"
+#include "esp_sntp.h"
+#include "esp_timer.h"
+
+#include <atomic>
 
 // FreeRTOS includes
 #include "freertos/FreeRTOS.h"
@@ -47,24 +60,56 @@
 #define GMT_OFFSET_SEC      3600    // GMT+1 for Central European Time
 #define DAYLIGHT_OFFSET_SEC 3600    // Daylight saving time offset
 #define SYNC_INTERVAL_MS    3600000 // Sync every hour
+#define SLEW_CHECK_MS       10000   // Republish the snapshot this often while a correction is slewed
+#define US_PER_SECOND       1000000
+
+// Task notification bits
+#define TIMESYNC_EVENT_BIT_SNTP_SYNC  (1U << 0) // The SNTP client received a time
+#define TIMESYNC_EVENT_BIT_SYNC_CHECK (1U << 1) // WiFi (re)connected or woke from light sleep - resync if overdue
+
+// ###########################################################################
+// # Type Definitions
+// ###########################################################################
+
+// Data behind timesync_get_snapshot() - written by the TimeSync task only
+typedef struct
+{
+    s64 wall_time_us; // Wall clock in us since the epoch when the snapshot was taken
+    s64 taken_at_us;  // esp_timer when the snapshot was taken
+    s32 utc_offset_s; // Offset of the local time to UTC
+    bool is_valid;    // The wall clock is valid
+    time_t last_sync; // Wall clock of the last NTP sync (0 = never)
+} time_snapshot_t;
 
 // ###########################################################################
 // # Private function declarations
 // ###########################################################################
 static void prv_timesync_task(void* parameter);
-static void prv_message_broker_callback(const msg_t* const message);
-static void prv_sync_time_from_ntp(void);
+static void prv_publish_snapshot(void);
+static s32 prv_get_utc_offset_s(time_t now);
+static void prv_start_sntp(void);
+static void prv_sntp_sync_callback(struct timeval* tv);
+static void prv_handle_sntp_sync(void);
+static void prv_publish_time_sync_notification(s32 clock_step_s, bool is_slewing);
+static void prv_publish_wake_deadline(time_t wake_at);
 
 // ###########################################################################
 // # Private Variables
 // ###########################################################################
 static bool g_is_initialized = false;
-static bool g_time_is_synchronized = false;
-static bool g_ntp_sync_was_successful = false; // Tracks if NTP was ever successful
-static bool g_logging_is_active = false;       // Logging initially disabled
+static volatile bool g_time_is_synchronized = false;
+static volatile bool g_ntp_sync_was_successful = false; // Tracks if NTP was ever successful
 static TaskHandle_t timesync_task_handle = NULL;
 static time_t g_last_ntp_sync_time = 0; // Track when last NTP sync occurred
 
+// Wall clock and esp_timer at the last sync - the difference reveals a step of the clock
+static time_t reference_wall_time = 0;
+static s64 reference_timer_us = 0;
+
+// Seqlock: odd while the TimeSync task writes the snapshot, readers retry until they see the same even value
+static std::atomic<u32> snapshot_sequence(0);
+static time_snapshot_t snapshot_data;
+
 // ###########################################################################
 // # Public function implementations
 // ###########################################################################
@@ -74,8 +119,8 @@ void timesync_init(void)
     ASSERT(!g_is_initialized);
 
     // Subscribe to time request messages
-    messagebroker_subscribe(MSG_0003, prv_message_broker_callback); // Logging control
-    messagebroker_subscribe(MSG_0100, prv_message_broker_callback); // Time request
+    messagebroker_subscribe(MSG_0203, timesync_message_handler); // WiFi connection status
+    messagebroker_subscribe(MSG_0504, timesync_message_handler); // Power state
 
     g_is_initialized = true;
 }
@@ -101,8 +146,8 @@ bool timesync_get_time(struct tm* timeinfo)
         return false;
     }
 
-    // Try to get local time (works with both NTP and RTC)
-    if (getLocalTime(timeinfo))
+    // Try to get local time (works with both NTP and RTC) - without waiting for a sync
+    if (getLocalTime(timeinfo, 0))
     {
         return true;
     }
@@ -124,6 +169,39 @@ time_t timesync_get_timestamp(void)
     return 0;
 }
 
+bool timesync_get_snapshot(timesync_snapshot_t* snapshot)
+{
+    ASSERT(snapshot != NULL);
+
+    time_snapshot_t data;
+    u32 sequence_begin;
+    u32 sequence_end;
+
+    do
+    {
+        sequence_begin = snapshot_sequence.load(std::memory_order_acquire);
+        data = snapshot_data;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        sequence_end = snapshot_sequence.load(std::memory_order_relaxed);
+    } while ((sequence_begin & 1U) || (sequence_begin != sequence_end));
+
+    s64 now_us = esp_timer_get_time();
+    s64 wall_time_us = data.is_valid ? (data.wall_time_us + (now_us - data.taken_at_us)) : 0;
+
+    snapshot->is_valid = data.is_valid;
+    snapshot->utc_offset_s = data.utc_offset_s;
+    snapshot->epoch = (time_t)(wall_time_us / US_PER_SECOND);
+    snapshot->microseconds = (u32)(wall_time_us % US_PER_SECOND);
+    snapshot->last_sync_age_s = UINT32_MAX;
+
+    if ((data.last_sync != 0) && (snapshot->epoch >= data.last_sync))
+    {
+        snapshot->last_sync_age_s = (u32)(snapshot->epoch - data.last_sync);
+    }
+
+    return snapshot->is_valid;
+}
+
 // ###########################################################################
 // # Private function implementations
 // ###########################################################################
@@ -132,184 +210,215 @@ static void prv_timesync_task(void* parameter)
 {
     (void)parameter;
 
-    TickType_t last_sync_time = 0;
-    bool initial_sync_done = false;
+    prv_start_sntp();
+    prv_publish_snapshot();
 
-    while (1)
+    // The RTC keeps the time across a software reset - it can be used until the first sync
+    if (timesync_get_timestamp() > 0)
     {
-        // Check if WiFi is connected
-        if (WiFi.status() == WL_CONNECTED)
-        {
-            TickType_t current_time = xTaskGetTickCount();
+        g_time_is_synchronized = true;
+        time(&reference_wall_time);
+        reference_timer_us = esp_timer_get_time();
 
-            // Sync time if not synchronized yet or if sync interval has passed (1 hour)
-            if (!initial_sync_done || (current_time - last_sync_time) >= pdMS_TO_TICKS(SYNC_INTERVAL_MS))
-            {
-                prv_sync_time_from_ntp();
-                last_sync_time = current_time;
-                initial_sync_done = true;
-
-                if (g_ntp_sync_was_successful)
-                {
-                    // Update RTC with NTP time
-                    time_t now;
-                    time(&now);
-                    g_last_ntp_sync_time = now;
-
-                    if (g_logging_is_active)
-                    {
-                        Serial.println("[TimeSync] RTC updated with NTP time");
-                    }
-                }
-            }
+        boot_timing_mark(BOOT_STAGE_TIME_VALID);
+        LOG_DEBUG(MODULE_TIMESYNC, "Using RTC time until the first NTP sync");
+        prv_publish_time_sync_notification(0, false);
+    }
+
+    while (1)
+    {
+        // Sleep until the SNTP client delivered a time or WiFi came up - or the slewing of a correction ended
+        bool is_slewing = (sntp_get_sync_status() == SNTP_SYNC_STATUS_IN_PROGRESS);
+        u32 event_bits = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &event_bits, is_slewing ? pdMS_TO_TICKS(SLEW_CHECK_MS) : portMAX_DELAY);
 
-            // Time is considered synchronized if we have valid time (from NTP or RTC)
-            g_time_is_synchronized = (timesync_get_timestamp() > 0);
+        if (is_slewing)
+        {
+            // The wall clock runs slightly faster or slower than the esp_timer while slewing
+            prv_publish_snapshot();
         }
-        else
+
+        if (event_bits & TIMESYNC_EVENT_BIT_SNTP_SYNC)
         {
-            // WiFi not connected - check if we have valid RTC time
-            time_t current_time = timesync_get_timestamp();
+            prv_handle_sntp_sync();
+        }
 
-            if (current_time > 0)
-            {
-                // RTC has valid time, mark as synchronized
-                g_time_is_synchronized = true;
-
-                if (g_logging_is_active && !initial_sync_done)
-                {
-                    Serial.println("[TimeSync] WiFi not available, using RTC time");
-                    initial_sync_done = true; // Prevent repeated messages
-                }
-            }
-            else
+        if (event_bits & TIMESYNC_EVENT_BIT_SYNC_CHECK)
+        {
+            // Don't wait for the SNTP timers if the time is unknown or the last sync is overdue
+            time_t now = timesync_get_timestamp();
+            if (!g_ntp_sync_was_successful || (now - g_last_ntp_sync_time) >= (SYNC_INTERVAL_MS / 1000))
             {
-                g_time_is_synchronized = false;
-
-                if (g_logging_is_active)
-                {
-                    Serial.println("[TimeSync] No valid time source available (no WiFi, no RTC)");
-                }
+                LOG_DEBUG(MODULE_TIMESYNC, "Requesting NTP sync");
+                sntp_restart();
             }
         }
-
-        // Wait for 10 seconds before checking again
-        vTaskDelay(pdMS_TO_TICKS(10000));
     }
 }
 
-static void prv_sync_time_from_ntp(void)
+static void prv_start_sntp(void)
 {
-    // Configure time with NTP server
+    // Sets the timezone and starts the SNTP client - it keeps retrying until WiFi is available
     configTime(GMT_OFFSET_SEC, DAYLIGHT_OFFSET_SEC, NTP_SERVER);
 
-    // Wait for time to be set (max 10 seconds)
-    int retry = 0;
-    const int retry_count = 10;
-    struct tm timeinfo;
+    sntp_set_time_sync_notification_cb(prv_sntp_sync_callback);
+    sntp_set_sync_interval(SYNC_INTERVAL_MS);
+
+    // The first sync (clock not set yet) steps the clock, later corrections are slewed
+    sntp_set_sync_mode(SNTP_SYNC_MODE_SMOOTH);
+    sntp_restart();
+}
+
+static void prv_sntp_sync_callback(struct timeval* tv)
+{
+    (void)tv;
 
-    while (retry < retry_count)
+    // Runs in the lwIP task - keep it short and let the TimeSync task do the work
+    if (timesync_task_handle != NULL)
     {
-        if (getLocalTime(&timeinfo))
-        {
-            g_ntp_sync_was_successful = true;
-            g_time_is_synchronized = true;
+        xTaskNotify(timesync_task_handle, TIMESYNC_EVENT_BIT_SNTP_SYNC, eSetBits);
+    }
+}
 
-            // Store timestamp of successful sync
-            time(&g_last_ntp_sync_time);
+static void prv_handle_sntp_sync(void)
+{
+    time_t now;
+    time(&now);
+    s64 now_us = esp_timer_get_time();
 
-            if (g_logging_is_active)
-            {
-                Serial.println("[TimeSync] Time synchronized with NTP server");
-                Serial.printf("[TimeSync] Current time: %s", asctime(&timeinfo));
-                Serial.printf("[TimeSync] Next sync in 1 hour\n");
-            }
-            return;
-        }
-        retry++;
-        vTaskDelay(pdMS_TO_TICKS(1000));
+    // Compare the clock with where it would be without a step since the last sync
+    s32 clock_step_s = 0;
+    if (g_time_is_synchronized && (reference_wall_time != 0))
+    {
+        time_t expected_now = reference_wall_time + (time_t)((now_us - reference_timer_us) / 1000000);
+        clock_step_s = (s32)(now - expected_now);
     }
 
-    if (g_logging_is_active)
+    bool is_slewing = (sntp_get_sync_status() == SNTP_SYNC_STATUS_IN_PROGRESS);
+
+    reference_wall_time = now;
+    reference_timer_us = now_us;
+    g_last_ntp_sync_time = now;
+    g_ntp_sync_was_successful = true;
+    g_time_is_synchronized = (timesync_get_timestamp() > 0);
+    prv_publish_snapshot();
+    boot_timing_mark(BOOT_STAGE_TIME_VALID);
+    boot_timing_mark(BOOT_STAGE_NTP_SYNCED);
+
+    if (logger_is_enabled(MODULE_TIMESYNC, LOG_LEVEL_DEBUG))
     {
-        Serial.println("[TimeSync] Failed to synchronize time with NTP server");
+        struct tm timeinfo;
+        localtime_r(&now, &timeinfo);
+        LOG_DEBUG(MODULE_TIMESYNC, "Time synchronized with NTP server");
+        LOG_DEBUG(MODULE_TIMESYNC, "Current time: %04d-%02d-%02d %02d:%02d:%02d", timeinfo.tm_year + 1900,
+                  timeinfo.tm_mon + 1, timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
+        LOG_DEBUG(MODULE_TIMESYNC, "Clock step: %ld s%s", (long)clock_step_s, is_slewing ? " (slewing)" : "");
+        LOG_DEBUG(MODULE_TIMESYNC, "Next sync in 1 hour");
+    }
 
-        // Check if we can fall back to RTC
-        time_t rtc_time = timesync_get_timestamp();
-        if (rtc_time > 0)
-        {
-            Serial.println("[TimeSync] Falling back to RTC time");
-        }
+    prv_publish_time_sync_notification(clock_step_s, is_slewing);
+
+    // Let the PowerManager wake the chip up in time for the next sync
+    prv_publish_wake_deadline(now + (SYNC_INTERVAL_MS / 1000));
+}
+
+static void prv_publish_snapshot(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    time_snapshot_t data;
+    data.taken_at_us = esp_timer_get_time();
+    data.wall_time_us = ((s64)tv.tv_sec * US_PER_SECOND) + tv.tv_usec;
+    data.is_valid = (timesync_get_timestamp() > 0);
+    data.utc_offset_s = data.is_valid ? prv_get_utc_offset_s(tv.tv_sec) : 0;
+    data.last_sync = g_ntp_sync_was_successful ? g_last_ntp_sync_time : 0;
+
+    // Readers spin while the sequence is odd - don't let them preempt the writer in between
+    vTaskSuspendAll();
+    snapshot_sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    snapshot_data = data;
+    snapshot_sequence.fetch_add(1, std::memory_order_release);
+    xTaskResumeAll();
+}
+
+static s32 prv_get_utc_offset_s(time_t now)
+{
+    struct tm local_tm;
+    struct tm utc_tm;
+    localtime_r(&now, &local_tm);
+    gmtime_r(&now, &utc_tm);
+
+    s32 offset_s = ((local_tm.tm_hour - utc_tm.tm_hour) * 3600) + ((local_tm.tm_min - utc_tm.tm_min) * 60);
+
+    // Local time and UTC may be on different days
+    if (local_tm.tm_year != utc_tm.tm_year)
+    {
+        offset_s += (local_tm.tm_year > utc_tm.tm_year) ? 86400 : -86400;
+    }
+    else if (local_tm.tm_yday != utc_tm.tm_yday)
+    {
+        offset_s += (local_tm.tm_yday - utc_tm.tm_yday) * 86400;
     }
+
+    return offset_s;
+}
+
+static void prv_publish_time_sync_notification(s32 clock_step_s, bool is_slewing)
+{
+    msg_time_sync_notification_t notification;
+    notification.timestamp = timesync_get_timestamp();
+    notification.clock_step_s = clock_step_s;
+    notification.is_slewing = is_slewing;
+
+    msg_t msg;
+    msg.msg_id = MSG_0102;
+    msg.data_size = sizeof(msg_time_sync_notification_t);
+    msg.data_bytes = (u8*)&notification;
+
+    messagebroker_publish(&msg);
+}
+
+static void prv_publish_wake_deadline(time_t wake_at)
+{
+    msg_power_wake_deadline_t deadline;
+    deadline.module_id = MODULE_TIMESYNC;
+    deadline.wake_at = wake_at;
+
+    msg_t msg;
+    msg.msg_id = MSG_0501;
+    msg.data_size = sizeof(msg_power_wake_deadline_t);
+    msg.data_bytes = (u8*)&deadline;
+
+    messagebroker_publish(&msg);
 }
 
-static void prv_message_broker_callback(const msg_t* const message)
+void timesync_message_handler(const msg_t* const message)
 {
     ASSERT(message != NULL);
 
     switch (message->msg_id)
     {
-        case MSG_0003: // Set logging
+        case MSG_0203: // WiFi connection status
         {
-            msg_set_logging_t* cmd = (msg_set_logging_t*)message->data_bytes;
+            msg_wifi_connection_status_t* status = (msg_wifi_connection_status_t*)message->data_bytes;
 
-            // Check if this message is for us
-            if (cmd->module_id == MODULE_TIMESYNC || cmd->module_id == MODULE_ALL
-                || strncmp(cmd->module_name, "timesync", MODULE_NAME_MAX_LENGTH) == 0)
+            if ((status->status == WIFI_STATUS_CONNECTED) && (timesync_task_handle != NULL))
             {
-                g_logging_is_active = cmd->enabled;
-                if (g_logging_is_active)
-                {
-                    Serial.println("[TimeSync] Logging enabled");
-                }
+                xTaskNotify(timesync_task_handle, TIMESYNC_EVENT_BIT_SYNC_CHECK, eSetBits);
             }
             break;
         }
 
-        case MSG_0100:
+        case MSG_0504: // Power state
         {
-            msg_time_get_response_t response;
-
-            // Try to get time from either NTP or RTC
-            response.timestamp = timesync_get_timestamp();
-            response.time_valid = timesync_get_time(&response.timeinfo);
+            msg_power_state_t* state = (msg_power_state_t*)message->data_bytes;
 
-            if (response.time_valid)
+            if (state->woke_from_sleep && (timesync_task_handle != NULL))
             {
-                if (g_logging_is_active)
-                {
-                    Serial.println("[TimeSync] Time request received");
-                    Serial.printf("[TimeSync] Current time: %s", asctime(&response.timeinfo));
-                    Serial.printf("[TimeSync] Unix timestamp: %ld\n", (long)response.timestamp);
-
-                    // Indicate source
-                    if (WiFi.status() == WL_CONNECTED && g_ntp_sync_was_successful)
-                    {
-                        Serial.println("[TimeSync] Time source: NTP");
-                    }
-                    else
-                    {
-                        Serial.println("[TimeSync] Time source: RTC");
-                    }
-                }
+                xTaskNotify(timesync_task_handle, TIMESYNC_EVENT_BIT_SYNC_CHECK, eSetBits);
             }
-            else
-            {
-                response.timestamp = 0;
-                memset(&response.timeinfo, 0, sizeof(struct tm));
-
-                if (g_logging_is_active)
-                {
-                    Serial.println("[TimeSync] Time request received but no valid time source available");
-                }
-            }
-
-            msg_t response_msg;
-            response_msg.msg_id = MSG_0101;
-            response_msg.data_size = sizeof(msg_time_get_response_t);
-            response_msg.data_bytes = (u8*)&response;
-
-            messagebroker_publish(&response_msg);
             break;
         }
 
@@ -4,6 +4,18 @@
 #include <time.h>
 #include "custom_types.h"
 
+/**
+ * Consistent view of the wall clock - see timesync_get_snapshot()
+ */
+typedef struct
+{
+    time_t epoch;        // Current Unix timestamp (0 if not valid)
+    u32 microseconds;    // Sub-second part of the current time (0 if not valid)
+    s32 utc_offset_s;    // Offset of the local time to UTC (including DST) when the snapshot was published
+    bool is_valid;       // The time was set by NTP or survived a reset in the RTC
+    u32 last_sync_age_s; // Seconds since the last successful NTP sync (UINT32_MAX = never synced)
+} timesync_snapshot_t;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -38,6 +50,17 @@ extern "C"
      */
     time_t timesync_get_timestamp(void);
 
+    /**
+     * @brief Read the current time without going through the broker
+     *
+     * Lock-free (seqlock) and safe to call from any task, but not from an ISR. The TimeSync task
+     * republishes the snapshot on every sync - the epoch is extrapolated from it with the esp_timer.
+     *
+     * @param snapshot Filled with the current time and its state
+     * @return true if the time is valid, false otherwise
+     */
+    bool timesync_get_snapshot(timesync_snapshot_t* snapshot);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,72 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * \file            boot_timing.c
+ * \brief           Timestamps of the boot stages
+ *
+ * Every stage is marked by exactly one module, so a plain slot per stage is enough. The esp_timer
+ * starts with the application, the timestamps therefore leave out the ROM and the second stage
+ * bootloader (a few hundred milliseconds).
+ */
+
+#include "boot_timing.h"
+#include <stddef.h>
+#include "custom_assert.h"
+#include "esp_timer.h"
+
+/* Private variables */
+static volatile int64_t stage_times_us[BOOT_STAGE_COUNT]; /* 0 = not reached yet */
+
+static const char* const stage_names[BOOT_STAGE_COUNT] = {
+    "Setup start", "Modules initialized", "Setup done", "Time valid",
+    "Schedules armed", "MP3 player ready", "WiFi connected", "NTP synced",
+};
+
+void boot_timing_mark(boot_stage_e stage)
+{
+    ASSERT(stage < BOOT_STAGE_COUNT);
+
+    if (stage_times_us[stage] == 0)
+    {
+        int64_t now_us = esp_timer_get_time();
+        stage_times_us[stage] = (now_us > 0) ? now_us : 1;
+    }
+}
+
+bool boot_timing_get(boot_stage_e stage, int64_t* at_us)
+{
+    ASSERT(stage < BOOT_STAGE_COUNT);
+    ASSERT(at_us != NULL);
+
+    *at_us = stage_times_us[stage];
+    return *at_us != 0;
+}
+
+const char* boot_timing_get_stage_name(boot_stage_e stage)
+{
+    ASSERT(stage < BOOT_STAGE_COUNT);
+
+    return stage_names[stage];
+}
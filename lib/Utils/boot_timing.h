@@ -0,0 +1,77 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) <2025> <Max Koell (maxkoell@proton.me)>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * \file            boot_timing.h
+ * \brief           Timestamps of the boot stages - how long it takes until a schedule can be played
+ */
+
+#ifndef BOOT_TIMING_HDR_H
+#define BOOT_TIMING_HDR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+    typedef enum
+    {
+        BOOT_STAGE_SETUP_START = 0,   // setup() was entered
+        BOOT_STAGE_MODULES_INIT,      // All modules are initialized and subscribed
+        BOOT_STAGE_SETUP_DONE,        // All tasks are started
+        BOOT_STAGE_TIME_VALID,        // The wall clock is valid - from the RTC or from NTP
+        BOOT_STAGE_SCHEDULES_ARMED,   // The schedules were evaluated against a valid wall clock
+        BOOT_STAGE_MP3_READY,         // The WT2605C answered its first command
+        BOOT_STAGE_WIFI_CONNECTED,    // WiFi is associated and has an IP address
+        BOOT_STAGE_NTP_SYNCED,        // First NTP sync
+        BOOT_STAGE_COUNT
+    } boot_stage_e;
+
+    /**
+     * \brief           Record the point in time a stage was reached - only the first call per stage counts
+     * \param[in]       stage: Stage that was reached
+     */
+    void boot_timing_mark(boot_stage_e stage);
+
+    /**
+     * \brief           Get the point in time a stage was reached
+     * \param[in]       stage: Stage to look up
+     * \param[out]      at_us: esp_timer in us when the stage was reached
+     * \return          true if the stage was reached, false otherwise
+     */
+    bool boot_timing_get(boot_stage_e stage, int64_t* at_us);
+
+    /**
+     * \brief           Get the printable name of a stage
+     */
+    const char* boot_timing_get_stage_name(boot_stage_e stage);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* BOOT_TIMING_HDR_H */
@@ -31,29 +31,103 @@
 #include <Arduino.h>
 #include <Preferences.h>
 #include <WiFi.h>
+#include <time.h>
+#include "Logger.h"
 #include "MessageBroker.h"
 #include "MessageDefinitions.h"
+#include "MessageRoutes.h"
+#include "boot_timing.h"
 #include "custom_assert.h"
 
 // FreeRTOS includes
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
+// lwIP - for the renewal time of the DHCP lease
+#include "esp_netif_net_stack.h"
+#include "lwip/dhcp.h"
+#include "lwip/prot/dhcp.h"
+
 // ###########################################################################
 // # Private defines
 // ###########################################################################
-#define WIFI_CONNECT_TIMEOUT_MS 10000
-#define WIFI_CHECK_INTERVAL_MS  20000
-#define PREFERENCES_NAMESPACE   "wifi"
-#define PREF_KEY_SSID           "ssid"
-#define PREF_KEY_PASSWORD       "password"
+#define WIFI_CONNECT_TIMEOUT_MS      10000 // A connection attempt without an IP after this time has failed
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 3000  // A directed attempt to the cached BSSID fails faster
+#define WIFI_BACKOFF_MIN_MS          1000  // Wait time after the first failed attempt - doubles with every failure
+#define WIFI_BACKOFF_MAX_MS          60000 // Upper limit of the wait time between two attempts
+#define PREFERENCES_NAMESPACE        "wifi"
+#define PREF_KEY_SSID                "ssid"
+#define PREF_KEY_PASSWORD            "password"
+#define PREF_KEY_FAST_CONNECT        "fast_connect"
+#define PREF_KEY_IP_CONFIG           "ip_config"
+#define WIFI_BSSID_LENGTH            6
+
+// Reuse the cached DHCP lease on a fast connect until its renewal time (T1) - skips DHCP
+#ifndef WIFI_REUSE_DHCP_LEASE
+#define WIFI_REUSE_DHCP_LEASE 0
+#endif
+
+#define WIFI_LEASE_CHECK_MAX_MS 3600000    // A reused lease is checked at least this often while connected
+#define TIMESTAMP_VALID_MIN     1000000000 // Timestamp after year 2001
+
+// Task notification bits - set by the WiFi event callback and the message handler
+#define WIFI_EVENT_BIT_GOT_IP         (1U << 0)
+#define WIFI_EVENT_BIT_DISCONNECTED   (1U << 1)
+#define WIFI_EVENT_BIT_CONFIG_CHANGED (1U << 2)
+
+// ###########################################################################
+// # Type Definitions
+// ###########################################################################
+typedef enum
+{
+    WIFI_STATE_IDLE = 0,   // No credentials - nothing to do
+    WIFI_STATE_CONNECTING, // Waiting for an IP or for the attempt to time out
+    WIFI_STATE_CONNECTED,  // Link is up - waiting for a disconnect
+    WIFI_STATE_BACKOFF     // Waiting before the next attempt
+} wifi_state_e;
+
+typedef struct
+{
+    u32 ip;
+    u32 gateway;
+    u32 subnet;
+    u32 dns;
+} wifi_ip_config_t;
+
+// Last good association - lets a reconnect skip the channel scan and DHCP
+typedef struct
+{
+    bool is_valid;
+    u8 bssid[WIFI_BSSID_LENGTH];
+    u8 channel;
+    wifi_ip_config_t lease; // Last DHCP lease (or the static configuration)
+    time_t renew_at;        // Wall clock of the renewal time (T1) of the lease (0 = must not be reused)
+} wifi_fast_connect_cache_t;
+
+// Stored IP configuration - DHCP unless use_static_ip is set
+typedef struct
+{
+    bool use_static_ip;
+    wifi_ip_config_t config;
+} wifi_stored_ip_config_t;
 
 // ###########################################################################
 // # Private function declarations
 // ###########################################################################
 static void prv_wifimanager_task(void* parameter);
-static void prv_message_broker_callback(const msg_t* const message);
-static void prv_connect_to_wifi(void);
+static void prv_wifi_event_callback(WiFiEvent_t event, WiFiEventInfo_t info);
+static void prv_notify_task(u32 event_bits);
+static TickType_t prv_get_wait_ticks(void);
+static void prv_process_events(u32 event_bits);
+static void prv_process_timeouts(void);
+static void prv_start_connection_attempt(void);
+static void prv_handle_failed_attempt(void);
+static void prv_enter_state(wifi_state_e new_state, u32 timeout_ms);
+static void prv_apply_ip_config(bool reuse_lease);
+static void prv_update_fast_connect_cache(void);
+static void prv_invalidate_fast_connect_cache(void);
+static u32 prv_get_lease_renew_s(void);
+static u32 prv_get_lease_check_ms(void);
 static void prv_save_credentials(const char* ssid, const char* password);
 static bool prv_load_credentials(char* ssid, char* password);
 static void prv_publish_connection_status(void);
@@ -62,15 +136,23 @@ static void prv_publish_connection_status(void);
 // # Private Variables
 // ###########################################################################
 static bool is_initialized = false;
-static bool is_connected = false;
-static bool g_logging_is_active = false; // Logging initially disabled
+static volatile bool is_connected = false;
 static TaskHandle_t wifimanager_task_handle = NULL;
+static wifi_state_e wifi_state = WIFI_STATE_IDLE;
+static u32 state_entered_ms = 0;    // millis() when the current state was entered
+static u32 state_timeout_ms = 0;    // Time the state may last (connect timeout or backoff)
+static u32 nof_failed_attempts = 0; // Consecutive failed attempts - defines the backoff
+static bool is_fast_attempt = false;  // The current attempt uses the fast connect cache
+static bool is_lease_reused = false;  // The address is the cached lease - DHCP did not confirm it
 static Preferences preferences;
 
 static char current_ssid[WIFI_SSID_MAX_LENGTH] = {0};
 static char current_password[WIFI_PASSWORD_MAX_LENGTH] = {0};
 static bool has_credentials = false;
 
+static wifi_fast_connect_cache_t fast_connect_cache = {};
+static wifi_stored_ip_config_t ip_config = {};
+
 // ###########################################################################
 // # Public function implementations
 // ###########################################################################
@@ -85,20 +167,35 @@ void wifimanager_init(void)
     // Load stored credentials
     has_credentials = prv_load_credentials(current_ssid, current_password);
 
+    // Load the IP configuration and the last good association (both optional)
+    if (preferences.getBytes(PREF_KEY_IP_CONFIG, &ip_config, sizeof(ip_config)) != sizeof(ip_config))
+    {
+        memset(&ip_config, 0, sizeof(ip_config));
+    }
+    if (preferences.getBytes(PREF_KEY_FAST_CONNECT, &fast_connect_cache, sizeof(fast_connect_cache))
+        != sizeof(fast_connect_cache))
+    {
+        memset(&fast_connect_cache, 0, sizeof(fast_connect_cache));
+    }
+
     // Subscribe to WiFi messages
-    messagebroker_subscribe(MSG_0003, prv_message_broker_callback); // Logging control
-    messagebroker_subscribe(MSG_0200, prv_message_broker_callback);
-    messagebroker_subscribe(MSG_0201, prv_message_broker_callback);
+    messagebroker_subscribe(MSG_0200, wifimanager_message_handler);
+    messagebroker_subscribe(MSG_0201, wifimanager_message_handler);
+    messagebroker_subscribe(MSG_0204, wifimanager_message_handler); // Set IP configuration
+    messagebroker_subscribe(MSG_0504, wifimanager_message_handler); // Power state
+
+    // The event callback wakes the task - it runs in the context of the Arduino event task
+    WiFi.onEvent(prv_wifi_event_callback);
 
     is_initialized = true;
 
     if (has_credentials)
     {
-        Serial.println("[WiFiManager] Loaded credentials from storage");
+        LOG_INFO(MODULE_WIFIMANAGER, "Loaded credentials from storage");
     }
     else
     {
-        Serial.println("[WiFiManager] No credentials stored");
+        LOG_INFO(MODULE_WIFIMANAGER, "No credentials stored");
     }
 }
 
@@ -122,61 +219,188 @@ static void prv_wifimanager_task(void* parameter)
 {
     (void)parameter;
 
+    // Reconnects are done by the state machine below - with a backoff that the WiFi driver does not offer
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);
+
+    if (has_credentials)
+    {
+        prv_start_connection_attempt();
+    }
+
     while (1)
     {
-        // Check current WiFi status
-        wl_status_t status = WiFi.status();
+        // Idle until a WiFi event arrives or the current state times out
+        u32 event_bits = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &event_bits, prv_get_wait_ticks());
+
+        prv_process_events(event_bits);
+        prv_process_timeouts();
+    }
+}
 
-        if (status == WL_CONNECTED)
+static void prv_wifi_event_callback(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+    switch (event)
+    {
+        case ARDUINO_EVENT_WIFI_STA_GOT_IP: prv_notify_task(WIFI_EVENT_BIT_GOT_IP); break;
+
+        case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
         {
-            if (!is_connected)
+            // Disconnects requested by this module are handled where they are requested
+            if (info.wifi_sta_disconnected.reason != WIFI_REASON_ASSOC_LEAVE)
             {
-                is_connected = true;
-                Serial.println("[WiFiManager] Connected to WiFi");
-                Serial.printf("[WiFiManager] IP Address: %s\n", WiFi.localIP().toString().c_str());
-                Serial.printf("[WiFiManager] RSSI: %d dBm\n", WiFi.RSSI());
-                prv_publish_connection_status();
+                prv_notify_task(WIFI_EVENT_BIT_DISCONNECTED);
             }
+            break;
         }
-        else
-        {
-            if (is_connected)
-            {
-                is_connected = false;
-                Serial.println("[WiFiManager] Disconnected from WiFi");
-                prv_publish_connection_status();
-            }
 
-            // Try to reconnect if we have credentials
-            if (has_credentials)
-            {
-                Serial.println("[WiFiManager] Attempting to reconnect...");
-                prv_connect_to_wifi();
-            }
-        }
+        default: break;
+    }
+}
 
-        vTaskDelay(pdMS_TO_TICKS(WIFI_CHECK_INTERVAL_MS));
+static void prv_notify_task(u32 event_bits)
+{
+    if (wifimanager_task_handle != NULL)
+    {
+        xTaskNotify(wifimanager_task_handle, event_bits, eSetBits);
     }
 }
 
-static void prv_connect_to_wifi(void)
+static TickType_t prv_get_wait_ticks(void)
 {
-    if (!has_credentials)
+    // A connection only times out while it runs on a reused lease
+    if ((wifi_state == WIFI_STATE_IDLE) || ((wifi_state == WIFI_STATE_CONNECTED) && (state_timeout_ms == 0)))
+    {
+        return portMAX_DELAY;
+    }
+
+    u32 elapsed_ms = millis() - state_entered_ms;
+    if (elapsed_ms >= state_timeout_ms)
+    {
+        return 0;
+    }
+
+    return pdMS_TO_TICKS(state_timeout_ms - elapsed_ms);
+}
+
+static void prv_process_events(u32 event_bits)
+{
+    if (event_bits & WIFI_EVENT_BIT_CONFIG_CHANGED)
     {
-        if (g_logging_is_active)
+        // Any other pending event belongs to the old connection
+        if (is_connected)
         {
-            Serial.println("[WiFiManager] No credentials available");
+            is_connected = false;
+            prv_publish_connection_status();
         }
+        WiFi.disconnect();
+
+        nof_failed_attempts = 0;
+        prv_start_connection_attempt();
         return;
     }
 
-    if (g_logging_is_active)
+    if ((event_bits & WIFI_EVENT_BIT_GOT_IP) && (WiFi.status() == WL_CONNECTED))
     {
-        Serial.printf("[WiFiManager] Connecting to SSID: %s\n", current_ssid);
+        u32 connect_time_ms = millis() - state_entered_ms;
+
+        nof_failed_attempts = 0;
+        is_connected = true;
+        boot_timing_mark(BOOT_STAGE_WIFI_CONNECTED);
+        prv_update_fast_connect_cache();
+        prv_enter_state(WIFI_STATE_CONNECTED, prv_get_lease_check_ms());
+
+        LOG_INFO(MODULE_WIFIMANAGER, "Connected to WiFi in %lu ms (%s)", (unsigned long)connect_time_ms,
+                 is_fast_attempt ? "fast connect" : "full scan");
+        LOG_INFO(MODULE_WIFIMANAGER, "IP Address: %s", WiFi.localIP().toString().c_str());
+        LOG_INFO(MODULE_WIFIMANAGER, "RSSI: %d dBm", WiFi.RSSI());
+        prv_publish_connection_status();
+        return;
     }
 
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(current_ssid, current_password);
+    if (event_bits & WIFI_EVENT_BIT_DISCONNECTED)
+    {
+        if (wifi_state == WIFI_STATE_CONNECTED)
+        {
+            is_connected = false;
+            LOG_WARNING(MODULE_WIFIMANAGER, "Disconnected from WiFi");
+            prv_publish_connection_status();
+
+            // The link was fine until now - the first reconnect starts right away
+            prv_start_connection_attempt();
+        }
+        else if (wifi_state == WIFI_STATE_CONNECTING)
+        {
+            prv_handle_failed_attempt();
+        }
+    }
+}
+
+static void prv_process_timeouts(void)
+{
+    if ((wifi_state == WIFI_STATE_IDLE) || ((wifi_state == WIFI_STATE_CONNECTED) && (state_timeout_ms == 0)))
+    {
+        return;
+    }
+
+    if ((millis() - state_entered_ms) < state_timeout_ms)
+    {
+        return;
+    }
+
+    if (wifi_state == WIFI_STATE_CONNECTED)
+    {
+        u32 check_ms = prv_get_lease_check_ms();
+        if (check_ms == 0)
+        {
+            // The renewal time of the reused lease was reached - let DHCP renew it (the address may change)
+            LOG_INFO(MODULE_WIFIMANAGER, "Reused DHCP lease is due for renewal, starting DHCP");
+            is_lease_reused = false;
+            prv_apply_ip_config(false);
+        }
+        prv_enter_state(WIFI_STATE_CONNECTED, check_ms);
+    }
+    else if (wifi_state == WIFI_STATE_CONNECTING)
+    {
+        // Neither an IP nor an error within the timeout - stop the attempt
+        WiFi.disconnect();
+        prv_handle_failed_attempt();
+    }
+    else
+    {
+        LOG_DEBUG(MODULE_WIFIMANAGER, "Attempting to reconnect...");
+        prv_start_connection_attempt();
+    }
+}
+
+static void prv_start_connection_attempt(void)
+{
+    if (!has_credentials)
+    {
+        LOG_DEBUG(MODULE_WIFIMANAGER, "No credentials available");
+        prv_enter_state(WIFI_STATE_IDLE, 0);
+        return;
+    }
+
+    is_fast_attempt = fast_connect_cache.is_valid;
+
+    LOG_DEBUG(MODULE_WIFIMANAGER, "Connecting to SSID: %s (%s)", current_ssid,
+              is_fast_attempt ? "fast connect" : "full scan");
+
+    prv_apply_ip_config(is_fast_attempt);
+
+    if (is_fast_attempt)
+    {
+        // Directed connect - no channel scan
+        WiFi.begin(current_ssid, current_password, fast_connect_cache.channel, fast_connect_cache.bssid);
+        prv_enter_state(WIFI_STATE_CONNECTING, WIFI_FAST_CONNECT_TIMEOUT_MS);
+    }
+    else
+    {
+        WiFi.begin(current_ssid, current_password);
+        prv_enter_state(WIFI_STATE_CONNECTING, WIFI_CONNECT_TIMEOUT_MS);
+    }
 
     // Publish connecting status
     msg_wifi_connection_status_t status_msg;
@@ -190,45 +414,168 @@ static void prv_connect_to_wifi(void)
     msg.data_size = sizeof(msg_wifi_connection_status_t);
     msg.data_bytes = (u8*)&status_msg;
     messagebroker_publish(&msg);
+}
 
-    // Wait for connection
-    unsigned long start_time = millis();
-    while (WiFi.status() != WL_CONNECTED && (millis() - start_time) < WIFI_CONNECT_TIMEOUT_MS)
+static void prv_handle_failed_attempt(void)
+{
+    if (is_fast_attempt)
     {
-        delay(500);
-        if (g_logging_is_active)
+        // The AP may have moved to another channel or BSSID - fall back to a full scan right away
+        LOG_DEBUG(MODULE_WIFIMANAGER, "Fast connect failed, falling back to a full scan");
+        prv_invalidate_fast_connect_cache();
+        prv_start_connection_attempt();
+        return;
+    }
+
+    // Exponential backoff: 1 s, 2 s, 4 s, ... up to WIFI_BACKOFF_MAX_MS
+    u32 backoff_ms = WIFI_BACKOFF_MAX_MS;
+    if (nof_failed_attempts < 16)
+    {
+        backoff_ms = WIFI_BACKOFF_MIN_MS << nof_failed_attempts;
+        if (backoff_ms > WIFI_BACKOFF_MAX_MS)
         {
-            Serial.print(".");
+            backoff_ms = WIFI_BACKOFF_MAX_MS;
         }
     }
-    if (g_logging_is_active)
+    nof_failed_attempts++;
+
+    is_connected = false;
+    prv_enter_state(WIFI_STATE_BACKOFF, backoff_ms);
+
+    LOG_DEBUG(MODULE_WIFIMANAGER, "Connection failed, next attempt in %lu ms", (unsigned long)backoff_ms);
+
+    msg_wifi_connection_status_t status_msg;
+    status_msg.status = WIFI_STATUS_FAILED;
+    strncpy(status_msg.ssid, current_ssid, WIFI_SSID_MAX_LENGTH - 1);
+    status_msg.ssid[WIFI_SSID_MAX_LENGTH - 1] = '\0';
+    status_msg.rssi = 0;
+
+    msg_t msg;
+    msg.msg_id = MSG_0203;
+    msg.data_size = sizeof(msg_wifi_connection_status_t);
+    msg.data_bytes = (u8*)&status_msg;
+    messagebroker_publish(&msg);
+}
+
+static void prv_enter_state(wifi_state_e new_state, u32 timeout_ms)
+{
+    wifi_state = new_state;
+    state_entered_ms = millis();
+    state_timeout_ms = timeout_ms;
+}
+
+static void prv_apply_ip_config(bool reuse_lease)
+{
+    const wifi_ip_config_t* config = NULL;
+    time_t now = time(NULL);
+
+    is_lease_reused = false;
+    if (ip_config.use_static_ip)
     {
-        Serial.println();
+        config = &ip_config.config;
+    }
+    else if (WIFI_REUSE_DHCP_LEASE && reuse_lease && (fast_connect_cache.lease.ip != 0)
+             && (now >= TIMESTAMP_VALID_MIN) && (now < fast_connect_cache.renew_at))
+    {
+        // The lease is used like a static configuration until its renewal time - the server keeps the
+        // binding at least that long. A failed fast connect drops it.
+        config = &fast_connect_cache.lease;
+        is_lease_reused = true;
     }
 
-    if (WiFi.status() == WL_CONNECTED)
+    if (config != NULL)
     {
-        is_connected = true;
-        if (g_logging_is_active)
-        {
-            Serial.println("[WiFiManager] Successfully connected");
-        }
-        prv_publish_connection_status();
+        WiFi.config(IPAddress(config->ip), IPAddress(config->gateway), IPAddress(config->subnet),
+                    IPAddress(config->dns));
     }
     else
     {
-        is_connected = false;
-        if (g_logging_is_active)
-        {
-            Serial.println("[WiFiManager] Connection failed");
-        }
+        // All zero addresses enable the DHCP client again
+        WiFi.config(IPAddress((u32)0), IPAddress((u32)0), IPAddress((u32)0));
+    }
+}
 
-        status_msg.status = WIFI_STATUS_FAILED;
-        status_msg.rssi = 0;
-        messagebroker_publish(&msg);
+static void prv_update_fast_connect_cache(void)
+{
+    wifi_fast_connect_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+
+    const u8* bssid = WiFi.BSSID();
+    if (bssid == NULL)
+    {
+        return;
+    }
+
+    cache.is_valid = true;
+    memcpy(cache.bssid, bssid, WIFI_BSSID_LENGTH);
+    cache.channel = (u8)WiFi.channel();
+    cache.lease.ip = (u32)WiFi.localIP();
+    cache.lease.gateway = (u32)WiFi.gatewayIP();
+    cache.lease.subnet = (u32)WiFi.subnetMask();
+    cache.lease.dns = (u32)WiFi.dnsIP();
+
+    // Only a lease that DHCP just handed out extends the time it may be reused
+    time_t now = time(NULL);
+    u32 renew_s = prv_get_lease_renew_s();
+    if (is_lease_reused)
+    {
+        cache.renew_at = fast_connect_cache.renew_at;
+    }
+    else if (!ip_config.use_static_ip && (renew_s > 0) && (now >= TIMESTAMP_VALID_MIN))
+    {
+        cache.renew_at = now + (time_t)renew_s;
+    }
+
+    // Only write to flash if something changed
+    if (memcmp(&cache, &fast_connect_cache, sizeof(cache)) != 0)
+    {
+        fast_connect_cache = cache;
+        preferences.putBytes(PREF_KEY_FAST_CONNECT, &fast_connect_cache, sizeof(fast_connect_cache));
+
+        LOG_DEBUG(MODULE_WIFIMANAGER, "Fast connect cache updated (channel %d)", fast_connect_cache.channel);
     }
 }
 
+static void prv_invalidate_fast_connect_cache(void)
+{
+    if (fast_connect_cache.is_valid)
+    {
+        memset(&fast_connect_cache, 0, sizeof(fast_connect_cache));
+        preferences.remove(PREF_KEY_FAST_CONNECT);
+    }
+}
+
+static u32 prv_get_lease_renew_s(void)
+{
+    // T1 of the bound DHCP lease - 0 if the address did not come from DHCP
+    struct netif* lwip_netif = (struct netif*)esp_netif_get_netif_impl(WiFi.STA.netif());
+    struct dhcp* dhcp = (lwip_netif != NULL) ? netif_dhcp_data(lwip_netif) : NULL;
+
+    if ((dhcp == NULL) || (dhcp->state != DHCP_STATE_BOUND))
+    {
+        return 0;
+    }
+    return (u32)dhcp->offered_t1_renew;
+}
+
+static u32 prv_get_lease_check_ms(void)
+{
+    // Time until the reused lease has to be renewed - 0 if it is due, or if the address is not a reused lease
+    if (!is_lease_reused)
+    {
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    if ((now < TIMESTAMP_VALID_MIN) || (now >= fast_connect_cache.renew_at))
+    {
+        return 0;
+    }
+
+    time_t remaining_s = fast_connect_cache.renew_at - now;
+    return (remaining_s > (WIFI_LEASE_CHECK_MAX_MS / 1000)) ? WIFI_LEASE_CHECK_MAX_MS : (u32)remaining_s * 1000U;
+}
+
 static void prv_save_credentials(const char* ssid, const char* password)
 {
     preferences.putString(PREF_KEY_SSID, ssid);
@@ -242,10 +589,10 @@ static void prv_save_credentials(const char* ssid, const char* password)
 
     has_credentials = true;
 
-    if (g_logging_is_active)
-    {
-        Serial.println("[WiFiManager] Credentials saved to storage");
-    }
+    // The cached association belongs to the old network
+    prv_invalidate_fast_connect_cache();
+
+    LOG_DEBUG(MODULE_WIFIMANAGER, "Credentials saved to storage");
 }
 
 static bool prv_load_credentials(char* ssid, char* password)
@@ -293,29 +640,12 @@ static void prv_publish_connection_status(void)
     messagebroker_publish(&msg);
 }
 
-static void prv_message_broker_callback(const msg_t* const message)
+void wifimanager_message_handler(const msg_t* const message)
 {
     ASSERT(message != NULL);
 
     switch (message->msg_id)
     {
-        case MSG_0003: // Set logging
-        {
-            msg_set_logging_t* cmd = (msg_set_logging_t*)message->data_bytes;
-
-            // Check if this message is for us
-            if (cmd->module_id == MODULE_WIFIMANAGER || cmd->module_id == MODULE_ALL
-                || strncmp(cmd->module_name, "wifimanager", MODULE_NAME_MAX_LENGTH) == 0)
-            {
-                g_logging_is_active = cmd->enabled;
-                if (g_logging_is_active)
-                {
-                    Serial.println("[WiFiManager] Logging enabled");
-                }
-            }
-            break;
-        }
-
         case MSG_0200:
         {
             ASSERT(message->data_size == sizeof(msg_wifi_set_credentials_t));
@@ -324,15 +654,27 @@ static void prv_message_broker_callback(const msg_t* const message)
             // Save credentials
             prv_save_credentials(creds->ssid, creds->password);
 
-            // Disconnect current connection if any
-            if (WiFi.status() == WL_CONNECTED)
-            {
-                WiFi.disconnect();
-                is_connected = false;
-            }
+            // The task drops the current connection and connects with the new credentials
+            prv_notify_task(WIFI_EVENT_BIT_CONFIG_CHANGED);
+            break;
+        }
 
-            // Connect with new credentials
-            prv_connect_to_wifi();
+        case MSG_0204: // Set IP configuration
+        {
+            ASSERT(message->data_size == sizeof(msg_wifi_set_ip_config_t));
+            msg_wifi_set_ip_config_t* cmd = (msg_wifi_set_ip_config_t*)message->data_bytes;
+
+            ip_config.use_static_ip = cmd->use_static_ip;
+            ip_config.config.ip = cmd->ip;
+            ip_config.config.gateway = cmd->gateway;
+            ip_config.config.subnet = cmd->subnet;
+            ip_config.config.dns = cmd->dns;
+            preferences.putBytes(PREF_KEY_IP_CONFIG, &ip_config, sizeof(ip_config));
+
+            LOG_DEBUG(MODULE_WIFIMANAGER, "IP configuration: %s", ip_config.use_static_ip ? "static" : "DHCP");
+
+            // Reconnect so that the new configuration is applied
+            prv_notify_task(WIFI_EVENT_BIT_CONFIG_CHANGED);
             break;
         }
 
@@ -364,6 +706,20 @@ static void prv_message_broker_callback(const msg_t* const message)
             break;
         }
 
+        case MSG_0504: // Power state
+        {
+            msg_power_state_t* state = (msg_power_state_t*)message->data_bytes;
+
+            // Maximum modem sleep keeps the association alive with the radio off between DTIM beacons
+            if (!state->woke_from_sleep)
+            {
+                WiFi.setSleep(state->low_power_enabled ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+
+                LOG_DEBUG(MODULE_WIFIMANAGER, "Modem sleep: %s", state->low_power_enabled ? "max" : "min");
+            }
+            break;
+        }
+
         default: break;
     }
 }
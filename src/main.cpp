@@ -1,11 +1,19 @@
 #include <Arduino.h>
 #include "ApplicationControl.h"
 #include "BlinkLed.h"
+#include "ClusterSync.h"
 #include "Console.h"
+#include "CrashRecord.h"
+#include "Logger.h"
 #include "MP3Player.h"
 #include "MessageBroker.h"
+#include "MqttBridge.h"
+#include "PowerManager.h"
+#include "ScheduleServer.h"
+#include "SystemMonitor.h"
 #include "TimeSync.h"
 #include "WiFiManager.h"
+#include "boot_timing.h"
 #include "custom_assert.h"
 
 // FreeRTOS includes
@@ -39,42 +47,93 @@ void setup()
 {
     // Initialize custom assert
     custom_assert_init(prv_assert_failed);
+    boot_timing_mark(BOOT_STAGE_SETUP_START);
 
     messagebroker_init();
+    messagebroker_start_task();
 
-    // Initialize MP3 Player
-    mp3player_init();
+    // Initialize Logger (the other modules log from their init functions on)
+    logger_init();
+    logger_start_task();
+
+    // Init phase - the modules subscribe and load their NVS settings, nothing here waits for a peripheral.
+    // Every module is subscribed before the first task can publish to it.
 
     // Initialize WiFi Manager
     wifimanager_init();
-    wifimanager_start_task();
 
     // Initialize Time Sync
     timesync_init();
-    timesync_start_task();
 
-    // Initialize Application Control
+    // Initialize MP3 Player (the handshake with the WT2605C is done by its task)
+    mp3player_init();
+
+    // Initialize Crash Record (reports a failed assertion that caused this boot)
+    crashrecord_init();
+
+    // Initialize Application Control (loads the schedules from flash)
     appcontrol_init();
 
+    // After a failed assertion the schedules continue where they stopped, not at the start of the minute
+    time_t resume_after = 0;
+    if (crashrecord_get_resume_point(&resume_after))
+    {
+        appcontrol_resume_after(resume_after);
+    }
+
+    // Initialize Cluster Sync (plays the announcements of a leader on a follower)
+    clustersync_init();
+
+    // Initialize Schedule Server (bulk import/export of the schedules once WiFi is connected)
+    scheduleserver_init();
+
+    // Initialize Power Manager (the other modules register their wake-up deadlines with it)
+    powermanager_init();
+
+    // Initialize System Monitor (task, stack and heap profile for the console)
+    systemmonitor_init();
+
+    // Initialize MQTT Bridge (selected topics and batched telemetry to an MQTT broker)
+    mqttbridge_init();
+
+    // Initialize console (subscribes to the broker, so it must run before the table is sealed)
+    console_init();
+
+    // All modules are subscribed - the subscriber table is read-only from here on
+    messagebroker_seal();
+    boot_timing_mark(BOOT_STAGE_MODULES_INIT);
+
+    // Start phase - the slow peripherals come up concurrently. The TimeSync task validates the RTC time
+    // right away, so the schedules are armed by loop() long before WiFi and NTP are up.
+    timesync_start_task();
+    wifimanager_start_task();
+    mp3player_start_task();
+    clustersync_start_task();
+    scheduleserver_start_task();
+    mqttbridge_start_task();
+
     // Create console task
     xTaskCreate(console_task,        // Task function
                 "ConsoleTask",       // Task name
-                4096,                // Stack size (words)
+                4096,                // Stack size (bytes)
                 NULL,                // Task parameters
                 1,                   // Task priority (0 = lowest, configMAX_PRIORITIES - 1 = highest)
                 &console_task_handle // Task handle
     );
 
+    // Start light sleeping once everything is running
+    powermanager_start_task();
+
     // Initialize Blink LED
     blinkled_init(LED_PIN);
+
+    boot_timing_mark(BOOT_STAGE_SETUP_DONE);
 }
 
 void loop()
 {
-    // Run Application Control (checks schedules)
+    // Run Application Control - sleeps until the next schedule is due
     appcontrol_run();
-
-    delay(1000); // Run once per second
 }
 
 // ###########################################################################
@@ -85,16 +144,11 @@ void console_task(void* parameter)
 {
     (void)parameter; // Unused parameter
 
-    // Initialize console
-    console_init();
-
     // Task main loop
     while (1)
     {
-        // Run the console processing
+        // Run the console processing - blocks until input was received
         console_run();
-
-        delay(5);
     }
 }
 
@@ -104,10 +158,13 @@ void console_task(void* parameter)
 
 static void prv_assert_failed(const char* file, uint32_t line, const char* expr)
 {
+    // Stored first - the output below may block, e.g. when the assertion failed in a critical section
+    crashrecord_save(file, line, expr, appcontrol_get_processed_until());
+
     Serial.printf("[ASSERT FAILED]: %s:%u - %s\n", file, line, expr);
-    // In embedded systems, we might want to reset instead of infinite loop
 
-    // Stop all tasks
+#ifdef HALT_ON_ASSERT
+    // Keep the state for the debugger - stop all tasks
     vTaskSuspend(console_task_handle);
 
     while (1)
@@ -115,6 +172,11 @@ static void prv_assert_failed(const char* file, uint32_t line, const char* expr)
         blinkled_toggle();
         delay(700); // Keep watchdog happy if enabled
     }
+#else
+    // Back in service right away - the record is reported on the next boot
+    Serial.flush();
+    ESP.restart();
+#endif
 }
 
 static void msg_broker_callback(const msg_t* const message)
@@ -0,0 +1,42 @@
+/**
+ * Helpers shared by the native test suites
+ *
+ * Every benchmark reports one line "BENCH <name>: <ns> ns/op" - grep the output of
+ * "pio test -e native" for BENCH to compare two runs.
+ */
+
+#ifndef BENCH_SUPPORT_H
+#define BENCH_SUPPORT_H
+
+#include <stdio.h>
+#include <time.h>
+#include <unity.h>
+#include "custom_assert.h"
+#include "custom_types.h"
+
+#define BENCH_REPORT_LENGTH 128
+
+static inline u64 bench_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ULL + (u64)now.tv_nsec;
+}
+
+static inline void bench_report(const char* name, u64 elapsed_ns, u32 nof_operations)
+{
+    char line[BENCH_REPORT_LENGTH];
+    snprintf(line, sizeof(line), "BENCH %s: %.1f ns/op (%lu ops)", name, (double)elapsed_ns / nof_operations,
+             (unsigned long)nof_operations);
+    TEST_MESSAGE(line);
+}
+
+// A failed ASSERT in a module fails the running test instead of halting
+static inline void bench_assert_failed(const char* file, uint32_t line, const char* expr)
+{
+    char message[BENCH_REPORT_LENGTH];
+    snprintf(message, sizeof(message), "ASSERT %s:%lu - %s", file, (unsigned long)line, expr);
+    TEST_FAIL_MESSAGE(message);
+}
+
+#endif // BENCH_SUPPORT_H
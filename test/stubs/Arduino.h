@@ -0,0 +1,46 @@
+/**
+ * Native stub of the parts of the Arduino core used by the tested modules - Serial writes to stdout
+ */
+
+#ifndef NATIVE_STUB_ARDUINO_H
+#define NATIVE_STUB_ARDUINO_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+
+static inline unsigned long millis(void) { return (unsigned long)(esp_timer_get_time() / 1000); }
+
+static inline unsigned long micros(void) { return (unsigned long)esp_timer_get_time(); }
+
+static inline void delay(unsigned long ms) { (void)ms; }
+
+class HardwareSerial
+{
+  public:
+    size_t write(uint8_t c) { return (fputc(c, stdout) == EOF) ? 0 : 1; }
+
+    size_t write(const uint8_t* buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+
+    size_t print(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+
+    size_t println(const char* str) { return print(str) + print("\r\n"); }
+
+    size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)))
+    {
+        va_list args;
+        va_start(args, fmt);
+        int written = vprintf(fmt, args);
+        va_end(args);
+        return (written > 0) ? (size_t)written : 0;
+    }
+
+    void flush(void) { fflush(stdout); }
+};
+
+inline HardwareSerial Serial;
+
+#endif // NATIVE_STUB_ARDUINO_H
@@ -0,0 +1,82 @@
+/**
+ * Native stub of the ESP32 Preferences (NVS) - the namespaces live in memory for the lifetime of the process
+ */
+
+#ifndef NATIVE_STUB_PREFERENCES_H
+#define NATIVE_STUB_PREFERENCES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences
+{
+  public:
+    bool begin(const char* name, bool read_only = false)
+    {
+        prefix = std::string(name) + "/";
+        is_read_only = read_only;
+        return true;
+    }
+
+    void end(void) { prefix.clear(); }
+
+    size_t putBytes(const char* key, const void* value, size_t length)
+    {
+        if (is_read_only)
+        {
+            return 0;
+        }
+        const uint8_t* bytes = (const uint8_t*)value;
+        prv_storage()[prefix + key] = std::vector<uint8_t>(bytes, bytes + length);
+        return length;
+    }
+
+    // Like the NVS, a value that does not fit into the buffer is not read at all
+    size_t getBytes(const char* key, void* buffer, size_t max_length)
+    {
+        auto entry = prv_storage().find(prefix + key);
+        if ((entry == prv_storage().end()) || (entry->second.size() > max_length))
+        {
+            return 0;
+        }
+        memcpy(buffer, entry->second.data(), entry->second.size());
+        return entry->second.size();
+    }
+
+    size_t getBytesLength(const char* key)
+    {
+        auto entry = prv_storage().find(prefix + key);
+        return (entry == prv_storage().end()) ? 0 : entry->second.size();
+    }
+
+    size_t putInt(const char* key, int32_t value) { return putBytes(key, &value, sizeof(value)); }
+
+    int32_t getInt(const char* key, int32_t default_value = 0)
+    {
+        int32_t value = default_value;
+        return (getBytes(key, &value, sizeof(value)) == sizeof(value)) ? value : default_value;
+    }
+
+    bool isKey(const char* key) { return prv_storage().count(prefix + key) > 0; }
+
+    bool remove(const char* key) { return !is_read_only && (prv_storage().erase(prefix + key) > 0); }
+
+    // Native only - forget every namespace, e.g. between two tests
+    static void clear_all(void) { prv_storage().clear(); }
+
+  private:
+    static std::map<std::string, std::vector<uint8_t>>& prv_storage(void)
+    {
+        static std::map<std::string, std::vector<uint8_t>> storage;
+        return storage;
+    }
+
+    std::string prefix;
+    bool is_read_only = false;
+};
+
+#endif // NATIVE_STUB_PREFERENCES_H
@@ -0,0 +1,26 @@
+/**
+ * Native stub of the CRC routines in the ESP32 ROM - same results, computed bitwise
+ */
+
+#ifndef NATIVE_STUB_ESP_ROM_CRC_H
+#define NATIVE_STUB_ESP_ROM_CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 (IEEE 802.3, reflected) - like the ROM, the inversion is done inside, so the chaining value starts at 0
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320UL & (0U - (crc & 1U)));
+        }
+    }
+    return ~crc;
+}
+
+#endif // NATIVE_STUB_ESP_ROM_CRC_H
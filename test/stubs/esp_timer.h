@@ -0,0 +1,58 @@
+/**
+ * Native stub of the ESP-IDF high resolution timer - backed by the monotonic clock of the host, the timers never fire
+ */
+
+#ifndef NATIVE_STUB_ESP_TIMER_H
+#define NATIVE_STUB_ESP_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+static inline int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+typedef int esp_err_t;
+typedef void* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+
+typedef enum
+{
+    ESP_TIMER_TASK,
+    ESP_TIMER_ISR,
+} esp_timer_dispatch_t;
+
+typedef struct
+{
+    esp_timer_cb_t callback;
+    void* arg;
+    esp_timer_dispatch_t dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+static inline esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle)
+{
+    (void)args;
+    *out_handle = (esp_timer_handle_t)1;
+    return 0;
+}
+
+static inline esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    (void)timer;
+    (void)timeout_us;
+    return 0;
+}
+
+static inline esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    (void)timer;
+    return 0;
+}
+
+#endif // NATIVE_STUB_ESP_TIMER_H
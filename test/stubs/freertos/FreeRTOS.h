@@ -0,0 +1,39 @@
+/**
+ * Native stub of the FreeRTOS types and critical sections for the native test environment
+ *
+ * The benchmarks run single threaded, so the critical sections compile to nothing.
+ */
+
+#ifndef NATIVE_STUB_FREERTOS_H
+#define NATIVE_STUB_FREERTOS_H
+
+#include <stdint.h>
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE               ((BaseType_t)0)
+#define pdTRUE                ((BaseType_t)1)
+#define pdFAIL                pdFALSE
+#define pdPASS                pdTRUE
+#define portMAX_DELAY         ((TickType_t)0xFFFFFFFFUL)
+#define portTICK_PERIOD_MS    1U
+#define configTICK_RATE_HZ    1000U
+#define tskIDLE_PRIORITY      0U
+#define configMAX_PRIORITIES  25U
+#define pdMS_TO_TICKS(ms)     ((TickType_t)(ms))
+
+typedef struct
+{
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux)      ((void)(mux))
+#define portEXIT_CRITICAL(mux)       ((void)(mux))
+#define portENTER_CRITICAL_ISR(mux)  ((void)(mux))
+#define portEXIT_CRITICAL_ISR(mux)   ((void)(mux))
+#define portYIELD_FROM_ISR(woken)    ((void)(woken))
+
+#endif // NATIVE_STUB_FREERTOS_H
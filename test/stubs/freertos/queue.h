@@ -0,0 +1,65 @@
+/**
+ * Native stub of the FreeRTOS queues - a plain ring buffer that never blocks
+ */
+
+#ifndef NATIVE_STUB_QUEUE_H
+#define NATIVE_STUB_QUEUE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+
+typedef struct native_queue
+{
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t nof_items;
+    uint8_t* items;
+} native_queue_t;
+
+typedef native_queue_t* QueueHandle_t;
+
+static inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    native_queue_t* queue = (native_queue_t*)calloc(1, sizeof(native_queue_t));
+    if (queue != NULL)
+    {
+        queue->length = length;
+        queue->item_size = item_size;
+        queue->items = (uint8_t*)calloc(length, item_size);
+    }
+    return queue;
+}
+
+static inline BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks_to_wait)
+{
+    (void)ticks_to_wait;
+    if (queue->nof_items == queue->length)
+    {
+        return pdFALSE;
+    }
+
+    UBaseType_t tail = (queue->head + queue->nof_items) % queue->length;
+    memcpy(&queue->items[tail * queue->item_size], item, queue->item_size);
+    queue->nof_items++;
+    return pdTRUE;
+}
+
+static inline BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks_to_wait)
+{
+    (void)ticks_to_wait;
+    if (queue->nof_items == 0)
+    {
+        return pdFALSE;
+    }
+
+    memcpy(item, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->nof_items--;
+    return pdTRUE;
+}
+
+static inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) { return queue->nof_items; }
+
+#endif // NATIVE_STUB_QUEUE_H
@@ -0,0 +1,29 @@
+/**
+ * Native stub of the FreeRTOS semaphores - always available, as the tests run single threaded
+ */
+
+#ifndef NATIVE_STUB_SEMPHR_H
+#define NATIVE_STUB_SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef void* SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) { return (SemaphoreHandle_t)1; }
+
+static inline SemaphoreHandle_t xSemaphoreCreateBinary(void) { return (SemaphoreHandle_t)1; }
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    (void)semaphore;
+    (void)ticks_to_wait;
+    return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    (void)semaphore;
+    return pdTRUE;
+}
+
+#endif // NATIVE_STUB_SEMPHR_H
@@ -0,0 +1,43 @@
+/**
+ * Native stub of the FreeRTOS tasks - tasks are not started, the tests call the module functions directly
+ */
+
+#ifndef NATIVE_STUB_TASK_H
+#define NATIVE_STUB_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* parameter);
+
+static inline BaseType_t xTaskCreate(TaskFunction_t task_function, const char* name, uint32_t stack_depth,
+                                     void* parameters, UBaseType_t priority, TaskHandle_t* task_handle)
+{
+    (void)task_function;
+    (void)name;
+    (void)stack_depth;
+    (void)parameters;
+    (void)priority;
+    if (task_handle != NULL)
+    {
+        *task_handle = NULL;
+    }
+    return pdPASS;
+}
+
+static inline uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    (void)clear_on_exit;
+    (void)ticks_to_wait;
+    return 0;
+}
+
+static inline BaseType_t xTaskNotifyGive(TaskHandle_t task_handle)
+{
+    (void)task_handle;
+    return pdPASS;
+}
+
+static inline void vTaskDelay(TickType_t ticks) { (void)ticks; }
+
+#endif // NATIVE_STUB_TASK_H
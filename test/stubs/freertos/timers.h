@@ -0,0 +1,46 @@
+/**
+ * Native stub of the FreeRTOS software timers - the timers never fire
+ */
+
+#ifndef NATIVE_STUB_TIMERS_H
+#define NATIVE_STUB_TIMERS_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef void* TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+static inline TimerHandle_t xTimerCreate(const char* name, TickType_t period, UBaseType_t auto_reload, void* timer_id,
+                                         TimerCallbackFunction_t callback)
+{
+    (void)name;
+    (void)period;
+    (void)auto_reload;
+    (void)timer_id;
+    (void)callback;
+    return (TimerHandle_t)1;
+}
+
+static inline BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    (void)timer;
+    (void)ticks_to_wait;
+    return pdPASS;
+}
+
+static inline BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    (void)timer;
+    (void)ticks_to_wait;
+    return pdPASS;
+}
+
+static inline BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks_to_wait)
+{
+    (void)timer;
+    (void)period;
+    (void)ticks_to_wait;
+    return pdPASS;
+}
+
+#endif // NATIVE_STUB_TIMERS_H
@@ -0,0 +1,204 @@
+/**
+ * @file test_appcontrol.cpp
+ * @brief Native tests and benchmarks of the schedule evaluation against the size of the schedule table
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ApplicationControl.h"
+#include "MessageBroker.h"
+#include "Preferences.h"
+#include "ScheduleStore.h"
+#include "TimeSync.h"
+#include "bench_support.h"
+
+#define BENCH_NOF_EVALUATIONS 20000U
+#define BENCH_EVALUATION_STEP 617 // Seconds between two evaluated points in time - walks through the whole week
+#define WEEKDAYS_MON_TO_FRI   0x1F // Bit 0 = Monday
+#define ALL_WEEKDAYS          0x7F
+
+// Built non-static in the TEST configuration
+time_t prv_find_next_due(time_t from);
+
+// Latest exception list - stands in for the console, which is not built natively
+static msg_schedule_exception_list_t received_exceptions;
+static u32 nof_exception_lists = 0;
+
+static void prv_exception_list_handler(const msg_t* const message)
+{
+    TEST_ASSERT_EQUAL_UINT16(sizeof(msg_schedule_exception_list_t), message->data_size);
+    memcpy(&received_exceptions, message->data_bytes, sizeof(received_exceptions));
+    nof_exception_lists++;
+}
+
+// The ApplicationControl reads the clock through the TimeSync - not linked natively
+bool timesync_get_snapshot(timesync_snapshot_t* snapshot)
+{
+    (void)snapshot;
+    return false;
+}
+
+static void prv_fill_store(u8 nof_schedules)
+{
+    schedulestore_clear();
+
+    // Spread over the day, a school like weekday pattern with a few daily entries
+    for (u8 i = 0; i < nof_schedules; i++)
+    {
+        u32 second_of_day = (u32)((i * 20237UL) % SCHEDULESTORE_SECONDS_PER_DAY);
+        u8 weekday_mask = ((i % 5) == 0) ? ALL_WEEKDAYS : WEEKDAYS_MON_TO_FRI;
+        TEST_ASSERT_NOT_EQUAL(SCHEDULESTORE_INVALID_ID, schedulestore_add(second_of_day, weekday_mask, i));
+    }
+}
+
+static void prv_bench_evaluation(u8 nof_schedules)
+{
+    prv_fill_store(nof_schedules);
+
+    time_t from = 1767225600; // 2026-01-01 00:00:00 UTC
+    time_t checksum = 0;
+
+    u64 start_ns = bench_now_ns();
+    for (u32 i = 0; i < BENCH_NOF_EVALUATIONS; i++)
+    {
+        checksum += prv_find_next_due(from);
+        from += BENCH_EVALUATION_STEP;
+    }
+    u64 elapsed_ns = bench_now_ns() - start_ns;
+
+    TEST_ASSERT_TRUE(checksum != 0);
+
+    char name[48];
+    snprintf(name, sizeof(name), "find next due, %u schedules", (unsigned)nof_schedules);
+    bench_report(name, elapsed_ns, BENCH_NOF_EVALUATIONS);
+}
+
+void setUp(void)
+{
+    Preferences::clear_all();
+    schedulestore_clear();
+    schedulestore_clear_exceptions();
+}
+
+void tearDown(void) {}
+
+static void test_next_due_is_the_next_matching_minute(void)
+{
+    schedulestore_add((7 * 60 + 30) * 60, WEEKDAYS_MON_TO_FRI, 1);
+    schedulestore_add(12 * 3600, WEEKDAYS_MON_TO_FRI, 2);
+
+    time_t friday_noon = 1767960000; // 2026-01-09 12:00:00 UTC, a Friday
+    time_t monday_0730 = friday_noon + 3 * 24 * 3600 - 4 * 3600 - 30 * 60;
+
+    TEST_ASSERT_EQUAL_INT64(friday_noon, prv_find_next_due(friday_noon));
+    TEST_ASSERT_EQUAL_INT64(monday_0730, prv_find_next_due(friday_noon + 60));
+}
+
+static void test_next_due_resolves_to_the_second(void)
+{
+    schedulestore_add(12 * 3600 + 15, ALL_WEEKDAYS, 1);
+    schedulestore_add(12 * 3600 + 45, ALL_WEEKDAYS, 2);
+
+    time_t friday_noon = 1767960000; // 2026-01-09 12:00:00 UTC, a Friday
+
+    TEST_ASSERT_EQUAL_INT64(friday_noon + 15, prv_find_next_due(friday_noon));
+    TEST_ASSERT_EQUAL_INT64(friday_noon + 15, prv_find_next_due(friday_noon + 15));
+    TEST_ASSERT_EQUAL_INT64(friday_noon + 45, prv_find_next_due(friday_noon + 16));
+    TEST_ASSERT_EQUAL_INT64(friday_noon + 24 * 3600 + 15, prv_find_next_due(friday_noon + 46));
+}
+
+static void test_exception_days_are_skipped(void)
+{
+    schedulestore_add((7 * 60 + 30) * 60, WEEKDAYS_MON_TO_FRI, 1);
+
+    time_t friday_noon = 1767960000; // 2026-01-09 12:00:00 UTC, a Friday
+    time_t monday_0730 = friday_noon + 3 * 24 * 3600 - 4 * 3600 - 30 * 60;
+    TEST_ASSERT_EQUAL_INT64(monday_0730, prv_find_next_due(friday_noon));
+
+    // Two weeks off - the first schedule after them is on the Monday after
+    u8 exception_id = schedulestore_add_exception(20260112, 20260123);
+    TEST_ASSERT_NOT_EQUAL(SCHEDULESTORE_INVALID_ID, exception_id);
+    TEST_ASSERT_EQUAL_INT64(monday_0730 + 14 * 24 * 3600, prv_find_next_due(friday_noon));
+
+    TEST_ASSERT_TRUE(schedulestore_remove_exception(exception_id));
+    TEST_ASSERT_EQUAL_INT64(monday_0730, prv_find_next_due(friday_noon));
+}
+
+static void test_invalid_exceptions_are_rejected(void)
+{
+    TEST_ASSERT_EQUAL(SCHEDULESTORE_INVALID_ID, schedulestore_add_exception(20260123, 20260112));
+    TEST_ASSERT_EQUAL(SCHEDULESTORE_INVALID_ID, schedulestore_add_exception(20261301, 20261301));
+    TEST_ASSERT_EQUAL(SCHEDULESTORE_INVALID_ID, schedulestore_add_exception(0, 20260101));
+    TEST_ASSERT_FALSE(schedulestore_is_exception_date(20260101));
+}
+
+static void test_exception_list_request_is_answered(void)
+{
+    u8 exception_id = schedulestore_add_exception(20261221, 20270101);
+    TEST_ASSERT_NOT_EQUAL(SCHEDULESTORE_INVALID_ID, exception_id);
+
+    // Request and answer both go through the dynamic routing - the answer is published synchronously
+    msg_t msg;
+    msg.msg_id = MSG_0413;
+    msg.data_size = 0;
+    msg.data_bytes = NULL;
+    u32 nof_lists_before = nof_exception_lists;
+    messagebroker_publish(&msg);
+
+    TEST_ASSERT_EQUAL_UINT32(nof_lists_before + 1, nof_exception_lists);
+    TEST_ASSERT_EQUAL_UINT8(1, received_exceptions.count);
+    TEST_ASSERT_EQUAL_UINT8(exception_id, received_exceptions.exceptions[0].exception_id);
+    TEST_ASSERT_EQUAL_UINT32(20261221, received_exceptions.exceptions[0].first_date);
+    TEST_ASSERT_EQUAL_UINT32(20270101, received_exceptions.exceptions[0].last_date);
+}
+
+static void test_empty_store_has_no_next_due(void) { TEST_ASSERT_EQUAL_INT64(0, prv_find_next_due(1767960000)); }
+
+static void bench_find_next_due_1(void) { prv_bench_evaluation(1); }
+
+static void bench_find_next_due_16(void) { prv_bench_evaluation(16); }
+
+static void bench_find_next_due_64(void) { prv_bench_evaluation(64); }
+
+static void bench_find_next_due_250(void) { prv_bench_evaluation(SCHEDULESTORE_MAX_SCHEDULES); }
+
+static void bench_add_and_save_full_table(void)
+{
+    u64 start_ns = bench_now_ns();
+    prv_fill_store(SCHEDULESTORE_MAX_SCHEDULES);
+    bench_report("add into the time index, full table", bench_now_ns() - start_ns, SCHEDULESTORE_MAX_SCHEDULES);
+
+    start_ns = bench_now_ns();
+    schedulestore_save();
+    bench_report("save the full table (CRC + blob)", bench_now_ns() - start_ns, 1);
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    // The schedule times are local times - evaluate them in UTC
+    setenv("TZ", "UTC0", 1);
+    tzset();
+
+    custom_assert_init(bench_assert_failed);
+    messagebroker_init();
+    appcontrol_init(); // Initializes the ScheduleStore as well
+    messagebroker_subscribe(MSG_0414, prv_exception_list_handler);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_next_due_is_the_next_matching_minute);
+    RUN_TEST(test_next_due_resolves_to_the_second);
+    RUN_TEST(test_exception_days_are_skipped);
+    RUN_TEST(test_invalid_exceptions_are_rejected);
+    RUN_TEST(test_exception_list_request_is_answered);
+    RUN_TEST(test_empty_store_has_no_next_due);
+    RUN_TEST(bench_find_next_due_1);
+    RUN_TEST(bench_find_next_due_16);
+    RUN_TEST(bench_find_next_due_64);
+    RUN_TEST(bench_find_next_due_250);
+    RUN_TEST(bench_add_and_save_full_table);
+    return UNITY_END();
+}
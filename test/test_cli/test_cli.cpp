@@ -0,0 +1,143 @@
+/**
+ * @file test_cli.cpp
+ * @brief Native tests and benchmarks of the CLI parser and command dispatch
+ */
+
+#include <string.h>
+#include "Cli.h"
+#include "bench_support.h"
+
+#define BENCH_NOF_LINES 200000U
+
+#define BENCH_BINDING(name) {#name, prv_cmd_count, NULL, "Benchmark command"}
+
+static cli_cfg_t cli_cfg;
+static u32 nof_cmd_calls = 0;
+static int last_argc = 0;
+static u64 nof_output_bytes = 0;
+
+static int prv_cmd_count(int argc, char* argv[], void* context)
+{
+    (void)argv;
+    (void)context;
+    nof_cmd_calls++;
+    last_argc = argc;
+    return CLI_OK_STATUS;
+}
+
+// About the size of the Console's command table
+static const cli_binding_t bindings[] = {
+    BENCH_BINDING(log),
+    BENCH_BINDING(msgbroker_stats),
+    BENCH_BINDING(msgbroker_test),
+    BENCH_BINDING(power_mode),
+    BENCH_BINDING(power_status),
+    BENCH_BINDING(restart),
+    BENCH_BINDING(schedule_add),
+    BENCH_BINDING(schedule_clear),
+    BENCH_BINDING(schedule_enable),
+    BENCH_BINDING(schedule_list),
+    BENCH_BINDING(schedule_remove),
+    BENCH_BINDING(speaker_mode),
+    BENCH_BINDING(speaker_next),
+    BENCH_BINDING(speaker_pause),
+    BENCH_BINDING(speaker_play),
+    BENCH_BINDING(speaker_previous),
+    BENCH_BINDING(speaker_volume),
+    BENCH_BINDING(speaker_volume_down),
+    BENCH_BINDING(speaker_volume_up),
+    BENCH_BINDING(system_info),
+    BENCH_BINDING(time_get),
+    BENCH_BINDING(wifi_get),
+    BENCH_BINDING(wifi_ip),
+    BENCH_BINDING(wifi_set),
+};
+
+static int prv_put_char(char c)
+{
+    (void)c;
+    nof_output_bytes++;
+    return 0;
+}
+
+static int prv_write_buffer(const char* buffer, size_t length)
+{
+    (void)buffer;
+    nof_output_bytes += length;
+    return 0;
+}
+
+static void prv_feed_line(const char* line)
+{
+    for (const char* c = line; *c != '\0'; c++)
+    {
+        cli_receive(*c);
+        cli_process();
+    }
+}
+
+static void prv_bench_lines(const char* name, const char* line)
+{
+    u64 start_ns = bench_now_ns();
+    for (u32 i = 0; i < BENCH_NOF_LINES; i++)
+    {
+        prv_feed_line(line);
+    }
+    cli_flush();
+    bench_report(name, bench_now_ns() - start_ns, BENCH_NOF_LINES);
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+static void test_line_is_dispatched_with_its_arguments(void)
+{
+    u32 calls_before = nof_cmd_calls;
+
+    prv_feed_line("schedule_add 0730 1111100 12\r");
+
+    TEST_ASSERT_EQUAL_UINT32(calls_before + 1, nof_cmd_calls);
+    TEST_ASSERT_EQUAL_INT(4, last_argc);
+}
+
+static void test_unknown_command_is_not_dispatched(void)
+{
+    u32 calls_before = nof_cmd_calls;
+
+    prv_feed_line("speaker_explode\r");
+
+    TEST_ASSERT_EQUAL_UINT32(calls_before, nof_cmd_calls);
+}
+
+static void bench_dispatch_short_line(void) { prv_bench_lines("cli line 'restart'", "restart\r"); }
+
+static void bench_dispatch_line_with_arguments(void)
+{
+    prv_bench_lines("cli line 'schedule_add' + 3 args", "schedule_add 0730 1111100 12\r");
+}
+
+static void bench_unknown_command(void) { prv_bench_lines("cli line, unknown command", "speaker_explode\r"); }
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    custom_assert_init(bench_assert_failed);
+
+    cli_init(&cli_cfg, prv_put_char);
+    cli_set_write_buffer_fn(prv_write_buffer);
+    for (size_t i = 0; i < CLI_GET_ARRAY_SIZE(bindings); i++)
+    {
+        cli_register(&bindings[i]);
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_line_is_dispatched_with_its_arguments);
+    RUN_TEST(test_unknown_command_is_not_dispatched);
+    RUN_TEST(bench_dispatch_short_line);
+    RUN_TEST(bench_dispatch_line_with_arguments);
+    RUN_TEST(bench_unknown_command);
+    return UNITY_END();
+}
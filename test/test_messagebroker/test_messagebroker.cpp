@@ -0,0 +1,178 @@
+/**
+ * @file test_messagebroker.cpp
+ * @brief Native tests and benchmarks of the MessageBroker publish paths
+ */
+
+#include "MessageBroker.h"
+#include "bench_support.h"
+
+#define BENCH_NOF_PUBLISHES 1000000U
+#define BENCH_NOF_LOANS     1000000U
+
+static volatile u32 nof_handler_calls = 0;
+
+// Distinct handlers - a topic accepts every handler only once
+template <int N> static void prv_counting_handler(const msg_t* const message)
+{
+    (void)message;
+    nof_handler_calls = nof_handler_calls + 1;
+}
+
+static const msg_callback_t handlers[] = {
+    prv_counting_handler<0>, prv_counting_handler<1>, prv_counting_handler<2>, prv_counting_handler<3>,
+    prv_counting_handler<4>, prv_counting_handler<5>, prv_counting_handler<6>, prv_counting_handler<7>,
+};
+
+static void prv_subscribe_handlers(msg_id_e topic, u8 nof_handlers)
+{
+    for (u8 i = 0; i < nof_handlers; i++)
+    {
+        messagebroker_subscribe(topic, handlers[i]);
+    }
+}
+
+static void prv_bench_publish(const char* name, msg_id_e topic)
+{
+    u32 payload = 0xC0FFEE;
+
+    msg_t msg;
+    msg.msg_id = topic;
+    msg.data_size = sizeof(payload);
+    msg.data_bytes = (u8*)&payload;
+
+    u64 start_ns = bench_now_ns();
+    for (u32 i = 0; i < BENCH_NOF_PUBLISHES; i++)
+    {
+        messagebroker_publish(&msg);
+    }
+    bench_report(name, bench_now_ns() - start_ns, BENCH_NOF_PUBLISHES);
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+static void test_publish_calls_every_subscriber(void)
+{
+    u32 calls_before = nof_handler_calls;
+    u32 count_before = messagebroker_get_publish_count(MSG_0100);
+
+    msg_t msg;
+    msg.msg_id = MSG_0100;
+    msg.data_size = 0;
+    msg.data_bytes = NULL;
+    messagebroker_publish(&msg);
+
+    TEST_ASSERT_EQUAL_UINT32(calls_before + 8, nof_handler_calls);
+    TEST_ASSERT_EQUAL_UINT32(count_before + 1, messagebroker_get_publish_count(MSG_0100));
+}
+
+static void test_status_counts_all_topics(void)
+{
+    msg_system_status_t before;
+    messagebroker_get_status(&before);
+
+    msg_t msg;
+    msg.data_size = 0;
+    msg.data_bytes = NULL;
+    msg.msg_id = MSG_0100;
+    messagebroker_publish(&msg);
+    msg.msg_id = MSG_0001;
+    messagebroker_publish(&msg);
+
+    msg_system_status_t after;
+    messagebroker_get_status(&after);
+    TEST_ASSERT_EQUAL_UINT32(before.nof_publishes + 2, after.nof_publishes);
+    TEST_ASSERT_EQUAL_UINT32(before.nof_deferred_dropped, after.nof_deferred_dropped);
+}
+
+static void test_trace_keeps_the_latest_publishes(void)
+{
+    msg_t msg;
+    msg.data_bytes = NULL;
+    for (u16 i = 0; i < MESSAGE_BROKER_TRACE_SIZE; i++)
+    {
+        msg.msg_id = MSG_0002;
+        msg.data_size = i;
+        messagebroker_publish(&msg);
+    }
+    msg.msg_id = MSG_0001;
+    msg.data_size = 0;
+    messagebroker_publish(&msg);
+
+    msg_trace_entry_t entries[MESSAGE_BROKER_TRACE_SIZE + 1];
+    u8 nof_entries = messagebroker_get_trace(entries, (u8)(sizeof(entries) / sizeof(entries[0])));
+    TEST_ASSERT_EQUAL_UINT8(MESSAGE_BROKER_TRACE_SIZE, nof_entries);
+
+    // The oldest publish was overwritten, the latest one comes last
+    TEST_ASSERT_EQUAL_UINT16(MSG_0002, entries[0].msg_id);
+    TEST_ASSERT_EQUAL_UINT16(1, entries[0].data_size);
+    TEST_ASSERT_EQUAL_UINT16(MSG_0001, entries[MESSAGE_BROKER_TRACE_SIZE - 1].msg_id);
+
+    TEST_ASSERT_EQUAL_UINT8(2, messagebroker_get_trace(entries, 2));
+    TEST_ASSERT_EQUAL_UINT16(MSG_0001, entries[1].msg_id);
+}
+
+static void test_loaned_blocks_return_to_the_pool(void)
+{
+    u8* blocks[16] = {NULL};
+    u8 nof_blocks = 0;
+
+    while ((nof_blocks < 16) && ((blocks[nof_blocks] = messagebroker_loan(sizeof(u32))) != NULL))
+    {
+        nof_blocks++;
+    }
+    TEST_ASSERT_TRUE(nof_blocks > 0);
+    TEST_ASSERT_TRUE(nof_blocks < 16); // The pool is exhausted at some point
+
+    for (u8 i = 0; i < nof_blocks; i++)
+    {
+        messagebroker_release(blocks[i]);
+    }
+
+    u8* block = messagebroker_loan(sizeof(u32));
+    TEST_ASSERT_NOT_NULL(block);
+    messagebroker_release(block);
+}
+
+static void bench_publish_fanout_1(void) { prv_bench_publish("publish, 1 subscriber", MSG_0001); }
+
+static void bench_publish_fanout_4(void) { prv_bench_publish("publish, 4 subscribers", MSG_0002); }
+
+static void bench_publish_fanout_8(void) { prv_bench_publish("publish, 8 subscribers", MSG_0100); }
+
+static void bench_loan_and_release(void)
+{
+    u64 start_ns = bench_now_ns();
+    for (u32 i = 0; i < BENCH_NOF_LOANS; i++)
+    {
+        u8* block = messagebroker_loan(sizeof(u32));
+        messagebroker_release(block);
+    }
+    bench_report("loan + release of a payload block", bench_now_ns() - start_ns, BENCH_NOF_LOANS);
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc;
+    (void)argv;
+
+    custom_assert_init(bench_assert_failed);
+
+    messagebroker_init();
+    prv_subscribe_handlers(MSG_0001, 1);
+    prv_subscribe_handlers(MSG_0002, 4);
+    prv_subscribe_handlers(MSG_0100, 8);
+    messagebroker_seal();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_publish_calls_every_subscriber);
+    RUN_TEST(test_status_counts_all_topics);
+    RUN_TEST(test_trace_keeps_the_latest_publishes);
+    RUN_TEST(test_loaned_blocks_return_to_the_pool);
+    RUN_TEST(bench_publish_fanout_1);
+    RUN_TEST(bench_publish_fanout_4);
+    RUN_TEST(bench_publish_fanout_8);
+    RUN_TEST(bench_loan_and_release);
+    return UNITY_END();
+}